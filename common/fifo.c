@@ -71,6 +71,8 @@ struct fifo
     unsigned short writer;
     /** Next address to read in 'first_chunk' */
     unsigned short reader;
+    /** Number of items in the fifo */
+    unsigned int count;
     /** Item destructor function, or NULL */
     fifo_item_destructor item_destructor;
 };
@@ -97,6 +99,7 @@ fifo_create(fifo_item_destructor item_destructor)
             result->last_chunk = cptr;
             result->writer = 0;
             result->reader = 0;
+            result->count = 0;
             result->item_destructor = item_destructor;
         }
     }
@@ -182,6 +185,7 @@ fifo_clear(struct fifo *self, void *closure)
         self->last_chunk = cptr;
         self->reader = 0;
         self->writer = 0;
+        self->count = 0;
     }
 }
 
@@ -208,6 +212,7 @@ fifo_add_item(struct fifo *self, void *item)
         }
 
         self->last_chunk->items[self->writer++] = item;
+        ++self->count;
         rv = 1;
     }
     return rv;
@@ -248,6 +253,11 @@ fifo_remove_item(struct fifo *self)
                 self->writer = 0;
             }
         }
+
+        if (item != NULL)
+        {
+            --self->count;
+        }
     }
     return item;
 }
@@ -261,3 +271,11 @@ fifo_is_empty(struct fifo *self)
             (self->first_chunk == self->last_chunk &&
              self->reader == self->writer));
 }
+
+/*****************************************************************************/
+
+unsigned int
+fifo_get_count(const struct fifo *self)
+{
+    return (self == NULL) ? 0 : self->count;
+}
@@ -95,4 +95,12 @@ fifo_remove_item(struct fifo *self);
 int
 fifo_is_empty(struct fifo *self);
 
+/** Number of items in the fifo
+ *
+ * @param self fifo
+ * @return Item count
+ */
+unsigned int
+fifo_get_count(const struct fifo *self);
+
 #endif
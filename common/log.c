@@ -146,6 +146,531 @@ internal_log_lvl2str(const enum logLevels lvl, char *str)
     }
 }
 
+/*
+ * Asynchronous logging
+ *
+ * If EnableAsync is set, messages are formatted on the calling thread and
+ * placed on a bounded lock-free queue. A writer thread takes them off
+ * the queue and writes them to the log destinations, so a slow disk or
+ * syslog daemon never stalls the caller.
+ *
+ * The queue is a ring of sequence-numbered slots which any thread can
+ * add to, but only the writer thread removes from. If the queue is
+ * full, errors are written synchronously, marked as being out of order,
+ * and anything less important is dropped and counted. The writer logs
+ * the number of dropped messages once it has caught up.
+ *
+ * Threads adding to the queue are counted, so the queue isn't shut
+ * down under them.
+ *
+ * The writer thread is started when a process first logs a message.
+ * After a fork, the child discards its copy of the queue and starts its
+ * own writer if it logs anything.
+ */
+
+/* Log destinations for a message */
+#define LOG_DEST_FILE (1 << 0)
+#define LOG_DEST_SYSLOG (1 << 1)
+#define LOG_DEST_CONSOLE (1 << 2)
+
+/* Added to errors written ahead of queued messages */
+#define LOG_ASYNC_OUT_OF_ORDER "(out of order) "
+
+/* Messages longer than this are copied to the heap */
+#define LOG_ASYNC_SLOT_BYTES 256
+
+#define LOG_ASYNC_MIN_QUEUE_LENGTH 16
+#define LOG_ASYNC_MAX_QUEUE_LENGTH 65536
+
+enum log_async_state
+{
+    LOG_ASYNC_OFF = 0, /* Not started in this process */
+    LOG_ASYNC_STARTING,
+    LOG_ASYNC_RUNNING,
+    LOG_ASYNC_STOPPED /* Stopped, or couldn't start. Writes are synchronous */
+};
+
+struct log_async_slot
+{
+    unsigned int seq;
+    enum logLevels lvl;
+    unsigned int dests;
+    char *long_text; /* Set if text is too short for the message */
+    char text[LOG_ASYNC_SLOT_BYTES];
+};
+
+struct log_async
+{
+    int state; /* enum log_async_state */
+    int stop;
+    int handlers_registered;
+    unsigned int length; /* Always a power of 2 */
+    struct log_async_slot *slots;
+    unsigned int producers; /* Threads in internal_log_async_enqueue() */
+    unsigned int enqueue_pos; /* Shared between producers */
+    unsigned int dequeue_pos; /* Only used by the writer */
+    tbus wake_sem;
+    tbus done_sem;
+    unsigned int drops_to_report;
+    unsigned int drops_total;
+};
+
+static struct log_async g_log_async;
+
+/* Held by the writer thread while it writes a message, and across fork()
+ * so the child never inherits a lock held inside syslog() or the file
+ * write path */
+static pthread_mutex_t g_log_async_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************/
+/* Works out which destinations will accept a message */
+static unsigned int
+internal_log_destinations(const enum logLevels lvl,
+                          const bool_t override_destination_level,
+                          const enum logLevels override_log_level)
+{
+    unsigned int dests = 0;
+
+    if (g_staticLogConfig->enable_syslog
+            && ((override_destination_level && lvl <= override_log_level)
+                || (!override_destination_level && lvl <= g_staticLogConfig->syslog_level)))
+    {
+        dests |= LOG_DEST_SYSLOG;
+    }
+
+    if (g_staticLogConfig->enable_console
+            && ((override_destination_level && lvl <= override_log_level)
+                || (!override_destination_level && lvl <= g_staticLogConfig->console_level)))
+    {
+        dests |= LOG_DEST_CONSOLE;
+    }
+
+    if (g_staticLogConfig->fd >= 0
+            && ((override_destination_level && lvl <= override_log_level)
+                || (!override_destination_level && lvl <= g_staticLogConfig->log_level)))
+    {
+        dests |= LOG_DEST_FILE;
+    }
+
+    return dests;
+}
+
+/******************************************************************************/
+/* Writes a formatted message to its destinations */
+static enum logReturns
+internal_log_write(const enum logLevels lvl, unsigned int dests,
+                   const char *buff)
+{
+    enum logReturns rv = LOG_STARTUP_OK;
+    int writereply;
+
+    if (dests & LOG_DEST_SYSLOG)
+    {
+        /* log to syslog*/
+        /* %s fix compiler warning 'not a string literal' */
+        syslog(internal_log_xrdp2syslog(lvl), "%s", buff + 31);
+    }
+
+    if (dests & LOG_DEST_CONSOLE)
+    {
+        /* log to console */
+        g_printf("%s", buff);
+    }
+
+    /* log to application logfile */
+    if ((dests & LOG_DEST_FILE) && g_staticLogConfig->fd >= 0)
+    {
+#ifdef LOG_ENABLE_THREAD
+        pthread_mutex_lock(&(g_staticLogConfig->log_lock));
+#endif
+
+        writereply = g_file_write(g_staticLogConfig->fd, buff, g_strlen(buff));
+
+        if (writereply <= 0)
+        {
+            rv = LOG_ERROR_NULL_FILE;
+        }
+
+#ifdef LOG_ENABLE_THREAD
+        pthread_mutex_unlock(&(g_staticLogConfig->log_lock));
+#endif
+    }
+
+    return rv;
+}
+
+/******************************************************************************/
+/* Writer thread only. Writes the next message on the queue.
+ * Returns 0 if the queue was empty */
+static int
+internal_log_async_dequeue(void)
+{
+    struct log_async_slot *slot;
+    unsigned int pos = g_log_async.dequeue_pos;
+
+    slot = &g_log_async.slots[pos & (g_log_async.length - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&g_log_async_write_lock);
+    if (slot->long_text != NULL)
+    {
+        internal_log_write(slot->lvl, slot->dests, slot->long_text);
+        g_free(slot->long_text);
+        slot->long_text = NULL;
+    }
+    else
+    {
+        internal_log_write(slot->lvl, slot->dests, slot->text);
+    }
+    pthread_mutex_unlock(&g_log_async_write_lock);
+
+    /* Hand the slot back to the producers for the next lap of the ring */
+    __atomic_store_n(&slot->seq, pos + g_log_async.length, __ATOMIC_RELEASE);
+    g_log_async.dequeue_pos = pos + 1;
+    return 1;
+}
+
+/******************************************************************************/
+static void
+internal_log_async_report_drops(void)
+{
+    char buff[LOG_BUFFER_SIZE + 43];
+    unsigned int drops;
+    unsigned int dests;
+
+    drops = __atomic_exchange_n(&g_log_async.drops_to_report, 0,
+                                __ATOMIC_RELAXED);
+    if (drops > 0)
+    {
+        dests = internal_log_destinations(LOG_LEVEL_WARNING, 0,
+                                          LOG_LEVEL_NEVER);
+        getFormattedDateTime(buff, 32);
+        internal_log_lvl2str(LOG_LEVEL_WARNING, buff + 31);
+        g_snprintf(buff + 39, LOG_BUFFER_SIZE,
+                   "%u log messages dropped as the log queue was full\n",
+                   drops);
+        pthread_mutex_lock(&g_log_async_write_lock);
+        internal_log_write(LOG_LEVEL_WARNING, dests, buff);
+        pthread_mutex_unlock(&g_log_async_write_lock);
+    }
+}
+
+/******************************************************************************/
+static THREAD_RV THREAD_CC
+internal_log_async_writer(void *arg)
+{
+    int stop;
+
+    UNUSED_VAR(arg);
+    do
+    {
+        tc_sem_dec(g_log_async.wake_sem);
+        stop = __atomic_load_n(&g_log_async.stop, __ATOMIC_ACQUIRE);
+        while (internal_log_async_dequeue())
+        {
+        }
+        internal_log_async_report_drops();
+    }
+    while (!stop);
+
+    tc_sem_inc(g_log_async.done_sem);
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Stops the writer thread for this process, after writing everything
+ * on the queue. Later messages are written synchronously.
+ */
+static void
+internal_log_async_stop(void)
+{
+    if (__atomic_load_n(&g_log_async.state, __ATOMIC_ACQUIRE) !=
+            LOG_ASYNC_RUNNING)
+    {
+        return;
+    }
+    __atomic_store_n(&g_log_async.state, LOG_ASYNC_STOPPED, __ATOMIC_SEQ_CST);
+
+    /* Wait for threads which saw the writer running to finish adding
+     * their messages. Later ones will see it has stopped */
+    while (__atomic_load_n(&g_log_async.producers, __ATOMIC_SEQ_CST) != 0)
+    {
+        g_sleep(1);
+    }
+
+    __atomic_store_n(&g_log_async.stop, 1, __ATOMIC_RELEASE);
+    tc_sem_inc(g_log_async.wake_sem);
+    tc_sem_dec(g_log_async.done_sem);
+
+    /* Write anything added while the writer was stopping */
+    while (internal_log_async_dequeue())
+    {
+    }
+    internal_log_async_report_drops();
+
+    tc_sem_delete(g_log_async.wake_sem);
+    tc_sem_delete(g_log_async.done_sem);
+    g_log_async.wake_sem = 0;
+    g_log_async.done_sem = 0;
+}
+
+/******************************************************************************/
+/* Make sure queued messages are written if the process calls exit() */
+static void
+internal_log_async_atexit(void)
+{
+    internal_log_async_stop();
+}
+
+/******************************************************************************/
+/* Pauses the writer thread between messages while the process forks */
+static void
+internal_log_async_atfork_prepare(void)
+{
+    pthread_mutex_lock(&g_log_async_write_lock);
+}
+
+/******************************************************************************/
+static void
+internal_log_async_atfork_parent(void)
+{
+    pthread_mutex_unlock(&g_log_async_write_lock);
+}
+
+/******************************************************************************/
+/* The writer thread isn't copied by fork(), so the child has to start
+ * its own. The parent will write anything already on the queue */
+static void
+internal_log_async_atfork_child(void)
+{
+    pthread_mutex_init(&g_log_async_write_lock, NULL);
+    g_log_async.state = LOG_ASYNC_OFF;
+    g_log_async.producers = 0;
+    g_log_async.wake_sem = 0;
+    g_log_async.done_sem = 0;
+    g_log_async.drops_to_report = 0;
+    g_log_async.drops_total = 0;
+}
+
+/******************************************************************************/
+/* Returns 0 if the writer thread is running */
+static int
+internal_log_async_start(void)
+{
+    unsigned int length = LOG_ASYNC_MIN_QUEUE_LENGTH;
+    unsigned int index;
+
+    while (length < g_staticLogConfig->async_queue_length &&
+            length < LOG_ASYNC_MAX_QUEUE_LENGTH)
+    {
+        length *= 2;
+    }
+
+    if (g_log_async.slots != NULL && g_log_async.length != length)
+    {
+        for (index = 0; index < g_log_async.length; index++)
+        {
+            g_free(g_log_async.slots[index].long_text);
+        }
+        g_free(g_log_async.slots);
+        g_log_async.slots = NULL;
+    }
+    if (g_log_async.slots == NULL)
+    {
+        g_log_async.slots = g_new0(struct log_async_slot, length);
+        if (g_log_async.slots == NULL)
+        {
+            return 1;
+        }
+        g_log_async.length = length;
+    }
+
+    /* Discard anything left over from an earlier run, or the parent */
+    for (index = 0; index < length; index++)
+    {
+        g_free(g_log_async.slots[index].long_text);
+        g_log_async.slots[index].long_text = NULL;
+        g_log_async.slots[index].seq = index;
+    }
+    g_log_async.enqueue_pos = 0;
+    g_log_async.dequeue_pos = 0;
+    g_log_async.stop = 0;
+    g_log_async.drops_to_report = 0;
+    g_log_async.drops_total = 0;
+
+    if (!g_log_async.handlers_registered)
+    {
+        if (atexit(internal_log_async_atexit) != 0 ||
+                pthread_atfork(internal_log_async_atfork_prepare,
+                               internal_log_async_atfork_parent,
+                               internal_log_async_atfork_child) != 0)
+        {
+            return 1;
+        }
+        g_log_async.handlers_registered = 1;
+    }
+
+    g_log_async.wake_sem = tc_sem_create(0);
+    g_log_async.done_sem = tc_sem_create(0);
+    if (g_log_async.wake_sem == 0 || g_log_async.done_sem == 0 ||
+            tc_thread_create(internal_log_async_writer, NULL) != 0)
+    {
+        if (g_log_async.wake_sem != 0)
+        {
+            tc_sem_delete(g_log_async.wake_sem);
+            g_log_async.wake_sem = 0;
+        }
+        if (g_log_async.done_sem != 0)
+        {
+            tc_sem_delete(g_log_async.done_sem);
+            g_log_async.done_sem = 0;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* Writes an error the queue has no room for, ahead of the messages
+ * already queued */
+static void
+internal_log_write_out_of_order(const enum logLevels lvl, unsigned int dests,
+                                const char *buff)
+{
+    char marked[LOG_BUFFER_SIZE + sizeof(LOG_ASYNC_OUT_OF_ORDER)];
+
+    /* 31 (datetime) + 8 (log level) = 39 */
+    g_snprintf(marked, sizeof(marked), "%.39s" LOG_ASYNC_OUT_OF_ORDER "%s",
+               buff, buff + 39);
+    internal_log_write(lvl, dests, marked);
+}
+
+/******************************************************************************/
+/* Called by internal_log_async_enqueue() */
+static int
+internal_log_async_add(const enum logLevels lvl, unsigned int dests,
+                       const char *buff)
+{
+    struct log_async_slot *slot;
+    unsigned int pos;
+    unsigned int seq;
+    char *long_text = NULL;
+    int len;
+    int state;
+
+    state = __atomic_load_n(&g_log_async.state, __ATOMIC_SEQ_CST);
+    if (state == LOG_ASYNC_OFF)
+    {
+        if (!g_staticLogConfig->enable_async)
+        {
+            return 1;
+        }
+        /* Only one thread gets to start the writer. The others write
+         * synchronously until it's running */
+        if (!__atomic_compare_exchange_n(&g_log_async.state, &state,
+                                         LOG_ASYNC_STARTING, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return 1;
+        }
+        state = (internal_log_async_start() == 0) ? LOG_ASYNC_RUNNING
+                : LOG_ASYNC_STOPPED;
+        __atomic_store_n(&g_log_async.state, state, __ATOMIC_RELEASE);
+    }
+    if (state != LOG_ASYNC_RUNNING)
+    {
+        return 1;
+    }
+
+    len = g_strlen(buff);
+    if (len >= LOG_ASYNC_SLOT_BYTES)
+    {
+        long_text = g_strdup(buff);
+    }
+
+    /* Claim a slot. The slot's sequence number equals the position
+     * when it's free for this lap of the ring */
+    pos = __atomic_load_n(&g_log_async.enqueue_pos, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        slot = &g_log_async.slots[pos & (g_log_async.length - 1)];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if ((int)(seq - pos) == 0)
+        {
+            if (__atomic_compare_exchange_n(&g_log_async.enqueue_pos, &pos,
+                                            pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if ((int)(seq - pos) < 0)
+        {
+            /* Queue is full. Errors are written now rather than lost,
+             * but we don't wait for the writer to make room */
+            g_free(long_text);
+            tc_sem_inc(g_log_async.wake_sem);
+            if (lvl <= LOG_LEVEL_ERROR)
+            {
+                internal_log_write_out_of_order(lvl, dests, buff);
+                return 0;
+            }
+            __atomic_add_fetch(&g_log_async.drops_to_report, 1,
+                               __ATOMIC_RELAXED);
+            __atomic_add_fetch(&g_log_async.drops_total, 1,
+                               __ATOMIC_RELAXED);
+            return 0;
+        }
+        else
+        {
+            pos = __atomic_load_n(&g_log_async.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->lvl = lvl;
+    slot->dests = dests;
+    slot->long_text = long_text;
+    if (long_text == NULL && len < LOG_ASYNC_SLOT_BYTES)
+    {
+        g_memcpy(slot->text, buff, len + 1);
+    }
+    else if (long_text == NULL)
+    {
+        /* Out of memory - truncate the message */
+        g_memcpy(slot->text, buff, LOG_ASYNC_SLOT_BYTES - 2);
+        slot->text[LOG_ASYNC_SLOT_BYTES - 2] = '\n';
+        slot->text[LOG_ASYNC_SLOT_BYTES - 1] = '\0';
+    }
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    tc_sem_inc(g_log_async.wake_sem);
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Queues a formatted message for the writer thread
+ *
+ * @return 0 if the message was queued, dropped or written, or non-zero
+ *         if the caller should write the message itself
+ */
+static int
+internal_log_async_enqueue(const enum logLevels lvl, unsigned int dests,
+                           const char *buff)
+{
+    int rv;
+
+    __atomic_add_fetch(&g_log_async.producers, 1, __ATOMIC_SEQ_CST);
+    rv = internal_log_async_add(lvl, dests, buff);
+    __atomic_sub_fetch(&g_log_async.producers, 1, __ATOMIC_RELEASE);
+    return rv;
+}
+
 /******************************************************************************/
 enum logReturns
 internal_log_start(struct log_config *l_cfg)
@@ -207,6 +732,10 @@ internal_log_end(struct log_config *l_cfg)
         return ret;
     }
 
+    /* Write anything still queued before the destinations are closed */
+    internal_log_async_stop();
+    g_log_async.state = LOG_ASYNC_OFF;
+
     if (-1 != l_cfg->fd)
     {
         /* closing logfile... */
@@ -313,6 +842,8 @@ internal_config_read_logging(int file,
     lc->syslog_level = LOG_LEVEL_INFO;
     lc->dump_on_start = 0;
     lc->enable_pid = 0;
+    lc->enable_async = 0;
+    lc->async_queue_length = LOG_ASYNC_DEFAULT_QUEUE_LENGTH;
 
     g_snprintf(section_name, 511, "%s%s", section_prefix, SESMAN_CFG_LOGGING);
     file_read_section(file, section_name, param_n, param_v);
@@ -366,6 +897,16 @@ internal_config_read_logging(int file,
         {
             lc->enable_pid = g_text2bool((char *)list_get_item(param_v, i));
         }
+
+        if (0 == g_strcasecmp(buf, SESMAN_CFG_LOG_ENABLE_ASYNC))
+        {
+            lc->enable_async = g_text2bool((char *)list_get_item(param_v, i));
+        }
+
+        if (0 == g_strcasecmp(buf, SESMAN_CFG_LOG_ASYNC_QUEUE))
+        {
+            lc->async_queue_length = g_atoi((char *)list_get_item(param_v, i));
+        }
     }
 
     if (0 == lc->log_file)
@@ -453,6 +994,15 @@ internal_log_config_dump(struct log_config *config)
     }
     g_printf("\tSyslogLevel:   %s\r\n", str_level);
 
+    if (config->enable_async)
+    {
+        g_printf("\tAsyncQueue:    %u\r\n", config->async_queue_length);
+    }
+    else
+    {
+        g_printf("\tAsyncQueue:    %s\r\n", "<disabled>");
+    }
+
 #ifdef LOG_PER_LOGGER_LEVEL
     g_printf("per logger configuration:\r\n");
     for (i = 0; i < config->per_logger_level->count; i++)
@@ -477,6 +1027,7 @@ internalInitAndAllocStruct(void)
     {
         ret->fd = -1;
         ret->enable_syslog = 0;
+        ret->async_queue_length = LOG_ASYNC_DEFAULT_QUEUE_LENGTH;
 #ifdef LOG_PER_LOGGER_LEVEL
         ret->per_logger_level = list_create();
         if (ret->per_logger_level != NULL)
@@ -499,6 +1050,115 @@ internalInitAndAllocStruct(void)
     return ret;
 }
 
+#ifdef LOG_PER_LOGGER_LEVEL
+/******************************************************************************/
+/* FNV-1a hash of a logger name. Only the characters g_strncmp() would
+ * compare are hashed */
+static unsigned int
+internal_log_logger_hash(enum log_logger_type logger_type, const char *name)
+{
+    unsigned int hash = 2166136261U ^ (unsigned int)logger_type;
+    int i;
+
+    for (i = 0; i < LOGGER_NAME_SIZE && name[i] != '\0'; i++)
+    {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619U;
+    }
+    return hash;
+}
+
+/******************************************************************************/
+/**
+ * Finds a per-logger level
+ *
+ * @return index in per_logger_level of the first logger which matches,
+ *         or -1
+ */
+static int
+internal_log_logger_find(const struct log_config *config,
+                         enum log_logger_type logger_type, const char *name)
+{
+    const struct log_logger_level *logger;
+    unsigned int mask = config->logger_hash_size - 1;
+    unsigned int pos;
+    int index;
+
+    pos = internal_log_logger_hash(logger_type, name) & mask;
+    while ((index = config->logger_hash[pos]) >= 0)
+    {
+        logger = (const struct log_logger_level *)
+                 list_get_item(config->per_logger_level, index);
+        if (logger->logger_type == logger_type
+                && 0 == g_strncmp(logger->logger_name, name, LOGGER_NAME_SIZE))
+        {
+            return index;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+/******************************************************************************/
+/**
+ * Builds the hash for the per-logger levels, so the cost of looking up
+ * a logger doesn't grow with the number configured.
+ *
+ * No hash is built if there are no per-logger levels.
+ */
+static void
+internal_log_logger_hash_build(struct log_config *config)
+{
+    struct log_logger_level *logger;
+    unsigned int size = 16;
+    unsigned int pos;
+    int i;
+
+    g_free(config->logger_hash);
+    config->logger_hash = NULL;
+    config->logger_hash_size = 0;
+
+    if (config->per_logger_level == NULL
+            || config->per_logger_level->count == 0)
+    {
+        return;
+    }
+
+    /* Keep the load factor at or below a half */
+    while (size < (unsigned int)config->per_logger_level->count * 2)
+    {
+        size *= 2;
+    }
+    config->logger_hash = g_new(int, size);
+    if (config->logger_hash == NULL)
+    {
+        return;
+    }
+    for (pos = 0; pos < size; pos++)
+    {
+        config->logger_hash[pos] = -1;
+    }
+    config->logger_hash_size = size;
+
+    for (i = 0; i < config->per_logger_level->count; i++)
+    {
+        logger = (struct log_logger_level *)
+                 list_get_item(config->per_logger_level, i);
+        /* Where a logger is listed twice, the first entry wins */
+        if (internal_log_logger_find(config, logger->logger_type,
+                                     logger->logger_name) < 0)
+        {
+            pos = internal_log_logger_hash(logger->logger_type,
+                                           logger->logger_name) & (size - 1);
+            while (config->logger_hash[pos] >= 0)
+            {
+                pos = (pos + 1) & (size - 1);
+            }
+            config->logger_hash[pos] = i;
+        }
+    }
+}
+#endif
+
 /**
  * Copies logging levels only from one log_config structure to another
  **/
@@ -530,6 +1190,7 @@ internal_log_config_copy_levels(struct log_config *dest,
 
     if (src->per_logger_level == NULL)
     {
+        internal_log_logger_hash_build(dest);
         return;
     }
 
@@ -544,6 +1205,8 @@ internal_log_config_copy_levels(struct log_config *dest,
 
          list_add_item(dest->per_logger_level, (tbus) dst_logger);
     }
+
+    internal_log_logger_hash_build(dest);
 #endif
 }
 
@@ -562,6 +1225,8 @@ internal_log_config_copy(struct log_config *dest, const struct log_config *src)
         dest->program_name = src->program_name;
         dest->enable_pid = src->enable_pid;
         dest->dump_on_start = src->dump_on_start;
+        dest->enable_async = src->enable_async;
+        dest->async_queue_length = src->async_queue_length;
 
         internal_log_config_copy_levels(dest, src);
     }
@@ -618,25 +1283,41 @@ internal_log_location_overrides_level(const char *function_name,
                                       enum logLevels *log_level_return)
 {
 #ifdef LOG_PER_LOGGER_LEVEL
-    struct log_logger_level *logger = NULL;
-    int i;
+    struct log_logger_level *logger;
+    int file_index;
+    int function_index;
+    int index;
 
-    if (g_staticLogConfig == NULL)
+    if (g_staticLogConfig == NULL || g_staticLogConfig->logger_hash == NULL)
     {
         return 0;
     }
-    for (i = 0; i < g_staticLogConfig->per_logger_level->count; i++)
+
+    file_index = internal_log_logger_find(g_staticLogConfig, LOG_TYPE_FILE,
+                                          file_name);
+    function_index = internal_log_logger_find(g_staticLogConfig,
+                                              LOG_TYPE_FUNCTION, function_name);
+
+    /* If both match, the logger listed first in the config wins */
+    if (file_index < 0)
     {
-        logger = (struct log_logger_level *)list_get_item(g_staticLogConfig->per_logger_level, i);
+        index = function_index;
+    }
+    else if (function_index < 0)
+    {
+        index = file_index;
+    }
+    else
+    {
+        index = MIN(file_index, function_index);
+    }
 
-        if ((logger->logger_type == LOG_TYPE_FILE
-                && 0 == g_strncmp(logger->logger_name, file_name, LOGGER_NAME_SIZE))
-                || (logger->logger_type == LOG_TYPE_FUNCTION
-                    && 0 == g_strncmp(logger->logger_name, function_name, LOGGER_NAME_SIZE)))
-        {
-            *log_level_return = logger->log_level;
-            return 1;
-        }
+    if (index >= 0)
+    {
+        logger = (struct log_logger_level *)
+                 list_get_item(g_staticLogConfig->per_logger_level, index);
+        *log_level_return = logger->log_level;
+        return 1;
     }
 #endif
 
@@ -716,6 +1397,8 @@ log_config_free(struct log_config *config)
             list_delete(config->per_logger_level);
             config->per_logger_level = NULL;
         }
+        g_free(config->logger_hash);
+        config->logger_hash = NULL;
 #endif
 
         if (0 != config->log_file)
@@ -1019,8 +1702,7 @@ internal_log_message(const enum logLevels lvl,
 {
     char buff[LOG_BUFFER_SIZE + 43]; /* 31 ("[2022-10-07T19:58:33.065+0900] ") + 8 (log level) + 4 (space+cr+lf+\0) */
     int len = 0;
-    enum logReturns rv = LOG_STARTUP_OK;
-    int writereply = 0;
+    unsigned int dests;
 
     if (g_staticLogConfig == NULL)
     {
@@ -1076,47 +1758,21 @@ internal_log_message(const enum logLevels lvl,
 #endif
 #endif
 
-    if (g_staticLogConfig->enable_syslog
-            && ((override_destination_level && lvl <= override_log_level)
-                || (!override_destination_level && lvl <= g_staticLogConfig->syslog_level)))
+    dests = internal_log_destinations(lvl, override_destination_level,
+                                      override_log_level);
+    if (internal_log_async_enqueue(lvl, dests, buff) == 0)
     {
-        /* log to syslog*/
-        /* %s fix compiler warning 'not a string literal' */
-        syslog(internal_log_xrdp2syslog(lvl), "%s", buff + 31);
-    }
-
-    if (g_staticLogConfig->enable_console
-            && ((override_destination_level && lvl <= override_log_level)
-                || (!override_destination_level && lvl <= g_staticLogConfig->console_level)))
-    {
-        /* log to console */
-        g_printf("%s", buff);
+        return LOG_STARTUP_OK;
     }
 
-    if ((override_destination_level && lvl <= override_log_level)
-            || (!override_destination_level && lvl <= g_staticLogConfig->log_level))
-    {
-        /* log to application logfile */
-        if (g_staticLogConfig->fd >= 0)
-        {
-#ifdef LOG_ENABLE_THREAD
-            pthread_mutex_lock(&(g_staticLogConfig->log_lock));
-#endif
-
-            writereply = g_file_write(g_staticLogConfig->fd, buff, g_strlen(buff));
-
-            if (writereply <= 0)
-            {
-                rv = LOG_ERROR_NULL_FILE;
-            }
-
-#ifdef LOG_ENABLE_THREAD
-            pthread_mutex_unlock(&(g_staticLogConfig->log_lock));
-#endif
-        }
-    }
+    return internal_log_write(lvl, dests, buff);
+}
 
-    return rv;
+/******************************************************************************/
+unsigned int
+log_get_dropped_count(void)
+{
+    return __atomic_load_n(&g_log_async.drops_total, __ATOMIC_RELAXED);
 }
 
 /**
@@ -1156,18 +1812,18 @@ getFormattedDateTime(char *replybuf, int bufsize)
     char buf_millisec[4];  /* 357 */
     char buf_timezone[6];  /* +0900 */
 
-    struct tm *now;
+    struct tm now;
     struct timeval tv;
     int millisec;
 
     gettimeofday(&tv, NULL);
-    now = localtime(&tv.tv_sec);
+    localtime_r(&tv.tv_sec, &now);
 
     millisec = (tv.tv_usec + 500 / 1000);
     g_snprintf(buf_millisec, sizeof(buf_millisec), "%03d", millisec);
 
-    strftime(buf_datetime, sizeof(buf_datetime), "%FT%T.", now);
-    strftime(buf_timezone, sizeof(buf_timezone), "%z", now);
+    strftime(buf_datetime, sizeof(buf_datetime), "%FT%T.", &now);
+    strftime(buf_timezone, sizeof(buf_timezone), "%z", &now);
     g_snprintf(replybuf, bufsize, "[%s%s%s] ", buf_datetime, buf_millisec, buf_timezone);
 
     return replybuf;
@@ -69,6 +69,11 @@ enum logReturns
 #define SESMAN_CFG_LOG_ENABLE_SYSLOG  "EnableSyslog"
 #define SESMAN_CFG_LOG_SYSLOG_LEVEL   "SyslogLevel"
 #define SESMAN_CFG_LOG_ENABLE_PID     "EnableProcessId"
+#define SESMAN_CFG_LOG_ENABLE_ASYNC   "EnableAsync"
+#define SESMAN_CFG_LOG_ASYNC_QUEUE    "AsyncQueueLength"
+
+/* Default number of messages the asynchronous log queue can hold */
+#define LOG_ASYNC_DEFAULT_QUEUE_LENGTH 256
 
 /* enable threading */
 /*#define LOG_ENABLE_THREAD*/
@@ -208,9 +213,15 @@ struct log_config
     enum logLevels syslog_level;
 #ifdef LOG_PER_LOGGER_LEVEL
     struct list *per_logger_level;
+    /* Open addressed hash of indexes into per_logger_level, or NULL */
+    int *logger_hash;
+    unsigned int logger_hash_size;
 #endif
     int dump_on_start;
     int enable_pid;
+    /* Write messages from a background thread. Fixed at log start */
+    int enable_async;
+    unsigned int async_queue_length;
 #ifdef LOG_ENABLE_THREAD
     pthread_mutex_t log_lock;
     pthread_mutexattr_t log_lock_attr;
@@ -430,6 +441,15 @@ log_hexdump_with_location(const char *function_name,
                           const char *p,
                           int len);
 
+/**
+ * Returns the number of messages this process has dropped since the
+ * log was started, because the asynchronous log queue was full.
+ *
+ * Errors are never dropped. They are written synchronously instead.
+ */
+unsigned int
+log_get_dropped_count(void);
+
 /**
  * This function returns the configured file name for the logfile
  * @param replybuf the buffer where the reply is stored
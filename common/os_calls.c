@@ -362,6 +362,28 @@ g_tcp_set_keepalive(int sck)
     return ret;
 }
 
+/*****************************************************************************/
+/* Gets the kernel's smoothed round trip time estimate for a TCP socket,
+   in microseconds. Returns 0 on success, 1 if not a TCP socket or
+   not supported on this platform */
+int
+g_tcp_get_rtt(int sck, unsigned int *rtt_us, unsigned int *rttvar_us)
+{
+#if defined(TCP_INFO)
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+
+    if (getsockopt(sck, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0 &&
+            info_len >= (socklen_t)sizeof(info))
+    {
+        *rtt_us = info.tcpi_rtt;
+        *rttvar_us = info.tcpi_rttvar;
+        return 0;
+    }
+#endif
+    return 1;
+}
+
 /*****************************************************************************/
 /* returns a newly created socket or -1 on error */
 /* in win32 a socket is an unsigned int, in linux, it's an int */
@@ -3538,6 +3560,18 @@ g_sigterm(int pid)
 #endif
 }
 
+/*****************************************************************************/
+/* does not work in win32 */
+int
+g_sigkill(int pid)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    return kill(pid, SIGKILL);
+#endif
+}
+
 /*****************************************************************************/
 int g_pid_is_active(int pid)
 {
@@ -66,6 +66,8 @@ void     g_hexdump(const char *p, int len);
 int      g_getchar(void);
 int      g_tcp_set_no_delay(int sck);
 int      g_tcp_set_keepalive(int sck);
+int      g_tcp_get_rtt(int sck, unsigned int *rtt_us,
+                       unsigned int *rttvar_us);
 int      g_tcp_socket(void);
 int      g_sck_set_send_buffer_bytes(int sck, int bytes);
 int      g_sck_get_send_buffer_bytes(int sck, int *bytes);
@@ -371,6 +373,7 @@ char    *g_getenv(const char *name);
 int      g_exit(int exit_code);
 int      g_getpid(void);
 int      g_sigterm(int pid);
+int      g_sigkill(int pid);
 int      g_sighup(int pid);
 /*
  * Is a particular PID active?
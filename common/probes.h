@@ -0,0 +1,73 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Static USDT (SystemTap/DTrace) probe points
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * Probes are only compiled in if configure was run with --enable-usdt.
+ * Otherwise the macros expand to nothing, and their arguments are not
+ * evaluated, so arguments must not have side effects.
+ *
+ * An enabled probe costs a single NOP until a tracer attaches to it.
+ * All probes use the 'xrdp' provider. For example, to time the encoder:-
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/xrdp:xrdp:process_enc_start
+ *                { @s[arg0] = nsecs; }
+ *                usdt:/usr/sbin/xrdp:xrdp:process_enc_end /@s[arg0]/
+ *                { @us = hist((nsecs - @s[arg0]) / 1000); delete(@s[arg0]); }'
+ *
+ * Probes (arguments in brackets):-
+ *
+ *   trans_send (sck, bytes requested, result)        common/trans.c
+ *   trans_recv (sck, bytes requested, result)        common/trans.c
+ *   fastpath_input (event code, event flags)         libxrdp/xrdp_fastpath.c
+ *   orders_send (order count, bytes)                 libxrdp/xrdp_orders.c
+ *   enc_enqueue (enc, queue depth)                   xrdp/xrdp_mm.c
+ *   enc_dequeue (enc)                                xrdp/xrdp_encoder.c
+ *   process_enc_start (enc)                          xrdp/xrdp_encoder.c
+ *   process_enc_end (enc)                            xrdp/xrdp_encoder.c
+ *   egfx_send (channel id, bytes)                    xrdp/xrdp_egfx.c
+ *   chansrv_data_in (channel id, bytes, total bytes) sesman/chansrv/chansrv.c
+ *   chansrv_data_out (channel id, bytes)             sesman/chansrv/chansrv.c
+ *   session_create (uid, display, session type)      sesman/scp_process.c
+ *
+ * Pointer arguments are only useful for matching start and end probes.
+ */
+
+#if defined(XRDP_USDT)
+
+#include <sys/sdt.h>
+
+#define XRDP_PROBE0(name) DTRACE_PROBE(xrdp, name)
+#define XRDP_PROBE1(name, a1) DTRACE_PROBE1(xrdp, name, a1)
+#define XRDP_PROBE2(name, a1, a2) DTRACE_PROBE2(xrdp, name, a1, a2)
+#define XRDP_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(xrdp, name, a1, a2, a3)
+
+#else
+
+#define XRDP_PROBE0(name) do { } while (0)
+#define XRDP_PROBE1(name, a1) do { } while (0)
+#define XRDP_PROBE2(name, a1, a2) do { } while (0)
+#define XRDP_PROBE3(name, a1, a2, a3) do { } while (0)
+
+#endif
+
+#endif
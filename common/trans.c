@@ -29,6 +29,7 @@
 #include "parse.h"
 #include "ssl_calls.h"
 #include "log.h"
+#include "probes.h"
 
 #define MAX_SBYTES 0
 
@@ -41,22 +42,38 @@
 static int
 trans_tls_recv(struct trans *self, char *ptr, int len)
 {
+    int rv;
+
     if (self->tls == NULL)
     {
         return 1;
     }
-    return ssl_tls_read(self->tls, ptr, len);
+    rv = ssl_tls_read(self->tls, ptr, len);
+    XRDP_PROBE3(trans_recv, self->sck, len, rv);
+    if (rv > 0)
+    {
+        self->bytes_recv += rv;
+    }
+    return rv;
 }
 
 /*****************************************************************************/
 static int
 trans_tls_send(struct trans *self, const char *data, int len)
 {
+    int rv;
+
     if (self->tls == NULL)
     {
         return 1;
     }
-    return ssl_tls_write(self->tls, data, len);
+    rv = ssl_tls_write(self->tls, data, len);
+    XRDP_PROBE3(trans_send, self->sck, len, rv);
+    if (rv > 0)
+    {
+        self->bytes_sent += rv;
+    }
+    return rv;
 }
 
 /*****************************************************************************/
@@ -74,14 +91,30 @@ trans_tls_can_recv(struct trans *self, int sck, int millis)
 static int
 trans_tcp_recv(struct trans *self, char *ptr, int len)
 {
-    return g_tcp_recv(self->sck, ptr, len, 0);
+    int rv;
+
+    rv = g_tcp_recv(self->sck, ptr, len, 0);
+    XRDP_PROBE3(trans_recv, self->sck, len, rv);
+    if (rv > 0)
+    {
+        self->bytes_recv += rv;
+    }
+    return rv;
 }
 
 /*****************************************************************************/
 static int
 trans_tcp_send(struct trans *self, const char *data, int len)
 {
-    return g_tcp_send(self->sck, data, len, 0);
+    int rv;
+
+    rv = g_tcp_send(self->sck, data, len, 0);
+    XRDP_PROBE3(trans_send, self->sck, len, rv);
+    if (rv > 0)
+    {
+        self->bytes_sent += rv;
+    }
+    return rv;
 }
 
 /*****************************************************************************/
@@ -91,6 +124,46 @@ trans_tcp_can_recv(struct trans *self, int sck, int millis)
     return g_sck_can_recv(sck, millis);
 }
 
+/*****************************************************************************/
+static int
+trans_unix_fd_recv(struct trans *self, char *ptr, int len)
+{
+    int fds[TRANS_MAX_RECV_FDS];
+    unsigned int fdcount;
+    unsigned int index;
+    int rv;
+
+    fdcount = 0;
+    rv = g_sck_recv_fd_set(self->sck, ptr, len,
+                           fds, TRANS_MAX_RECV_FDS, &fdcount);
+    XRDP_PROBE3(trans_recv, self->sck, len, rv);
+    if (fdcount > TRANS_MAX_RECV_FDS)
+    {
+        /* Excess fds have already been closed */
+        LOG(LOG_LEVEL_WARNING, "trans_unix_fd_recv: %u fds discarded",
+            fdcount - TRANS_MAX_RECV_FDS);
+        fdcount = TRANS_MAX_RECV_FDS;
+    }
+    for (index = 0; index < fdcount; ++index)
+    {
+        if (self->recv_fd_count < TRANS_MAX_RECV_FDS)
+        {
+            self->recv_fds[self->recv_fd_count++] = fds[index];
+        }
+        else
+        {
+            LOG(LOG_LEVEL_WARNING, "trans_unix_fd_recv: fd queue full, "
+                "discarding fd %d", fds[index]);
+            g_file_close(fds[index]);
+        }
+    }
+    if (rv > 0)
+    {
+        self->bytes_recv += rv;
+    }
+    return rv;
+}
+
 /*****************************************************************************/
 struct trans *
 trans_create(int mode, int in_size, int out_size)
@@ -135,6 +208,11 @@ trans_delete(struct trans *self)
     free_stream(self->in_s);
     free_stream(self->out_s);
 
+    while (self->recv_fd_count > 0)
+    {
+        g_file_close(self->recv_fds[--self->recv_fd_count]);
+    }
+
     if (self->sck >= 0)
     {
         g_tcp_close(self->sck);
@@ -1077,3 +1155,32 @@ trans_shutdown_tls_mode(struct trans *self)
 
     return 0;
 }
+
+/*****************************************************************************/
+int
+trans_enable_fd_passing(struct trans *self)
+{
+    if (self == NULL || self->mode != TRANS_MODE_UNIX || self->tls != NULL)
+    {
+        return 1;
+    }
+    self->trans_recv = trans_unix_fd_recv;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+trans_get_recv_fd(struct trans *self)
+{
+    int rv;
+
+    if (self == NULL || self->recv_fd_count == 0)
+    {
+        return -1;
+    }
+    rv = self->recv_fds[0];
+    --self->recv_fd_count;
+    g_memmove(&self->recv_fds[0], &self->recv_fds[1],
+              self->recv_fd_count * sizeof(self->recv_fds[0]));
+    return rv;
+}
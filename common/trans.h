@@ -37,6 +37,9 @@
 #define TRANS_STATUS_DOWN 0
 #define TRANS_STATUS_UP 1
 
+/* Max number of received file descriptors queued on a transport */
+#define TRANS_MAX_RECV_FDS 8
+
 struct trans; /* forward declaration */
 struct xrdp_tls;
 
@@ -117,6 +120,16 @@ struct trans
     trans_can_recv_proc trans_can_recv;
     struct source_info *si;
     enum xrdp_source my_source;
+
+    /* File descriptors received with SCM_RIGHTS and not yet claimed by
+     * trans_get_recv_fd(). Only used if trans_enable_fd_passing() has been
+     * called on a UNIX domain transport */
+    int recv_fds[TRANS_MAX_RECV_FDS];
+    unsigned int recv_fd_count;
+    /* Payload bytes moved over the transport. For TLS transports these
+     * are the plaintext bytes */
+    tui64 bytes_sent;
+    tui64 bytes_recv;
 };
 
 struct trans *
@@ -178,4 +191,30 @@ trans_shutdown_tls_mode(struct trans *self);
 int
 trans_tcp_force_read_s(struct trans *self, struct stream *in_s, int size);
 
+/**
+ * Enable receipt of file descriptors on a UNIX domain transport
+ *
+ * @param self Transport
+ * @return 0 for success
+ *
+ * Once enabled, all reads on the transport are made with recvmsg(), and
+ * any file descriptors passed with the data are queued on the transport
+ * in the order they arrive. This allows descriptors to be collected along
+ * with the stream data they accompany, without further reads on the
+ * socket.
+ */
+int
+trans_enable_fd_passing(struct trans *self);
+
+/**
+ * Remove the oldest queued file descriptor from a transport
+ *
+ * @param self Transport
+ * @return file descriptor, or -1 if none are queued
+ *
+ * The caller becomes responsible for closing the returned descriptor.
+ */
+int
+trans_get_recv_fd(struct trans *self);
+
 #endif
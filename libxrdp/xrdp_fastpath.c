@@ -23,6 +23,7 @@
 
 #include "libxrdp.h"
 #include "ms-rdpbcgr.h"
+#include "probes.h"
 
 /*****************************************************************************/
 struct xrdp_fastpath *
@@ -349,6 +350,7 @@ xrdp_fastpath_process_input_event(struct xrdp_fastpath *self,
 
         eventFlags = (eventHeader & 0x1F);
         eventCode = (eventHeader >> 5);
+        XRDP_PROBE2(fastpath_input, eventCode, eventFlags);
         LOG_DEVEL(LOG_LEVEL_TRACE, "Received [MS-RDPBCGR] TS_FP_INPUT_EVENT"
                   "eventHeader.eventFlags 0x%2.2x, eventHeader.eventCode 0x%1.1x",
                   eventFlags, eventCode);
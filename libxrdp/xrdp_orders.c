@@ -25,6 +25,7 @@
 #include "libxrdp.h"
 #include "ms-rdpbcgr.h"
 #include "ms-rdpegdi.h"
+#include "probes.h"
 
 #if defined(XRDP_NEUTRINORDP)
 #include <freerdp/codec/rfx.h>
@@ -153,6 +154,8 @@ xrdp_orders_send(struct xrdp_orders *self)
         {
             s_mark_end(self->out_s);
             LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_orders_send sending %d orders", self->order_count);
+            XRDP_PROBE2(orders_send, self->order_count,
+                        (int)(self->out_s->end - self->out_s->data));
             self->order_count_ptr[0] = self->order_count;
             self->order_count_ptr[1] = self->order_count >> 8;
             self->order_count = 0;
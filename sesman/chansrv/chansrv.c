@@ -21,6 +21,8 @@
 #include <config_ac.h>
 #endif
 
+#include <stdlib.h>
+
 #ifdef XRDP_IBUS
 #include "input.h"
 #endif
@@ -49,6 +51,7 @@
 #include "scp_sync.h"
 
 #include "ms-rdpbcgr.h"
+#include "probes.h"
 
 #define MAX_PATH 260
 
@@ -113,138 +116,173 @@ struct xrdp_api_data
     int chan_id;
 };
 
+/* Timeouts are kept in a binary min-heap ordered by expiry time, so the
+ * next timeout to expire is always g_timeouts[0] */
 struct timeout_obj
 {
     tui32 mstime;
+    tui32 seq; /* timeouts with the same mstime run in the order added */
     void *data;
     void (*callback)(void *data);
-    struct timeout_obj *next;
 };
 
-static struct timeout_obj *g_timeout_head = 0;
-static struct timeout_obj *g_timeout_tail = 0;
+static struct timeout_obj *g_timeouts = 0;
+static int g_timeout_count = 0;
+static int g_timeout_alloc = 0;
+static tui32 g_timeout_seq = 0;
 
 /*****************************************************************************/
-int
-add_timeout(int msoffset, void (*callback)(void *data), void *data)
+/* Returns non-zero if timeout a is due before timeout b. Times wrap
+ * after 49 days, so they're compared by difference */
+static int
+timeout_before(const struct timeout_obj *a, const struct timeout_obj *b)
 {
-    struct timeout_obj *tobj;
-    tui32 now;
+    int diff = (int)(a->mstime - b->mstime);
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "add_timeout:");
-    now = g_get_elapsed_ms();
-    tobj = g_new0(struct timeout_obj, 1);
-    tobj->mstime = now + msoffset;
-    tobj->callback = callback;
-    tobj->data = data;
-    if (g_timeout_tail == 0)
+    if (diff != 0)
     {
-        g_timeout_head = tobj;
-        g_timeout_tail = tobj;
+        return diff < 0;
     }
-    else
+    return (int)(a->seq - b->seq) < 0;
+}
+
+/*****************************************************************************/
+static void
+timeout_sift_up(int index)
+{
+    struct timeout_obj tobj = g_timeouts[index];
+    int parent;
+
+    while (index > 0)
     {
-        g_timeout_tail->next = tobj;
-        g_timeout_tail = tobj;
+        parent = (index - 1) / 2;
+        if (!timeout_before(&tobj, &g_timeouts[parent]))
+        {
+            break;
+        }
+        g_timeouts[index] = g_timeouts[parent];
+        index = parent;
     }
+    g_timeouts[index] = tobj;
+}
+
+/*****************************************************************************/
+static void
+timeout_sift_down(int index)
+{
+    struct timeout_obj tobj = g_timeouts[index];
+    int child;
+
+    while ((child = index * 2 + 1) < g_timeout_count)
+    {
+        if ((child + 1 < g_timeout_count) &&
+                timeout_before(&g_timeouts[child + 1], &g_timeouts[child]))
+        {
+            child++;
+        }
+        if (!timeout_before(&g_timeouts[child], &tobj))
+        {
+            break;
+        }
+        g_timeouts[index] = g_timeouts[child];
+        index = child;
+    }
+    g_timeouts[index] = tobj;
+}
+
+/*****************************************************************************/
+/* Removes the next timeout to expire from the heap */
+static void
+timeout_pop(struct timeout_obj *tobj)
+{
+    *tobj = g_timeouts[0];
+    g_timeout_count--;
+    if (g_timeout_count > 0)
+    {
+        g_timeouts[0] = g_timeouts[g_timeout_count];
+        timeout_sift_down(0);
+    }
+}
+
+/*****************************************************************************/
+int
+add_timeout(int msoffset, void (*callback)(void *data), void *data)
+{
+    struct timeout_obj *new_timeouts;
+    int new_alloc;
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "add_timeout:");
+    if (g_timeout_count == g_timeout_alloc)
+    {
+        new_alloc = (g_timeout_alloc == 0) ? 16 : g_timeout_alloc * 2;
+        new_timeouts = (struct timeout_obj *)
+                       realloc(g_timeouts, new_alloc * sizeof(g_timeouts[0]));
+        if (new_timeouts == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "add_timeout: out of memory");
+            return 1;
+        }
+        g_timeouts = new_timeouts;
+        g_timeout_alloc = new_alloc;
+    }
+    g_timeouts[g_timeout_count].mstime = g_get_elapsed_ms() + msoffset;
+    g_timeouts[g_timeout_count].seq = g_timeout_seq++;
+    g_timeouts[g_timeout_count].callback = callback;
+    g_timeouts[g_timeout_count].data = data;
+    g_timeout_count++;
+    timeout_sift_up(g_timeout_count - 1);
     return 0;
 }
 
 /*****************************************************************************/
+/* Reduces *timeout so the wait ends when the next timeout expires.
+ * A *timeout < 0 means no timeout has been set yet */
 static int
 get_timeout(int *timeout)
 {
-    struct timeout_obj *tobj;
-    tui32 now;
     int ltimeout;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "get_timeout:");
-    ltimeout = *timeout;
-    if (ltimeout < 1)
+    if (g_timeout_count > 0)
     {
-        ltimeout = 0;
-    }
-    tobj = g_timeout_head;
-    if (tobj != 0)
-    {
-        now = g_get_elapsed_ms();
-        while (tobj != 0)
+        ltimeout = (int)(g_timeouts[0].mstime - g_get_elapsed_ms());
+        if (ltimeout < 0)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "  now %u tobj->mstime %u", now, tobj->mstime);
-            if (now < tobj->mstime)
-            {
-                ltimeout = tobj->mstime - now;
-            }
-            tobj = tobj->next;
+            /* Already due */
+            ltimeout = 0;
         }
-    }
-    if (ltimeout > 0)
-    {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "  ltimeout %d", ltimeout);
-        if (*timeout < 1)
+        if ((*timeout < 0) || (*timeout > ltimeout))
         {
             *timeout = ltimeout;
         }
-        else
-        {
-            if (*timeout > ltimeout)
-            {
-                *timeout = ltimeout;
-            }
-        }
     }
     return 0;
 }
 
 /*****************************************************************************/
+/* Runs the callbacks for all expired timeouts. Timeouts added by the
+ * callbacks are run on a later call, even if they have already expired */
 static int
 check_timeout(void)
 {
-    struct timeout_obj *tobj;
-    struct timeout_obj *last_tobj;
-    struct timeout_obj *temp_tobj;
-    int count;
+    struct timeout_obj tobj;
     tui32 now;
+    tui32 seq_limit;
+    int count;
+
     UNUSED_VAR(count);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "check_timeout:");
     count = 0;
-    tobj = g_timeout_head;
-    if (tobj != 0)
+    now = g_get_elapsed_ms();
+    seq_limit = g_timeout_seq;
+    while ((g_timeout_count > 0) &&
+            ((int)(g_timeouts[0].mstime - now) <= 0) &&
+            ((int)(g_timeouts[0].seq - seq_limit) < 0))
     {
-        last_tobj = 0;
-        while (tobj != 0)
-        {
-            count++;
-            now = g_get_elapsed_ms();
-            if (now >= tobj->mstime)
-            {
-                tobj->callback(tobj->data);
-                if (last_tobj == 0)
-                {
-                    g_timeout_head = tobj->next;
-                    if (g_timeout_head == 0)
-                    {
-                        g_timeout_tail = 0;
-                    }
-                }
-                else
-                {
-                    last_tobj->next = tobj->next;
-                    if (g_timeout_tail == tobj)
-                    {
-                        g_timeout_tail = last_tobj;
-                    }
-                }
-                temp_tobj = tobj;
-                tobj = tobj->next;
-                g_free(temp_tobj);
-            }
-            else
-            {
-                last_tobj = tobj;
-                tobj = tobj->next;
-            }
-        }
+        timeout_pop(&tobj);
+        tobj.callback(tobj.data);
+        count++;
     }
     LOG_DEVEL(LOG_LEVEL_DEBUG, "  count %d", count);
     return 0;
@@ -258,32 +296,38 @@ g_is_term(void)
 }
 
 /*****************************************************************************/
-/* send data to a static virtual channel
-   size can be > MAX_CHANNEL_FRAG_BYTES, in which case, > 1 message
-   will be sent*/
+/* send part of a message to a static virtual channel
+   offset is the position of data within the whole message, which is
+   total_size bytes long. Parts must be sent in order, and the message is
+   complete when offset + size == total_size. This allows a large message
+   to be sent without assembling it in memory first */
 /* returns error */
 int
-send_channel_data(int chan_id, const char *data, int size)
+send_channel_data_part(int chan_id, const char *data, int size,
+                       int offset, int total_size)
 {
     int sending_bytes;
     int chan_flags;
     int error;
-    int total_size;
     struct stream *s;
 
     if ((chan_id < 0) || (chan_id > 31) ||
             (data == NULL) ||
-            (size < 1) || (size > MAX_CHANNEL_BYTES))
+            (size < 1) || (total_size > MAX_CHANNEL_BYTES) ||
+            (offset < 0) || (offset + size > total_size))
     {
         /* bad param */
         return 1;
     }
-    total_size = size;
-    chan_flags = 1; /* first */
+    if (offset == 0)
+    {
+        XRDP_PROBE2(chansrv_data_out, chan_id, total_size);
+    }
+    chan_flags = (offset == 0) ? 1 : 0; /* first */
     while (size > 0)
     {
         sending_bytes = MIN(MAX_CHANNEL_FRAG_BYTES, size);
-        if (sending_bytes >= size)
+        if (offset + sending_bytes >= total_size)
         {
             chan_flags |= 2; /* last */
         }
@@ -304,6 +348,7 @@ send_channel_data(int chan_id, const char *data, int size)
         s_mark_end(s);
         size -= sending_bytes;
         data += sending_bytes;
+        offset += sending_bytes;
         error = trans_write_copy(g_con_trans);
         if (error != 0)
         {
@@ -314,6 +359,17 @@ send_channel_data(int chan_id, const char *data, int size)
     return 0;
 }
 
+/*****************************************************************************/
+/* send data to a static virtual channel
+   size can be > MAX_CHANNEL_FRAG_BYTES, in which case, > 1 message
+   will be sent*/
+/* returns error */
+int
+send_channel_data(int chan_id, const char *data, int size)
+{
+    return send_channel_data_part(chan_id, data, size, 0, size);
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -457,6 +513,7 @@ process_message_channel_data(struct stream *s)
     in_uint32_le(s, total_length);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "process_message_channel_data: chan_id %d "
               "chan_flags %d", chan_id, chan_flags);
+    XRDP_PROBE3(chansrv_data_in, chan_id, length, total_length);
     rv = 0;
 
     if (rv == 0)
@@ -1273,6 +1330,20 @@ my_api_trans_data_in(struct trans *trans)
     return rv;
 }
 
+/*****************************************************************************/
+/* Closes the connection to xrdp, and resets the channels which
+ * were using it */
+static void
+close_con_trans(void)
+{
+    clipboard_deinit();
+    sound_deinit();
+    devredir_deinit();
+    rail_deinit();
+    trans_delete(g_con_trans);
+    g_con_trans = 0;
+}
+
 /*****************************************************************************/
 static int
 my_trans_conn_in(struct trans *trans, struct trans *new_trans)
@@ -1287,23 +1358,24 @@ my_trans_conn_in(struct trans *trans, struct trans *new_trans)
         return 1;
     }
 
-    if (g_con_trans != 0) /* if already set, error */
-    {
-        return 1;
-    }
-
     if (new_trans == 0)
     {
         return 1;
     }
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "my_trans_conn_in:");
+    if (g_con_trans != 0)
+    {
+        /* A reconnecting client gets a new xrdp process. The old one may
+         * not notice its client has gone until the TCP connection times
+         * out, so the newest connection takes over the channels */
+        LOG(LOG_LEVEL_INFO, "New connection from xrdp - "
+            "closing the existing connection");
+        close_con_trans();
+    }
     g_con_trans = new_trans;
     g_con_trans->trans_data_in = my_trans_data_in;
     g_con_trans->header_size = 8;
-    /* stop listening */
-    trans_delete(g_lis_trans);
-    g_lis_trans = 0;
     return 0;
 }
 
@@ -1535,20 +1607,7 @@ channel_thread_loop(void *in_val)
                 {
                     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: "
                               "trans_check_wait_objs error resetting");
-                    clipboard_deinit();
-                    sound_deinit();
-                    devredir_deinit();
-                    rail_deinit();
-                    /* delete g_con_trans */
-                    trans_delete(g_con_trans);
-                    g_con_trans = 0;
-                    /* create new listener */
-                    error = setup_listen();
-
-                    if (error != 0)
-                    {
-                        break;
-                    }
+                    close_con_trans();
                 }
             }
 
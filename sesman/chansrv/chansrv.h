@@ -35,6 +35,8 @@ int
 g_is_term(void);
 
 int send_channel_data(int chan_id, const char *data, int size);
+int send_channel_data_part(int chan_id, const char *data, int size,
+                           int offset, int total_size);
 int send_rail_drawing_orders(char *data, int size);
 int main_cleanup(void);
 int add_timeout(int msoffset, void (*callback)(void *data), void *data);
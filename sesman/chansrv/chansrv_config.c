@@ -42,11 +42,15 @@
 #define DEFAULT_FUSE_MOUNT_NAME             "xrdp-client"
 #define DEFAULT_FUSE_MOUNT_NAME_COLON_CHAR_REPLACEMENT ':'
 #define DEFAULT_FUSE_DIRECT_IO              0
+#define DEFAULT_FUSE_READ_AHEAD_BLOCKS      8
+#define DEFAULT_FUSE_WRITE_BACK             0
+#define DEFAULT_FUSE_CACHE_TIMEOUT          5
 #define DEFAULT_FILE_UMASK                  077
 #define DEFAULT_USE_NAUTILUS3_FLIST_FORMAT  0
 #define DEFAULT_NUM_SILENT_FRAMES_AAC       4
 #define DEFAULT_NUM_SILENT_FRAMES_MP3       2
 #define DEFAULT_MSEC_DO_NOT_SEND            1000
+#define DEFAULT_SOUND_TARGET_LATENCY        150
 #define DEFAULT_LOG_FILE_PATH               ""
 /**
  * Type used for passing a logging function about
@@ -244,6 +248,18 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->fuse_direct_io = g_text2bool(value);
         }
+        else if (g_strcasecmp(name, "FuseReadAheadBlocks") == 0)
+        {
+            cfg->fuse_read_ahead_blocks = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "FuseWriteBack") == 0)
+        {
+            cfg->fuse_write_back = g_text2bool(value);
+        }
+        else if (g_strcasecmp(name, "FuseCacheTimeout") == 0)
+        {
+            cfg->fuse_cache_timeout = strtoul(value, NULL, 0);
+        }
         else if (g_strcasecmp(name, "FileUmask") == 0)
         {
             cfg->file_umask = strtol(value, NULL, 0);
@@ -264,6 +280,10 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->msec_do_not_send = strtoul(value, NULL, 0);
         }
+        else if (g_strcasecmp(name, "SoundTargetLatency") == 0)
+        {
+            cfg->sound_target_latency = strtoul(value, NULL, 0);
+        }
     }
 
     return error;
@@ -337,11 +357,15 @@ new_config(void)
         cfg->fuse_mount_name = fuse_mount_name;
         cfg->fuse_mount_name_colon_char_replacement = DEFAULT_FUSE_MOUNT_NAME_COLON_CHAR_REPLACEMENT;
         cfg->fuse_direct_io = DEFAULT_FUSE_DIRECT_IO;
+        cfg->fuse_read_ahead_blocks = DEFAULT_FUSE_READ_AHEAD_BLOCKS;
+        cfg->fuse_write_back = DEFAULT_FUSE_WRITE_BACK;
+        cfg->fuse_cache_timeout = DEFAULT_FUSE_CACHE_TIMEOUT;
         cfg->file_umask = DEFAULT_FILE_UMASK;
         cfg->use_nautilus3_flist_format = DEFAULT_USE_NAUTILUS3_FLIST_FORMAT;
         cfg->num_silent_frames_aac = DEFAULT_NUM_SILENT_FRAMES_AAC;
         cfg->num_silent_frames_mp3 = DEFAULT_NUM_SILENT_FRAMES_MP3;
         cfg->msec_do_not_send = DEFAULT_MSEC_DO_NOT_SEND;
+        cfg->sound_target_latency = DEFAULT_SOUND_TARGET_LATENCY;
         cfg->log_file_path = log_file_path;
     }
 
@@ -443,9 +467,17 @@ config_dump(struct config_chansrv *config)
     g_writeln("    FuseMountNameColonCharReplacement:             %c", config->fuse_mount_name_colon_char_replacement);
     g_writeln("    FuseDirectIO:              %s",
               g_bool2text(config->fuse_direct_io));
+    g_writeln("    FuseReadAheadBlocks:       %u",
+              config->fuse_read_ahead_blocks);
+    g_writeln("    FuseWriteBack:             %s",
+              g_bool2text(config->fuse_write_back));
+    g_writeln("    FuseCacheTimeout:          %u",
+              config->fuse_cache_timeout);
     g_writeln("    FileMask:                  0%o", config->file_umask);
     g_writeln("    Nautilus 3 Flist Format:   %s",
               g_bool2text(config->use_nautilus3_flist_format));
+    g_writeln("    SoundTargetLatency:        %u",
+              config->sound_target_latency);
     g_writeln("    LogFilePath            :   %s",
               (config->log_file_path[0]) ? config->log_file_path : "<default>");
 }
@@ -32,6 +32,18 @@ struct config_chansrv
     /** Whether to use direct I/O to FUSE filesystems */
     int fuse_direct_io;
 
+    /** Number of reads to keep in flight when a file on a redirected
+     *  drive, or in the clipboard, is read sequentially.
+     *  0 disables read-ahead */
+    unsigned int fuse_read_ahead_blocks;
+
+    /** Whether to buffer writes to files on redirected drives */
+    int fuse_write_back;
+
+    /** Seconds to trust attributes and directory listings read from
+     *  redirected drives for. 0 disables the cache */
+    unsigned int fuse_cache_timeout;
+
     /** RestrictOutboundClipboard setting from sesman.ini */
     int restrict_outbound_clipboard;
     /** RestrictInboundClipboard setting from sesman.ini */
@@ -52,6 +64,9 @@ struct config_chansrv
     unsigned int num_silent_frames_mp3;
     /** Do net send sound data afer SNDC_CLOSE is sent. unit is millisecond, setting from sesman.ini */
     unsigned int msec_do_not_send;
+    /** Client playback latency the sound output tries to stay within, in
+     *  milliseconds. 0 disables latency targeting */
+    unsigned int sound_target_latency;
 
     /** LogFilePath from sesman.ini ([ChansrvLogging]) */
     char *log_file_path;
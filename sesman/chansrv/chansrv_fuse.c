@@ -187,6 +187,8 @@ int xfuse_path_in_xfuse_fs(const char *path)
 #define EREMOTEIO EIO
 #endif
 
+/* Timeouts for entries which aren't cached by xfs_cache_remaining(). For
+ * redirected entries, the time left in our cache is used instead */
 #define XFUSE_ATTR_TIMEOUT      5.0
 #define XFUSE_ENTRY_TIMEOUT     5.0
 
@@ -296,6 +298,8 @@ struct state_create
 struct state_read
 {
     fuse_req_t        req;        /* Original FUSE request from lookup  */
+    struct xfuse_read_ahead *ra;  /* Set if this is a read-ahead block  */
+    off_t             block_off;  /* Offset of the read-ahead block     */
 };
 
 /*
@@ -305,6 +309,8 @@ struct state_write
 {
     fuse_req_t        req;        /* Original FUSE request from lookup  */
     fuse_ino_t        inum;       /* inum of file we're writing         */
+    struct xfuse_write_back *wb;  /* Set if this is a write-back flush  */
+    unsigned int      slot;       /* Index of write in wb->in_flight    */
 };
 
 /*
@@ -347,11 +353,122 @@ struct state_statfs
 };
 
 
+/* Size of the blocks read by read-ahead */
+#define XFUSE_RA_BLOCK_SIZE (64 * 1024)
+/* Sequential reads seen in a row before read-ahead starts */
+#define XFUSE_RA_MIN_SEQ_READS 2
+/* Blocks allowed for current FUSE requests, on top of the window */
+#define XFUSE_RA_SPARE_BLOCKS 4
+
+enum xfuse_ra_block_state
+{
+    XFUSE_RA_EMPTY = 0,
+    XFUSE_RA_PENDING,
+    XFUSE_RA_VALID,
+    XFUSE_RA_ERROR
+};
+
+struct xfuse_ra_block
+{
+    off_t off;                /* Block aligned file offset */
+    enum xfuse_ra_block_state state;
+    int stale;                /* File written since block was read */
+    size_t len;               /* Less than XFUSE_RA_BLOCK_SIZE at EOF */
+    char *data;
+    unsigned int last_used;
+};
+
+/* A FUSE read waiting for blocks */
+struct xfuse_ra_wait
+{
+    fuse_req_t req;
+    off_t off;
+    size_t size;
+};
+
+/* Read-ahead state for a file handle */
+struct xfuse_read_ahead
+{
+    fuse_ino_t inum;
+    tui32 DeviceId;
+    tui32 FileId;
+    off_t next_off;           /* Where a sequential read would start */
+    unsigned int seq_reads;   /* Sequential reads seen in a row */
+    unsigned int use_count;   /* For least recently used eviction */
+    unsigned int pending;     /* Block reads in flight */
+    int in_read;              /* In xfuse_ra_read() */
+    int closed;               /* Handle released. Freed when pending is 0 */
+    int lindex;               /* Clipboard file index, or -1 */
+    unsigned int block_count;
+    struct xfuse_ra_block *blocks;
+    struct list *waiting;     /* struct xfuse_ra_wait */
+};
+
+/* Size of the buffer used to merge writes */
+#define XFUSE_WB_BUFFER_SIZE (256 * 1024)
+/* Most write-back writes in flight for a handle */
+#define XFUSE_WB_MAX_IN_FLIGHT 4
+/* Buffered bytes for all handles before we start sending buffers */
+#define XFUSE_WB_MAX_BUFFERED (16 * 1024 * 1024)
+/* Longest time data stays in a buffer */
+#define XFUSE_WB_FLUSH_MS 500
+
+enum xfuse_wb_op_type
+{
+    XFUSE_WB_OP_WRITE,
+    XFUSE_WB_OP_READ,
+    XFUSE_WB_OP_SYNC,
+    XFUSE_WB_OP_RELEASE,
+    XFUSE_WB_OP_SETATTR
+};
+
+/* A FUSE request waiting for earlier writes */
+struct xfuse_wb_op
+{
+    enum xfuse_wb_op_type type;
+    fuse_req_t req;
+    fuse_ino_t inum;
+    struct xfuse_handle *fh;  /* XFUSE_WB_OP_READ */
+    off_t off;
+    size_t size;
+    char *data;               /* XFUSE_WB_OP_WRITE */
+    struct state_close *fip;  /* XFUSE_WB_OP_RELEASE */
+    struct state_setattr *setattr; /* XFUSE_WB_OP_SETATTR */
+    unsigned int passes_left; /* Handles a READ or SETATTR can move to */
+};
+
+/* A range of the file being written by the client */
+struct xfuse_wb_range
+{
+    off_t off;
+    size_t len;               /* 0 for an unused entry */
+};
+
+/* Write-back state for a file handle */
+struct xfuse_write_back
+{
+    fuse_ino_t inum;
+    tui32 DeviceId;
+    tui32 FileId;
+    char *data;               /* Merged writes not yet sent */
+    off_t off;                /* File offset of data */
+    size_t len;
+    unsigned int buffered_at; /* When data was first added to the buffer */
+    unsigned int in_flight_count;
+    struct xfuse_wb_range in_flight[XFUSE_WB_MAX_IN_FLIGHT];
+    int error;                /* errno for a failed write not yet reported */
+    int busy;                 /* Stops re-entry to xfuse_wb_process() */
+    int closed;               /* Handle released. Freed when all done */
+    struct list *ops;         /* struct xfuse_wb_op, oldest first */
+};
+
 struct xfuse_handle
 {
     tui32 DeviceId;
     tui32 FileId;
     int   is_loc_resource; /* this is not a redirected resource */
+    struct xfuse_read_ahead *ra; /* NULL until the file is first read */
+    struct xfuse_write_back *wb; /* NULL until the file is first written */
 
     /* a directory handle, if this xfuse_handle represents a directory.
      * NULL, if this xfuse_handle represents a file.
@@ -363,18 +480,28 @@ struct xfuse_handle
 };
 typedef struct xfuse_handle XFUSE_HANDLE;
 
+/* Most clipboard file data requests in flight to the client */
+#define XFUSE_CLIP_MAX_IN_FLIGHT 16
+
 /* used for file data request sent to client */
 struct req_list_item
 {
     fuse_req_t req;
-    int stream_id;
+    int stream_id;            /* 0 until the request is sent */
     int lindex;
     int off;
     int size;
+    struct state_read *fusep; /* Set if this is a read-ahead block */
 };
 
 
 static struct list *g_req_list = 0;
+static int g_clip_in_flight = 0;              /* requests sent to client */
+static int g_clip_stream_id = 0;              /* last streamId used      */
+static struct list *g_ra_list = NULL;         /* struct xfuse_read_ahead */
+static struct list *g_wb_list = NULL;         /* struct xfuse_write_back */
+static unsigned int g_wb_buffered = 0;        /* bytes in all wb buffers */
+static int g_wb_timer_set = 0;                /* flush timer is running  */
 static struct xfs_fs *g_xfs;                 /* an inst of xrdp file system */
 static ino_t g_clipboard_inum;               /* inode of clipboard dir      */
 static struct fuse_lowlevel_ops g_xfuse_ops; /* setup FUSE callbacks        */
@@ -431,6 +558,13 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
 static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
                           off_t off, struct fuse_file_info *fi);
 
+/* this is not a callback, but it's used by xfuse_cb_read() */
+static void xfuse_read_remote(struct xfuse_handle *fh, fuse_req_t req,
+                              fuse_ino_t ino, size_t size, off_t off);
+
+/* this is not a callback, but it's used by xfuse_cb_setattr() */
+static void xfuse_setattr_remote(struct state_setattr *fip);
+
 static void xfuse_cb_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
                            size_t size, off_t off, struct fuse_file_info *fi);
 
@@ -438,10 +572,11 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
                             const char *name, mode_t mode,
                             struct fuse_file_info *fi);
 
-#if 0
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi);
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi);
-#endif
 
 static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
                              int to_set, struct fuse_file_info *fi);
@@ -449,6 +584,10 @@ static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
 static void xfuse_cb_opendir(fuse_req_t req, fuse_ino_t ino,
                              struct fuse_file_info *fi);
 
+/* this is not a callback, but it's used by xfuse_cb_opendir() */
+static void xfuse_reply_opendir(fuse_req_t req, fuse_ino_t ino,
+                                struct fuse_file_info *fi);
+
 static void xfuse_cb_releasedir(fuse_req_t req, fuse_ino_t ino,
                                 struct fuse_file_info *fi);
 
@@ -493,21 +632,1317 @@ xfuse_handle_delete(XFUSE_HANDLE *self)
     {
         free(self->dir_handle);
     }
-    free(self);
+    free(self);
+}
+
+/*****************************************************************************/
+static uint64_t
+xfuse_handle_to_fuse_handle(XFUSE_HANDLE *self)
+{
+    return (uint64_t) (tintptr) self;
+}
+
+/*****************************************************************************/
+static XFUSE_HANDLE *
+xfuse_handle_from_fuse_handle(uint64_t handle)
+{
+    return (XFUSE_HANDLE *) (tintptr) handle;
+}
+
+/*****************************************************************************
+**                                                                          **
+**       file data requests for the .clipboard directory                    **
+**                                                                          **
+*****************************************************************************/
+
+/*
+ * Reads of files in the .clipboard directory become FileContentsRequests
+ * to the client. Up to XFUSE_CLIP_MAX_IN_FLIGHT of these are sent at
+ * once, each with its own streamId, so copying many files, or a large
+ * file, isn't limited to one request per round trip. Sequential reads
+ * also use read-ahead.
+ */
+
+/*****************************************************************************/
+/* Sends queued requests until we've got enough in flight */
+static void
+xfuse_clip_send_requests(void)
+{
+    struct req_list_item *rli;
+    int i;
+
+    for (i = 0; i < g_req_list->count &&
+            g_clip_in_flight < XFUSE_CLIP_MAX_IN_FLIGHT; ++i)
+    {
+        rli = (struct req_list_item *)list_get_item(g_req_list, i);
+        if (rli->stream_id != 0)
+        {
+            continue;
+        }
+        /* streamIds are positive, and unique for requests in flight */
+        if (++g_clip_stream_id <= 0)
+        {
+            g_clip_stream_id = 1;
+        }
+        rli->stream_id = g_clip_stream_id;
+        ++g_clip_in_flight;
+
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data "
+                  "stream_id = %d lindex = %d off = %d size = %d",
+                  rli->stream_id, rli->lindex, rli->off, rli->size);
+        clipboard_request_file_data(rli->stream_id, rli->lindex,
+                                    rli->off, rli->size);
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Queues a request for clipboard file data
+ *
+ * Further processing happens in xfuse_file_contents_range()
+ *
+ * @param req FUSE request to reply to, or NULL for a read-ahead block
+ * @param fusep read-ahead block state, or NULL for a FUSE request
+ * @return 0 if the request has been queued
+ */
+static int
+xfuse_clip_request(fuse_req_t req, struct state_read *fusep,
+                   int lindex, off_t off, size_t size)
+{
+    struct req_list_item *rli = g_new0(struct req_list_item, 1);
+
+    if (rli == NULL)
+    {
+        return 1;
+    }
+    rli->req = req;
+    rli->fusep = fusep;
+    rli->lindex = lindex;
+    rli->off = (int) off;
+    rli->size = (int) size;
+    list_add_item(g_req_list, (tintptr) rli);
+    xfuse_clip_send_requests();
+    return 0;
+}
+
+/*****************************************************************************
+**                                                                          **
+**       read-ahead for files on redirected drives                          **
+**                                                                          **
+*****************************************************************************/
+
+/*
+ * Without read-ahead, each FUSE read becomes one IRP_MJ_READ, and the
+ * kernel waits for a full client round trip before sending the next
+ * read. When a handle is read sequentially, we instead read the file in
+ * fixed-size blocks, keeping up to FuseReadAheadBlocks block reads in
+ * flight ahead of the reader. FUSE reads are answered from the blocks.
+ *
+ * Blocks are held per handle. A write or truncate through any handle
+ * invalidates the blocks for that inode.
+ *
+ * Files in the .clipboard directory use the same mechanism, with blocks
+ * read by FileContentsRequests.
+ */
+
+/*****************************************************************************/
+static int
+xfuse_ra_block_needed(const struct xfuse_read_ahead *ra,
+                      const struct xfuse_ra_block *blk)
+{
+    const struct xfuse_ra_wait *w;
+    int i;
+
+    for (i = 0; i < ra->waiting->count; ++i)
+    {
+        w = (const struct xfuse_ra_wait *)list_get_item(ra->waiting, i);
+        if (blk->off < (off_t)(w->off + w->size) &&
+                w->off < (off_t)(blk->off + XFUSE_RA_BLOCK_SIZE))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+xfuse_ra_block_clear(struct xfuse_ra_block *blk)
+{
+    free(blk->data);
+    blk->data = NULL;
+    blk->len = 0;
+    blk->stale = 0;
+    blk->state = XFUSE_RA_EMPTY;
+}
+
+/*****************************************************************************/
+/**
+ * Finds the block starting at an offset
+ *
+ * @param allow_stale Whether to return a block invalidated by a write
+ */
+static struct xfuse_ra_block *
+xfuse_ra_find_block(struct xfuse_read_ahead *ra, off_t off, int allow_stale)
+{
+    struct xfuse_ra_block *blk;
+    unsigned int i;
+
+    for (i = 0; i < ra->block_count; ++i)
+    {
+        blk = &ra->blocks[i];
+        if (blk->state != XFUSE_RA_EMPTY && blk->off == off &&
+                (allow_stale || !blk->stale))
+        {
+            return blk;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/**
+ * Gets a block to read into, evicting the least recently used block
+ * if necessary
+ *
+ * @param evict_before Only blocks wholly before this offset are evicted.
+ *        This stops read-ahead evicting blocks the reader hasn't got to
+ *        yet. Use -1 for no limit.
+ * @return block, or NULL if none can be evicted
+ */
+static struct xfuse_ra_block *
+xfuse_ra_get_block(struct xfuse_read_ahead *ra, off_t evict_before)
+{
+    struct xfuse_ra_block *blk;
+    struct xfuse_ra_block *victim = NULL;
+    unsigned int i;
+
+    for (i = 0; i < ra->block_count; ++i)
+    {
+        blk = &ra->blocks[i];
+        if (blk->state == XFUSE_RA_EMPTY)
+        {
+            return blk;
+        }
+        if (blk->state == XFUSE_RA_PENDING ||
+                (evict_before >= 0 &&
+                 blk->off + XFUSE_RA_BLOCK_SIZE > evict_before) ||
+                xfuse_ra_block_needed(ra, blk))
+        {
+            continue;
+        }
+        if (victim == NULL || blk->last_used < victim->last_used)
+        {
+            victim = blk;
+        }
+    }
+
+    if (victim != NULL)
+    {
+        xfuse_ra_block_clear(victim);
+    }
+    return victim;
+}
+
+/*****************************************************************************/
+/**
+ * Starts reading a block from the client
+ *
+ * @return 0 if the read was started
+ */
+static int
+xfuse_ra_fetch(struct xfuse_read_ahead *ra, off_t off, off_t evict_before)
+{
+    struct xfuse_ra_block *blk;
+    struct state_read *fusep;
+
+    if ((blk = xfuse_ra_get_block(ra, evict_before)) == NULL)
+    {
+        return 1;
+    }
+    if ((fusep = g_new0(struct state_read, 1)) == NULL)
+    {
+        return 1;
+    }
+    blk->off = off;
+    blk->state = XFUSE_RA_PENDING;
+    blk->last_used = ++ra->use_count;
+
+    fusep->ra = ra;
+    fusep->block_off = off;
+    ++ra->pending;
+
+    if (ra->lindex >= 0)
+    {
+        /* Further processing happens in xfuse_file_contents_range() */
+        if (xfuse_clip_request(NULL, fusep, ra->lindex,
+                               off, XFUSE_RA_BLOCK_SIZE) != 0)
+        {
+            --ra->pending;
+            xfuse_ra_block_clear(blk);
+            free(fusep);
+            return 1;
+        }
+        return 0;
+    }
+
+    /*
+     * Further processing happens in xfuse_ra_block_done(). This can
+     * be called before devredir_file_read() returns.
+     */
+    devredir_file_read(fusep, ra->DeviceId, ra->FileId,
+                       XFUSE_RA_BLOCK_SIZE, off);
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Replies to a waiting FUSE request if all its blocks are available
+ *
+ * @return 1 if the request has been replied to
+ */
+static int
+xfuse_ra_try_reply(struct xfuse_read_ahead *ra, const struct xfuse_ra_wait *w)
+{
+    struct xfuse_ra_block *blk;
+    struct xfuse_ra_block *first = NULL;
+    off_t end = w->off + w->size;
+    off_t off;
+    size_t skip;
+    size_t copy;
+    size_t total = 0;
+    char *buf;
+    int single_block;
+
+    /* Check all the blocks are here first */
+    for (off = w->off - w->off % XFUSE_RA_BLOCK_SIZE; off < end;
+            off += XFUSE_RA_BLOCK_SIZE)
+    {
+        if ((blk = xfuse_ra_find_block(ra, off, 0)) == NULL &&
+                (blk = xfuse_ra_find_block(ra, off, 1)) == NULL)
+        {
+            fuse_reply_err(w->req, EIO);
+            return 1;
+        }
+        if (blk->state == XFUSE_RA_PENDING)
+        {
+            return 0;
+        }
+        if (blk->state == XFUSE_RA_ERROR)
+        {
+            fuse_reply_err(w->req, EIO);
+            return 1;
+        }
+        if (first == NULL)
+        {
+            first = blk;
+        }
+        if (blk->len < XFUSE_RA_BLOCK_SIZE)
+        {
+            /* End of file */
+            end = off + blk->len;
+            break;
+        }
+    }
+
+    single_block =
+        (w->off - w->off % XFUSE_RA_BLOCK_SIZE) + XFUSE_RA_BLOCK_SIZE >= end;
+    if (first == NULL || w->off >= end)
+    {
+        fuse_reply_buf(w->req, NULL, 0);
+    }
+    else if (single_block)
+    {
+        /* Reply straight from the block */
+        first->last_used = ++ra->use_count;
+        skip = w->off - first->off;
+        fuse_reply_buf(w->req, first->data + skip, end - w->off);
+    }
+    else if ((buf = (char *)malloc(end - w->off)) == NULL)
+    {
+        fuse_reply_err(w->req, ENOMEM);
+    }
+    else
+    {
+        for (off = w->off; off < end; off += copy)
+        {
+            blk = xfuse_ra_find_block(ra, off - off % XFUSE_RA_BLOCK_SIZE, 0);
+            if (blk == NULL)
+            {
+                blk = xfuse_ra_find_block(ra, off - off % XFUSE_RA_BLOCK_SIZE, 1);
+            }
+            blk->last_used = ++ra->use_count;
+            skip = off - blk->off;
+            copy = MIN((size_t)(end - off), blk->len - skip);
+            g_memcpy(buf + total, blk->data + skip, copy);
+            total += copy;
+        }
+        fuse_reply_buf(w->req, buf, total);
+        free(buf);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* Replies to any waiting FUSE requests we can, and frees blocks
+ * which aren't worth keeping */
+static void
+xfuse_ra_service(struct xfuse_read_ahead *ra)
+{
+    struct xfuse_ra_block *blk;
+    unsigned int i;
+    int index = 0;
+
+    if (ra->in_read)
+    {
+        /* xfuse_ra_read() will call us when it's ready */
+        return;
+    }
+
+    while (index < ra->waiting->count)
+    {
+        if (xfuse_ra_try_reply(ra, (const struct xfuse_ra_wait *)
+                               list_get_item(ra->waiting, index)))
+        {
+            list_remove_item(ra->waiting, index);
+        }
+        else
+        {
+            ++index;
+        }
+    }
+
+    for (i = 0; i < ra->block_count; ++i)
+    {
+        blk = &ra->blocks[i];
+        if ((blk->state == XFUSE_RA_ERROR ||
+                (blk->state == XFUSE_RA_VALID && blk->stale)) &&
+                !xfuse_ra_block_needed(ra, blk))
+        {
+            xfuse_ra_block_clear(blk);
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+xfuse_ra_free(struct xfuse_read_ahead *ra)
+{
+    unsigned int i;
+
+    for (i = 0; i < ra->block_count; ++i)
+    {
+        free(ra->blocks[i].data);
+    }
+    free(ra->blocks);
+    list_delete(ra->waiting);
+    free(ra);
+}
+
+/*****************************************************************************/
+static struct xfuse_read_ahead *
+xfuse_ra_create(fuse_ino_t inum, tui32 DeviceId, tui32 FileId)
+{
+    struct xfuse_read_ahead *ra = g_new0(struct xfuse_read_ahead, 1);
+
+    if (ra != NULL)
+    {
+        ra->inum = inum;
+        ra->DeviceId = DeviceId;
+        ra->FileId = FileId;
+        ra->lindex = -1;
+        ra->block_count = g_cfg->fuse_read_ahead_blocks + XFUSE_RA_SPARE_BLOCKS;
+        ra->blocks = g_new0(struct xfuse_ra_block, ra->block_count);
+        ra->waiting = list_create();
+        if (ra->blocks == NULL || ra->waiting == NULL ||
+                (g_ra_list == NULL && (g_ra_list = list_create()) == NULL))
+        {
+            list_delete(ra->waiting);
+            free(ra->blocks);
+            free(ra);
+            ra = NULL;
+        }
+        else
+        {
+            ra->waiting->auto_free = 1;
+            list_add_item(g_ra_list, (tintptr)ra);
+        }
+    }
+    return ra;
+}
+
+/*****************************************************************************/
+/* Called when the file handle is released */
+static void
+xfuse_ra_delete(struct xfuse_read_ahead *ra)
+{
+    const struct xfuse_ra_wait *w;
+    int i;
+
+    if (ra == NULL)
+    {
+        return;
+    }
+
+    /* FUSE shouldn't release a handle with reads outstanding */
+    for (i = 0; i < ra->waiting->count; ++i)
+    {
+        w = (const struct xfuse_ra_wait *)list_get_item(ra->waiting, i);
+        fuse_reply_err(w->req, EIO);
+    }
+    list_clear(ra->waiting);
+    list_remove_item(g_ra_list, list_index_of(g_ra_list, (tintptr)ra));
+
+    /* Blocks still being read are freed by xfuse_ra_block_done() */
+    ra->closed = 1;
+    if (ra->pending == 0)
+    {
+        xfuse_ra_free(ra);
+    }
+}
+
+/*****************************************************************************/
+/* Called when devredir has read a block */
+static void
+xfuse_ra_block_done(struct state_read *fip, enum NTSTATUS IoStatus,
+                    const char *buf, size_t length)
+{
+    struct xfuse_read_ahead *ra = fip->ra;
+    struct xfuse_ra_block *blk;
+    unsigned int i;
+
+    --ra->pending;
+    if (ra->closed)
+    {
+        if (ra->pending == 0)
+        {
+            xfuse_ra_free(ra);
+        }
+        return;
+    }
+
+    for (i = 0; i < ra->block_count; ++i)
+    {
+        blk = &ra->blocks[i];
+        if (blk->state != XFUSE_RA_PENDING || blk->off != fip->block_off)
+        {
+            continue;
+        }
+
+        if (IoStatus != STATUS_SUCCESS)
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "Read NTSTATUS is %d", (int) IoStatus);
+            blk->state = XFUSE_RA_ERROR;
+        }
+        else if (length > 0 && (blk->data = (char *)malloc(length)) == NULL)
+        {
+            blk->state = XFUSE_RA_ERROR;
+        }
+        else
+        {
+            g_memcpy(blk->data, buf, length);
+            blk->len = MIN(length, XFUSE_RA_BLOCK_SIZE);
+            blk->state = XFUSE_RA_VALID;
+        }
+        break;
+    }
+
+    xfuse_ra_service(ra);
+}
+
+/*****************************************************************************/
+/**
+ * Handles a FUSE read with read-ahead, if the file is being read
+ * sequentially, or the data is already here
+ *
+ * @return 0 if the request has been taken, or non-zero if the caller
+ *         should read the data itself
+ */
+static int
+xfuse_ra_read(struct xfuse_read_ahead *ra, fuse_req_t req,
+              size_t size, off_t off)
+{
+    struct xfuse_ra_wait *w;
+    const XFS_INODE *xinode;
+    off_t first = off - off % XFUSE_RA_BLOCK_SIZE;
+    off_t end = off + size;
+    off_t block;
+    unsigned int i;
+    int cached = 0;
+
+    ra->seq_reads = (off == ra->next_off) ? ra->seq_reads + 1 : 0;
+    ra->next_off = end;
+
+    for (block = first; block < end && !cached; block += XFUSE_RA_BLOCK_SIZE)
+    {
+        cached = (xfuse_ra_find_block(ra, block, 0) != NULL);
+    }
+    if (size == 0 || (!cached && ra->seq_reads < XFUSE_RA_MIN_SEQ_READS))
+    {
+        return 1;
+    }
+
+    if ((w = g_new0(struct xfuse_ra_wait, 1)) == NULL)
+    {
+        return 1;
+    }
+    w->req = req;
+    w->off = off;
+    w->size = size;
+    list_add_item(ra->waiting, (tintptr)w);
+
+    /* Stop block completions replying to FUSE until we're done */
+    ra->in_read = 1;
+
+    for (block = first; block < end; block += XFUSE_RA_BLOCK_SIZE)
+    {
+        if (xfuse_ra_find_block(ra, block, 0) == NULL &&
+                xfuse_ra_fetch(ra, block, -1) != 0)
+        {
+            /* No room for this request - the caller can read it */
+            list_remove_item(ra->waiting, ra->waiting->count - 1);
+            ra->in_read = 0;
+            xfuse_ra_service(ra);
+            return 1;
+        }
+    }
+
+    /* Start reads for the blocks after this request */
+    xinode = xfs_get(g_xfs, ra->inum);
+    block = end + (XFUSE_RA_BLOCK_SIZE - end % XFUSE_RA_BLOCK_SIZE) %
+            XFUSE_RA_BLOCK_SIZE;
+    for (i = 0; i < g_cfg->fuse_read_ahead_blocks;
+            ++i, block += XFUSE_RA_BLOCK_SIZE)
+    {
+        if (xinode == NULL || block >= xinode->size)
+        {
+            break;
+        }
+        if (xfuse_ra_find_block(ra, block, 0) == NULL &&
+                xfuse_ra_fetch(ra, block, first) != 0)
+        {
+            break;
+        }
+    }
+
+    ra->in_read = 0;
+    xfuse_ra_service(ra);
+    return 0;
+}
+
+/*****************************************************************************/
+/* Invalidates blocks read from an inode, before it's changed */
+static void
+xfuse_ra_invalidate_inode(fuse_ino_t inum)
+{
+    struct xfuse_read_ahead *ra;
+    struct xfuse_ra_block *blk;
+    unsigned int i;
+    int index;
+
+    if (g_ra_list == NULL)
+    {
+        return;
+    }
+
+    for (index = 0; index < g_ra_list->count; ++index)
+    {
+        ra = (struct xfuse_read_ahead *)list_get_item(g_ra_list, index);
+        if (ra->inum != inum)
+        {
+            continue;
+        }
+        for (i = 0; i < ra->block_count; ++i)
+        {
+            blk = &ra->blocks[i];
+            if (blk->state == XFUSE_RA_EMPTY)
+            {
+                continue;
+            }
+            /* Requests already waiting get the old data. New requests
+             * will read the block again */
+            if (blk->state == XFUSE_RA_PENDING ||
+                    xfuse_ra_block_needed(ra, blk))
+            {
+                blk->stale = 1;
+            }
+            else
+            {
+                xfuse_ra_block_clear(blk);
+            }
+        }
+        ra->seq_reads = 0;
+    }
+}
+
+/*****************************************************************************
+**                                                                          **
+**       write-back for files on redirected drives                          **
+**                                                                          **
+*****************************************************************************/
+
+/*
+ * Without write-back, each FUSE write becomes one IRP_MJ_WRITE, and the
+ * writer waits for a full client round trip before it can write again.
+ * With FuseWriteBack set, writes are copied into a buffer on the handle
+ * and acknowledged straight away. Adjacent writes are merged, and up to
+ * XFUSE_WB_MAX_IN_FLIGHT buffers are sent without waiting for each to
+ * complete. Writes in flight never overlap, so the client can complete
+ * them in any order.
+ *
+ * The buffer is sent when a write doesn't follow on from it, when it's
+ * full, when it's XFUSE_WB_FLUSH_MS old, when all the buffers together
+ * hold more than XFUSE_WB_MAX_BUFFERED bytes, and before a read, sync or
+ * release of the handle. Requests which can't be handled straight away
+ * are queued on the handle, and handled in order.
+ *
+ * A read or setattr must also follow writes made on other handles for
+ * the file. These requests wait on each handle with writes in turn,
+ * moving on from one to the next until none are left. A write waits
+ * for any writes made on other handles which it overlaps.
+ *
+ * A failed write is reported to the next write, read, flush or fsync on
+ * the handle. As the flush for close(2) waits for all the writes on the
+ * handle, close(2) reports any failure.
+ */
+
+static void xfuse_wb_process(struct xfuse_write_back *wb);
+static struct xfuse_wb_op *xfuse_wb_add_op(struct xfuse_write_back *wb,
+        enum xfuse_wb_op_type type,
+        fuse_req_t req, fuse_ino_t inum);
+
+/*****************************************************************************/
+/* Returns the errno to report for a failed write, and clears it */
+static int
+xfuse_wb_take_error(struct xfuse_write_back *wb)
+{
+    int error = wb->error;
+
+    wb->error = 0;
+    return error;
+}
+
+/*****************************************************************************/
+/* Returns true if a handle has writes the client hasn't completed */
+static int
+xfuse_wb_has_writes(const struct xfuse_write_back *wb)
+{
+    return wb->len > 0 || wb->in_flight_count > 0;
+}
+
+/*****************************************************************************/
+/**
+ * Finds a handle for an inode with writes the client hasn't completed
+ *
+ * @param inum inode
+ * @param after Handle to search on from, or NULL to search from the start
+ * @return handle, or NULL if there isn't one other than 'after'
+ *
+ * The search wraps round, so each handle is found in turn by repeated
+ * calls.
+ */
+static struct xfuse_write_back *
+xfuse_wb_find_writes(fuse_ino_t inum, struct xfuse_write_back *after)
+{
+    struct xfuse_write_back *wb;
+    int count;
+    int start = 0;
+    int i;
+
+    if (g_wb_list == NULL)
+    {
+        return NULL;
+    }
+    count = g_wb_list->count;
+    if (after != NULL)
+    {
+        start = list_index_of(g_wb_list, (tintptr)after) + 1;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        wb = (struct xfuse_write_back *)
+             list_get_item(g_wb_list, (start + i) % count);
+        if (wb != after && wb->inum == inum && xfuse_wb_has_writes(wb))
+        {
+            return wb;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/**
+ * Finds another handle for the inode with writes the client hasn't
+ * completed which overlap a range
+ *
+ * @return handle, or NULL if there isn't one
+ */
+static struct xfuse_write_back *
+xfuse_wb_find_overlap(struct xfuse_write_back *wb, off_t off, size_t size)
+{
+    struct xfuse_write_back *other;
+    const struct xfuse_wb_range *range;
+    int index;
+    unsigned int i;
+
+    for (index = 0; index < g_wb_list->count; ++index)
+    {
+        other = (struct xfuse_write_back *)list_get_item(g_wb_list, index);
+        if (other == wb || other->inum != wb->inum)
+        {
+            continue;
+        }
+        if (other->len > 0 && off < (off_t)(other->off + other->len) &&
+                other->off < (off_t)(off + size))
+        {
+            return other;
+        }
+        for (i = 0; i < XFUSE_WB_MAX_IN_FLIGHT; ++i)
+        {
+            range = &other->in_flight[i];
+            if (range->len > 0 && off < (off_t)(range->off + range->len) &&
+                    range->off < (off_t)(off + size))
+            {
+                return other;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/**
+ * Sends a write to the client
+ *
+ * @return 0 if the write has been taken, or 1 if it must wait for
+ *         writes already in flight
+ */
+static int
+xfuse_wb_send(struct xfuse_write_back *wb, const char *buf, size_t size,
+              off_t off)
+{
+    const struct xfuse_wb_range *range;
+    struct state_write *fusep;
+    unsigned int slot = XFUSE_WB_MAX_IN_FLIGHT;
+    unsigned int i;
+
+    for (i = 0; i < XFUSE_WB_MAX_IN_FLIGHT; ++i)
+    {
+        range = &wb->in_flight[i];
+        if (range->len == 0)
+        {
+            slot = MIN(slot, i);
+        }
+        else if (off < (off_t)(range->off + range->len) &&
+                 range->off < (off_t)(off + size))
+        {
+            /* The client could complete overlapping writes in any order */
+            return 1;
+        }
+    }
+    if (slot == XFUSE_WB_MAX_IN_FLIGHT)
+    {
+        return 1;
+    }
+
+    if ((fusep = g_new0(struct state_write, 1)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        if (wb->error == 0)
+        {
+            wb->error = ENOMEM;
+        }
+        return 0;
+    }
+    fusep->inum = wb->inum;
+    fusep->wb = wb;
+    fusep->slot = slot;
+    wb->in_flight[slot].off = off;
+    wb->in_flight[slot].len = size;
+    ++wb->in_flight_count;
+
+    /*
+     * Further processing happens in xfuse_wb_write_done(). This can
+     * be called before devredir_file_write() returns.
+     */
+    devredir_file_write(fusep, wb->DeviceId, wb->FileId, buf, size, off);
+    return 0;
+}
+
+/*****************************************************************************/
+/* Sends the buffer. Returns 0 if the buffer is now empty */
+static int
+xfuse_wb_flush_buffer(struct xfuse_write_back *wb)
+{
+    if (wb->len > 0)
+    {
+        if (xfuse_wb_send(wb, wb->data, wb->len, wb->off) != 0)
+        {
+            return 1;
+        }
+        g_wb_buffered -= wb->len;
+        wb->len = 0;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Sends the buffer of a handle, and handles anything that lets happen.
+ * wb may be freed by this call */
+static void
+xfuse_wb_flush(struct xfuse_write_back *wb)
+{
+    int busy = wb->busy;
+
+    wb->busy = 1;
+    xfuse_wb_flush_buffer(wb);
+    wb->busy = busy;
+    xfuse_wb_process(wb);
+}
+
+/*****************************************************************************/
+/**
+ * Sends the buffers of all the handles, or of all the handles for an inode
+ *
+ * @param inum inode, or 0 for all handles
+ */
+static void
+xfuse_wb_flush_all(fuse_ino_t inum)
+{
+    struct xfuse_write_back *wb;
+    int index;
+
+    if (g_wb_list == NULL)
+    {
+        return;
+    }
+
+    /* Backwards, as handles can be freed as we go */
+    for (index = g_wb_list->count - 1; index >= 0; --index)
+    {
+        wb = (struct xfuse_write_back *)list_get_item(g_wb_list, index);
+        if (wb != NULL && wb->len > 0 && (inum == 0 || wb->inum == inum))
+        {
+            xfuse_wb_flush(wb);
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+xfuse_wb_timer_cb(void *data)
+{
+    struct xfuse_write_back *wb;
+    unsigned int now = g_get_elapsed_ms();
+    int index;
+
+    g_wb_timer_set = 0;
+    if (g_wb_list == NULL)
+    {
+        return;
+    }
+
+    for (index = g_wb_list->count - 1; index >= 0; --index)
+    {
+        wb = (struct xfuse_write_back *)list_get_item(g_wb_list, index);
+        if (wb != NULL && wb->len > 0 &&
+                now - wb->buffered_at >= XFUSE_WB_FLUSH_MS)
+        {
+            xfuse_wb_flush(wb);
+        }
+    }
+
+    /* Anything left was buffered since the timer started, or is waiting
+     * for writes in flight */
+    for (index = 0; index < g_wb_list->count; ++index)
+    {
+        wb = (struct xfuse_write_back *)list_get_item(g_wb_list, index);
+        if (wb->len > 0)
+        {
+            g_wb_timer_set = 1;
+            add_timeout(XFUSE_WB_FLUSH_MS, xfuse_wb_timer_cb, NULL);
+            break;
+        }
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Adds a FUSE write to the buffer, and replies to it
+ *
+ * @return 0 if the write has been replied to, or 1 if it must wait
+ */
+static int
+xfuse_wb_buffer_write(struct xfuse_write_back *wb, fuse_req_t req,
+                      const char *buf, size_t size, off_t off)
+{
+    XFS_INODE *xinode;
+    struct xfuse_write_back *other;
+    int error;
+
+    if ((error = xfuse_wb_take_error(wb)) != 0)
+    {
+        fuse_reply_err(req, error);
+        return 0;
+    }
+
+    if ((other = xfuse_wb_find_overlap(wb, off, size)) != NULL)
+    {
+        /* The earlier write must get to the client first. We're called
+         * again by xfuse_wb_write_done() */
+        xfuse_wb_flush(other);
+        return 1;
+    }
+
+    if (wb->len > 0 &&
+            (off != (off_t)(wb->off + wb->len) ||
+             wb->len + size > XFUSE_WB_BUFFER_SIZE) &&
+            xfuse_wb_flush_buffer(wb) != 0)
+    {
+        return 1;
+    }
+
+    if (size > XFUSE_WB_BUFFER_SIZE)
+    {
+        /* Big enough on its own */
+        if (xfuse_wb_send(wb, buf, size, off) != 0)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        if (wb->data == NULL &&
+                (wb->data = (char *)malloc(XFUSE_WB_BUFFER_SIZE)) == NULL)
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+            fuse_reply_err(req, ENOMEM);
+            return 0;
+        }
+        if (wb->len == 0)
+        {
+            wb->off = off;
+            wb->buffered_at = g_get_elapsed_ms();
+            if (!g_wb_timer_set)
+            {
+                g_wb_timer_set = 1;
+                add_timeout(XFUSE_WB_FLUSH_MS, xfuse_wb_timer_cb, NULL);
+            }
+        }
+        g_memcpy(wb->data + wb->len, buf, size);
+        wb->len += size;
+        g_wb_buffered += size;
+    }
+
+    /* The client hasn't seen the write yet, so update the size here */
+    if ((xinode = xfs_get(g_xfs, wb->inum)) != NULL &&
+            (off_t)(off + size) > xinode->size)
+    {
+        xinode->size = off + size;
+    }
+    fuse_reply_write(req, size);
+
+    if (wb->len == XFUSE_WB_BUFFER_SIZE)
+    {
+        xfuse_wb_flush_buffer(wb);
+    }
+    if (g_wb_buffered > XFUSE_WB_MAX_BUFFERED)
+    {
+        xfuse_wb_flush_all(0);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Completes a queued read, sync, release or setattr once all writes
+ * are done */
+static void
+xfuse_wb_finish_op(struct xfuse_write_back *wb, struct xfuse_wb_op *op)
+{
+    int error = 0;
+
+    switch (op->type)
+    {
+        case XFUSE_WB_OP_READ:
+            /* Only report failed writes made on the reading handle */
+            if (op->fh->wb != NULL)
+            {
+                error = xfuse_wb_take_error(op->fh->wb);
+            }
+            if (error != 0)
+            {
+                fuse_reply_err(op->req, error);
+            }
+            else
+            {
+                xfuse_read_remote(op->fh, op->req, op->inum,
+                                  op->size, op->off);
+            }
+            break;
+
+        case XFUSE_WB_OP_SYNC:
+            fuse_reply_err(op->req, xfuse_wb_take_error(wb));
+            break;
+
+        case XFUSE_WB_OP_RELEASE:
+            if ((error = xfuse_wb_take_error(wb)) != 0)
+            {
+                LOG(LOG_LEVEL_WARNING, "A write to inode %ld failed after "
+                    "the file was last flushed", (long)wb->inum);
+            }
+            /*
+             * If this call succeeds, further request processing happens in
+             * xfuse_devredir_cb_file_close()
+             */
+            if (devredir_file_close(op->fip, wb->DeviceId, wb->FileId))
+            {
+                LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
+                fuse_reply_err(op->req, EREMOTEIO);
+                free(op->fip);
+            }
+            op->fip = NULL;
+            break;
+
+        case XFUSE_WB_OP_SETATTR:
+            /* Further processing happens in xfuse_devredir_cb_setattr() */
+            xfuse_setattr_remote(op->setattr);
+            op->setattr = NULL;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Moves a queued read or setattr to the next handle for the inode with
+ * writes the client hasn't completed
+ *
+ * @return 1 if the request has moved, or 0 if it can be completed
+ *
+ * Each move uses up one pass, so the request can't chase writes made
+ * after it around the handles for ever.
+ */
+static int
+xfuse_wb_pass_on(struct xfuse_write_back *wb, struct xfuse_wb_op *op)
+{
+    struct xfuse_write_back *next;
+    struct xfuse_wb_op *next_op;
+
+    if ((op->type != XFUSE_WB_OP_READ && op->type != XFUSE_WB_OP_SETATTR) ||
+            op->passes_left == 0 ||
+            (next = xfuse_wb_find_writes(wb->inum, wb)) == NULL ||
+            (next_op = xfuse_wb_add_op(next, op->type, op->req,
+                                       op->inum)) == NULL)
+    {
+        return 0;
+    }
+    next_op->fh = op->fh;
+    next_op->off = op->off;
+    next_op->size = op->size;
+    next_op->setattr = op->setattr;
+    next_op->passes_left = op->passes_left - 1;
+    op->setattr = NULL;
+    xfuse_wb_flush(next);
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+xfuse_wb_free(struct xfuse_write_back *wb)
+{
+    struct xfuse_wb_op *op;
+    int i;
+
+    for (i = 0; i < wb->ops->count; ++i)
+    {
+        op = (struct xfuse_wb_op *)list_get_item(wb->ops, i);
+        free(op->data);
+        free(op->fip);
+        free(op->setattr);
+    }
+    g_wb_buffered -= wb->len;
+    list_remove_item(g_wb_list, list_index_of(g_wb_list, (tintptr)wb));
+    list_delete(wb->ops);
+    free(wb->data);
+    free(wb);
+}
+
+/*****************************************************************************/
+/* Handles queued requests, in order, for as long as we can. A released
+ * handle is freed once all its writes are done */
+static void
+xfuse_wb_process(struct xfuse_write_back *wb)
+{
+    struct xfuse_wb_op *op;
+
+    if (wb->busy)
+    {
+        /* Whoever set busy will call us again */
+        return;
+    }
+
+    wb->busy = 1;
+    while (wb->ops->count > 0)
+    {
+        op = (struct xfuse_wb_op *)list_get_item(wb->ops, 0);
+        if (op->type == XFUSE_WB_OP_WRITE)
+        {
+            if (xfuse_wb_buffer_write(wb, op->req, op->data,
+                                      op->size, op->off) != 0)
+            {
+                break;
+            }
+        }
+        else if (xfuse_wb_flush_buffer(wb) != 0 || wb->in_flight_count > 0)
+        {
+            break;
+        }
+        else if (!xfuse_wb_pass_on(wb, op))
+        {
+            xfuse_wb_finish_op(wb, op);
+        }
+        free(op->data);
+        list_remove_item(wb->ops, 0);
+    }
+    wb->busy = 0;
+
+    if (wb->closed && wb->ops->count == 0 && wb->len == 0 &&
+            wb->in_flight_count == 0)
+    {
+        xfuse_wb_free(wb);
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Queues a request on a handle, behind earlier requests. The caller
+ * fills in the rest of the entry, and calls xfuse_wb_process()
+ *
+ * @return The new entry, or NULL if memory is short
+ */
+static struct xfuse_wb_op *
+xfuse_wb_add_op(struct xfuse_write_back *wb, enum xfuse_wb_op_type type,
+                fuse_req_t req, fuse_ino_t inum)
+{
+    struct xfuse_wb_op *op = g_new0(struct xfuse_wb_op, 1);
+
+    if (op != NULL)
+    {
+        op->type = type;
+        op->req = req;
+        op->inum = inum;
+        list_add_item(wb->ops, (tintptr)op);
+    }
+    return op;
+}
+
+/*****************************************************************************/
+static struct xfuse_write_back *
+xfuse_wb_create(fuse_ino_t inum, tui32 DeviceId, tui32 FileId)
+{
+    struct xfuse_write_back *wb = g_new0(struct xfuse_write_back, 1);
+
+    if (wb != NULL)
+    {
+        wb->inum = inum;
+        wb->DeviceId = DeviceId;
+        wb->FileId = FileId;
+        wb->ops = list_create();
+        if (wb->ops == NULL ||
+                (g_wb_list == NULL && (g_wb_list = list_create()) == NULL))
+        {
+            list_delete(wb->ops);
+            free(wb);
+            wb = NULL;
+        }
+        else
+        {
+            wb->ops->auto_free = 1;
+            list_add_item(g_wb_list, (tintptr)wb);
+        }
+    }
+    return wb;
+}
+
+/*****************************************************************************/
+/* Handles a FUSE write on a handle with write-back */
+static void
+xfuse_wb_write(struct xfuse_write_back *wb, fuse_req_t req,
+               const char *buf, size_t size, off_t off)
+{
+    struct xfuse_wb_op *op;
+    int rv = 1;
+
+    if (wb->ops->count == 0)
+    {
+        wb->busy = 1;
+        rv = xfuse_wb_buffer_write(wb, req, buf, size, off);
+        wb->busy = 0;
+    }
+
+    if (rv != 0)
+    {
+        /* Wait for earlier writes. FUSE owns buf, so we need a copy */
+        if ((op = xfuse_wb_add_op(wb, XFUSE_WB_OP_WRITE, req,
+                                  wb->inum)) == NULL ||
+                (op->data = (char *)malloc(size)) == NULL)
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+            if (op != NULL)
+            {
+                list_remove_item(wb->ops, wb->ops->count - 1);
+            }
+            fuse_reply_err(req, ENOMEM);
+        }
+        else
+        {
+            g_memcpy(op->data, buf, size);
+            op->off = off;
+            op->size = size;
+        }
+    }
+    xfuse_wb_process(wb);
 }
 
 /*****************************************************************************/
-static uint64_t
-xfuse_handle_to_fuse_handle(XFUSE_HANDLE *self)
+/* Called when devredir has written a buffer */
+static void
+xfuse_wb_write_done(struct state_write *fip, enum NTSTATUS IoStatus)
 {
-    return (uint64_t) (tintptr) self;
-}
+    struct xfuse_write_back *wb = fip->wb;
+    struct xfuse_write_back *other;
+    fuse_ino_t inum = wb->inum;
+    int index;
 
-/*****************************************************************************/
-static XFUSE_HANDLE *
-xfuse_handle_from_fuse_handle(uint64_t handle)
-{
-    return (XFUSE_HANDLE *) (tintptr) handle;
+    wb->in_flight[fip->slot].len = 0;
+    --wb->in_flight_count;
+    if (IoStatus != STATUS_SUCCESS)
+    {
+        LOG(LOG_LEVEL_WARNING, "Buffered write to inode %ld failed, "
+            "NTSTATUS is %08x", (long)wb->inum, (int)IoStatus);
+        if (wb->error == 0)
+        {
+            wb->error = EIO;
+        }
+    }
+    xfuse_wb_process(wb);
+
+    /* Other handles may have writes waiting for this one. Backwards, as
+     * handles can be freed as we go */
+    for (index = g_wb_list->count - 1; index >= 0; --index)
+    {
+        if (index >= g_wb_list->count)
+        {
+            continue;
+        }
+        other = (struct xfuse_write_back *)list_get_item(g_wb_list, index);
+        if (other->inum == inum && other->ops->count > 0)
+        {
+            xfuse_wb_process(other);
+        }
+    }
 }
 
 /*****************************************************************************
@@ -651,7 +2086,8 @@ xfuse_init(void)
     g_xfuse_ops.read        = xfuse_cb_read;
     g_xfuse_ops.write       = xfuse_cb_write;
     g_xfuse_ops.create      = xfuse_cb_create;
-    //g_xfuse_ops.fsync     = xfuse_cb_fsync; /* LK_TODO delete this */
+    g_xfuse_ops.flush       = xfuse_cb_flush;
+    g_xfuse_ops.fsync       = xfuse_cb_fsync;
     g_xfuse_ops.getattr     = xfuse_cb_getattr;
     g_xfuse_ops.setattr     = xfuse_cb_setattr;
     g_xfuse_ops.opendir     = xfuse_cb_opendir;
@@ -695,8 +2131,23 @@ xfuse_deinit(void)
     free(g_buffer.mem);
     g_buffer.mem = NULL;
 
+    if (g_req_list != NULL)
+    {
+        int i;
+        for (i = 0; i < g_req_list->count; ++i)
+        {
+            struct req_list_item *rli;
+            rli = (struct req_list_item *) list_get_item(g_req_list, i);
+            free(rli->fusep);
+        }
+    }
     list_delete(g_req_list);
     g_req_list = 0;
+    g_clip_in_flight = 0;
+    list_delete(g_ra_list);
+    g_ra_list = NULL;
+    list_delete(g_wb_list);
+    g_wb_list = NULL;
 
     xfuse_deinit_xrdp_fs();
 
@@ -827,6 +2278,8 @@ int xfuse_clear_clip_dir(void)
 /**
  * Return clipboard data to fuse
  *
+ * @param stream_id streamId of the request
+ * @param data_bytes Length of data, or -1 if the request failed
  * @return 0 on success, -1 on failure
  *****************************************************************************/
 
@@ -835,9 +2288,25 @@ xfuse_file_contents_range(int stream_id, const char *data, int data_bytes)
 {
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: stream_id=%d data_bytes=%d", stream_id, data_bytes);
 
-    struct req_list_item *rli;
+    struct req_list_item *rli = NULL;
+    struct state_read *fusep;
+    fuse_req_t req;
+    int size;
+    int i;
 
-    if ((rli = (struct req_list_item *) list_get_item(g_req_list, 0)) == NULL)
+    if (g_req_list != NULL && stream_id != 0)
+    {
+        for (i = 0; i < g_req_list->count; ++i)
+        {
+            rli = (struct req_list_item *) list_get_item(g_req_list, i);
+            if (rli->stream_id == stream_id)
+            {
+                break;
+            }
+            rli = NULL;
+        }
+    }
+    if (rli == NULL)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "range error!");
         return -1;
@@ -845,27 +2314,31 @@ xfuse_file_contents_range(int stream_id, const char *data, int data_bytes)
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "lindex=%d off=%d size=%d", rli->lindex, rli->off, rli->size);
 
-    fuse_reply_buf(rli->req, data, data_bytes);
+    req = rli->req;
+    fusep = rli->fusep;
+    size = rli->size;
+    list_remove_item(g_req_list, i);
+    --g_clip_in_flight;
 
-    list_remove_item(g_req_list, 0);
-    if (g_req_list->count <= 0)
+    if (fusep != NULL)
     {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "completed all requests");
-        return 0;
+        xfuse_ra_block_done(fusep,
+                            (data_bytes < 0) ?
+                            STATUS_UNSUCCESSFUL : STATUS_SUCCESS,
+                            data, MIN(MAX(data_bytes, 0), size));
+        free(fusep);
     }
-
-    /* send next request */
-    rli = (struct req_list_item *) list_get_item(g_req_list, 0);
-    if (rli == NULL)
+    else if (data_bytes < 0)
     {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "range error!");
-        return -1;
+        fuse_reply_err(req, EIO);
+    }
+    else
+    {
+        fuse_reply_buf(req, data, MIN(data_bytes, size));
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data");
-
-    clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                rli->off, rli->size);
+    /* send next requests */
+    xfuse_clip_send_requests();
 
     return 0;
 }
@@ -1048,6 +2521,7 @@ static int xfuse_init_xrdp_fs(void)
         else
         {
             g_clipboard_inum = xino->inum;
+            xfs_set_cache_timeout(g_xfs, g_cfg->fuse_cache_timeout * 1000);
             result = 0;
         }
     }
@@ -1104,11 +2578,30 @@ void xfuse_devredir_cb_enum_dir_add_entry(
         LOG_DEVEL(LOG_LEVEL_DEBUG, "parent_inode=%ld name=%s", fip->pinum, name);
 
         /* Does the file already exist ? If it does it's important we
-         * don't mess with it, as we're only enumerating the directory, and
-         * we don't want to disrupt any existing operations on the file
+         * don't mess with it if it's open, as we're only enumerating the
+         * directory, and we don't want to disrupt any existing operations
+         * on the file
          */
         xinode = xfs_lookup_in_dir(g_xfs, fip->pinum, name);
-        if (xinode == NULL)
+        if (xinode != NULL &&
+                (xinode->mode & (S_IFREG | S_IFDIR)) !=
+                (fattr->mode & (S_IFREG | S_IFDIR)))
+        {
+            /* Type has changed from file to directory, or vice-versa */
+            xfs_remove_entry(g_xfs, xinode->inum);
+            xinode = NULL;
+        }
+
+        if (xinode != NULL)
+        {
+            /* Refresh the attributes, so a lookup can use them */
+            if (xfs_get_file_open_count(g_xfs, xinode->inum) == 0)
+            {
+                update_inode_file_attributes(fattr, TO_SET_ALL, xinode);
+            }
+            xfs_cache_update(g_xfs, xinode->inum, XFS_CACHE_ATTR);
+        }
+        else
         {
             /* Add a new node to the file system */
             LOG_DEVEL(LOG_LEVEL_DEBUG, "Creating name=%s in parent=%ld in xrdp_fs",
@@ -1128,6 +2621,7 @@ void xfuse_devredir_cb_enum_dir_add_entry(
                 xinode->ctime = fattr->mtime;
 
                 /* device_id is inherited from parent */
+                xfs_cache_update(g_xfs, xinode->inum, XFS_CACHE_ATTR);
             }
         }
     }
@@ -1166,30 +2660,8 @@ void xfuse_devredir_cb_enum_dir_done(struct state_dirscan *fip,
     }
     else
     {
-        struct fuse_file_info *fi = &fip->fi;
-        XFUSE_HANDLE *xhandle = xfuse_handle_create();
-
-        if (xhandle == NULL)
-        {
-            fuse_reply_err(fip->req, ENOMEM);
-        }
-        else
-        {
-            // Coverity gets confused by xfuse_handle_to_fuse_handle(), and
-            // sees the dir_handle leaked
-            //coverity[RESOURCE_LEAK:FALSE]
-            xhandle->dir_handle = xfs_opendir(g_xfs, fip->pinum);
-            if (xhandle->dir_handle == NULL)
-            {
-                xfuse_handle_delete(xhandle);
-                fuse_reply_err(fip->req, ENOMEM);
-            }
-            else
-            {
-                fi->fh = xfuse_handle_to_fuse_handle(xhandle);
-                fuse_reply_open(fip->req, &fip->fi);
-            }
-        }
+        xfs_cache_update(g_xfs, fip->pinum, XFS_CACHE_DIR_LIST);
+        xfuse_reply_opendir(fip->req, fip->pinum, &fip->fi);
     }
 
     free(fip);
@@ -1311,6 +2783,7 @@ void xfuse_devredir_cb_lookup_entry(struct state_lookup *fip,
         }
         if (xinode != NULL)
         {
+            xfs_cache_update(g_xfs, xinode->inum, XFS_CACHE_ATTR);
             make_fuse_entry_reply(fip->req, xinode);
         }
         else
@@ -1361,6 +2834,7 @@ void xfuse_devredir_cb_setattr(struct state_setattr *fip,
     else
     {
         update_inode_file_attributes(&fip->fattr, fip->change_mask, xinode);
+        xfs_cache_update(g_xfs, xinode->inum, XFS_CACHE_ATTR);
         make_fuse_attr_reply(fip->req, xinode);
     }
     free(fip);
@@ -1448,6 +2922,9 @@ void xfuse_devredir_cb_create_file(struct state_create *fip,
             }
             else
             {
+                /* We know all about a new entry */
+                xfs_cache_update(g_xfs, xinode->inum, XFS_CACHE_ATTR);
+                xfs_cache_update(g_xfs, xinode->inum, XFS_CACHE_DIR_LIST);
 
                 if ((fip->mode & S_IFDIR) != 0)
                 {
@@ -1529,7 +3006,11 @@ void xfuse_devredir_cb_read_file(struct state_read *fip,
                                  enum NTSTATUS IoStatus,
                                  const char *buf, size_t length)
 {
-    if (IoStatus != STATUS_SUCCESS)
+    if (fip->ra != NULL)
+    {
+        xfuse_ra_block_done(fip, IoStatus, buf, length);
+    }
+    else if (IoStatus != STATUS_SUCCESS)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "Read NTSTATUS is %d", (int) IoStatus);
         fuse_reply_err(fip->req, EIO);
@@ -1549,7 +3030,11 @@ void xfuse_devredir_cb_write_file(
 {
     XFS_INODE   *xinode;
 
-    if (IoStatus != STATUS_SUCCESS)
+    if (fip->wb != NULL)
+    {
+        xfuse_wb_write_done(fip, IoStatus);
+    }
+    else if (IoStatus != STATUS_SUCCESS)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "Write NTSTATUS is %d", (int) IoStatus);
         fuse_reply_err(fip->req, EIO);
@@ -1765,12 +3250,15 @@ static void xfuse_cb_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
                 fuse_reply_err(req, ENOENT);
             }
         }
+        else if ((xinode = xfs_lookup_in_dir(g_xfs, parent, name)) != NULL &&
+                 xfs_cache_remaining(g_xfs, xinode->inum, XFS_CACHE_ATTR) > 0)
+        {
+            /* We've recently read this entry from the client */
+            make_fuse_entry_reply(req, xinode);
+        }
         else
         {
-            /* specified file resides on redirected share
-             *
-             * We always look these up, and relying on libfuse to do sane
-             * caching */
+            /* specified file resides on redirected share */
             struct state_lookup *fip = g_new0(struct state_lookup, 1);
             char *full_path = get_name_for_entry_in_parent(parent, name);
 
@@ -2345,6 +3833,7 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
                              fuse_file_info *fi)
 {
     XFS_INODE   *xinode;
+    struct xfuse_wb_op *op;
 
     XFUSE_HANDLE *handle = xfuse_handle_from_fuse_handle(fi->fh);
 
@@ -2359,6 +3848,12 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
     else if (!xinode->is_redirected)
     {
         /* specified file is a local resource */
+        fi->fh = xfuse_handle_to_fuse_handle(NULL);
+        if (handle != NULL)
+        {
+            xfuse_ra_delete(handle->ra);
+            xfuse_handle_delete(handle);
+        }
         fuse_reply_err(req, 0);
     }
     else
@@ -2379,17 +3874,27 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
 
         fi->fh = xfuse_handle_to_fuse_handle(NULL);
 
+        if (handle->wb != NULL &&
+                (op = xfuse_wb_add_op(handle->wb, XFUSE_WB_OP_RELEASE,
+                                      req, ino)) != NULL)
+        {
+            /* The file is closed when all the writes are done */
+            op->fip = fip;
+            handle->wb->closed = 1;
+            xfuse_wb_process(handle->wb);
+        }
         /*
          * If this call succeeds, further request processing happens in
          * xfuse_devredir_cb_file_close()
          */
-        if (devredir_file_close(fip, xinode->device_id, handle->FileId))
+        else if (devredir_file_close(fip, xinode->device_id, handle->FileId))
         {
             LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
             fuse_reply_err(req, EREMOTEIO);
             free(fip);
         }
 
+        xfuse_ra_delete(handle->ra);
         xfuse_handle_delete(handle);
     }
 }
@@ -2404,9 +3909,9 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
                           off_t off, struct fuse_file_info *fi)
 {
     XFUSE_HANDLE          *fh;
-    struct state_read *fusep;
     XFS_INODE            *xinode;
-    struct req_list_item  *rli;
+    struct xfuse_wb_op    *op;
+    struct xfuse_write_back *wb;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "want_bytes %zd bytes at off %lld", size, (long long) off);
 
@@ -2427,45 +3932,87 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
             return;
         }
 
-        rli = g_new0(struct req_list_item, 1);
-
-        rli->stream_id = 0;
-        rli->req = req;
-        rli->lindex = xinode->lindex;
-        rli->off = off;
-        rli->size = size;
-        list_add_item(g_req_list, (tbus) rli);
-
-        if (g_req_list->count == 1)
+        if (fh->ra == NULL && g_cfg->fuse_read_ahead_blocks > 0 &&
+                (fh->ra = xfuse_ra_create(ino, 0, 0)) != NULL)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data lindex = %d off = %lld size = %zd",
-                      rli->lindex, (long long) off, size);
-
-            clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                        (int) off, (int) size);
+            fh->ra->lindex = xinode->lindex;
+        }
+        if (fh->ra != NULL && xfuse_ra_read(fh->ra, req, size, off) == 0)
+        {
+            /* Request is answered by xfuse_ra_service() */
+        }
+        else if (xfuse_clip_request(req, NULL, xinode->lindex, off, size) != 0)
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+            fuse_reply_err(req, ENOMEM);
         }
     }
-    else
+    else if ((fh->wb != NULL &&
+              (xfuse_wb_has_writes(fh->wb) || fh->wb->ops->count > 0) &&
+              (wb = fh->wb) != NULL) ||
+             (wb = xfuse_wb_find_writes(ino, NULL)) != NULL)
     {
-        /* target file is on a remote device */
-
-        fusep = g_new0(struct state_read, 1);
-        if (fusep == NULL)
+        /* Read after the writes to the file are done */
+        if ((op = xfuse_wb_add_op(wb, XFUSE_WB_OP_READ, req, ino)) == NULL)
         {
             LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
             fuse_reply_err(req, ENOMEM);
         }
         else
         {
-            fusep->req = req;
-
-            /*
-             * If this call succeeds, further request processing happens in
-             * xfuse_devredir_cb_read_file()
-             */
-            devredir_file_read(fusep, fh->DeviceId, fh->FileId, size, off);
+            op->fh = fh;
+            op->off = off;
+            op->size = size;
+            op->passes_left = g_wb_list->count;
+            xfuse_wb_flush(wb);
         }
     }
+    else if (fh->wb != NULL && fh->wb->error != 0)
+    {
+        fuse_reply_err(req, xfuse_wb_take_error(fh->wb));
+    }
+    else
+    {
+        /* target file is on a remote device */
+        xfuse_read_remote(fh, req, ino, size, off);
+    }
+}
+
+/**
+ * Reads from a file on a redirected drive
+ *****************************************************************************/
+
+static void xfuse_read_remote(struct xfuse_handle *fh, fuse_req_t req,
+                              fuse_ino_t ino, size_t size, off_t off)
+{
+    struct state_read *fusep;
+
+    if (fh->ra == NULL && g_cfg->fuse_read_ahead_blocks > 0)
+    {
+        fh->ra = xfuse_ra_create(ino, fh->DeviceId, fh->FileId);
+    }
+    if (fh->ra != NULL && xfuse_ra_read(fh->ra, req, size, off) == 0)
+    {
+        /* Request is answered by xfuse_ra_service() */
+        return;
+    }
+
+    fusep = g_new0(struct state_read, 1);
+    if (fusep == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fuse_reply_err(req, ENOMEM);
+    }
+    else
+    {
+        fusep->req = req;
+
+        /*
+         * If this call succeeds, further request processing happens in
+         * xfuse_devredir_cb_read_file()
+         */
+        devredir_file_read(fusep, fh->DeviceId, fh->FileId, size, off);
+    }
 }
 
 /**
@@ -2498,6 +4045,20 @@ static void xfuse_cb_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
     {
         /* target file is on a remote device */
 
+        xfuse_ra_invalidate_inode(ino);
+        /* The client will change the modification time */
+        xfs_cache_invalidate(g_xfs, ino, XFS_CACHE_ATTR);
+
+        if (fh->wb == NULL && g_cfg->fuse_write_back)
+        {
+            fh->wb = xfuse_wb_create(ino, fh->DeviceId, fh->FileId);
+        }
+        if (fh->wb != NULL)
+        {
+            xfuse_wb_write(fh->wb, req, buf, size, off);
+            return;
+        }
+
         fusep = g_new0(struct state_write, 1);
         if (fusep == NULL)
         {
@@ -2540,15 +4101,55 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
 /**
  *****************************************************************************/
 
-#if 0
+/**
+ * Waits for buffered writes on a handle, and reports any failure
+ *
+ * Used for flush (called for each close(2)) and fsync. Without
+ * write-back, writes are complete when they are replied to, so there
+ * is nothing to do.
+ *****************************************************************************/
+
+static void xfuse_sync_handle(fuse_req_t req, fuse_ino_t ino,
+                              struct fuse_file_info *fi)
+{
+    XFUSE_HANDLE *fh = xfuse_handle_from_fuse_handle(fi->fh);
+    struct xfuse_wb_op *op;
+
+    if (fh == NULL || fh->wb == NULL)
+    {
+        fuse_reply_err(req, 0);
+    }
+    else if ((op = xfuse_wb_add_op(fh->wb, XFUSE_WB_OP_SYNC,
+                                   req, ino)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fuse_reply_err(req, ENOMEM);
+    }
+    else
+    {
+        xfuse_wb_process(fh->wb);
+    }
+}
+
+/**
+ *****************************************************************************/
+
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi)
+{
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: ino=%ld", ino);
+    xfuse_sync_handle(req, ino, fi);
+}
+
+/**
+ *****************************************************************************/
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi)
 {
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "#################### entered: ino=%ld datasync=%d", ino, datasync);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "function not required");
-    fuse_reply_err(req, EINVAL);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: ino=%ld datasync=%d", ino, datasync);
+    xfuse_sync_handle(req, ino, fi);
 }
-#endif
 
 /**
  * Sets attributes for a directory entry.
@@ -2603,6 +4204,7 @@ static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         {
             attrs.size = attr->st_size;
             change_mask |= TO_SET_SIZE;
+            xfuse_ra_invalidate_inode(ino);
         }
 
         if ((to_set & FUSE_SET_ATTR_ATIME) && xinode->atime != attr->st_atime)
@@ -2631,40 +4233,108 @@ static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         else
         {
             struct state_setattr *fip = g_new0(struct state_setattr, 1);
-            char *full_path = xfs_get_full_path(g_xfs, ino);
-            if (!full_path || !fip)
+            struct xfuse_write_back *wb;
+            struct xfuse_wb_op *op;
+
+            if (!fip)
             {
                 LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
                 fuse_reply_err(req, ENOMEM);
-                free(fip);
-                free(full_path);
+                return;
+            }
+
+            fip->req = req;
+            fip->inum = ino;
+            /* Save the important stuff so we can update our node if the
+             * remote update is successful */
+            fip->fattr = attrs;
+            fip->change_mask = change_mask;
+
+            if ((wb = xfuse_wb_find_writes(ino, NULL)) != NULL &&
+                    (op = xfuse_wb_add_op(wb, XFUSE_WB_OP_SETATTR,
+                                          req, ino)) != NULL)
+            {
+                /* Buffered writes must not reach the client after (say)
+                 * a truncate. The request is sent once they are done */
+                op->setattr = fip;
+                op->passes_left = g_wb_list->count;
+                xfuse_wb_flush(wb);
             }
             else
             {
-                const char *cptr;
-                fip->req = req;
-                fip->inum = ino;
-                /* Save the important stuff so we can update our node if the
-                 * remote update is successful */
-                fip->fattr = attrs;
-                fip->change_mask = change_mask;
+                xfuse_setattr_remote(fip);
+            }
+        }
+    }
+}
 
-                /* we want path minus 'root node of the share' */
-                cptr = filename_on_device(full_path);
+/**
+ * Asks devredir to set attributes for a file on a remote share
+ *
+ * This results in a call to xfuse_devredir_cb_setattr(), which replies
+ * to FUSE and frees fip
+ *****************************************************************************/
 
-                /*
-                 * If this call succeeds, further request processing happens
-                 * in xfuse_devredir_cb_setattr()
-                 */
-                if (devredir_setattr_for_entry(fip, xinode->device_id,
-                                               cptr, &attrs, change_mask) < 0)
-                {
-                    fuse_reply_err(req, EIO);
-                    free(fip);
-                }
+static void xfuse_setattr_remote(struct state_setattr *fip)
+{
+    XFS_INODE *xinode;
+    char *full_path;
 
-                free(full_path);
-            }
+    if ((xinode = xfs_get(g_xfs, fip->inum)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is not valid", fip->inum);
+        fuse_reply_err(fip->req, ENOENT);
+        free(fip);
+    }
+    else if ((full_path = xfs_get_full_path(g_xfs, fip->inum)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fuse_reply_err(fip->req, ENOMEM);
+        free(fip);
+    }
+    else
+    {
+        /* we want path minus 'root node of the share' */
+        const char *cptr = filename_on_device(full_path);
+
+        if (devredir_setattr_for_entry(fip, xinode->device_id, cptr,
+                                       &fip->fattr, fip->change_mask) < 0)
+        {
+            fuse_reply_err(fip->req, EIO);
+            free(fip);
+        }
+
+        free(full_path);
+    }
+}
+
+/**
+ * Replies to an opendir from the directory we have in the xrdp_fs
+ *****************************************************************************/
+static void xfuse_reply_opendir(fuse_req_t req, fuse_ino_t ino,
+                                struct fuse_file_info *fi)
+{
+    XFUSE_HANDLE *xhandle = xfuse_handle_create();
+
+    if (xhandle == NULL)
+    {
+        fuse_reply_err(req, ENOMEM);
+    }
+    else
+    {
+        // Coverity gets confused by xfuse_handle_to_fuse_handle(), and
+        // sees the dir_handle leaked
+        //coverity[RESOURCE_LEAK:FALSE]
+        xhandle->dir_handle = xfs_opendir(g_xfs, ino);
+        if (xhandle->dir_handle == NULL)
+        {
+            xfuse_handle_delete(xhandle);
+            fuse_reply_err(req, ENOMEM);
+        }
+        else
+        {
+            fi->fh = xfuse_handle_to_fuse_handle(xhandle);
+            fuse_reply_open(req, fi);
         }
     }
 }
@@ -2680,7 +4350,6 @@ static void xfuse_cb_opendir(fuse_req_t req, fuse_ino_t ino,
                              struct fuse_file_info *fi)
 {
     XFS_INODE      *xinode;
-    XFUSE_HANDLE   *xhandle;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "inode=%ld", ino);
 
@@ -2689,29 +4358,11 @@ static void xfuse_cb_opendir(fuse_req_t req, fuse_ino_t ino,
         LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is not valid", ino);
         fuse_reply_err(req, ENOENT);
     }
-    else if (!xinode->is_redirected)
+    else if (!xinode->is_redirected ||
+             xfs_cache_remaining(g_xfs, ino, XFS_CACHE_DIR_LIST) > 0)
     {
-        if ((xhandle = xfuse_handle_create()) == NULL)
-        {
-            fuse_reply_err(req, ENOMEM);
-        }
-        else
-        {
-            // Coverity gets confused by xfuse_handle_to_fuse_handle(), and
-            // sees the dir_handle leaked
-            //coverity[RESOURCE_LEAK:FALSE]
-            xhandle->dir_handle = xfs_opendir(g_xfs, ino);
-            if (xhandle->dir_handle == NULL)
-            {
-                xfuse_handle_delete(xhandle);
-                fuse_reply_err(req, ENOMEM);
-            }
-            else
-            {
-                fi->fh = xfuse_handle_to_fuse_handle(xhandle);
-                fuse_reply_open(req, fi);
-            }
-        }
+        /* We know what's in the directory */
+        xfuse_reply_opendir(req, ino, fi);
     }
     else
     {
@@ -2829,13 +4480,29 @@ static void xfuse_cb_statfs(fuse_req_t req, fuse_ino_t ino)
  *                           miscellaneous functions
  *****************************************************************************/
 
+/*
+ * Gets how long the kernel can cache an entry for
+ *
+ * Redirected entries are cached for as long as our copy is trusted, so
+ * the kernel comes back to us when we'd go to the client.
+ */
+static double xfuse_cache_timeout(const XFS_INODE *xinode, double timeout)
+{
+    if (xinode->is_redirected && g_cfg->fuse_cache_timeout > 0)
+    {
+        timeout = xfs_cache_remaining(g_xfs, xinode->inum,
+                                      XFS_CACHE_ATTR) / 1000.0;
+    }
+    return timeout;
+}
+
 static void xfs_inode_to_fuse_entry_param(const XFS_INODE *xinode,
         struct fuse_entry_param *e)
 {
     memset(e, 0, sizeof(*e));
     e->ino = xinode->inum;
-    e->attr_timeout = XFUSE_ATTR_TIMEOUT;
-    e->entry_timeout = XFUSE_ENTRY_TIMEOUT;
+    e->attr_timeout = xfuse_cache_timeout(xinode, XFUSE_ATTR_TIMEOUT);
+    e->entry_timeout = xfuse_cache_timeout(xinode, XFUSE_ENTRY_TIMEOUT);
     e->attr.st_ino = xinode->inum;
     e->attr.st_mode = xinode->mode & ~g_cfg->file_umask;
     e->attr.st_nlink = 1;
@@ -2870,7 +4537,7 @@ static void make_fuse_attr_reply(fuse_req_t req, const XFS_INODE *xinode)
     st.st_mtime = xinode->mtime;
     st.st_ctime = xinode->ctime;
 
-    fuse_reply_attr(req, &st, XFUSE_ATTR_TIMEOUT);
+    fuse_reply_attr(req, &st, xfuse_cache_timeout(xinode, XFUSE_ATTR_TIMEOUT));
 }
 
 /*
@@ -44,6 +44,9 @@
 /* inum of the delete pending directory */
 #define DELETE_PENDING_ID 2
 
+/* Directories with this many entries get a hashed index of names */
+#define DIR_INDEX_THRESHOLD 64
+
 /*
  * A double-linked list of inodes, sorted by inum
  *
@@ -75,10 +78,28 @@ typedef struct xfs_inode_all
     struct xfs_inode_all *next;        /* Next entry in parent             */
     struct xfs_inode_all *previous;    /* Previous entry in parent         */
     XFS_LIST             dir;          /* Directory only - children        */
+    /*
+     * Name index for large directories. Entries in a bucket are chained
+     * through index_next. index_size is a power of 2, or 0 if the
+     * directory isn't indexed
+     */
+    struct xfs_inode_all **index;      /* Directory only - index buckets   */
+    unsigned int         index_size;   /* Directory only                   */
+    unsigned int         entry_count;  /* Directory only - children        */
+    struct xfs_inode_all *index_next;  /* Next entry in parent's bucket    */
+    unsigned int         name_hash;    /* Hash of pub.name                 */
     /*
      * Other private elements
      */
     unsigned int         open_count;   /* Regular files only               */
+    /*
+     * Cache state for redirected entries. Times are from
+     * g_get_elapsed_ms()
+     */
+    unsigned int         attr_time;    /* When attributes were read        */
+    unsigned int         list_time;    /* Directory only - when listed     */
+    char                 attr_valid;   /* attr_time is set                 */
+    char                 list_valid;   /* list_time is set                 */
 } XFS_INODE_ALL;
 
 
@@ -101,6 +122,7 @@ struct xfs_fs
     unsigned int inode_count;        /* Current number of inodes             */
     unsigned int free_count;         /* Size of free_list                    */
     unsigned int generation;         /* Changes when an inode is deleted     */
+    unsigned int cache_timeout;      /* ms to trust client info. 0 for none  */
 };
 
 /* A directory handle
@@ -238,19 +260,131 @@ remove_inode_from_list(XFS_LIST *list, XFS_INODE_ALL *xino)
 
 }
 
+/*  ------------------------------------------------------------------------ */
+/* FNV-1a */
+static unsigned int
+name_hash(const char *name)
+{
+    unsigned int hash = 2166136261U;
+
+    while (*name != '\0')
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+add_inode_to_index(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
+{
+    XFS_INODE_ALL **bucket;
+
+    bucket = &dinode->index[xino->name_hash & (dinode->index_size - 1)];
+    xino->index_next = *bucket;
+    *bucket = xino;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+remove_inode_from_index(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
+{
+    XFS_INODE_ALL **p;
+
+    p = &dinode->index[xino->name_hash & (dinode->index_size - 1)];
+    while (*p != NULL && *p != xino)
+    {
+        p = &(*p)->index_next;
+    }
+    if (*p != NULL)
+    {
+        *p = xino->index_next;
+    }
+    xino->index_next = NULL;
+}
+
+/*  ------------------------------------------------------------------------ */
+/*
+ * (Re)builds the name index of a directory so there's a bucket for
+ * every entry. If memory is short, the directory keeps its current
+ * index, or is searched linearly
+ *
+ * @return 0 if the index was rebuilt
+ */
+static int
+rebuild_dir_index(XFS_INODE_ALL *dinode)
+{
+    XFS_INODE_ALL **new_index;
+    XFS_INODE_ALL *p;
+    unsigned int new_size = DIR_INDEX_THRESHOLD * 2;
+
+    while (new_size < dinode->entry_count * 2)
+    {
+        new_size *= 2;
+    }
+    if ((new_index = g_new0(XFS_INODE_ALL *, new_size)) == NULL)
+    {
+        return 1;
+    }
+
+    free(dinode->index);
+    dinode->index = new_index;
+    dinode->index_size = new_size;
+    for (p = dinode->dir.begin ; p != NULL; p = p->next)
+    {
+        add_inode_to_index(dinode, p);
+    }
+    return 0;
+}
+
 /*  ------------------------------------------------------------------------ */
 static void
 link_inode_into_directory_node(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
 {
     xino->parent = dinode;
+    xino->name_hash = name_hash(xino->pub.name);
     add_inode_to_list(&dinode->dir, xino);
+    ++dinode->entry_count;
+
+    if (dinode->entry_count > dinode->index_size)
+    {
+        /* Not indexed yet, or the buckets are getting full */
+        if (dinode->entry_count >= DIR_INDEX_THRESHOLD &&
+                rebuild_dir_index(dinode) != 0 && dinode->index != NULL)
+        {
+            /* Keep using the old index */
+            add_inode_to_index(dinode, xino);
+        }
+    }
+    else
+    {
+        add_inode_to_index(dinode, xino);
+    }
 }
 
 /*  ------------------------------------------------------------------------ */
 static void
 unlink_inode_from_parent(XFS_INODE_ALL *xino)
 {
-    remove_inode_from_list(&xino->parent->dir, xino);
+    XFS_INODE_ALL *dinode = xino->parent;
+
+    remove_inode_from_list(&dinode->dir, xino);
+    --dinode->entry_count;
+    if (dinode->index != NULL)
+    {
+        if (dinode->entry_count == 0)
+        {
+            /* Don't keep a big index for an emptied directory */
+            free(dinode->index);
+            dinode->index = NULL;
+            dinode->index_size = 0;
+        }
+        else
+        {
+            remove_inode_from_index(dinode, xino);
+        }
+    }
 
     xino->next = NULL;
     xino->previous = NULL;
@@ -362,6 +496,7 @@ xfs_free_inode(XFS_INODE_ALL *xino)
     if (xino != NULL)
     {
         free(xino->pub.name);
+        free(xino->index);
         free(xino);
     }
 }
@@ -592,12 +727,28 @@ xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
             (xino->pub.mode & S_IFDIR) != 0)
     {
         XFS_INODE_ALL *p;
-        for (p = xino->dir.begin ; p != NULL; p = p->next)
+        if (xino->index != NULL)
+        {
+            unsigned int hash = name_hash(name);
+            for (p = xino->index[hash & (xino->index_size - 1)] ; p != NULL;
+                    p = p->index_next)
+            {
+                if (p->name_hash == hash && strcmp(p->pub.name, name) == 0)
+                {
+                    result = &p->pub;
+                    break;
+                }
+            }
+        }
+        else
         {
-            if (strcmp(p->pub.name, name) == 0)
+            for (p = xino->dir.begin ; p != NULL; p = p->next)
             {
-                result = &p->pub;
-                break;
+                if (strcmp(p->pub.name, name) == 0)
+                {
+                    result = &p->pub;
+                    break;
+                }
             }
         }
     }
@@ -803,6 +954,82 @@ xfs_get_file_open_count(struct xfs_fs *xfs, fuse_ino_t inum)
     return result;
 }
 
+/*  ------------------------------------------------------------------------ */
+void
+xfs_set_cache_timeout(struct xfs_fs *xfs, unsigned int timeout_ms)
+{
+    xfs->cache_timeout = timeout_ms;
+}
+
+/*  ------------------------------------------------------------------------ */
+void
+xfs_cache_update(struct xfs_fs *xfs, fuse_ino_t inum,
+                 enum xfs_cache_type type)
+{
+    XFS_INODE_ALL *xino;
+    if (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL))
+    {
+        if (type == XFS_CACHE_ATTR)
+        {
+            xino->attr_time = g_get_elapsed_ms();
+            xino->attr_valid = 1;
+        }
+        else if ((xino->pub.mode & S_IFDIR) != 0)
+        {
+            xino->list_time = g_get_elapsed_ms();
+            xino->list_valid = 1;
+        }
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+void
+xfs_cache_invalidate(struct xfs_fs *xfs, fuse_ino_t inum,
+                     enum xfs_cache_type type)
+{
+    XFS_INODE_ALL *xino;
+    if (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL))
+    {
+        if (type == XFS_CACHE_ATTR)
+        {
+            xino->attr_valid = 0;
+        }
+        else
+        {
+            xino->list_valid = 0;
+        }
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+unsigned int
+xfs_cache_remaining(struct xfs_fs *xfs, fuse_ino_t inum,
+                    enum xfs_cache_type type)
+{
+    unsigned int result = 0;
+    unsigned int age;
+    XFS_INODE_ALL *xino;
+    if (xfs->cache_timeout > 0 &&
+            inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL))
+    {
+        if (type == XFS_CACHE_ATTR ? xino->attr_valid : xino->list_valid)
+        {
+            /* Unsigned arithmetic copes with the clock wrapping */
+            age = g_get_elapsed_ms() -
+                  (type == XFS_CACHE_ATTR ? xino->attr_time : xino->list_time);
+            if (age < xfs->cache_timeout)
+            {
+                result = xfs->cache_timeout - age;
+            }
+        }
+    }
+
+    return result;
+}
+
 /*  ------------------------------------------------------------------------ */
 void
 xfs_delete_redirected_entries_with_device_id(struct xfs_fs *xfs,
@@ -890,13 +1117,14 @@ xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
             }
 
             unlink_inode_from_parent(xino);
-            link_inode_into_directory_node(parent, xino);
 
             /* Swap the copy name and the inode name so we end up with the
              * right name, and the old one gets freed */
             char *t = xino->pub.name;
             xino->pub.name = cpyname;
             cpyname = t;
+
+            link_inode_into_directory_node(parent, xino);
         }
         else if (strcmp(xino->pub.name, name) != 0)
         {
@@ -907,11 +1135,22 @@ xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
                 xfs_remove_entry(xfs, dest->inum);
             }
 
+            if (parent->index != NULL)
+            {
+                remove_inode_from_index(parent, xino);
+            }
+
             /* Swap the copy name and the inode name so we end up with the
              * right name, and the old one gets freed */
             char *t = xino->pub.name;
             xino->pub.name = cpyname;
             cpyname = t;
+
+            xino->name_hash = name_hash(xino->pub.name);
+            if (parent->index != NULL)
+            {
+                add_inode_to_index(parent, xino);
+            }
         }
         result = 0;
     }
@@ -161,6 +161,9 @@ xfs_get_full_path(struct xfs_fs *xfs, fuse_ino_t inum);
 /*
  * Lookup a file in a directory
  *
+ * Large directories are indexed by name, so this is cheap even for
+ * directories with many entries.
+ *
  * @param xfs  filesystem instance
  * @param inum Inumber of the directory
  * @param name Name of the file to lookup
@@ -276,6 +279,64 @@ xfs_decrement_file_open_count(struct xfs_fs *xfs, fuse_ino_t inum);
 unsigned int
 xfs_get_file_open_count(struct xfs_fs *xfs, fuse_ino_t inum);
 
+/*
+ * Cached information about redirected entries
+ *
+ * XFS_CACHE_ATTR      The attributes of an entry
+ * XFS_CACHE_DIR_LIST  The entries in a directory
+ */
+enum xfs_cache_type
+{
+    XFS_CACHE_ATTR,
+    XFS_CACHE_DIR_LIST
+};
+
+/*
+ * Sets how long information read from a client is trusted for
+ *
+ * @param xfs  filesystem instance
+ * @param timeout_ms Time in milliseconds. 0 disables the cache
+ */
+void
+xfs_set_cache_timeout(struct xfs_fs *xfs, unsigned int timeout_ms);
+
+/*
+ * Records that information for an entry has just been read from the client
+ *
+ * XFS_CACHE_DIR_LIST is ignored for anything other than a directory
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of entry
+ * @param type Information which has been read
+ */
+void
+xfs_cache_update(struct xfs_fs *xfs, fuse_ino_t inum,
+                 enum xfs_cache_type type);
+
+/*
+ * Records that information for an entry must be read from the client again
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of entry
+ * @param type Information which is out of date
+ */
+void
+xfs_cache_invalidate(struct xfs_fs *xfs, fuse_ino_t inum,
+                     enum xfs_cache_type type);
+
+/*
+ * Gets how much longer cached information for an entry can be used for
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of entry
+ * @param type Information wanted
+ * @return Time in milliseconds, or 0 if the information must be read
+ *         from the client
+ */
+unsigned int
+xfs_cache_remaining(struct xfs_fs *xfs, fuse_ino_t inum,
+                    enum xfs_cache_type type);
+
 /*
  * Deletes all redirected entries with the matching device id
  *
@@ -163,6 +163,9 @@ x-special/gnome-copied-files
 #include <config_ac.h>
 #endif
 
+#include <limits.h>
+#include <stdlib.h>
+
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/Xfixes.h>
@@ -180,10 +183,24 @@ x-special/gnome-copied-files
 #include "chansrv_fuse.h"
 #include "ms-rdpeclip.h"
 #include "xrdp_constants.h"
+#include "unicode_defines.h"
 
 #define BMPFILEHEADER_LEN       14
 #define BMPINFOHEADER_LEN       40
 
+/* Large data responses are converted and sent to the client in parts
+ * of this size, rather than being assembled in memory first */
+#define CLIP_OUT_PART_BYTES     (64 * 1024)
+
+/* Most memory reserved up front for an INCR transfer from an X client,
+ * whatever size the client claims the transfer will be */
+#define CLIP_INCR_PREALLOC_MAX  (16 * 1024 * 1024)
+
+/* Limits on the converted client data kept for repeated pastes. The
+ * most recent conversion is always kept, whatever its size */
+#define CLIP_CACHE_ENTRIES      8
+#define CLIP_CACHE_MAX_BYTES    (64 * 1024 * 1024)
+
 extern int g_cliprdr_chan_id;   /* in chansrv.c */
 
 extern Display *g_display;      /* in xcommon.c */
@@ -224,6 +241,31 @@ static XSelectionRequestEvent g_saved_selection_req_event;
 /* xserver maximum request size in bytes */
 static int g_incr_max_req_size = 0;
 
+/* text data response being streamed from the client */
+struct c2s_text_state
+{
+    char partial[4]; /* UTF-16 character split between fragments */
+    int partial_bytes;
+    int terminated; /* the terminator has been seen */
+};
+static struct c2s_text_state g_c2s_text;
+
+/* client data converted for an X target, kept until the client
+ * announces new clipboard formats */
+struct clip_cache_entry
+{
+    Atom key; /* see clipboard_cache_key() */
+    char *data;
+    int data_bytes;
+};
+/* oldest entry first */
+static struct clip_cache_entry g_clip_cache[CLIP_CACHE_ENTRIES];
+static int g_clip_cache_count = 0;
+static int g_clip_cache_bytes = 0;
+
+/* incremented every time the client announces new clipboard formats */
+static unsigned int g_clip_generation = 0;
+
 /* server to client, pasting from linux app to mstsc */
 struct clip_s2c g_clip_s2c;
 /* client to server, pasting from mstsc to linux app */
@@ -480,6 +522,113 @@ clipboard_init(void)
     return rv;
 }
 
+/*****************************************************************************/
+/* Returns the cache key for client data converted for an X target.
+ * All the text targets are given the same UTF-8 data */
+static Atom
+clipboard_cache_key(Atom target)
+{
+    return (target == XA_STRING) ? g_utf8_atom : target;
+}
+
+/*****************************************************************************/
+static int
+clipboard_cache_find(Atom key)
+{
+    int index;
+
+    for (index = 0; index < g_clip_cache_count; index++)
+    {
+        if (g_clip_cache[index].key == key)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+/* Removes an entry from the cache. The data is freed unless it's the
+ * data currently being given to X clients */
+static void
+clipboard_cache_remove(int index)
+{
+    if (g_clip_cache[index].data != g_clip_c2s.data)
+    {
+        g_free(g_clip_cache[index].data);
+    }
+    g_clip_cache_bytes -= g_clip_cache[index].data_bytes;
+    g_clip_cache_count--;
+    g_memmove(&g_clip_cache[index], &g_clip_cache[index + 1],
+              (g_clip_cache_count - index) * sizeof(g_clip_cache[0]));
+}
+
+/*****************************************************************************/
+static void
+clipboard_cache_clear(void)
+{
+    while (g_clip_cache_count > 0)
+    {
+        clipboard_cache_remove(g_clip_cache_count - 1);
+    }
+}
+
+/*****************************************************************************/
+/* Frees the current client data, unless it's owned by the cache */
+static void
+clipboard_c2s_release_data(void)
+{
+    int index;
+
+    for (index = 0; index < g_clip_cache_count; index++)
+    {
+        if (g_clip_cache[index].data == g_clip_c2s.data)
+        {
+            g_clip_c2s.data = NULL;
+            return;
+        }
+    }
+    g_free(g_clip_c2s.data);
+    g_clip_c2s.data = NULL;
+}
+
+/*****************************************************************************/
+/* Adds the current client data to the cache, once it has been completely
+ * converted for g_clip_c2s.type. Data requested before the client last
+ * announced its formats is not added */
+static void
+clipboard_cache_store(void)
+{
+    int index;
+    Atom key;
+
+    if ((g_clip_c2s.data == NULL) ||
+            (g_clip_c2s.generation != g_clip_generation))
+    {
+        return;
+    }
+    key = clipboard_cache_key(g_clip_c2s.type);
+    index = clipboard_cache_find(key);
+    if (index >= 0)
+    {
+        clipboard_cache_remove(index);
+    }
+    while ((g_clip_cache_count > 0) &&
+            ((g_clip_cache_count == CLIP_CACHE_ENTRIES) ||
+             (g_clip_cache_bytes + g_clip_c2s.total_bytes > CLIP_CACHE_MAX_BYTES)))
+    {
+        clipboard_cache_remove(0);
+    }
+    index = g_clip_cache_count++;
+    g_clip_cache[index].key = key;
+    g_clip_cache[index].data = g_clip_c2s.data;
+    g_clip_cache[index].data_bytes = g_clip_c2s.total_bytes;
+    g_clip_cache_bytes += g_clip_c2s.total_bytes;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_cache_store: %s, %d bytes, "
+              "%d entries", get_atom_text(key), g_clip_c2s.total_bytes,
+              g_clip_cache_count);
+}
+
 /*****************************************************************************/
 int
 clipboard_deinit(void)
@@ -493,8 +642,8 @@ clipboard_deinit(void)
 
     xfuse_deinit();
 
-    g_free(g_clip_c2s.data);
-    g_clip_c2s.data = 0;
+    clipboard_cache_clear();
+    clipboard_c2s_release_data();
     g_free(g_clip_s2c.data);
     g_clip_s2c.data = 0;
 
@@ -515,6 +664,7 @@ clipboard_send_data_request(int format_id)
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_send_data_request:");
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_send_data_request: %d", format_id);
     g_clip_c2s.in_request = 1;
+    g_clip_c2s.generation = g_clip_generation;
     make_stream(s);
     init_stream(s, 8192);
     out_uint16_le(s, CB_FORMAT_DATA_REQUEST); /* 4 CLIPRDR_DATA_REQUEST */
@@ -716,59 +866,154 @@ clipboard_send_format_announce(int xrdp_clip_type)
     return rv;
 }
 
+/*****************************************************************************/
+/* Sends the contents of a stream as the next part of a message to the
+ * client, and empties the stream so it can be re-used */
+static int
+clipboard_send_part(struct stream *s, int *offset, int total_size)
+{
+    int size;
+    int rv = 0;
+
+    size = (int)(s->p - s->data);
+    if (size > 0)
+    {
+        rv = send_channel_data_part(g_cliprdr_chan_id, s->data, size,
+                                    *offset, total_size);
+        *offset += size;
+    }
+    s->p = s->data;
+    return rv;
+}
+
 /*****************************************************************************/
 static int
 clipboard_send_data_response_for_image(const char *data, int data_size)
 {
     struct stream *s;
-    int size;
+    int total_size;
+    int offset;
+    int bytes;
     int rv;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_send_data_response_for_image: data_size %d",
               data_size);
     make_stream(s);
-    init_stream(s, 64 + data_size);
+    init_stream(s, CLIP_OUT_PART_BYTES);
+    total_size = 8 + data_size + 4;
+    offset = 0;
+    rv = 0;
     out_uint16_le(s, CB_FORMAT_DATA_RESPONSE); /* 5 CLIPRDR_DATA_RESPONSE */
     out_uint16_le(s, CB_RESPONSE_OK); /* 1 status */
     out_uint32_le(s, data_size); /* length */
-    out_uint8p(s, data, data_size);
-    out_uint32_le(s, 0);
-    s_mark_end(s);
-    size = (int)(s->end - s->data);
-    rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
+    while ((rv == 0) && (data_size > 0))
+    {
+        bytes = MIN(data_size, s_rem_out(s));
+        out_uint8p(s, data, bytes);
+        data += bytes;
+        data_size -= bytes;
+        if (s_rem_out(s) == 0)
+        {
+            rv = clipboard_send_part(s, &offset, total_size);
+        }
+    }
+    if (rv == 0)
+    {
+        if (!s_check_rem_out(s, 4))
+        {
+            rv = clipboard_send_part(s, &offset, total_size);
+        }
+        out_uint32_le(s, 0);
+        if (rv == 0)
+        {
+            rv = clipboard_send_part(s, &offset, total_size);
+        }
+    }
     free_stream(s);
     return rv;
 }
 
+/*****************************************************************************/
+/* Returns the number of bytes of a UTF-8 string to convert to UTF-16 in
+ * one go, so that the output fits in half of an output part. Every UTF-8
+ * byte produces at most one UTF-16 word. Where possible, the string is
+ * split on a character boundary */
+static unsigned int
+clipboard_utf8_piece_len(const char *data, unsigned int data_size)
+{
+    unsigned int rv = CLIP_OUT_PART_BYTES / 4;
+
+    if (rv >= data_size)
+    {
+        return data_size;
+    }
+    while ((rv > 0) && ((data[rv] & 0xc0) == 0x80))
+    {
+        --rv;
+    }
+    return (rv > 0) ? rv : CLIP_OUT_PART_BYTES / 4;
+}
+
 /*****************************************************************************/
 static int
 clipboard_send_data_response_for_text(const char *data, int data_size)
 {
     struct stream *s;
-    int size;
+    const char *piece;
+    unsigned int piece_len;
+    unsigned int left;
+    int total_size;
+    int offset;
     int rv;
     int num_words;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_send_data_response_for_text: data_size %d",
               data_size);
     LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "clipboard send data response:", data, data_size);
-    num_words = utf8_as_utf16_word_count(data, data_size);
+    /* Count the words piece by piece, so the count matches the conversion
+     * below exactly */
+    num_words = 0;
+    piece = data;
+    left = data_size;
+    while (left > 0)
+    {
+        piece_len = clipboard_utf8_piece_len(piece, left);
+        num_words += utf8_as_utf16_word_count(piece, piece_len);
+        piece += piece_len;
+        left -= piece_len;
+    }
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_send_data_response_for_text: data_size %d "
               "num_words %d", data_size, num_words);
     make_stream(s);
-    init_stream(s, 64 + num_words * 2);
+    init_stream(s, CLIP_OUT_PART_BYTES);
+    total_size = 8 + num_words * 2 + 2 + 4;
+    offset = 0;
+    rv = 0;
     out_uint16_le(s, CB_FORMAT_DATA_RESPONSE); /* 5 CLIPRDR_DATA_RESPONSE */
     out_uint16_le(s, CB_RESPONSE_OK); /* 1 status */
     out_uint32_le(s, num_words * 2 + 2); /* length */
-    out_utf8_as_utf16_le(s, data, data_size);
-    out_uint16_le(s, 0); /* nil for string */
-    out_uint32_le(s, 0);
-    s_mark_end(s);
-    size = (int)(s->end - s->data);
+    piece = data;
+    left = data_size;
+    while ((rv == 0) && (left > 0))
+    {
+        piece_len = clipboard_utf8_piece_len(piece, left);
+        out_utf8_as_utf16_le(s, piece, piece_len);
+        piece += piece_len;
+        left -= piece_len;
+        if (!s_check_rem_out(s, CLIP_OUT_PART_BYTES / 2))
+        {
+            rv = clipboard_send_part(s, &offset, total_size);
+        }
+    }
+    if (rv == 0)
+    {
+        out_uint16_le(s, 0); /* nil for string */
+        out_uint32_le(s, 0);
+        rv = clipboard_send_part(s, &offset, total_size);
+    }
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_send_data_response_for_text: data out, "
-              "sending CLIPRDR_DATA_RESPONSE (clip_msg_id = 5) size %d "
-              "num_words %d", size, num_words);
-    rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
+              "sent CLIPRDR_DATA_RESPONSE (clip_msg_id = 5) size %d "
+              "num_words %d", total_size, num_words);
     free_stream(s);
     return rv;
 }
@@ -856,6 +1101,7 @@ clipboard_provide_selection_c2s(XSelectionRequestEvent *req, Atom type)
         /* start the INCR process */
         g_clip_c2s.incr_in_progress = 1;
         g_clip_c2s.incr_bytes_done = 0;
+        g_clip_c2s.incr_waiting = 0;
         g_clip_c2s.type = type;
         g_clip_c2s.property = req->property;
         g_clip_c2s.window = req->requestor;
@@ -882,6 +1128,70 @@ clipboard_provide_selection_c2s(XSelectionRequestEvent *req, Atom type)
     return 0;
 }
 
+/*****************************************************************************/
+/* Sends the next chunk of an INCR transfer to an X client. If the client
+ * has already had all the data received so far, the chunk is sent when
+ * more data arrives */
+static void
+clipboard_c2s_send_incr(void)
+{
+    tui8 *data;
+    int data_bytes;
+
+    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
+    if ((data_bytes < 1) && g_clip_c2s.streaming)
+    {
+        g_clip_c2s.incr_waiting = 1;
+        return;
+    }
+    g_clip_c2s.incr_waiting = 0;
+    if (data_bytes > g_incr_max_req_size)
+    {
+        data_bytes = g_incr_max_req_size;
+    }
+    data = (tui8 *)(g_clip_c2s.data + g_clip_c2s.incr_bytes_done);
+    g_clip_c2s.incr_bytes_done += data_bytes;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_send_incr: data_bytes %d", data_bytes);
+    XChangeProperty(g_display, g_clip_c2s.window, g_clip_c2s.property,
+                    g_clip_c2s.type, 8, PropModeReplace, data, data_bytes);
+    if (data_bytes < 1)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_send_incr: INCR done");
+        g_clip_c2s.incr_in_progress = 0;
+        /* we no longer need property notify */
+        XSelectInput(g_display, g_clip_c2s.window, NoEventMask);
+    }
+}
+
+/*****************************************************************************/
+/* Gives an X client data already fetched from the client and converted
+ * for the target it wants. Returns 0 if the data was in the cache */
+static int
+clipboard_provide_cached_c2s(XSelectionRequestEvent *req, int xrdp_clip_type)
+{
+    int index;
+
+    /* Don't disturb a transfer to another X client */
+    if (g_clip_c2s.incr_in_progress || g_clip_c2s.streaming)
+    {
+        return 1;
+    }
+    index = clipboard_cache_find(clipboard_cache_key(req->target));
+    if (index < 0)
+    {
+        return 1;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_provide_cached_c2s: %s from cache",
+              get_atom_text(req->target));
+    clipboard_c2s_release_data();
+    g_clip_c2s.data = g_clip_cache[index].data;
+    g_clip_c2s.total_bytes = g_clip_cache[index].data_bytes;
+    g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
+    g_clip_c2s.type = req->target;
+    g_clip_c2s.xrdp_clip_type = xrdp_clip_type;
+    return clipboard_provide_selection_c2s(req, req->target);
+}
+
 /*****************************************************************************/
 static int
 clipboard_provide_selection(XSelectionRequestEvent *req, Atom type, int format,
@@ -949,7 +1259,8 @@ clipboard_process_format_announce(struct stream *s, int clip_msg_status,
     clipboard_send_format_ack();
 
     xfuse_clear_clip_dir();
-    g_clip_c2s.converted = 0;
+    g_clip_generation++;
+    clipboard_cache_clear();
 
     desc[0] = 0;
     g_num_formatIds = 0;
@@ -1144,7 +1455,7 @@ clipboard_process_data_response_for_image(struct stream *s,
         return 0;
     }
 
-    g_free(g_clip_c2s.data);
+    clipboard_c2s_release_data();
     g_clip_c2s.data = (char *) g_malloc(len + BMPFILEHEADER_LEN, 0);
     if (g_clip_c2s.data == 0)
     {
@@ -1178,6 +1489,7 @@ clipboard_process_data_response_for_image(struct stream *s,
     in_uint8a(s, g_clip_c2s.data + BMPFILEHEADER_LEN, len);
 
     free_stream(bmp_hs);
+    clipboard_cache_store();
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response_for_image: calling "
               "clipboard_provide_selection_c2s");
     clipboard_provide_selection_c2s(lxev, lxev->target);
@@ -1206,7 +1518,7 @@ clipboard_process_data_response_for_file(struct stream *s,
     lxev = &g_saved_selection_req_event;
 
     const int flist_size = 1024 * 1024;
-    g_free(g_clip_c2s.data);
+    clipboard_c2s_release_data();
     g_clip_c2s.data = (char *)g_malloc(flist_size, 0);
     if (g_clip_c2s.data == NULL)
     {
@@ -1269,6 +1581,10 @@ clipboard_process_data_response_for_file(struct stream *s,
     g_clip_c2s.total_bytes =
         (g_clip_c2s.data == NULL) ? 0 : g_strlen(g_clip_c2s.data);
     g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
+    if (rv == 0)
+    {
+        clipboard_cache_store();
+    }
     clipboard_provide_selection_c2s(lxev, lxev->target);
 
     return rv;
@@ -1296,7 +1612,7 @@ clipboard_process_data_response_for_text(struct stream *s,
     /* Get the buffer size we need */
     byte_count = in_utf16_le_terminated_as_utf8_length(s);
 
-    g_free(g_clip_c2s.data);
+    clipboard_c2s_release_data();
     g_clip_c2s.total_bytes = 0;
     if ((g_clip_c2s.data = (char *)g_malloc(byte_count, 0)) == NULL)
     {
@@ -1313,6 +1629,7 @@ clipboard_process_data_response_for_text(struct stream *s,
 
         g_clip_c2s.total_bytes = byte_count;
         g_clip_c2s.read_bytes_done = byte_count;
+        clipboard_cache_store();
         clipboard_provide_selection_c2s(lxev, lxev->target);
     }
     return 0;
@@ -1369,6 +1686,269 @@ clipboard_process_data_response(struct stream *s, int clip_msg_status,
 }
 
 
+/*****************************************************************************/
+/* Converts complete UTF-16 characters from a text data response to UTF-8,
+ * and adds them to the data received so far */
+static void
+clipboard_c2s_stream_text_chars(char *data, int data_bytes)
+{
+    struct stream ls;
+    unsigned int needed;
+    unsigned int written;
+    int alloc_bytes;
+    char *new_data;
+
+    if (data_bytes < 2)
+    {
+        return;
+    }
+    g_memset(&ls, 0, sizeof(ls));
+    ls.data = data;
+    ls.p = ls.data;
+    ls.end = ls.p + data_bytes;
+
+    /* Size the buffer exactly, so the common case of mostly ASCII text
+     * fits in the initial allocation */
+    needed = in_utf16_le_terminated_as_utf8_length(&ls);
+    if (g_clip_c2s.read_bytes_done + needed > (unsigned int)g_clip_c2s.alloc_bytes)
+    {
+        alloc_bytes = g_clip_c2s.alloc_bytes + g_clip_c2s.alloc_bytes / 2;
+        alloc_bytes = MAX(alloc_bytes, g_clip_c2s.read_bytes_done + (int)needed);
+        new_data = (char *)realloc(g_clip_c2s.data, alloc_bytes);
+        if (new_data == NULL)
+        {
+            /* Keep what we've got, and ignore the rest */
+            LOG(LOG_LEVEL_ERROR, "Can't allocate %d bytes for text clip "
+                "response. Text is truncated", alloc_bytes);
+            g_c2s_text.terminated = 1;
+            return;
+        }
+        g_clip_c2s.data = new_data;
+        g_clip_c2s.alloc_bytes = alloc_bytes;
+    }
+
+    written = in_utf16_le_terminated_as_utf8(&ls,
+              g_clip_c2s.data + g_clip_c2s.read_bytes_done,
+              g_clip_c2s.alloc_bytes - g_clip_c2s.read_bytes_done);
+    g_clip_c2s.read_bytes_done += written - 1; /* Ignore the terminator */
+
+    /* Did we stop on a terminator? */
+    if (ls.p[-1] == 0 && ls.p[-2] == 0)
+    {
+        g_c2s_text.terminated = 1;
+    }
+}
+
+/*****************************************************************************/
+/* Processes a fragment of a text data response. UTF-16 characters split
+ * between fragments are held back until the rest of the character
+ * arrives */
+static void
+clipboard_c2s_stream_text(char *data, int data_bytes)
+{
+    int usable;
+    int char_bytes;
+
+    /* Complete a character left over from the last fragment */
+    while ((g_c2s_text.partial_bytes > 0) && (data_bytes > 0) &&
+            !g_c2s_text.terminated)
+    {
+        g_c2s_text.partial[g_c2s_text.partial_bytes++] = *data++;
+        --data_bytes;
+        char_bytes = 2;
+        if ((g_c2s_text.partial_bytes >= 2) &&
+                IS_HIGH_SURROGATE(GGET_UINT16(g_c2s_text.partial, 0)))
+        {
+            char_bytes = 4;
+        }
+        if (g_c2s_text.partial_bytes == char_bytes)
+        {
+            clipboard_c2s_stream_text_chars(g_c2s_text.partial, char_bytes);
+            g_c2s_text.partial_bytes = 0;
+        }
+    }
+
+    if (g_c2s_text.terminated)
+    {
+        return;
+    }
+
+    /* Process whole words, but not a trailing high surrogate */
+    usable = data_bytes & ~1;
+    if ((usable >= 2) &&
+            IS_HIGH_SURROGATE(GGET_UINT16(data, usable - 2)))
+    {
+        usable -= 2;
+    }
+    clipboard_c2s_stream_text_chars(data, usable);
+    g_c2s_text.partial_bytes = data_bytes - usable;
+    g_memcpy(g_c2s_text.partial, data + usable, g_c2s_text.partial_bytes);
+}
+
+/*****************************************************************************/
+/* Called when the whole of a streamed data response has arrived */
+static void
+clipboard_c2s_stream_end(void)
+{
+    XSelectionRequestEvent *lxev = &g_saved_selection_req_event;
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_stream_end: %d bytes",
+              g_clip_c2s.read_bytes_done);
+    g_clip_c2s.streaming = 0;
+    g_clip_c2s.in_request = 0;
+    g_clip_c2s.total_bytes = g_clip_c2s.read_bytes_done;
+    clipboard_cache_store();
+    if (g_clip_c2s.incr_in_progress)
+    {
+        if (g_clip_c2s.incr_waiting)
+        {
+            clipboard_c2s_send_incr();
+        }
+    }
+    else if (g_clip_c2s.data == NULL)
+    {
+        clipboard_refuse_selection(lxev);
+    }
+    else
+    {
+        clipboard_provide_selection_c2s(lxev, lxev->target);
+    }
+}
+
+/*****************************************************************************/
+/* Processes a fragment of a streamed data response from the client.
+ * Data is passed on to an X client waiting on an INCR transfer as
+ * soon as it arrives */
+static void
+clipboard_c2s_stream_data(char *data, int data_bytes, int last)
+{
+    if (g_clip_c2s.data != NULL)
+    {
+        if (g_clip_c2s.xrdp_clip_type == XRDP_CB_BITMAP)
+        {
+            data_bytes = MIN(data_bytes,
+                             g_clip_c2s.alloc_bytes - g_clip_c2s.read_bytes_done);
+            g_memcpy(g_clip_c2s.data + g_clip_c2s.read_bytes_done,
+                     data, data_bytes);
+            g_clip_c2s.read_bytes_done += data_bytes;
+        }
+        else
+        {
+            clipboard_c2s_stream_text(data, data_bytes);
+        }
+    }
+
+    if (last)
+    {
+        clipboard_c2s_stream_end();
+    }
+    else if (g_clip_c2s.incr_in_progress && g_clip_c2s.incr_waiting)
+    {
+        clipboard_c2s_send_incr();
+    }
+}
+
+/*****************************************************************************/
+/* Called with the first fragment of a message from the client which
+ * doesn't fit in a single fragment.
+ *
+ * Text and image data responses are converted as each fragment arrives,
+ * rather than being reassembled first. If the data is large enough to
+ * need an INCR transfer, the transfer is started straight away so the
+ * X client gets the data as it arrives.
+ *
+ * Returns 0 if the message is being streamed, or 1 if it should be
+ * reassembled and processed in the usual way */
+static int
+clipboard_c2s_stream_start(struct stream *s, int length, int total_length)
+{
+    XSelectionRequestEvent *lxev = &g_saved_selection_req_event;
+    struct stream *bmp_hs;
+    char *holdp;
+    int clip_msg_id;
+    int clip_msg_status;
+    int payload;
+
+    if (g_clip_c2s.streaming)
+    {
+        /* Previous response didn't complete. Finish with what we've got */
+        clipboard_c2s_stream_end();
+    }
+    if ((length < 8) || !s_check_rem(s, length))
+    {
+        return 1;
+    }
+    holdp = s->p;
+    in_uint16_le(s, clip_msg_id);
+    in_uint16_le(s, clip_msg_status);
+    in_uint8s(s, 4); /* dataLen */
+    if ((clip_msg_id != CB_FORMAT_DATA_RESPONSE) ||
+            ((clip_msg_status & CB_RESPONSE_FAIL) != 0) ||
+            ((clip_msg_status & CB_RESPONSE_OK) == 0) ||
+            ((g_clip_c2s.xrdp_clip_type != XRDP_CB_TEXT) &&
+             ((g_clip_c2s.xrdp_clip_type != XRDP_CB_BITMAP) ||
+              (g_clip_c2s.type != g_image_bmp_atom))))
+    {
+        s->p = holdp;
+        return 1;
+    }
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_stream_start: total_length %d",
+              total_length);
+    payload = total_length - 8;
+    clipboard_c2s_release_data();
+    g_clip_c2s.read_bytes_done = 0;
+    g_clip_c2s.streaming = 1;
+    g_clip_c2s.incr_waiting = 0;
+
+    if (g_clip_c2s.xrdp_clip_type == XRDP_CB_BITMAP)
+    {
+        /* Size is known, so allocate it all now and add the
+         * bitmap file header */
+        g_clip_c2s.alloc_bytes = payload + BMPFILEHEADER_LEN;
+        g_clip_c2s.total_bytes = g_clip_c2s.alloc_bytes;
+        g_clip_c2s.data = (char *)g_malloc(g_clip_c2s.alloc_bytes, 0);
+        make_stream(bmp_hs);
+        if ((g_clip_c2s.data != NULL) && (bmp_hs != NULL))
+        {
+            init_stream(bmp_hs, BMPFILEHEADER_LEN);
+            out_uint8(bmp_hs, 'B');
+            out_uint8(bmp_hs, 'M');
+            out_uint32_le(bmp_hs, g_clip_c2s.total_bytes);
+            out_uint16_le(bmp_hs, 0);
+            out_uint16_le(bmp_hs, 0);
+            out_uint32_le(bmp_hs, BMPFILEHEADER_LEN + BMPINFOHEADER_LEN);
+            g_memcpy(g_clip_c2s.data, bmp_hs->data, BMPFILEHEADER_LEN);
+            g_clip_c2s.read_bytes_done = BMPFILEHEADER_LEN;
+        }
+        free_stream(bmp_hs);
+    }
+    else
+    {
+        /* Allocate enough for ASCII text. The buffer is grown if
+         * necessary. Only a lower bound on the size is known */
+        g_clip_c2s.alloc_bytes = payload / 2 + 1;
+        g_clip_c2s.total_bytes = payload / 2 - 1;
+        g_clip_c2s.data = (char *)g_malloc(g_clip_c2s.alloc_bytes, 0);
+        g_memset(&g_c2s_text, 0, sizeof(g_c2s_text));
+    }
+
+    if (g_clip_c2s.data == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't allocate %d bytes for clip response",
+            g_clip_c2s.alloc_bytes);
+        g_clip_c2s.alloc_bytes = 0;
+    }
+    else if (g_clip_c2s.total_bytes >= g_incr_max_req_size)
+    {
+        clipboard_provide_selection_c2s(lxev, lxev->target);
+    }
+
+    clipboard_c2s_stream_data(s->p, length - 8, 0);
+    return 0;
+}
+
+
 /*****************************************************************************/
 static int
 clipboard_process_clip_caps(struct stream *s, int clip_msg_status,
@@ -1450,8 +2030,19 @@ clipboard_data_in(struct stream *s, int chan_id, int chan_flags, int length,
     {
         if (chan_flags & 1)
         {
+            if (clipboard_c2s_stream_start(s, length, total_length) == 0)
+            {
+                XFlush(g_display);
+                return 0;
+            }
             init_stream(g_ins, total_length);
         }
+        else if (g_clip_c2s.streaming)
+        {
+            clipboard_c2s_stream_data(s->p, length, chan_flags & 2);
+            XFlush(g_display);
+            return 0;
+        }
 
         in_uint8a(s, g_ins->end, length);
         g_ins->end += length;
@@ -1571,6 +2162,42 @@ clipboard_event_selection_owner_notify(XEvent *xevent)
     return 0;
 }
 
+/*****************************************************************************/
+/* Makes room for 'bytes' more bytes of INCR data from an X client. The
+ * buffer grows geometrically, so a large transfer isn't copied again
+ * for every chunk which arrives */
+static int
+clipboard_s2c_reserve(int bytes)
+{
+    char *data;
+    int needed;
+    int alloc_bytes;
+
+    needed = g_clip_s2c.total_bytes + bytes;
+    if ((bytes < 0) || (needed < g_clip_s2c.total_bytes))
+    {
+        return 1;
+    }
+    if (needed <= g_clip_s2c.alloc_bytes)
+    {
+        return 0;
+    }
+    alloc_bytes = g_clip_s2c.alloc_bytes;
+    if (alloc_bytes < INT_MAX / 2)
+    {
+        alloc_bytes *= 2;
+    }
+    alloc_bytes = MAX(alloc_bytes, needed);
+    data = (char *)realloc(g_clip_s2c.data, alloc_bytes);
+    if (data == NULL)
+    {
+        return 1;
+    }
+    g_clip_s2c.data = data;
+    g_clip_s2c.alloc_bytes = alloc_bytes;
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error
    get a window property from wnd */
@@ -1750,9 +2377,17 @@ clipboard_event_selection_notify(XEvent *xevent)
             g_clip_s2c.property = lxevent->property;
             g_clip_s2c.type = lxevent->target;
             g_clip_s2c.total_bytes = 0;
+            g_clip_s2c.alloc_bytes = 0;
             g_free(g_clip_s2c.data);
             g_clip_s2c.data = 0;
             //LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "", data, sizeof(long));
+            /* The property holds a lower bound on the size of the data.
+             * Use it to avoid growing the buffer repeatedly */
+            if ((fmt == 32) && (n_items > 0))
+            {
+                clipboard_s2c_reserve((int)MIN(((long *)data)[0],
+                                               CLIP_INCR_PREALLOC_MAX));
+            }
             g_free(data);
             return 0;
         }
@@ -2187,7 +2822,7 @@ clipboard_event_selection_request(XEvent *xevent)
                     lxev->target == XA_STRING ? "XA_STRING" : "UTF8_STRING");
                 clipboard_refuse_selection(lxev);
             }
-            else
+            else if (clipboard_provide_cached_c2s(lxev, XRDP_CB_FILE) != 0)
             {
                 g_memcpy(&g_saved_selection_req_event, lxev,
                          sizeof(g_saved_selection_req_event));
@@ -2207,7 +2842,7 @@ clipboard_event_selection_request(XEvent *xevent)
                     lxev->target == XA_STRING ? "XA_STRING" : "UTF8_STRING");
                 clipboard_refuse_selection(lxev);
             }
-            else
+            else if (clipboard_provide_cached_c2s(lxev, XRDP_CB_TEXT) != 0)
             {
                 /* The client may have advertised CF_TEXT or CF_OEMTEXT,
                  * but the Windows clipboard will convert these formats
@@ -2225,31 +2860,13 @@ clipboard_event_selection_request(XEvent *xevent)
     else if (lxev->target == g_image_bmp_atom)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_selection_request: image/bmp");
-        if ((g_clip_c2s.type == lxev->target) && g_clip_c2s.converted)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_selection_request: -------------------------------------------");
-
-            if (g_cfg->restrict_inbound_clipboard & CLIP_RESTRICT_IMAGE)
-            {
-                LOG(LOG_LEVEL_DEBUG,
-                    "inbound clipboard image/bmp converted is restricted because of config");
-                clipboard_refuse_selection(lxev);
-            }
-            else
-            {
-                clipboard_provide_selection_c2s(lxev, lxev->target);
-            }
-            return 0;
-
-        }
-
         if (g_cfg->restrict_inbound_clipboard & CLIP_RESTRICT_IMAGE)
         {
             LOG(LOG_LEVEL_DEBUG,
                 "inbound clipboard image/bmp is restricted because of config");
             clipboard_refuse_selection(lxev);
         }
-        else
+        else if (clipboard_provide_cached_c2s(lxev, XRDP_CB_BITMAP) != 0)
         {
             g_memcpy(&g_saved_selection_req_event, lxev,
                      sizeof(g_saved_selection_req_event));
@@ -2263,22 +2880,6 @@ clipboard_event_selection_request(XEvent *xevent)
     else if (lxev->target == g_file_atom1)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_selection_request: g_file_atom1");
-        if ((g_clip_c2s.type == lxev->target) && g_clip_c2s.converted)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_selection_request: -------------------------------------------");
-            if (g_cfg->restrict_inbound_clipboard & CLIP_RESTRICT_FILE)
-            {
-                LOG(LOG_LEVEL_DEBUG,
-                    "inbound clipboard text/uri-list is restricted because of config");
-                clipboard_refuse_selection(lxev);
-                return 0;
-            }
-            else
-            {
-                clipboard_provide_selection_c2s(lxev, lxev->target);
-                return 0;
-            }
-        }
         if (g_cfg->restrict_inbound_clipboard & CLIP_RESTRICT_FILE)
         {
             LOG(LOG_LEVEL_DEBUG,
@@ -2286,6 +2887,10 @@ clipboard_event_selection_request(XEvent *xevent)
             clipboard_refuse_selection(lxev);
             return 0;
         }
+        else if (clipboard_provide_cached_c2s(lxev, XRDP_CB_FILE) == 0)
+        {
+            return 0;
+        }
         else
         {
             g_memcpy(&g_saved_selection_req_event, lxev,
@@ -2301,22 +2906,6 @@ clipboard_event_selection_request(XEvent *xevent)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_selection_request: g_file_atom2");
 
-        if ((g_clip_c2s.type == lxev->target) && g_clip_c2s.converted)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_selection_request: -------------------------------------------");
-            if (g_cfg->restrict_inbound_clipboard & CLIP_RESTRICT_FILE)
-            {
-                LOG(LOG_LEVEL_DEBUG,
-                    "inbound clipboard x-special/gnome-copied-files converted is restricted because of config");
-                clipboard_refuse_selection(lxev);
-                return 0;
-            }
-            else
-            {
-                clipboard_provide_selection_c2s(lxev, lxev->target);
-                return 0;
-            }
-        }
         if (g_cfg->restrict_inbound_clipboard & CLIP_RESTRICT_FILE)
         {
             LOG(LOG_LEVEL_DEBUG,
@@ -2324,6 +2913,10 @@ clipboard_event_selection_request(XEvent *xevent)
             clipboard_refuse_selection(lxev);
             return 0;
         }
+        else if (clipboard_provide_cached_c2s(lxev, XRDP_CB_FILE) == 0)
+        {
+            return 0;
+        }
         else
         {
             g_memcpy(&g_saved_selection_req_event, lxev,
@@ -2386,8 +2979,6 @@ clipboard_event_property_notify(XEvent *xevent)
     int rv;
     int format_in_bytes;
     int new_data_len;
-    int data_bytes;
-    char *cptr;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: PropertyNotify .window %ld "
               ".state %d .atom %ld %s", xevent->xproperty.window,
@@ -2403,37 +2994,12 @@ clipboard_event_property_notify(XEvent *xevent)
         /* this is used for when copying a large clipboard to the other app,
            it will delete the property so we know to send the next one */
 
-        if ((g_clip_c2s.data == 0) || (g_clip_c2s.total_bytes < 1))
+        if (g_clip_c2s.data == 0)
         {
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR error");
             return 0;
         }
-        data = (tui8 *)(g_clip_c2s.data + g_clip_c2s.incr_bytes_done);
-        data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-        if ((data_bytes < 1) &&
-                (g_clip_c2s.read_bytes_done < g_clip_c2s.total_bytes))
-        {
-            g_clip_c2s.incr_in_progress = 0;
-            return 0;
-        }
-        if (data_bytes > g_incr_max_req_size)
-        {
-            data_bytes = g_incr_max_req_size;
-        }
-        g_clip_c2s.incr_bytes_done += data_bytes;
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: data_bytes %d", data_bytes);
-        XChangeProperty(xevent->xproperty.display, xevent->xproperty.window,
-                        xevent->xproperty.atom, g_clip_c2s.type, 8,
-                        PropModeReplace, data, data_bytes);
-        if (data_bytes < 1)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR done");
-            g_clip_c2s.incr_in_progress = 0;
-            /* we no longer need property notify */
-            XSelectInput(xevent->xproperty.display, xevent->xproperty.window,
-                         NoEventMask);
-            g_clip_c2s.converted = 1;
-        }
+        clipboard_c2s_send_incr();
     }
     if (g_clip_s2c.incr_in_progress &&
             (xevent->xproperty.window == g_wnd) &&
@@ -2461,7 +3027,8 @@ clipboard_event_property_notify(XEvent *xevent)
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR done");
             /* clipboard INCR cycle has completed */
             g_clip_s2c.incr_in_progress = 0;
-            if (g_clip_s2c.type == g_image_bmp_atom)
+            if ((g_clip_s2c.type == g_image_bmp_atom) &&
+                    (g_clip_s2c.total_bytes > 14))
             {
                 g_clip_s2c.xrdp_clip_type = XRDP_CB_BITMAP;
                 //LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "", g_last_clip_data, 64);
@@ -2500,12 +3067,17 @@ clipboard_event_property_notify(XEvent *xevent)
 
             format_in_bytes = FORMAT_TO_BYTES(actual_format_return);
             new_data_len = nitems_returned * format_in_bytes;
-            cptr = (char *) g_malloc(g_clip_s2c.total_bytes + new_data_len, 0);
-            if (cptr == NULL)
+            if (clipboard_s2c_reserve(new_data_len) != 0)
             {
                 /* cannot add any more data */
+                LOG(LOG_LEVEL_ERROR, "Can't allocate %d bytes for clipboard "
+                    "INCR transfer", g_clip_s2c.total_bytes + new_data_len);
                 g_free(g_clip_s2c.data);
                 g_clip_s2c.data = 0;
+                g_clip_s2c.total_bytes = 0;
+                g_clip_s2c.alloc_bytes = 0;
+                g_clip_s2c.incr_in_progress = 0;
+                clipboard_send_data_response_failed();
 
                 if (data != 0)
                 {
@@ -2515,11 +3087,8 @@ clipboard_event_property_notify(XEvent *xevent)
                 XDeleteProperty(g_display, g_wnd, g_clip_s2c.property);
                 return 0;
             }
-            g_memcpy(cptr, g_clip_s2c.data, g_clip_s2c.total_bytes);
-            g_free(g_clip_s2c.data);
 
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: new_data_len %d", new_data_len);
-            g_clip_s2c.data = cptr;
             if (data)
             {
                 g_memcpy(g_clip_s2c.data + g_clip_s2c.total_bytes, data, new_data_len);
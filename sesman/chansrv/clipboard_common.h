@@ -31,6 +31,7 @@ struct clip_s2c /* server to client, pasting from linux app to mstsc */
 {
     int incr_in_progress;
     int total_bytes;
+    int alloc_bytes; /* bytes allocated for data during INCR */
     char *data;
     Atom type; /* UTF8_STRING, image/bmp, ... */
     Atom property; /* XRDP_CLIP_PROPERTY_ATOM, _QT_SELECTION, ... */
@@ -45,13 +46,16 @@ struct clip_c2s /* client to server, pasting from mstsc to linux app */
     int incr_bytes_done;
     int read_bytes_done;
     int total_bytes;
+    int alloc_bytes; /* bytes allocated for data while streaming */
     char *data;
     Atom type; /* UTF8_STRING, image/bmp, ... */
     Atom property; /* XRDP_CLIP_PROPERTY_ATOM, _QT_SELECTION, ... */
     Window window; /* Window used in INCR transfer */
     int xrdp_clip_type; /* XRDP_CB_TEXT, XRDP_CB_BITMAP, XRDP_CB_FILE, ... */
-    int converted;
     int in_request; /* a data request has been sent to client */
+    unsigned int generation; /* formats announcement data was requested for */
+    int streaming; /* a data response is arriving from the client */
+    int incr_waiting; /* INCR requestor is waiting for more data */
 };
 
 struct clip_file_desc /* CLIPRDR_FILEDESCRIPTOR */
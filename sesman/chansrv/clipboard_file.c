@@ -62,8 +62,13 @@ struct cb_file_info
 
 static struct list *g_files_list = 0;
 
-/* used when server is asking for file info from the client */
-static int g_file_request_sent_type = 0;
+/*
+ * Requests sent when server is asking for file info from the client,
+ * which haven't had a response yet. Several range requests can be in
+ * flight at once. Responses are matched to requests using the streamId.
+ */
+static int g_file_size_requests = 0;
+static int g_file_range_requests = 0;
 
 /* number of seconds from 1 Jan. 1601 00:00 to 1 Jan 1970 00:00 UTC */
 #define CB_EPOCH_DIFF 11644473600LL
@@ -463,7 +468,7 @@ clipboard_request_file_size(int stream_id, int lindex)
     int rv;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_request_file_size:");
-    if (g_file_request_sent_type != 0)
+    if (g_file_range_requests != 0)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_request_file_size: warning, still waiting "
                   "for CB_FILECONTENTS_RESPONSE");
@@ -485,7 +490,7 @@ clipboard_request_file_size(int stream_id, int lindex)
     size = (int)(s->end - s->data);
     rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
     free_stream(s);
-    g_file_request_sent_type = CB_FILECONTENTS_SIZE;
+    ++g_file_size_requests;
     return rv;
 }
 
@@ -580,11 +585,6 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_request_file_data: stream_id=%d lindex=%d off=%d request_bytes=%d",
               stream_id, lindex, offset, request_bytes);
 
-    if (g_file_request_sent_type != 0)
-    {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_request_file_data: warning, still waiting "
-                  "for CB_FILECONTENTS_RESPONSE");
-    }
     make_stream(s);
     init_stream(s, 8192);
     out_uint16_le(s, CB_FILECONTENTS_REQUEST); /* 8 */
@@ -602,7 +602,7 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     size = (int)(s->end - s->data);
     rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
     free_stream(s);
-    g_file_request_sent_type = CB_FILECONTENTS_RANGE;
+    ++g_file_range_requests;
     return rv;
 }
 
@@ -651,25 +651,32 @@ clipboard_process_file_response(struct stream *s, int clip_msg_status,
     int file_size;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_file_response:");
-    if (g_file_request_sent_type == CB_FILECONTENTS_SIZE)
+    if (!s_check_rem_and_log(s, 4, "Parsing [MS-RDPECLIP] CLIPRDR_FILECONTENTS_RESPONSE"))
+    {
+        return 1;
+    }
+    in_uint32_le(s, streamId);
+
+    /* We don't send size requests while range requests are in flight,
+     * so a response is for a range request if any are outstanding */
+    if (g_file_range_requests > 0)
     {
-        g_file_request_sent_type = 0;
-        in_uint32_le(s, streamId);
+        --g_file_range_requests;
+        xfuse_file_contents_range(streamId, s->p,
+                                  (clip_msg_status & CB_RESPONSE_FAIL) ?
+                                  -1 : clip_msg_len - 4);
+    }
+    else if (g_file_size_requests > 0)
+    {
+        --g_file_size_requests;
         in_uint32_le(s, file_size);
         LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_file_response: streamId %d "
                   "file_size %d", streamId, file_size);
         xfuse_file_contents_size(streamId, file_size);
     }
-    else if (g_file_request_sent_type == CB_FILECONTENTS_RANGE)
-    {
-        g_file_request_sent_type = 0;
-        in_uint32_le(s, streamId);
-        xfuse_file_contents_range(streamId, s->p, clip_msg_len - 4);
-    }
     else
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_process_file_response: error");
-        g_file_request_sent_type = 0;
     }
     return 0;
 }
@@ -196,6 +196,7 @@ int
 devredir_deinit(void)
 {
     scard_deinit();
+    devredir_irp_deinit();
     return 0;
 }
 
@@ -1045,6 +1046,7 @@ devredir_proc_device_iocompletion(struct stream *s)
     tui32      CompletionId;
     tui32      IoStatus32;
     tui32      Length;
+    tui32      FileId;
     enum COMPLETION_TYPE comp_type;
 
     if (!s_check_rem_and_log(s, 12, "Parsing [MS-RDPEFS] DR_DEVICE_IOCOMPLETION"))
@@ -1100,7 +1102,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                     {
                         return -1;
                     }
-                    xstream_rd_u32_le(s, irp->FileId);
+                    xstream_rd_u32_le(s, FileId);
+                    devredir_irp_set_file_id(irp, FileId);
                     devredir_send_drive_dir_request(irp, DeviceId,
                                                     1, irp->pathname);
                 }
@@ -1111,7 +1114,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
 
                 xfuse_devredir_cb_create_file(
                     (struct state_create *) irp->fuse_info,
@@ -1127,7 +1131,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
 
                 xfuse_devredir_cb_open_file((struct state_open *) irp->fuse_info,
                                             IoStatus, DeviceId, irp->FileId);
@@ -1188,7 +1193,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 devredir_proc_cid_rmdir_or_file(irp, IoStatus);
                 break;
 
@@ -1201,7 +1207,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 devredir_proc_cid_rename_file(irp, IoStatus);
                 break;
 
@@ -1403,7 +1410,7 @@ devredir_get_dir_listing(struct state_dirscan *fusep, tui32 device_id,
         strcpy(irp->pathname, path);
         devredir_cvt_slash(irp->pathname);
 
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_CREATE_DIR_REQ;
         irp->DeviceId = device_id;
         irp->fuse_info = fusep;
@@ -1467,7 +1474,7 @@ devredir_lookup_entry(struct state_lookup *fusep, tui32 device_id,
          * Allocate an IRP to open the file, read the basic attributes,
          * read the standard attributes, and then close the file
          */
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_LOOKUP;
         irp->DeviceId = device_id;
         irp->gen.lookup.state = E_LOOKUP_GET_FH;
@@ -1525,7 +1532,7 @@ devredir_setattr_for_entry(struct state_setattr *fusep, tui32 device_id,
          * Allocate an IRP to open the file, update the attributes
          * and close the file.
          */
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_SETATTR;
         irp->DeviceId = device_id;
         irp->fuse_info = fusep;
@@ -1588,7 +1595,7 @@ devredir_statfs(struct state_statfs *fusep, tui32 device_id, const char *path)
          * Allocate an IRP to open the file, read the filesystem size
          * attributes and then close the file
          */
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_STATFS;
         irp->DeviceId = device_id;
         irp->fuse_info = fusep;
@@ -1629,7 +1636,7 @@ devredir_file_create(struct state_create *fusep, tui32 device_id,
         devredir_cvt_slash(irp->pathname);
 
         irp->completion_type = CID_CREATE_REQ;
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->DeviceId = device_id;
         irp->fuse_info = fusep;
 
@@ -1682,7 +1689,7 @@ devredir_file_open(struct state_open *fusep, tui32 device_id,
         devredir_cvt_slash(irp->pathname);
 
         irp->completion_type = CID_OPEN_REQ;
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->DeviceId = device_id;
 
         irp->fuse_info = fusep;
@@ -1738,7 +1745,7 @@ int devredir_file_close(struct state_close *fusep, tui32 device_id,
         return -1;
     }
 
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
 #else
     if ((irp = devredir_irp_find_by_fileid(FileId)) == NULL)
     {
@@ -1778,7 +1785,7 @@ devredir_rmdir_or_file(struct state_remove *fusep, tui32 device_id,
         /* convert / to windows compatible \ */
         devredir_cvt_slash(irp->pathname);
 
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_RMDIR_OR_FILE;
         irp->DeviceId = device_id;
 
@@ -1839,7 +1846,7 @@ devredir_file_read(struct state_read *fusep, tui32 DeviceId, tui32 FileId,
         new_irp->DeviceId = DeviceId;
         new_irp->FileId = FileId;
         new_irp->completion_type = CID_READ;
-        new_irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(new_irp, g_completion_id++);
         new_irp->fuse_info = fusep;
 
         devredir_insert_DeviceIoRequest(s,
@@ -1898,7 +1905,7 @@ devredir_file_write(struct state_write *fusep, tui32 DeviceId, tui32 FileId,
         new_irp->DeviceId = DeviceId;
         new_irp->FileId = FileId;
         new_irp->completion_type = CID_WRITE;
-        new_irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(new_irp, g_completion_id++);
         new_irp->fuse_info = fusep;
         /* Offset needed after write to calculate new EOF */
         new_irp->gen.write.offset = Offset;
@@ -1963,7 +1970,7 @@ int devredir_file_rename(struct state_rename *fusep, tui32 device_id,
         devredir_cvt_slash(irp->gen.rename.new_name);
 
         irp->completion_type = CID_RENAME_FILE;
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->DeviceId = device_id;
 
         irp->fuse_info = fusep;
@@ -2285,6 +2292,7 @@ devredir_proc_cid_lookup(IRP *irp,
                          enum NTSTATUS IoStatus)
 {
     tui32 Length;
+    tui32 FileId;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entry state is %d", irp->gen.lookup.state);
     if (IoStatus != STATUS_SUCCESS)
@@ -2300,7 +2308,8 @@ devredir_proc_cid_lookup(IRP *irp,
         {
             case E_LOOKUP_GET_FH:
                 /* We've been sent the file ID */
-                xstream_rd_u32_le(s_in, irp->FileId);
+                xstream_rd_u32_le(s_in, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 issue_lookup(irp, FileBasicInformation);
                 irp->gen.lookup.state = E_LOOKUP_CHECK_BASIC;
                 break;
@@ -2585,6 +2594,7 @@ devredir_proc_cid_setattr(IRP *irp,
 #define TO_SET_BASIC_ATTRS (TO_SET_MODE | \
                             TO_SET_ATIME | TO_SET_MTIME)
     tui32 Length;
+    tui32 FileId;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entry state is %d", irp->gen.setattr.state);
     if (IoStatus != STATUS_SUCCESS)
@@ -2600,7 +2610,8 @@ devredir_proc_cid_setattr(IRP *irp,
         {
             case E_SETATTR_GET_FH:
                 /* We've been sent the file ID */
-                xstream_rd_u32_le(s_in, irp->FileId);
+                xstream_rd_u32_le(s_in, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 break;
 
             case E_SETATTR_CHECK_BASIC:
@@ -31,50 +31,241 @@
 #include "string_calls.h"
 #include "irp.h"
 
+/*
+ * IRPs with a pathname shorter than this are allocated from a pool of
+ * fixed-size blocks, so the many small IRPs used for file I/O don't
+ * each need a g_malloc()/g_free()
+ */
+#define IRP_POOL_PATHNAME_LEN 256
+#define IRP_POOL_BLOCK_SIZE (sizeof(IRP) + IRP_POOL_PATHNAME_LEN)
+/* Most free blocks we keep in the pool */
+#define IRP_POOL_MAX_FREE 128
+
+/* Minimum size of the IRP lookup tables. Always a power of 2 */
+#define IRP_MAP_MIN_SIZE 64
+
+/* A hash table of IRPs. Buckets are chained through the IRP */
+struct irp_map
+{
+    IRP **buckets;
+    unsigned int size;    /* Number of buckets, or 0 */
+    unsigned int count;   /* Number of IRPs in the table */
+};
+
 IRP *g_irp_head = NULL;
+static IRP *g_irp_tail = NULL;
+
+static IRP *g_irp_pool = NULL;  /* Free blocks, chained through next */
+static unsigned int g_irp_pool_count = 0;
+
+static struct irp_map g_cid_map;  /* IRPs by CompletionId */
+static struct irp_map g_fid_map;  /* Open IRPs by FileId */
+
+/*****************************************************************************/
+static IRP **
+irp_map_chain(struct irp_map *map, IRP *irp)
+{
+    return (map == &g_cid_map) ? &irp->cid_next : &irp->fid_next;
+}
+
+/*****************************************************************************/
+static tui32
+irp_map_key(struct irp_map *map, const IRP *irp)
+{
+    return (map == &g_cid_map) ? irp->CompletionId : irp->FileId;
+}
+
+/*****************************************************************************/
+/* Keys are sequential or client-chosen, so mix them up a bit */
+static unsigned int
+irp_map_bucket(const struct irp_map *map, tui32 key)
+{
+    return (key * 2654435761U) & (map->size - 1);
+}
+
+/*****************************************************************************/
+/* Resizes a map. Returns 0 for success */
+static int
+irp_map_resize(struct irp_map *map, unsigned int new_size)
+{
+    IRP **old_buckets = map->buckets;
+    unsigned int old_size = map->size;
+    unsigned int i;
+    unsigned int bucket;
+    IRP *irp;
+    IRP *next;
+    IRP **chain;
+
+    map->buckets = g_new0(IRP *, new_size);
+    if (map->buckets == NULL)
+    {
+        map->buckets = old_buckets;
+        return 1;
+    }
+    map->size = new_size;
+
+    for (i = 0 ; i < old_size; ++i)
+    {
+        for (irp = old_buckets[i]; irp != NULL; irp = next)
+        {
+            chain = irp_map_chain(map, irp);
+            next = *chain;
+            bucket = irp_map_bucket(map, irp_map_key(map, irp));
+            *chain = map->buckets[bucket];
+            map->buckets[bucket] = irp;
+        }
+    }
+    g_free(old_buckets);
+    return 0;
+}
+
+/*****************************************************************************/
+/* Adds an IRP to a map. Returns 0 for success */
+static int
+irp_map_add(struct irp_map *map, IRP *irp)
+{
+    unsigned int bucket;
+    IRP **chain;
+
+    if (map->count >= map->size)
+    {
+        if (irp_map_resize(map, (map->size == 0) ?
+                           IRP_MAP_MIN_SIZE : map->size * 2) != 0 &&
+                map->size == 0)
+        {
+            return 1;
+        }
+    }
+
+    bucket = irp_map_bucket(map, irp_map_key(map, irp));
+    chain = irp_map_chain(map, irp);
+    *chain = map->buckets[bucket];
+    map->buckets[bucket] = irp;
+    ++map->count;
+    return 0;
+}
+
+/*****************************************************************************/
+/* Removes an IRP from a map, if it's in it */
+static void
+irp_map_remove(struct irp_map *map, IRP *irp)
+{
+    IRP **p;
+
+    if (map->size > 0)
+    {
+        p = &map->buckets[irp_map_bucket(map, irp_map_key(map, irp))];
+        while (*p != NULL && *p != irp)
+        {
+            p = irp_map_chain(map, *p);
+        }
+        if (*p != NULL)
+        {
+            *p = *irp_map_chain(map, irp);
+            *irp_map_chain(map, irp) = NULL;
+            --map->count;
+        }
+    }
+}
+
+/*****************************************************************************/
+static IRP *
+irp_map_find(struct irp_map *map, tui32 key)
+{
+    IRP *irp = NULL;
+
+    if (map->size > 0)
+    {
+        irp = map->buckets[irp_map_bucket(map, key)];
+        while (irp != NULL && irp_map_key(map, irp) != key)
+        {
+            irp = *irp_map_chain(map, irp);
+        }
+    }
+    return irp;
+}
+
+/*****************************************************************************/
+static void
+irp_map_free(struct irp_map *map)
+{
+    g_free(map->buckets);
+    map->buckets = NULL;
+    map->size = 0;
+    map->count = 0;
+}
 
 /**
- * Create a new IRP and append to linked list
+ * Allocate a zeroed IRP with space for a pathname of the specified length,
+ * and append it to the linked list
  *
  * @return new IRP or NULL on error
  *****************************************************************************/
 
-IRP *devredir_irp_new(void)
+static IRP *
+irp_alloc(unsigned int pathnamelen)
 {
     IRP *irp;
-    IRP *irp_last;
+    int pooled = (pathnamelen < IRP_POOL_PATHNAME_LEN);
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered");
+    if (pooled && g_irp_pool != NULL)
+    {
+        irp = g_irp_pool;
+        g_irp_pool = irp->next;
+        --g_irp_pool_count;
+    }
+    else if (pooled)
+    {
+        irp = (IRP *)g_malloc(IRP_POOL_BLOCK_SIZE, 0);
+    }
+    else
+    {
+        irp = (IRP *)g_malloc(sizeof(IRP) + (pathnamelen + 1), 0);
+    }
 
-    /* create new IRP */
-    irp = g_new0(IRP, 1);
     if (irp == NULL)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory!");
         return NULL;
     }
+    g_memset(irp, 0, sizeof(IRP) + (pathnamelen + 1));
+    irp->pooled = pooled;
 
     /* insert at end of linked list */
-    if ((irp_last = devredir_irp_get_last()) == NULL)
+    if (g_irp_tail == NULL)
     {
         /* list is empty, this is the first entry */
         g_irp_head = irp;
     }
     else
     {
-        irp_last->next = irp;
-        irp->prev = irp_last;
+        g_irp_tail->next = irp;
+        irp->prev = g_irp_tail;
     }
+    g_irp_tail = irp;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "new IRP=%p", irp);
     return irp;
 }
 
+/**
+ * Create a new IRP and append to linked list
+ *
+ * @return new IRP or NULL on error
+ *****************************************************************************/
+
+IRP *devredir_irp_new(void)
+{
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered");
+
+    return irp_alloc(0);
+}
+
 /**
  * Create a new IRP with a copied pathname, and append to linked list.
  *
  * Allocation is made in such a way that the IRP can be freed with a single
- * free() operation
+ * devredir_irp_delete() operation
  *
  * @return new IRP or NULL on error
  *****************************************************************************/
@@ -96,7 +287,7 @@ IRP *devredir_irp_with_pathname_new(const char *pathname)
  * linked list.
  *
  * Allocation is made in such a way that the IRP can be freed with a single
- * free() operation
+ * devredir_irp_delete() operation
  *
  * @return new IRP or NULL on error
  *****************************************************************************/
@@ -104,33 +295,17 @@ IRP *devredir_irp_with_pathname_new(const char *pathname)
 IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
 {
     IRP *irp;
-    IRP *irp_last;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entered");
 
     /* create new IRP with space on end for the pathname and a terminator */
-    irp = (IRP *)g_malloc(sizeof(IRP) + (pathnamelen + 1), 1);
-    if (irp == NULL)
-    {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory!");
-        return NULL;
-    }
-
-    irp->pathname = (char *)irp + sizeof(IRP); /* Initialise pathname pointer */
-
-    /* insert at end of linked list */
-    if ((irp_last = devredir_irp_get_last()) == NULL)
-    {
-        /* list is empty, this is the first entry */
-        g_irp_head = irp;
-    }
-    else
+    irp = irp_alloc(pathnamelen);
+    if (irp != NULL)
     {
-        irp_last->next = irp;
-        irp->prev = irp_last;
+        /* Initialise pathname pointer */
+        irp->pathname = (char *)irp + sizeof(IRP);
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "new IRP=%p", irp);
     return irp;
 }
 
@@ -142,11 +317,9 @@ IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
 
 int devredir_irp_delete(IRP *irp)
 {
-    IRP *lirp = g_irp_head;
-
-    if ((irp == NULL) || (lirp == NULL))
+    if (irp == NULL || (irp->prev == NULL && irp != g_irp_head))
     {
-        return -1;
+        return -1;    /* did not find specified irp */
     }
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "irp=%p completion_id=%d type=%d",
@@ -154,49 +327,37 @@ int devredir_irp_delete(IRP *irp)
 
     devredir_irp_dump(); // LK_TODO
 
-    while (lirp)
-    {
-        if (lirp == irp)
-        {
-            break;
-        }
+    irp_map_remove(&g_cid_map, irp);
+    irp_map_remove(&g_fid_map, irp);
 
-        lirp = lirp->next;
+    if (irp->prev == NULL)
+    {
+        g_irp_head = irp->next;
     }
-
-    if (lirp == NULL)
+    else
     {
-        return -1;    /* did not find specified irp */
+        irp->prev->next = irp->next;
     }
 
-    if (lirp->prev == NULL)
+    if (irp->next == NULL)
     {
-        /* we are at head of linked list */
-        if (lirp->next == NULL)
-        {
-            /* only one element in list */
-            g_free(lirp);
-            g_irp_head = NULL;
-            devredir_irp_dump(); // LK_TODO
-            return 0;
-        }
-
-        lirp->next->prev = NULL;
-        g_irp_head = lirp->next;
-        g_free(lirp);
+        g_irp_tail = irp->prev;
     }
-    else if (lirp->next == NULL)
+    else
     {
-        /* we are at tail of linked list */
-        lirp->prev->next = NULL;
-        g_free(lirp);
+        irp->next->prev = irp->prev;
+    }
+
+    if (irp->pooled && g_irp_pool_count < IRP_POOL_MAX_FREE)
+    {
+        irp->next = g_irp_pool;
+        irp->prev = NULL;
+        g_irp_pool = irp;
+        ++g_irp_pool_count;
     }
     else
     {
-        /* we are in between */
-        lirp->prev->next = lirp->next;
-        lirp->next->prev = lirp->prev;
-        g_free(lirp);
+        g_free(irp);
     }
 
     devredir_irp_dump(); // LK_TODO
@@ -204,46 +365,51 @@ int devredir_irp_delete(IRP *irp)
     return 0;
 }
 
+/*****************************************************************************/
+void devredir_irp_set_completion_id(IRP *irp, tui32 completion_id)
+{
+    irp_map_remove(&g_cid_map, irp);
+    irp->CompletionId = completion_id;
+    if (irp_map_add(&g_cid_map, irp) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Out of memory indexing completion ID %u",
+            completion_id);
+    }
+}
+
+/*****************************************************************************/
+void devredir_irp_set_file_id(IRP *irp, tui32 FileId)
+{
+    irp_map_remove(&g_fid_map, irp);
+    irp->FileId = FileId;
+    if (irp_map_add(&g_fid_map, irp) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Out of memory indexing file ID %u", FileId);
+    }
+}
+
 /**
  * Return IRP containing specified completion_id
  *****************************************************************************/
 
 IRP *devredir_irp_find(tui32 completion_id)
 {
-    IRP *irp = g_irp_head;
+    IRP *irp = irp_map_find(&g_cid_map, completion_id);
 
-    while (irp)
-    {
-        if (irp->CompletionId == completion_id)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-            return irp;
-        }
-
-        irp = irp->next;
-    }
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=NULL");
-    return NULL;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
+    return irp;
 }
 
+/**
+ * Return the IRP which opened the file with the specified FileId
+ *****************************************************************************/
+
 IRP *devredir_irp_find_by_fileid(tui32 FileId)
 {
-    IRP *irp = g_irp_head;
+    IRP *irp = irp_map_find(&g_fid_map, FileId);
 
-    while (irp)
-    {
-        if (irp->FileId == FileId)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-            return irp;
-        }
-
-        irp = irp->next;
-    }
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=NULL");
-    return NULL;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
+    return irp;
 }
 
 /**
@@ -252,20 +418,8 @@ IRP *devredir_irp_find_by_fileid(tui32 FileId)
 
 IRP *devredir_irp_get_last(void)
 {
-    IRP *irp = g_irp_head;
-
-    while (irp)
-    {
-        if (irp->next == NULL)
-        {
-            break;
-        }
-
-        irp = irp->next;
-    }
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-    return irp;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", g_irp_tail);
+    return g_irp_tail;
 }
 
 void devredir_irp_dump(void)
@@ -282,3 +436,22 @@ void devredir_irp_dump(void)
     }
     LOG_DEVEL(LOG_LEVEL_DEBUG, "------- dumping IRPs done ---");
 }
+
+/*****************************************************************************/
+void devredir_irp_deinit(void)
+{
+    IRP *irp;
+
+    while (g_irp_head != NULL)
+    {
+        devredir_irp_delete(g_irp_head);
+    }
+    while ((irp = g_irp_pool) != NULL)
+    {
+        g_irp_pool = irp->next;
+        g_free(irp);
+    }
+    g_irp_pool_count = 0;
+    irp_map_free(&g_cid_map);
+    irp_map_free(&g_fid_map);
+}
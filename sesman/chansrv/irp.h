@@ -80,9 +80,13 @@ typedef struct irp IRP;
 
 struct irp
 {
-    tui32      CompletionId;        /* unique number                     */
+    tui32      CompletionId;        /* unique number
+                                     * Set with
+                                     * devredir_irp_set_completion_id()  */
     tui32      DeviceId;            /* identifies remote device          */
-    tui32      FileId;              /* RDP client provided unique number */
+    tui32      FileId;              /* RDP client provided unique number
+                                     * Set with devredir_irp_set_file_id()
+                                     * on the IRP which opens the file   */
     char       completion_type;     /* describes I/O type                */
     char       *pathname;           /* absolute pathname
                                      * Allocate with
@@ -98,6 +102,9 @@ struct irp
     void      *fuse_info;           /* Fuse info pointer for FUSE calls  */
     IRP       *next;                /* point to next IRP                 */
     IRP       *prev;                /* point to previous IRP             */
+    IRP       *cid_next;            /* CompletionId hash chain           */
+    IRP       *fid_next;            /* FileId hash chain                 */
+    char       pooled;              /* Allocated from the IRP pool       */
     int        scard_index;         /* used to smart card to locate dev  */
 
     void     (*callback)(struct stream *s, IRP *irp, tui32 DeviceId,
@@ -114,9 +121,17 @@ IRP *devredir_irp_with_pathname_new(const char *pathname);
  * significantly */
 IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen);
 int   devredir_irp_delete(IRP *irp);
+/* Sets the CompletionId of an IRP so devredir_irp_find() can find it */
+void  devredir_irp_set_completion_id(IRP *irp, tui32 completion_id);
+/* Sets the FileId returned when an IRP opens a file, so
+ * devredir_irp_find_by_fileid() can find it. Other IRPs for the
+ * same file can set the FileId field directly */
+void  devredir_irp_set_file_id(IRP *irp, tui32 FileId);
 IRP *devredir_irp_find(tui32 completion_id);
 IRP *devredir_irp_find_by_fileid(tui32 FileId);
 IRP *devredir_irp_get_last(void);
 void  devredir_irp_dump(void);
+/* Deletes any remaining IRPs, and frees the IRP pool and lookup tables */
+void  devredir_irp_deinit(void);
 
 #endif /* end ifndef __IRP_H */
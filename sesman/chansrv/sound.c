@@ -76,8 +76,6 @@ static int    g_cBlockNo = 0;
 static int    g_bytes_in_stream = 0;
 struct fifo  *g_in_fifo;
 int    g_bytes_in_fifo = 0;
-static int    g_time_diff = 0;
-static int    g_best_time_diff = 0;
 
 
 static struct stream *g_stream_inp = NULL;
@@ -88,9 +86,59 @@ static char g_buffer[MAX_BBUF_SIZE];
 static int g_buf_index = 0;
 static unsigned int g_sent_time[256];
 
-static int g_bbuf_size = 1024 * 8; /* may change later */
+static int g_bbuf_size = 1024 * 8; /* set by sound_chunk_bytes() */
 
-static struct list *g_ack_time_diff = 0;
+/* sizes we can chunk output into, smallest first */
+struct chunk_size
+{
+    int bytes;
+    int msec;
+};
+
+/* at 48000, opus only takes 2.5, 5, 10, 20, 40 or 60 ms frames */
+static const struct chunk_size g_opus_chunk_sizes[] =
+{
+    { 1920, 10 }, { 3840, 20 }, { 7680, 40 }, { 11520, 60 }
+};
+
+/* 44100 stereo 16 bit */
+static const struct chunk_size g_pcm_chunk_sizes[] =
+{
+    { 2048, 12 }, { 4096, 23 }, { 8192, 46 }
+};
+
+/* encoders with a fixed frame size */
+static const struct chunk_size g_aac_chunk_sizes[] = { { 4096, 23 } };
+static const struct chunk_size g_mp3_chunk_sizes[] = { { 11520, 65 } };
+
+/* latency target used when SoundTargetLatency is 0. Chunk sizes
+   aren't changed, and data is dropped when the client gets this far
+   behind the best it has done */
+#define LEGACY_LATENCY_MARGIN 250
+
+/* confirms to wait after changing chunk size before changing it again */
+#define CHUNK_ADJUST_CONFIRMS 16
+
+/* confirms needed before the delay measurements are trusted */
+#define MIN_CONFIRM_SAMPLES 8
+
+/* Tracks how far behind the client is from the time between sending a
+   block and the client confirming it has been played. The smoothing is
+   the same as TCP uses for round trip times (RFC 6298) */
+struct jitter_ctl
+{
+    int srtt;             /* smoothed confirm delay, ms * 8 */
+    int rttvar;           /* smoothed delay deviation, ms * 4 */
+    int min_delay;        /* lowest smoothed delay this stream, ms */
+    int samples;          /* confirms measured this stream */
+    int last_confirmed;   /* last cConfirmedBlockNo */
+    int level;            /* index into the chunk size table */
+    int adjust_countdown; /* confirms until the next size change */
+    int holding;          /* set after dropping data */
+    int hold_block;       /* last block sent before dropping data */
+};
+
+static struct jitter_ctl g_jitter;
 
 struct xr_wave_format_ex
 {
@@ -261,6 +309,7 @@ static int sound_process_input_data(struct stream *s, int bytes);
 static int sound_sndsrvr_source_data_in(struct trans *trans);
 static int sound_start_source_listener(void);
 static int sound_start_sink_listener(void);
+static void sound_jitter_reset(void);
 
 /*****************************************************************************/
 static int
@@ -478,6 +527,8 @@ sound_process_output_formats(struct stream *s, int size)
                                         nAvgBytesPerSec, nBlockAlign, wBitsPerSample,
                                         cbSize, data);
         }
+        /* chunk sizes depend on the codec */
+        sound_jitter_reset();
         sound_send_training();
     }
 
@@ -862,22 +913,185 @@ sound_wave_compress(char *data, int data_bytes, int *format_index)
 {
     if (g_client_does_fdk_aac)
     {
-        g_bbuf_size = 4096;
         return sound_wave_compress_fdk_aac(data, data_bytes, format_index);
     }
     else if (g_client_does_opus)
     {
-        g_bbuf_size = 11520;
         return sound_wave_compress_opus(data, data_bytes, format_index);
     }
     else if (g_client_does_mp3lame)
     {
-        g_bbuf_size = 11520;
         return sound_wave_compress_mp3lame(data, data_bytes, format_index);
     }
     return data_bytes;
 }
 
+/*****************************************************************************/
+/* chunk sizes for the encoder sound_wave_compress() will use */
+static const struct chunk_size *
+sound_chunk_sizes(int *count)
+{
+    if (g_client_does_fdk_aac)
+    {
+        *count = sizeof(g_aac_chunk_sizes) / sizeof(g_aac_chunk_sizes[0]);
+        return g_aac_chunk_sizes;
+    }
+    if (g_client_does_opus)
+    {
+        *count = sizeof(g_opus_chunk_sizes) / sizeof(g_opus_chunk_sizes[0]);
+        return g_opus_chunk_sizes;
+    }
+    if (g_client_does_mp3lame)
+    {
+        *count = sizeof(g_mp3_chunk_sizes) / sizeof(g_mp3_chunk_sizes[0]);
+        return g_mp3_chunk_sizes;
+    }
+    *count = sizeof(g_pcm_chunk_sizes) / sizeof(g_pcm_chunk_sizes[0]);
+    return g_pcm_chunk_sizes;
+}
+
+/*****************************************************************************/
+/* the chunk size currently chosen by the jitter controller */
+static const struct chunk_size *
+sound_chunk_size(void)
+{
+    const struct chunk_size *sizes;
+    int count;
+
+    sizes = sound_chunk_sizes(&count);
+    if (g_jitter.level >= count)
+    {
+        g_jitter.level = count - 1;
+    }
+    return sizes + g_jitter.level;
+}
+
+/*****************************************************************************/
+/* start a new stream with the largest chunk size which leaves room
+   for the client to buffer a chunk within the target latency */
+static void
+sound_jitter_reset(void)
+{
+    const struct chunk_size *sizes;
+    int count;
+    int target;
+
+    g_memset(&g_jitter, 0, sizeof(g_jitter));
+    sizes = sound_chunk_sizes(&count);
+    target = (int) g_cfg->sound_target_latency;
+    g_jitter.last_confirmed = g_cBlockNo & 0xff;
+    g_jitter.level = count - 1;
+    while (target > 0 && g_jitter.level > 0 &&
+            sizes[g_jitter.level].msec * 2 > target)
+    {
+        g_jitter.level--;
+    }
+    g_jitter.adjust_countdown = CHUNK_ADJUST_CONFIRMS;
+}
+
+/*****************************************************************************/
+/* how far behind the client is, in ms. The client can't be less far
+   behind than the blocks it hasn't confirmed yet */
+static int
+sound_jitter_latency(void)
+{
+    int in_flight;
+
+    in_flight = (g_cBlockNo - g_jitter.last_confirmed) & 0xff;
+    return MAX(g_jitter.srtt >> 3, in_flight * sound_chunk_size()->msec);
+}
+
+/*****************************************************************************/
+/* the latency above which data is dropped. Allows for the measured
+   jitter, and never asks for less than the client has managed */
+static int
+sound_jitter_limit(void)
+{
+    int target;
+    int margin;
+
+    target = (int) g_cfg->sound_target_latency;
+    if (target == 0)
+    {
+        return g_jitter.min_delay + LEGACY_LATENCY_MARGIN;
+    }
+    margin = MAX(g_jitter.rttvar, 2 * sound_chunk_size()->msec);
+    return MAX(target, g_jitter.min_delay) + margin;
+}
+
+/*****************************************************************************/
+/* update the controller with the delay of a confirmed block */
+static void
+sound_jitter_update(int block_no, int delay)
+{
+    const struct chunk_size *sizes;
+    int count;
+    int target;
+    int latency;
+    int err;
+
+    if (g_jitter.holding)
+    {
+        /* blocks queued before the drop tell us nothing about the
+           client now */
+        if (((block_no - g_jitter.hold_block) & 0xff) >= 128 ||
+                block_no == g_jitter.hold_block)
+        {
+            return;
+        }
+        g_jitter.holding = 0;
+        g_jitter.samples = 0;
+    }
+    g_jitter.last_confirmed = block_no;
+
+    if (g_jitter.samples == 0)
+    {
+        g_jitter.srtt = delay << 3;
+        g_jitter.rttvar = delay << 1;
+    }
+    else
+    {
+        err = delay - (g_jitter.srtt >> 3);
+        g_jitter.srtt += err;
+        g_jitter.rttvar += ((err < 0) ? -err : err) - (g_jitter.rttvar >> 2);
+    }
+    g_jitter.samples++;
+    if (g_jitter.samples < MIN_CONFIRM_SAMPLES)
+    {
+        return;
+    }
+    if (g_jitter.min_delay < 1 || g_jitter.min_delay > (g_jitter.srtt >> 3))
+    {
+        g_jitter.min_delay = g_jitter.srtt >> 3;
+    }
+
+    target = (int) g_cfg->sound_target_latency;
+    if (target == 0 || --g_jitter.adjust_countdown > 0)
+    {
+        return;
+    }
+    sizes = sound_chunk_sizes(&count);
+    latency = sound_jitter_latency();
+    if (latency > target && g_jitter.level > 0)
+    {
+        g_jitter.level--;
+    }
+    else if (g_jitter.level < count - 1 &&
+             latency + g_jitter.rttvar + sizes[g_jitter.level + 1].msec -
+             sizes[g_jitter.level].msec < target)
+    {
+        g_jitter.level++;
+    }
+    else
+    {
+        return;
+    }
+    g_jitter.adjust_countdown = CHUNK_ADJUST_CONFIRMS;
+    LOG(LOG_LEVEL_DEBUG, "sound_jitter_update: latency %d ms, jitter %d ms, "
+        "chunk now %d ms", latency, g_jitter.rttvar >> 2,
+        sizes[g_jitter.level].msec);
+}
+
 /*****************************************************************************/
 /* send wave message to client */
 static int
@@ -956,19 +1170,37 @@ sound_send_wave_data(char *data, int data_bytes)
     int data_index;
     int error;
     int res;
+    int excess;
+    int drop_bytes;
+    const struct chunk_size *chunk;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: sending %d bytes", data_bytes);
-    if (g_time_diff > g_best_time_diff + 250)
+    data_index = 0;
+    if (g_jitter.samples >= MIN_CONFIRM_SAMPLES && !g_jitter.holding)
     {
-        data_bytes = data_bytes / 4;
-        data_bytes = data_bytes & ~3;
-        g_memset(data, 0, data_bytes);
-        g_time_diff = 0;
+        excess = sound_jitter_latency() - sound_jitter_limit();
+        if (excess > 0)
+        {
+            /* drop enough to get back to the limit, or all of this data */
+            chunk = sound_chunk_size();
+            drop_bytes = (int) ((long) excess * chunk->bytes / chunk->msec);
+            drop_bytes = MIN(drop_bytes, data_bytes) & ~3;
+            LOG(LOG_LEVEL_DEBUG, "sound_send_wave_data: %d ms behind, "
+                "dropping %d bytes", excess, drop_bytes);
+            data_index = drop_bytes;
+            data_bytes -= drop_bytes;
+            g_jitter.holding = 1;
+            g_jitter.hold_block = g_cBlockNo & 0xff;
+        }
     }
-    data_index = 0;
     error = 0;
     while (data_bytes > 0)
     {
+        if (g_buf_index == 0)
+        {
+            /* only change the size between chunks */
+            g_bbuf_size = sound_chunk_size()->bytes;
+        }
         space_left = g_bbuf_size - g_buf_index;
         chunk_bytes = MIN(space_left, data_bytes);
         if (chunk_bytes < 1)
@@ -1014,7 +1246,7 @@ sound_send_close(void)
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_close:");
 
-    g_best_time_diff = 0;
+    sound_jitter_reset();
     g_buf_index = 0;
 
     /* send close msg */
@@ -1054,8 +1286,6 @@ sound_process_wave_confirm(struct stream *s, int size)
     int cConfirmedBlockNo;
     unsigned int time;
     int time_diff;
-    int index;
-    int acc;
 
     time = g_get_elapsed_ms();
     in_uint16_le(s, wTimeStamp);
@@ -1066,25 +1296,7 @@ sound_process_wave_confirm(struct stream *s, int size)
         "cConfirmedBlockNo %d time diff %d",
         wTimeStamp, cConfirmedBlockNo, time_diff);
 
-    acc = 0;
-    list_add_item(g_ack_time_diff, time_diff);
-    if (g_ack_time_diff->count >= 50)
-    {
-        while (g_ack_time_diff->count > 50)
-        {
-            list_remove_item(g_ack_time_diff, 0);
-        }
-        for (index = 0; index < g_ack_time_diff->count; index++)
-        {
-            acc += list_get_item(g_ack_time_diff, index);
-        }
-        acc = acc / g_ack_time_diff->count;
-        if ((g_best_time_diff < 1) || (g_best_time_diff > acc))
-        {
-            g_best_time_diff = acc;
-        }
-    }
-    g_time_diff = acc;
+    sound_jitter_update(cConfirmedBlockNo & 0xff, time_diff);
     return 0;
 }
 
@@ -1127,7 +1339,6 @@ process_pcm_message(int id, int size, struct stream *s)
                         sound_send_wave_data_chunk(buf, g_bbuf_size);
                     }
                     free(buf);
-                    g_time_diff = 0;
                 }
             }
             return sound_send_close();
@@ -1297,11 +1508,7 @@ sound_init(void)
     g_client_does_mp3lame = 0;
     g_client_mp3lame_index = 0;
 
-    if (g_ack_time_diff == 0)
-    {
-        g_ack_time_diff = list_create();
-    }
-    list_clear(g_ack_time_diff);
+    sound_jitter_reset();
 
 #if defined(XRDP_FDK_AAC) || defined(XRDP_MP3LAME)
     LOG(LOG_LEVEL_INFO, "num_silent_frames_aac: %d", g_cfg->num_silent_frames_aac);
@@ -32,6 +32,7 @@
 
 #include "eicp.h"
 #include "eicp_process.h"
+#include "login_queue.h"
 #include "os_calls.h"
 #include "pre_session_list.h"
 #include "scp.h"
@@ -55,6 +56,11 @@ process_sys_login_response(struct pre_session_item *psi)
             psi->username,
             (is_logged_in) ? "logged in" : "not logged in");
 
+        if (is_logged_in)
+        {
+            login_queue_authenticated(psi);
+        }
+
         if (!is_logged_in)
         {
             // This shouldn't happen. Close the connection to the
@@ -41,23 +41,46 @@ static int
 process_session_announce_event(struct session_item *si)
 {
     int rv;
+    uid_t uid;
+    enum scp_session_type type;
+    unsigned short start_width;
+    unsigned short start_height;
+    unsigned char bpp;
+    struct guid guid;
     const char *start_ip_addr;
+    time_t start_time;
 
     rv = ercp_get_session_announce_event(si->sesexec_trans,
                                          NULL,
-                                         &si->uid,
-                                         &si->type,
-                                         &si->start_width,
-                                         &si->start_height,
-                                         &si->bpp,
-                                         &si->guid,
+                                         &uid,
+                                         &type,
+                                         &start_width,
+                                         &start_height,
+                                         &bpp,
+                                         &guid,
                                          &start_ip_addr,
-                                         &si->start_time);
+                                         &start_time);
     if (rv == 0)
     {
+        if (si->state == E_SESSION_RUNNING)
+        {
+            /* The session is indexed on these fields, so they can't
+             * be changed now */
+            LOG(LOG_LEVEL_WARNING, "Ignoring repeated announcement of "
+                "session on display %d", si->display);
+            return 0;
+        }
+
+        si->uid = uid;
+        si->type = type;
+        si->start_width = start_width;
+        si->start_height = start_height;
+        si->bpp = bpp;
+        si->guid = guid;
         snprintf(si->start_ip_addr, sizeof(si->start_ip_addr),
                  "%s", start_ip_addr);
-        si->state = E_SESSION_RUNNING;
+        si->start_time = start_time;
+        session_list_set_running(si);
     }
 
     return rv;
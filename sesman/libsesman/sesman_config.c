@@ -72,6 +72,9 @@
 #define SESMAN_CFG_SEC_ALLOW_ALTERNATE_SHELL       "AllowAlternateShell"
 #define SESMAN_CFG_SEC_XORG_NO_NEW_PRIVILEGES      "XorgNoNewPrivileges"
 #define SESMAN_CFG_SEC_SESSION_SOCKDIR_GROUP       "SessionSockdirGroup"
+#define SESMAN_CFG_SEC_MAX_CONCURRENT_LOGINS       "MaxConcurrentLogins"
+#define SESMAN_CFG_SEC_MAX_QUEUED_LOGINS           "MaxQueuedLogins"
+#define SESMAN_CFG_SEC_LOGIN_TIMEOUT               "LoginTimeout"
 
 #define SESMAN_CFG_SESSIONS          "Sessions"
 #define SESMAN_CFG_SESS_MAX          "MaxSessions"
@@ -80,6 +83,10 @@
 #define SESMAN_CFG_SESS_DISC_LIMIT   "DisconnectedTimeLimit"
 #define SESMAN_CFG_SESS_X11DISPLAYOFFSET "X11DisplayOffset"
 #define SESMAN_CFG_SESS_MAX_DISPLAY  "MaxDisplayNumber"
+#define SESMAN_CFG_SESS_SESEXEC_POOL "SesexecPoolSize"
+
+/* Upper limit for SesexecPoolSize */
+#define MAX_SESEXEC_POOL_SIZE 16
 
 #define SESMAN_CFG_SESS_POLICY_S "Policy"
 #define SESMAN_CFG_SESS_POLICY_DFLT_S "Default"
@@ -314,6 +321,9 @@ config_read_security(int file, struct config_security *sc,
     sc->ts_users = g_strdup("");
     sc->ts_admins = g_strdup("");
     sc->session_sockdir_group = g_strdup("");
+    sc->max_concurrent_logins = 16;
+    sc->max_queued_logins = 64;
+    sc->login_timeout = 60;
 
     file_read_section(file, SESMAN_CFG_SECURITY, param_n, param_v);
 
@@ -387,6 +397,44 @@ config_read_security(int file, struct config_security *sc,
             g_free(sc->session_sockdir_group);
             sc->session_sockdir_group = g_strdup(value);
         }
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SEC_MAX_CONCURRENT_LOGINS))
+        {
+            int mcl = g_atoi(value);
+            if (mcl > SESMAN_CFG_MAX_CONCURRENT_LOGINS_LIMIT)
+            {
+                LOG(LOG_LEVEL_WARNING, "'%s' is limited to %d",
+                    SESMAN_CFG_SEC_MAX_CONCURRENT_LOGINS,
+                    SESMAN_CFG_MAX_CONCURRENT_LOGINS_LIMIT);
+                mcl = SESMAN_CFG_MAX_CONCURRENT_LOGINS_LIMIT;
+            }
+            if (mcl > 0)
+            {
+                sc->max_concurrent_logins = mcl;
+            }
+        }
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SEC_MAX_QUEUED_LOGINS))
+        {
+            int mql = g_atoi(value);
+            if (mql > SESMAN_CFG_MAX_QUEUED_LOGINS_LIMIT)
+            {
+                LOG(LOG_LEVEL_WARNING, "'%s' is limited to %d",
+                    SESMAN_CFG_SEC_MAX_QUEUED_LOGINS,
+                    SESMAN_CFG_MAX_QUEUED_LOGINS_LIMIT);
+                mql = SESMAN_CFG_MAX_QUEUED_LOGINS_LIMIT;
+            }
+            if (mql >= 0)
+            {
+                sc->max_queued_logins = mql;
+            }
+        }
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SEC_LOGIN_TIMEOUT))
+        {
+            int lt = g_atoi(value);
+            if (lt >= 0)
+            {
+                sc->login_timeout = lt;
+            }
+        }
     }
 
     return 0;
@@ -422,6 +470,7 @@ config_read_sessions(int file, struct config_sessions *se, struct list *param_n,
     se->max_disc_time = 0;
     se->kill_disconnected = 0;
     se->policy = SESMAN_CFG_SESS_POLICY_DEFAULT;
+    se->sesexec_pool_size = 0;
 
     file_read_section(file, SESMAN_CFG_SESSIONS, param_n, param_v);
 
@@ -476,6 +525,19 @@ config_read_sessions(int file, struct config_sessions *se, struct list *param_n,
         {
             se->policy = parse_policy_string(value);
         }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_SESEXEC_POOL))
+        {
+            int ps = g_atoi(value);
+            if (ps > MAX_SESEXEC_POOL_SIZE)
+            {
+                se->sesexec_pool_size = MAX_SESEXEC_POOL_SIZE;
+            }
+            else if (ps >= 0)
+            {
+                se->sesexec_pool_size = ps;
+            }
+        }
     }
 
     return 0;
@@ -667,6 +729,7 @@ config_dump(struct config_sesman *config)
     g_writeln("    IdleTimeLimit:            %d", se->max_idle_time);
     g_writeln("    DisconnectedTimeLimit:    %d", se->max_disc_time);
     g_writeln("    Policy:                   %s", policy_s);
+    g_writeln("    SesexecPoolSize:          %u", se->sesexec_pool_size);
 
     /* Security configuration */
     g_writeln("Security configuration:");
@@ -687,6 +750,9 @@ config_dump(struct config_sesman *config)
     g_writeln("    TSUsersGroup:              %s", sc->ts_users);
     g_writeln("    TSAdminsGroup:             %s", sc->ts_admins);
     g_writeln("    SessionSockdirGroup:       %s", sc->session_sockdir_group);
+    g_writeln("    MaxConcurrentLogins:       %u", sc->max_concurrent_logins);
+    g_writeln("    MaxQueuedLogins:           %u", sc->max_queued_logins);
+    g_writeln("    LoginTimeout:              %u", sc->login_timeout);
 
 
     /* Xorg */
@@ -50,6 +50,13 @@ enum SESMAN_CFG_SESS_POLICY_BITS
  */
 #define DEFAULT_SESMAN_INI XRDP_CFG_PATH "/sesman.ini"
 
+/**
+ * Upper limits for MaxConcurrentLogins and MaxQueuedLogins. Every login
+ * adds an object to the sesman main loop wait, which has a fixed size
+ */
+#define SESMAN_CFG_MAX_CONCURRENT_LOGINS_LIMIT 64
+#define SESMAN_CFG_MAX_QUEUED_LOGINS_LIMIT 64
+
 /**
  *
  * @struct config_security
@@ -115,6 +122,24 @@ struct config_security
      * @brief Group to have read access to the session sockdirs
      */
     char *session_sockdir_group;
+
+    /**
+     * @var max_concurrent_logins
+     * @brief Logins authenticated at once
+     */
+    unsigned int max_concurrent_logins;
+
+    /**
+     * @var max_queued_logins
+     * @brief Logins allowed to wait for authentication
+     */
+    unsigned int max_queued_logins;
+
+    /**
+     * @var login_timeout
+     * @brief Seconds allowed for a login to be authenticated. 0 for no limit
+     */
+    unsigned int login_timeout;
 };
 
 /**
@@ -160,6 +185,11 @@ struct config_sessions
      * @brief session allocation policy
      */
     unsigned int policy;
+    /**
+     * @var sesexec_pool_size
+     * @brief number of idle sesexec processes to keep ready for logins
+     */
+    unsigned int sesexec_pool_size;
 };
 
 /**
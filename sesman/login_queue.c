@@ -0,0 +1,460 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file login_queue.c
+ * @brief Limits the number of system logins being authenticated at once
+ *
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "arch.h"
+#include "eicp.h"
+#include "list.h"
+#include "log.h"
+#include "os_calls.h"
+#include "scp.h"
+#include "string_calls.h"
+#include "trans.h"
+
+#include "login_queue.h"
+#include "pre_session_list.h"
+#include "sesexec_control.h"
+#include "sesman.h"
+#include "sesman_config.h"
+
+struct login_request
+{
+    struct pre_session_item *psi;
+    char *password; ///< Only kept while the login is queued
+    unsigned int request_time; ///< When the client asked to log in
+    unsigned int start_time; ///< When sesexec was asked to authenticate
+};
+
+/* Logins waiting for sesexec, oldest first */
+static struct list *g_queued = NULL;
+/* Logins being authenticated by sesexec */
+static struct list *g_active = NULL;
+/* Set when a pre-session has been left for the dispatcher to terminate */
+static int g_terminate_pending = 0;
+
+/******************************************************************************/
+static void
+free_request(struct login_request *lr)
+{
+    if (lr->password != NULL)
+    {
+        g_memset(lr->password, '\0', g_strlen(lr->password));
+        g_free(lr->password);
+    }
+    g_free(lr);
+}
+
+/******************************************************************************/
+/* Returns the index of a pre-session item on a list, or -1 */
+static int
+find_request(struct list *l, const struct pre_session_item *psi)
+{
+    int i;
+
+    for (i = 0 ; i < l->count; ++i)
+    {
+        if (((struct login_request *)list_get_item(l, i))->psi == psi)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/******************************************************************************/
+/* Returns non-zero if a queued login can be started now */
+static int
+have_free_worker(void)
+{
+    return ((unsigned int)g_active->count < g_cfg->sec.max_concurrent_logins);
+}
+
+/******************************************************************************/
+/**
+ * Creates a sesexec process, and asks it to authenticate the user
+ *
+ * @param psi Pre-session item
+ * @param password Password for the user
+ * @return Status to send to the client if the login can't be started
+ */
+static enum scp_login_status
+start_login(struct pre_session_item *psi, const char *password)
+{
+    /* We won't check for the user being valid here, as this might
+     * lead to information leakage */
+    if (sesexec_start(psi) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't start sesexec to authenticate user");
+        return E_SCP_LOGIN_GENERAL_ERROR;
+    }
+
+    if (eicp_send_sys_login_request(psi->sesexec_trans,
+                                    psi->username,
+                                    password,
+                                    psi->start_ip_addr,
+                                    psi->client_trans->sck) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't ask sesexec to authenticate user");
+        return E_SCP_LOGIN_GENERAL_ERROR;
+    }
+
+    return E_SCP_LOGIN_OK;
+}
+
+/******************************************************************************/
+/* Moves a request to the active list once the login is started */
+static void
+make_active(struct login_request *lr)
+{
+    if (lr->password != NULL)
+    {
+        g_memset(lr->password, '\0', g_strlen(lr->password));
+        g_free(lr->password);
+        lr->password = NULL;
+    }
+    lr->start_time = g_get_elapsed_ms();
+
+    if (list_add_item(g_active, (tintptr)lr))
+    {
+        lr->psi->auth_state = E_PS_AUTH_ACTIVE;
+    }
+    else
+    {
+        /* The login carries on, but isn't counted or timed */
+        LOG(LOG_LEVEL_ERROR, "Can't track login for %s", lr->psi->username);
+        lr->psi->auth_state = E_PS_AUTH_NONE;
+        free_request(lr);
+    }
+}
+
+/******************************************************************************/
+enum scp_login_status
+login_queue_add(struct pre_session_item *psi, const char *password)
+{
+    enum scp_login_status status = E_SCP_LOGIN_OK;
+    struct login_request *lr;
+
+    if (g_queued == NULL)
+    {
+        g_queued = list_create();
+        g_active = list_create();
+        if (g_queued == NULL || g_active == NULL)
+        {
+            list_delete(g_queued);
+            list_delete(g_active);
+            g_queued = NULL;
+            g_active = NULL;
+            return E_SCP_LOGIN_NO_MEMORY;
+        }
+    }
+
+    if ((lr = g_new0(struct login_request, 1)) == NULL)
+    {
+        return E_SCP_LOGIN_NO_MEMORY;
+    }
+    lr->psi = psi;
+    lr->request_time = g_get_elapsed_ms();
+
+    if (g_queued->count == 0 && have_free_worker())
+    {
+        status = start_login(psi, password);
+        if (status == E_SCP_LOGIN_OK)
+        {
+            make_active(lr);
+            /* We've handed over responsibility for the
+             * SCP communication */
+            psi->dispatcher_action = E_PSD_REMOVE_CLIENT_TRANS;
+        }
+        else
+        {
+            free_request(lr);
+        }
+    }
+    else if ((unsigned int)g_queued->count >= g_cfg->sec.max_queued_logins)
+    {
+        LOG(LOG_LEVEL_WARNING, "Rejecting login for %s. %d logins are in "
+            "progress and %d are queued",
+            psi->username, g_active->count, g_queued->count);
+        free_request(lr);
+        status = E_SCP_LOGIN_GENERAL_ERROR;
+    }
+    else if ((lr->password = g_strdup(password)) == NULL ||
+             !list_add_item(g_queued, (tintptr)lr))
+    {
+        free_request(lr);
+        status = E_SCP_LOGIN_NO_MEMORY;
+    }
+    else
+    {
+        psi->auth_state = E_PS_AUTH_QUEUED;
+        LOG(LOG_LEVEL_INFO, "Queued login for %s. %d logins are in "
+            "progress and %d are queued",
+            psi->username, g_active->count, g_queued->count);
+    }
+
+    return status;
+}
+
+/******************************************************************************/
+void
+login_queue_authenticated(struct pre_session_item *psi)
+{
+    struct login_request *lr;
+    int i;
+
+    if (psi->auth_state == E_PS_AUTH_ACTIVE &&
+            (i = find_request(g_active, psi)) >= 0)
+    {
+        lr = (struct login_request *)list_get_item(g_active, i);
+        list_remove_item(g_active, i);
+        LOG(LOG_LEVEL_INFO, "Authenticated %s in %u ms, after %u ms "
+            "queued. %d logins are in progress and %d are queued",
+            psi->username,
+            g_get_elapsed_ms() - lr->start_time,
+            lr->start_time - lr->request_time,
+            g_active->count, g_queued->count);
+        free_request(lr);
+    }
+    psi->auth_state = E_PS_AUTH_NONE;
+}
+
+/******************************************************************************/
+void
+login_queue_remove(struct pre_session_item *psi)
+{
+    struct login_request *lr;
+    int i;
+
+    if (psi->auth_state == E_PS_AUTH_QUEUED &&
+            (i = find_request(g_queued, psi)) >= 0)
+    {
+        lr = (struct login_request *)list_get_item(g_queued, i);
+        list_remove_item(g_queued, i);
+        LOG(LOG_LEVEL_INFO, "Queued login for %s abandoned by the client",
+            psi->username);
+        free_request(lr);
+    }
+    else if (psi->auth_state == E_PS_AUTH_ACTIVE &&
+             (i = find_request(g_active, psi)) >= 0)
+    {
+        /* sesexec has rejected the user, or failed */
+        lr = (struct login_request *)list_get_item(g_active, i);
+        list_remove_item(g_active, i);
+        LOG(LOG_LEVEL_INFO, "Login for %s failed after %u ms, after %u ms "
+            "queued", psi->username,
+            g_get_elapsed_ms() - lr->start_time,
+            lr->start_time - lr->request_time);
+        free_request(lr);
+    }
+    psi->auth_state = E_PS_AUTH_NONE;
+}
+
+/******************************************************************************/
+unsigned int
+login_queue_get_count(void)
+{
+    return (g_queued == NULL) ? 0 : g_queued->count + g_active->count;
+}
+
+/******************************************************************************/
+/* Returns when a login's timer was started. Time in the queue and time
+ * being authenticated are limited separately */
+static unsigned int
+timer_start(const struct login_request *lr)
+{
+    return (lr->psi->auth_state == E_PS_AUTH_ACTIVE) ?
+           lr->start_time : lr->request_time;
+}
+
+/******************************************************************************/
+/* Reduces a timeout to the time left before a login times out */
+static void
+reduce_timeout(struct list *l, unsigned int now, int *timeout)
+{
+    unsigned int timeout_ms = g_cfg->sec.login_timeout * 1000;
+    unsigned int elapsed;
+    int left;
+    int i;
+
+    for (i = 0 ; i < l->count; ++i)
+    {
+        elapsed = now - timer_start((struct login_request *)
+                                    list_get_item(l, i));
+        left = (elapsed >= timeout_ms) ? 0 : (int)(timeout_ms - elapsed);
+        if (*timeout < 0 || left < *timeout)
+        {
+            *timeout = left;
+        }
+    }
+}
+
+/******************************************************************************/
+void
+login_queue_get_timeout(int *timeout)
+{
+    unsigned int now = g_get_elapsed_ms();
+
+    if (g_terminate_pending)
+    {
+        /* The pre-session list was checked before we abandoned a login,
+         * so the pre-session won't be freed until the next wait returns */
+        *timeout = 0;
+    }
+    else if (g_queued == NULL)
+    {
+        return;
+    }
+    else if (g_queued->count > 0 && have_free_worker())
+    {
+        /* A login finished since we last looked */
+        *timeout = 0;
+    }
+    else if (g_cfg->sec.login_timeout > 0)
+    {
+        reduce_timeout(g_queued, now, timeout);
+        reduce_timeout(g_active, now, timeout);
+    }
+}
+
+/******************************************************************************/
+int
+login_queue_check_wait_objs(void)
+{
+    unsigned int timeout_ms = g_cfg->sec.login_timeout * 1000;
+    unsigned int now = g_get_elapsed_ms();
+    struct login_request *lr;
+    struct pre_session_item *psi;
+    int i;
+
+    /* The pre-session list has been checked, so anything we left for
+     * the dispatcher to terminate has now gone */
+    g_terminate_pending = 0;
+
+    if (g_queued == NULL)
+    {
+        return 0;
+    }
+
+    /* Abandon logins which have taken too long */
+    for (i = g_active->count - 1 ; timeout_ms > 0 && i >= 0; --i)
+    {
+        lr = (struct login_request *)list_get_item(g_active, i);
+        psi = lr->psi;
+        if (now - lr->start_time >= timeout_ms)
+        {
+            /* sesexec is probably stuck in PAM, so a SIGTERM may not
+             * be seen. Killing it closes the client connection */
+            LOG(LOG_LEVEL_WARNING, "Login for %s timed out after %u ms. "
+                "Stopping sesexec (pid %d)",
+                psi->username, now - lr->start_time,
+                (int)psi->sesexec_pid);
+            g_sigkill(psi->sesexec_pid);
+            psi->sesexec_trans->status = TRANS_STATUS_DOWN;
+            psi->auth_state = E_PS_AUTH_NONE;
+            list_remove_item(g_active, i);
+            free_request(lr);
+        }
+    }
+
+    for (i = g_queued->count - 1 ; timeout_ms > 0 && i >= 0; --i)
+    {
+        lr = (struct login_request *)list_get_item(g_queued, i);
+        psi = lr->psi;
+        if (now - lr->request_time >= timeout_ms)
+        {
+            LOG(LOG_LEVEL_WARNING, "Login for %s timed out after %u ms "
+                "in the login queue", psi->username, now - lr->request_time);
+            (void)scp_send_login_response(psi->client_trans,
+                                          E_SCP_LOGIN_GENERAL_ERROR, 1, -1);
+            psi->dispatcher_action = E_PSD_TERMINATE_PRE_SESSION;
+            psi->auth_state = E_PS_AUTH_NONE;
+            g_terminate_pending = 1;
+            list_remove_item(g_queued, i);
+            free_request(lr);
+        }
+    }
+
+    /* Start queued logins, oldest first */
+    while (g_queued->count > 0 && have_free_worker())
+    {
+        lr = (struct login_request *)list_get_item(g_queued, 0);
+        list_remove_item(g_queued, 0);
+        psi = lr->psi;
+        LOG(LOG_LEVEL_DEBUG, "Starting login for %s after %u ms queued",
+            psi->username, now - lr->request_time);
+        if (start_login(psi, lr->password) == E_SCP_LOGIN_OK)
+        {
+            /* We're not in a callback for the client transport, so
+             * we can remove it here */
+            trans_delete(psi->client_trans);
+            psi->client_trans = NULL;
+            make_active(lr);
+        }
+        else
+        {
+            (void)scp_send_login_response(psi->client_trans,
+                                          E_SCP_LOGIN_GENERAL_ERROR, 1, -1);
+            psi->dispatcher_action = E_PSD_TERMINATE_PRE_SESSION;
+            psi->auth_state = E_PS_AUTH_NONE;
+            g_terminate_pending = 1;
+            free_request(lr);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+static void
+free_request_list(struct list *l)
+{
+    struct login_request *lr;
+    int i;
+
+    for (i = 0 ; i < l->count; ++i)
+    {
+        lr = (struct login_request *)list_get_item(l, i);
+        lr->psi->auth_state = E_PS_AUTH_NONE;
+        free_request(lr);
+    }
+    list_delete(l);
+}
+
+/******************************************************************************/
+void
+login_queue_cleanup(void)
+{
+    if (g_queued != NULL)
+    {
+        free_request_list(g_queued);
+        free_request_list(g_active);
+        g_queued = NULL;
+        g_active = NULL;
+    }
+    g_terminate_pending = 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file login_queue.h
+ * @brief Limits the number of system logins being authenticated at once
+ *
+ * Each system login is authenticated by its own sesexec process. At most
+ * MaxConcurrentLogins of these run at once. Further logins wait on a
+ * queue of up to MaxQueuedLogins entries, and are rejected if the queue
+ * is full. A login which waits in the queue for longer than
+ * LoginTimeout, or which sesexec takes longer than LoginTimeout to
+ * authenticate, is abandoned.
+ */
+
+#ifndef LOGIN_QUEUE_H
+#define LOGIN_QUEUE_H
+
+#include "scp_application_types.h"
+
+struct pre_session_item;
+
+/**
+ * Starts or queues a system login
+ *
+ * @param psi Pre-session item. The username and start_ip_addr fields
+ *            must be set.
+ * @param password Password for the user
+ * @return E_SCP_LOGIN_OK if the login has been started or queued. Any
+ *         other value must be sent to the client.
+ *
+ * This must be called from the SCP callback for psi. If the login is
+ * started, the dispatcher is asked to remove the client transport, as
+ * sesexec is now handling the client.
+ */
+enum scp_login_status
+login_queue_add(struct pre_session_item *psi, const char *password);
+
+/**
+ * Tells the login queue sesexec has authenticated a user
+ *
+ * @param psi Pre-session item
+ */
+void
+login_queue_authenticated(struct pre_session_item *psi);
+
+/**
+ * Removes a pre-session item from the login queue, if it's on it
+ *
+ * @param psi Pre-session item
+ *
+ * A queued login is never started by this call
+ */
+void
+login_queue_remove(struct pre_session_item *psi);
+
+/**
+ * Returns the number of queued and active logins
+ * @return login count
+ */
+unsigned int
+login_queue_get_count(void);
+
+/**
+ * Gets the time until the login queue next needs checking
+ *
+ * @param[in,out] timeout Timeout for g_obj_wait() in milliseconds, or -1.
+ *                        Reduced if the queue needs checking sooner
+ */
+void
+login_queue_get_timeout(int *timeout);
+
+/**
+ * Starts queued logins if there's room, and abandons logins which
+ * have taken too long
+ *
+ * @return 0 for success
+ *
+ * This must not be called from an SCP or EICP callback
+ */
+int
+login_queue_check_wait_objs(void);
+
+/**
+ * Discards all queued and active logins
+ *
+ * Call before the pre-session list is cleaned up. No sesexec processes
+ * are stopped, and nothing is logged, so this can be used after a fork.
+ */
+void
+login_queue_cleanup(void);
+
+#endif // LOGIN_QUEUE_H
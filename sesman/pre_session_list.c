@@ -31,6 +31,7 @@
 
 #include "arch.h"
 #include "list.h"
+#include "login_queue.h"
 #include "os_calls.h"
 #include "pre_session_list.h"
 #include "trans.h"
@@ -61,6 +62,7 @@ free_pre_session_item(struct pre_session_item *psi)
 {
     if (psi != NULL)
     {
+        login_queue_remove(psi);
         trans_delete(psi->client_trans);
         trans_delete(psi->sesexec_trans);
         g_free(psi->username);
@@ -45,6 +45,16 @@ enum ps_login_state
     E_PS_LOGIN_UDS
 };
 
+/**
+ * Type describing the state of a system login for a pre-session item
+ */
+enum ps_auth_state
+{
+    E_PS_AUTH_NONE = 0, ///< No system login is in progress
+    E_PS_AUTH_QUEUED, ///< Waiting for a login worker
+    E_PS_AUTH_ACTIVE ///< sesexec is authenticating the user
+};
+
 /**
  * Action we require the dispatcher to do for us
  *
@@ -70,6 +80,7 @@ struct pre_session_item
     pid_t sesexec_pid; ///< PID of sesexec (if sesexec is active)
     char peername[15 + 1]; ///< Name of peer, if known, for logging
     enum ps_login_state login_state; ///< Login state
+    enum ps_auth_state auth_state; ///< System login state (login_queue.c)
     /**
      * Any action which a callback requires the dispatcher to
      * do out of scope of the callback */
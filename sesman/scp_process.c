@@ -40,11 +40,13 @@
 #include "sesman_auth.h"
 #include "sesman_config.h"
 #include "os_calls.h"
+#include "login_queue.h"
 #include "pre_session_list.h"
 #include "session_list.h"
 #include "sesexec_control.h"
 #include "string_calls.h"
 #include "xrdp_sockets.h"
+#include "probes.h"
 
 /******************************************************************************/
 
@@ -88,7 +90,8 @@ process_sys_login_request(struct pre_session_item *psi)
             "Received system login request from %s for user: %s IP: %s",
             psi->peername, username, ip_addr);
 
-        if (psi->login_state != E_PS_LOGIN_NOT_LOGGED_IN)
+        if (psi->login_state != E_PS_LOGIN_NOT_LOGGED_IN ||
+                psi->auth_state != E_PS_AUTH_NONE)
         {
             errorcode = E_SCP_LOGIN_ALREADY_LOGGED_IN;
             LOG(LOG_LEVEL_ERROR, "Connection is already logged in for %s",
@@ -110,44 +113,20 @@ process_sys_login_request(struct pre_session_item *psi)
             g_snprintf(psi->start_ip_addr, sizeof(psi->start_ip_addr),
                        "%s", ip_addr);
 
-            /* Create a sesexec process to handle the login
-             *
-             * We won't check for the user being valid here, as this might
-             * lead to information leakage */
-            if (sesexec_start(psi) != 0)
-            {
-                LOG(LOG_LEVEL_ERROR,
-                    "Can't start sesexec to authenticate user");
-                errorcode = E_SCP_LOGIN_GENERAL_ERROR;
-            }
-            else
+            /* Start the login, or queue it if too many logins
+             * are being authenticated already */
+            errorcode = login_queue_add(psi, password);
+            if (errorcode == E_SCP_LOGIN_OK)
             {
-                int eicp_stat;
-                eicp_stat = eicp_send_sys_login_request(psi->sesexec_trans,
-                                                        username,
-                                                        password,
-                                                        ip_addr,
-                                                        psi->client_trans->sck);
-                if (eicp_stat != 0)
-                {
-                    LOG(LOG_LEVEL_ERROR,
-                        "Can't ask sesexec to authenticate user");
-                    errorcode = E_SCP_LOGIN_GENERAL_ERROR;
-                }
-                else
-                {
-                    /* We've handed over responsibility for the
-                     * SCP communication */
-                    send_client_reply = 0;
-                    psi->dispatcher_action = E_PSD_REMOVE_CLIENT_TRANS;
-                }
+                send_client_reply = 0;
             }
         }
 
         if (send_client_reply)
         {
             /* We only get here if something has gone
-             * wrong with the handover to sesexec */
+             * wrong with the handover to sesexec, or the login
+             * queue is full */
             rv = scp_send_login_response(psi->client_trans, errorcode, 1, -1);
             psi->dispatcher_action = E_PSD_TERMINATE_PRE_SESSION;
         }
@@ -511,7 +490,12 @@ process_create_session_request(struct pre_session_item *psi)
 
                     // Add the display to the session item so we don't try
                     // to allocate it to another session
-                    s_item->display = display;
+                    if (session_list_set_display(s_item, display) != 0)
+                    {
+                        LOG(LOG_LEVEL_WARNING,
+                            "Can't reserve display :%d", display);
+                    }
+                    XRDP_PROBE3(session_create, psi->uid, display, type);
                 }
             }
         }
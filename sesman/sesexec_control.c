@@ -103,8 +103,53 @@ create_exec_args(void)
 }
 
 /*****************************************************************************/
-int
-sesexec_start(struct pre_session_item *psi)
+/**
+ * Idle sesexec processes, started before they're needed
+ *
+ * Starting sesexec involves an exec() and reading the config. Doing this
+ * in advance takes it out of the time taken to log in.
+ */
+struct pool_item
+{
+    struct trans *trans;
+    pid_t pid;
+};
+
+#define MAX_POOL_ITEMS 16
+
+static struct pool_item g_pool[MAX_POOL_ITEMS];
+static unsigned int g_pool_count = 0;
+
+/* If a pooled sesexec fails, we don't refill the pool before
+ * g_pool_refill_time, to avoid a fork loop if sesexec can't run.
+ * g_pool_refill_time is only valid while g_pool_refill_paused is set */
+static int g_pool_refill_paused = 0;
+static unsigned int g_pool_refill_time;
+#define POOL_REFILL_DELAY_MS 10000
+
+/*****************************************************************************/
+/**
+ * Data in callback for a pooled sesexec.
+ *
+ * Sesexec doesn't send anything until it's been asked to do something.
+ */
+static int
+pool_eicp_data_in(struct trans *self)
+{
+    LOG(LOG_LEVEL_ERROR, "Unexpected message from idle sesexec");
+    return 1;
+}
+
+/*****************************************************************************/
+/**
+ * Starts a sesexec process
+ *
+ * @param[out] trans EICP transport to sesexec
+ * @param[out] sesexec_pid PID of sesexec
+ * @result 0 for success
+ */
+static int
+start_process(struct trans **trans, pid_t *sesexec_pid)
 {
     // Local socket pair used to set up the EICP channel for sesexec
     // We also use the socket pair to communicate the PID of sesexec back
@@ -213,10 +258,8 @@ sesexec_start(struct pre_session_item *psi)
                 }
                 else
                 {
-                    t->trans_data_in = sesman_eicp_data_in;
-                    t->callback_data = (void *)psi;
-                    psi->sesexec_trans = t;
-                    psi->sesexec_pid = pid;
+                    *trans = t;
+                    *sesexec_pid = pid;
                     rv = 0;
                 }
             }
@@ -226,3 +269,134 @@ sesexec_start(struct pre_session_item *psi)
     list_delete(args);
     return rv;
 }
+
+/*****************************************************************************/
+int
+sesexec_start(struct pre_session_item *psi)
+{
+    struct trans *t;
+    pid_t pid;
+
+    if (g_pool_count > 0)
+    {
+        // Use the most recently started process
+        --g_pool_count;
+        t = g_pool[g_pool_count].trans;
+        pid = g_pool[g_pool_count].pid;
+        LOG(LOG_LEVEL_DEBUG, "Using pre-started sesexec pid %d", pid);
+    }
+    else if (start_process(&t, &pid) != 0)
+    {
+        return -1;
+    }
+
+    t->trans_data_in = sesman_eicp_data_in;
+    t->callback_data = (void *)psi;
+    psi->sesexec_trans = t;
+    psi->sesexec_pid = pid;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+sesexec_pool_get_wait_objs(tbus robjs[], int *robjs_count)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < g_pool_count; ++i)
+    {
+        if (trans_get_wait_objs(g_pool[i].trans, robjs, robjs_count) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Stops the pool being refilled for a while after a sesexec fails
+ */
+static void
+pause_refill(void)
+{
+    g_pool_refill_paused = 1;
+    g_pool_refill_time = g_get_elapsed_ms() + POOL_REFILL_DELAY_MS;
+}
+
+/*****************************************************************************/
+int
+sesexec_pool_check_wait_objs(void)
+{
+    unsigned int i = 0;
+    unsigned int target;
+
+    // Remove any processes which have gone away
+    while (i < g_pool_count)
+    {
+        if (trans_check_wait_objs(g_pool[i].trans) != 0 ||
+                g_pool[i].trans->status != TRANS_STATUS_UP)
+        {
+            LOG(LOG_LEVEL_WARNING, "Pre-started sesexec pid %d has exited",
+                g_pool[i].pid);
+            trans_delete(g_pool[i].trans);
+            g_pool[i] = g_pool[--g_pool_count];
+            pause_refill();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    target = g_cfg->sess.sesexec_pool_size;
+    if (target > MAX_POOL_ITEMS)
+    {
+        target = MAX_POOL_ITEMS;
+    }
+
+    // Shrink the pool if it's been reconfigured...
+    while (g_pool_count > target)
+    {
+        --g_pool_count;
+        trans_delete(g_pool[g_pool_count].trans);
+    }
+
+    // ...or top it up
+    if (g_pool_refill_paused &&
+            (int)(g_get_elapsed_ms() - g_pool_refill_time) >= 0)
+    {
+        g_pool_refill_paused = 0;
+    }
+
+    if (g_pool_count < target && !g_pool_refill_paused)
+    {
+        while (g_pool_count < target)
+        {
+            struct pool_item *pi = &g_pool[g_pool_count];
+            if (start_process(&pi->trans, &pi->pid) != 0)
+            {
+                pause_refill();
+                break;
+            }
+            pi->trans->trans_data_in = pool_eicp_data_in;
+            pi->trans->callback_data = NULL;
+            ++g_pool_count;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+void
+sesexec_pool_clear(void)
+{
+    // Closing the EICP transport makes sesexec exit
+    while (g_pool_count > 0)
+    {
+        --g_pool_count;
+        trans_delete(g_pool[g_pool_count].trans);
+    }
+}
@@ -30,6 +30,8 @@
 
 #include <sys/types.h>
 
+#include "arch.h"
+
 struct trans;
 struct pre_session_item;
 
@@ -46,4 +48,32 @@ struct pre_session_item;
 int
 sesexec_start(struct pre_session_item *psi);
 
+/**
+ * @brief Get the wait objs for the idle sesexec pool
+ * @param @robjs Objects array to update
+ * @param robjs_count Elements in robjs (by reference)
+ * @return 0 for success
+ */
+int
+sesexec_pool_get_wait_objs(tbus robjs[], int *robjs_count);
+
+/**
+ * @brief Check the wait objs for the idle sesexec pool
+ * @return 0 for success
+ *
+ * Processes which have exited are removed, and the pool is topped up
+ * to the SesexecPoolSize configured in sesman.ini
+ */
+int
+sesexec_pool_check_wait_objs(void);
+
+/**
+ * @brief Stops all the idle sesexec processes in the pool
+ *
+ * Call on exit, or when the config changes. The pool is refilled by
+ * the next call to sesexec_pool_check_wait_objs()
+ */
+void
+sesexec_pool_clear(void);
+
 #endif // SESEXEC_H
@@ -42,6 +42,7 @@
 #include "pre_session_list.h"
 #include "session_list.h"
 #include "lock_uds.h"
+#include "login_queue.h"
 #include "os_calls.h"
 #include "scp.h"
 #include "scp_process.h"
@@ -207,8 +208,10 @@ sesman_close_all(void)
 {
     LOG_DEVEL(LOG_LEVEL_TRACE, "sesman_close_all:");
 
+    login_queue_cleanup();
     pre_session_list_cleanup();
     session_list_cleanup();
+    sesexec_pool_clear();
 
     g_delete_wait_obj(g_reload_event);
     g_delete_wait_obj(g_sigchld_event);
@@ -248,7 +251,9 @@ static int
 sesman_listen_conn_in(struct trans *self, struct trans *new_self)
 {
     struct pre_session_item *psi;
-    if (pre_session_list_get_count() >= MAX_PRE_SESSION_ITEMS)
+    /* Logins waiting for authentication are limited separately */
+    if (pre_session_list_get_count() - login_queue_get_count() >=
+            MAX_PRE_SESSION_ITEMS)
     {
         LOG(LOG_LEVEL_ERROR, "sesman_listen_conn_in: error, too many "
             "connections, rejecting");
@@ -457,6 +462,7 @@ sesman_main_loop(void)
 {
     int error;
     int robjs_count;
+    int timeout;
     intptr_t robjs[1024];
 
     g_con_list = list_create();
@@ -474,10 +480,12 @@ sesman_main_loop(void)
     }
     LOG(LOG_LEVEL_INFO, "Sesman now listening on %s", g_cfg->listen_port);
 
-    error = 0;
+    /* Fill the sesexec pool, if there is one */
+    error = sesexec_pool_check_wait_objs();
     while (!error)
     {
         robjs_count = 0;
+        timeout = -1;
         robjs[robjs_count++] = g_term_event;
         robjs[robjs_count++] = g_sigchld_event;
         robjs[robjs_count++] = g_reload_event;
@@ -502,6 +510,7 @@ sesman_main_loop(void)
                 "pre_session_list_get_wait_objs failed");
             break;
         }
+        login_queue_get_timeout(&timeout);
 
         error = session_list_get_wait_objs(robjs, &robjs_count);
         if (error != 0)
@@ -511,7 +520,15 @@ sesman_main_loop(void)
             break;
         }
 
-        if (g_obj_wait(robjs, robjs_count, NULL, 0, -1) != 0)
+        error = sesexec_pool_get_wait_objs(robjs, &robjs_count);
+        if (error != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
+                "sesexec_pool_get_wait_objs failed");
+            break;
+        }
+
+        if (g_obj_wait(robjs, robjs_count, NULL, 0, timeout) != 0)
         {
             /* should not get here */
             LOG(LOG_LEVEL_WARNING, "sesman_main_loop: "
@@ -561,6 +578,14 @@ sesman_main_loop(void)
             break;
         }
 
+        error = login_queue_check_wait_objs();
+        if (error != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
+                "login_queue_check_wait_objs failed");
+            break;
+        }
+
         error = session_list_check_wait_objs();
         if (error != 0)
         {
@@ -568,6 +593,15 @@ sesman_main_loop(void)
                 "session_list_check_wait_objs failed");
             break;
         }
+
+        /* Last, so processes taken for logins above are replaced */
+        error = sesexec_pool_check_wait_objs();
+        if (error != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
+                "sesexec_pool_check_wait_objs failed");
+            break;
+        }
     }
 
     return error;
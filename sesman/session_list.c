@@ -47,6 +47,47 @@
 
 static struct list *g_session_list = NULL;
 
+/*
+ * Bitmaps of display numbers, so we can find a free display without
+ * looking at every session, or probing every display number.
+ *
+ * g_display_map has a bit set for every display allocated to a session
+ * on g_session_list.
+ *
+ * g_foreign_map has a bit set for every display we've found in use by
+ * something other than sesman (e.g. a console X server). These are
+ * forgotten FOREIGN_MAP_LIFETIME_MS after the first of them is found,
+ * so they're checked again from time to time. g_foreign_map_expiry is
+ * only valid while g_foreign_map_in_use is set.
+ */
+#define MAP_WORD_BITS 32
+#define FOREIGN_MAP_LIFETIME_MS (60 * 1000)
+
+static tui32 *g_display_map = NULL;
+static tui32 *g_foreign_map = NULL;
+static unsigned int g_map_words = 0;
+static int g_foreign_map_in_use = 0;
+static unsigned int g_foreign_map_expiry;
+
+/* Minimum size of the session lookup indexes. Always a power of 2 */
+#define SESSION_MAP_MIN_SIZE 64
+
+/*
+ * A hash table of running sessions. Buckets are chained through the
+ * session item. Items are appended to their chain, so if several
+ * sessions match a search, the one which started first is found first.
+ */
+struct session_map
+{
+    struct session_item **buckets;
+    unsigned int size;    /* Number of buckets, or 0 */
+    unsigned int count;   /* Number of sessions in the table */
+};
+
+static struct session_map g_uid_map;  /* Running sessions by uid */
+/* Running sessions by uid, type, bpp and initial geometry */
+static struct session_map g_data_map;
+
 #define SESSION_IN_USE(si) \
     ((si) != NULL && \
      (si)->sesexec_trans != NULL && \
@@ -75,6 +116,246 @@ session_list_init(void)
     return rv;
 }
 
+/******************************************************************************/
+/**
+ * Makes sure the display maps can hold the specified display
+ *
+ * @param display Display number
+ * @return 0 for success
+ */
+static int
+display_map_reserve(unsigned int display)
+{
+    unsigned int words = display / MAP_WORD_BITS + 1;
+    tui32 *display_map;
+    tui32 *foreign_map;
+
+    if (words <= g_map_words)
+    {
+        return 0;
+    }
+
+    display_map = (tui32 *)g_malloc(words * sizeof(tui32), 1);
+    foreign_map = (tui32 *)g_malloc(words * sizeof(tui32), 1);
+    if (display_map == NULL || foreign_map == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display map");
+        g_free(display_map);
+        g_free(foreign_map);
+        return 1;
+    }
+    if (g_map_words > 0)
+    {
+        g_memcpy(display_map, g_display_map, g_map_words * sizeof(tui32));
+        g_memcpy(foreign_map, g_foreign_map, g_map_words * sizeof(tui32));
+    }
+    g_free(g_display_map);
+    g_free(g_foreign_map);
+    g_display_map = display_map;
+    g_foreign_map = foreign_map;
+    g_map_words = words;
+    return 0;
+}
+
+/******************************************************************************/
+static void
+display_map_set(tui32 *map, unsigned int display)
+{
+    map[display / MAP_WORD_BITS] |= (tui32)1 << (display % MAP_WORD_BITS);
+}
+
+/******************************************************************************/
+static void
+display_map_clear(tui32 *map, unsigned int display)
+{
+    if (display / MAP_WORD_BITS < g_map_words)
+    {
+        map[display / MAP_WORD_BITS] &=
+            ~((tui32)1 << (display % MAP_WORD_BITS));
+    }
+}
+
+/******************************************************************************/
+/**
+ * Finds the lowest display in a range not set in either map
+ *
+ * @param first First display to consider
+ * @param last Last display to consider. Must be covered by the maps
+ * @return display, or -1 if all are in use
+ */
+static int
+display_map_find_free(unsigned int first, unsigned int last)
+{
+    unsigned int display = first;
+    unsigned int word;
+    tui32 used;
+
+    while (display <= last)
+    {
+        word = display / MAP_WORD_BITS;
+        used = g_display_map[word] | g_foreign_map[word];
+        if (used == 0xffffffff)
+        {
+            // Skip the whole word
+            display = (word + 1) * MAP_WORD_BITS;
+            continue;
+        }
+        if ((used & ((tui32)1 << (display % MAP_WORD_BITS))) == 0)
+        {
+            return display;
+        }
+        ++display;
+    }
+
+    return -1;
+}
+
+/******************************************************************************/
+static unsigned int
+uid_hash(uid_t uid)
+{
+    return (unsigned int)uid * 2654435761U;
+}
+
+/******************************************************************************/
+static unsigned int
+data_hash(uid_t uid, enum scp_session_type type,
+          unsigned short width, unsigned short height, unsigned char bpp)
+{
+    unsigned int h = uid_hash(uid);
+
+    h = (h ^ (unsigned int)type) * 2654435761U;
+    h = (h ^ bpp) * 2654435761U;
+    h = (h ^ (((unsigned int)width << 16) | height)) * 2654435761U;
+    return h ^ (h >> 16);
+}
+
+/******************************************************************************/
+static struct session_item **
+session_map_chain(struct session_map *map, struct session_item *si)
+{
+    return (map == &g_uid_map) ? &si->uid_next : &si->data_next;
+}
+
+/******************************************************************************/
+static unsigned int
+session_map_hash(struct session_map *map, const struct session_item *si)
+{
+    return (map == &g_uid_map) ? uid_hash(si->uid) :
+           data_hash(si->uid, si->type,
+                     si->start_width, si->start_height, si->bpp);
+}
+
+/******************************************************************************/
+/* Appends a session to the end of a bucket chain */
+static void
+session_map_append(struct session_map *map, struct session_item *si)
+{
+    struct session_item **p;
+
+    p = &map->buckets[session_map_hash(map, si) & (map->size - 1)];
+    while (*p != NULL)
+    {
+        p = session_map_chain(map, *p);
+    }
+    *p = si;
+    *session_map_chain(map, si) = NULL;
+}
+
+/******************************************************************************/
+/* Resizes a map. Returns 0 for success */
+static int
+session_map_resize(struct session_map *map, unsigned int new_size)
+{
+    struct session_item **old_buckets = map->buckets;
+    unsigned int old_size = map->size;
+    unsigned int i;
+    struct session_item *si;
+    struct session_item *next;
+
+    map->buckets = g_new0(struct session_item *, new_size);
+    if (map->buckets == NULL)
+    {
+        map->buckets = old_buckets;
+        return 1;
+    }
+    map->size = new_size;
+
+    // Sessions with the same key are in the same old chain, so their
+    // order is preserved
+    for (i = 0 ; i < old_size; ++i)
+    {
+        for (si = old_buckets[i]; si != NULL; si = next)
+        {
+            next = *session_map_chain(map, si);
+            session_map_append(map, si);
+        }
+    }
+    g_free(old_buckets);
+    return 0;
+}
+
+/******************************************************************************/
+/* Adds a session to a map. Returns 0 for success */
+static int
+session_map_add(struct session_map *map, struct session_item *si)
+{
+    if (map->count >= map->size)
+    {
+        if (session_map_resize(map, (map->size == 0) ?
+                               SESSION_MAP_MIN_SIZE : map->size * 2) != 0 &&
+                map->size == 0)
+        {
+            return 1;
+        }
+    }
+
+    session_map_append(map, si);
+    ++map->count;
+    return 0;
+}
+
+/******************************************************************************/
+/* Removes a session from a map, if it's in it */
+static void
+session_map_remove(struct session_map *map, struct session_item *si)
+{
+    struct session_item **p;
+
+    if (map->size > 0)
+    {
+        p = &map->buckets[session_map_hash(map, si) & (map->size - 1)];
+        while (*p != NULL && *p != si)
+        {
+            p = session_map_chain(map, *p);
+        }
+        if (*p != NULL)
+        {
+            *p = *session_map_chain(map, si);
+            *session_map_chain(map, si) = NULL;
+            --map->count;
+        }
+    }
+}
+
+/******************************************************************************/
+/* Returns the first session in the bucket for a hash value */
+static struct session_item *
+session_map_first(const struct session_map *map, unsigned int hash)
+{
+    return (map->size > 0) ? map->buckets[hash & (map->size - 1)] : NULL;
+}
+
+/******************************************************************************/
+static void
+session_map_free(struct session_map *map)
+{
+    g_free(map->buckets);
+    map->buckets = NULL;
+    map->size = 0;
+    map->count = 0;
+}
+
 /******************************************************************************/
 /**
  * Frees resources allocated to a session_item
@@ -93,6 +374,15 @@ free_session(struct session_item *si)
         {
             trans_delete(si->sesexec_trans);
         }
+        if (si->display >= 0)
+        {
+            display_map_clear(g_display_map, si->display);
+        }
+        if (si->state == E_SESSION_RUNNING)
+        {
+            session_map_remove(&g_uid_map, si);
+            session_map_remove(&g_data_map, si);
+        }
         g_free(si);
     }
 }
@@ -113,6 +403,14 @@ session_list_cleanup(void)
         list_delete(g_session_list);
         g_session_list = NULL;
     }
+    session_map_free(&g_uid_map);
+    session_map_free(&g_data_map);
+    g_free(g_display_map);
+    g_free(g_foreign_map);
+    g_display_map = NULL;
+    g_foreign_map = NULL;
+    g_map_words = 0;
+    g_foreign_map_in_use = 0;
 }
 
 /******************************************************************************/
@@ -130,6 +428,7 @@ session_list_new(void)
     if (result != NULL)
     {
         result->state = E_SESSION_STARTING;
+        result->display = -1;
         if (!list_add_item(g_session_list, (tintptr)result))
         {
             g_free(result);
@@ -207,109 +506,155 @@ x_server_running_check_ports(int display)
 }
 
 /******************************************************************************/
-/* Helper function for get_sorted_display_list():qsort() */
-static int
-icmp(const void *v1, const void *v2)
-{
-    // Pointers point to unsigned ints
-    unsigned int i1 = *(unsigned int *)v1;
-    unsigned int i2 = *(unsigned int *)v2;
-    return (i1 < i2) ? -1 : (i1 > i2) ? 1 : 0;
-}
-
-/******************************************************************************/
-/**
- * Get a sorted array of all the displays allocated to sessions
- * @param[out] cnt Count of displays in list
- * @return Allocated array of displays or NULL for no memory
- *
- * Result must always be freed, even if cnt == 0
- */
-
-static unsigned int *
-get_sorted_session_displays(unsigned int *cnt)
+int
+session_list_get_available_display(void)
 {
-    unsigned int *displays;
+    unsigned int first = g_cfg->sess.x11_display_offset;
+    unsigned int last = g_cfg->sess.max_display_number;
+    int display = -1;
 
-    *cnt = 0;
-    displays = g_new(unsigned int, session_list_get_count() + 1);
-    if (displays == NULL)
-    {
-        LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display list");
-    }
-    else if (g_session_list != NULL)
+    // The maps can grow if the config is reloaded
+    if (first <= last && display_map_reserve(last) == 0)
     {
-        int i;
+        if (g_foreign_map_in_use &&
+                (int)(g_get_elapsed_ms() - g_foreign_map_expiry) >= 0)
+        {
+            g_memset(g_foreign_map, 0, g_map_words * sizeof(tui32));
+            g_foreign_map_in_use = 0;
+        }
 
-        for (i = 0 ; i < g_session_list->count ; ++i)
+        // Displays allocated to sessions are never checked. This also
+        // prevents us allocating the same display number to two callers
+        // who call in quick succession i.e. if the first caller has not
+        // created its X server by the time we service the second request.
+        //
+        // Only the chosen display is checked for something else using it.
+        while ((display = display_map_find_free(first, last)) >= 0 &&
+                x_server_running_check_ports(display))
         {
-            const struct session_item *si;
-            si = (const struct session_item *)list_get_item(g_session_list, i);
-            if (SESSION_IN_USE(si) && si->display >= 0)
+            if (!g_foreign_map_in_use)
             {
-                displays[(*cnt)++] = si->display;
+                g_foreign_map_in_use = 1;
+                g_foreign_map_expiry = g_get_elapsed_ms() +
+                                       FOREIGN_MAP_LIFETIME_MS;
             }
+            display_map_set(g_foreign_map, display);
         }
-        qsort(displays, *cnt, sizeof(displays[0]), icmp);
     }
 
-    return displays;
+    if (display < 0)
+    {
+        LOG(LOG_LEVEL_ERROR,
+            "X server -- no display in range (%d to %d) is available",
+            g_cfg->sess.x11_display_offset,
+            g_cfg->sess.max_display_number);
+    }
+
+    return display;
 }
 
 /******************************************************************************/
 int
-session_list_get_available_display(void)
+session_list_set_display(struct session_item *si, int display)
 {
-    int rv = -1;
-    unsigned int max_alloc = 0;
-
-    // Find all displays already allocated. We do this to prevent
-    // unnecessary file system accesses, and also to prevent us allocating
-    // the same display number to two callers who call in quick
-    // succession  i.e. if the first caller has not created its X server
-    // by the time we service the second request
-    unsigned int *allocated_displays = get_sorted_session_displays(&max_alloc);
-    if (allocated_displays != NULL)
-    {
-        unsigned int i = 0;
-        unsigned int display;
-
-        for (display = g_cfg->sess.x11_display_offset;
-                display <= g_cfg->sess.max_display_number;
-                ++display)
-        {
-            // Have we already allocated this one?
-            while (i < max_alloc && display > allocated_displays[i])
-            {
-                ++i;
-            }
-            if (i < max_alloc && display == allocated_displays[i])
-            {
-                continue; // Already allocated
-            }
+    if (si->display >= 0)
+    {
+        display_map_clear(g_display_map, si->display);
+    }
+    si->display = display;
+    if (display < 0 || display_map_reserve(display) != 0)
+    {
+        return 1;
+    }
+    display_map_set(g_display_map, display);
+    return 0;
+}
 
-            if (!x_server_running_check_ports(display))
-            {
-                break;
-            }
-        }
+/******************************************************************************/
+void
+session_list_set_running(struct session_item *si)
+{
+    if (si->state == E_SESSION_RUNNING)
+    {
+        // Already indexed
+        return;
+    }
+    si->state = E_SESSION_RUNNING;
+    if (session_map_add(&g_uid_map, si) != 0 ||
+            session_map_add(&g_data_map, si) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't index session on display %d - "
+            "it may not be possible to reconnect to it", si->display);
+    }
+}
+
+/******************************************************************************/
+/**
+ * Checks a session against the search criteria of a session policy
+ *
+ * @return != 0 if the session matches
+ */
+static int
+session_matches(const struct session_item *si, int policy,
+                uid_t uid,
+                enum scp_session_type type,
+                unsigned short width,
+                unsigned short height,
+                unsigned char  bpp,
+                const char *ip_addr)
+{
+    if (!SESSION_IN_USE(si) || si->state != E_SESSION_RUNNING)
+    {
+        return 0;
+    }
 
-        g_free(allocated_displays);
+    LOG(LOG_LEVEL_DEBUG,
+        "%s: try %p type=%s U=%d B=%d D=(%dx%d) I=%s",
+        __func__,
+        si,
+        SCP_SESSION_TYPE_TO_STR(si->type),
+        si->uid, si->bpp,
+        si->start_width, si->start_height,
+        si->start_ip_addr);
 
-        if (display > g_cfg->sess.max_display_number)
-        {
-            LOG(LOG_LEVEL_ERROR,
-                "X server -- no display in range (%d to %d) is available",
-                g_cfg->sess.x11_display_offset,
-                g_cfg->sess.max_display_number);
-        }
-        else
-        {
-            rv = display;
-        }
+    if (si->type != type)
+    {
+        LOG(LOG_LEVEL_DEBUG, "%s: Type doesn't match", __func__);
+        return 0;
     }
 
-    return rv;
+    if ((policy & SESMAN_CFG_SESS_POLICY_U) && uid != si->uid)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: UID doesn't match for 'U' policy", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_B) && si->bpp != bpp)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: bpp doesn't match for 'B' policy", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_D) &&
+            (si->start_width != width ||
+             si->start_height != height))
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: Dimensions don't match for 'D' policy", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_I) &&
+            g_strcmp(si->start_ip_addr, ip_addr) != 0)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: IPs don't match for 'I' policy", __func__);
+        return 0;
+    }
+
+    return 1;
 }
 
 /******************************************************************************/
@@ -321,8 +666,12 @@ session_list_get_bydata(uid_t uid,
                         unsigned char  bpp,
                         const char *ip_addr)
 {
+    const int udb_policy = SESMAN_CFG_SESS_POLICY_U |
+                           SESMAN_CFG_SESS_POLICY_B |
+                           SESMAN_CFG_SESS_POLICY_D;
     char policy_str[64];
     int policy = g_cfg->sess.policy;
+    struct session_item *si = NULL;
     int i;
 
     if (ip_addr == NULL)
@@ -354,75 +703,61 @@ session_list_get_bydata(uid_t uid,
         return NULL;
     }
 
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    if ((policy & udb_policy) == udb_policy)
     {
-        struct session_item *si;
-        si = (struct session_item *)list_get_item(g_session_list, i);
-        if (!SESSION_IN_USE(si))
-        {
-            continue;
-        }
-
-        LOG(LOG_LEVEL_DEBUG,
-            "%s: try %p type=%s U=%d B=%d D=(%dx%d) I=%s",
-            __func__,
-            si,
-            SCP_SESSION_TYPE_TO_STR(si->type),
-            si->uid, si->bpp,
-            si->start_width, si->start_height,
-            si->start_ip_addr);
-
-        if (si->type != type)
-        {
-            LOG(LOG_LEVEL_DEBUG, "%s: Type doesn't match", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_U) && uid != si->uid)
+        // Everything but the IP address is in the key
+        si = session_map_first(&g_data_map,
+                               data_hash(uid, type, width, height, bpp));
+        while (si != NULL &&
+                !session_matches(si, policy, uid, type,
+                                 width, height, bpp, ip_addr))
         {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: UID doesn't match for 'U' policy", __func__);
-            continue;
+            si = si->data_next;
         }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_B) && si->bpp != bpp)
-        {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: bpp doesn't match for 'B' policy", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_D) &&
-                (si->start_width != width ||
-                 si->start_height != height))
+    }
+    else if (policy & SESMAN_CFG_SESS_POLICY_U)
+    {
+        si = session_map_first(&g_uid_map, uid_hash(uid));
+        while (si != NULL &&
+                !session_matches(si, policy, uid, type,
+                                 width, height, bpp, ip_addr))
         {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: Dimensions don't match for 'D' policy", __func__);
-            continue;
+            si = si->uid_next;
         }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_I) &&
-                g_strcmp(si->start_ip_addr, ip_addr) != 0)
+    }
+    else
+    {
+        /* Sessions aren't indexed for this policy */
+        for (i = 0 ; i < g_session_list->count ; ++i)
         {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: IPs don't match for 'I' policy", __func__);
-            continue;
+            si = (struct session_item *)list_get_item(g_session_list, i);
+            if (session_matches(si, policy, uid, type,
+                                width, height, bpp, ip_addr))
+            {
+                break;
+            }
+            si = NULL;
         }
+    }
 
+    if (si != NULL)
+    {
         LOG(LOG_LEVEL_DEBUG,
             "%s: Got match, display=%d", __func__, si->display);
-        return si;
     }
-
-    LOG(LOG_LEVEL_DEBUG, "%s: No matches found", __func__);
-    return NULL;
+    else
+    {
+        LOG(LOG_LEVEL_DEBUG, "%s: No matches found", __func__);
+    }
+    return si;
 }
 
 /******************************************************************************/
 struct scp_session_info *
 session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
 {
-    int i;
+    const struct session_item *first;
+    const struct session_item *si;
     struct scp_session_info *sess;
     int count;
     int index;
@@ -431,10 +766,9 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
 
     LOG(LOG_LEVEL_DEBUG, "searching for session by UID: %d", uid);
 
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    first = session_map_first(&g_uid_map, uid_hash(uid));
+    for (si = first ; si != NULL ; si = si->uid_next)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
         if (SESSION_IN_USE(si) && uid == si->uid)
         {
             count++;
@@ -457,11 +791,8 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
     }
 
     index = 0;
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    for (si = first ; si != NULL ; si = si->uid_next)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
-
         if (SESSION_IN_USE(si) && uid == si->uid)
         {
             (sess[index]).sid = si->sesexec_pid;
@@ -477,7 +808,7 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
             /* Check for string allocation failures */
             if ((sess[index]).start_ip_addr == NULL)
             {
-                free_session_info_list(sess, *cnt);
+                free_session_info_list(sess, index);
                 (*cnt) = 0;
                 return 0;
             }
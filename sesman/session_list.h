@@ -66,6 +66,9 @@ struct session_item
     struct guid guid;
     char start_ip_addr[MAX_PEER_ADDRSTRLEN];
     time_t start_time;
+    /* Lookup index chains. Only used by session_list.c */
+    struct session_item *uid_next;
+    struct session_item *data_next;
 };
 
 /**
@@ -111,11 +114,38 @@ session_list_new(void);
  * Get the next available display
  *
  * The display isn't reserved until the caller has allocated a new session
- * (with session_list_new()) and put the new display in it.
+ * (with session_list_new()) and put the new display in it with
+ * session_list_set_display().
  */
 int
 session_list_get_available_display(void);
 
+/**
+ * Sets the display for a session, and reserves it
+ *
+ * @param si Session item
+ * @param display Display number from session_list_get_available_display()
+ * @return 0 for success. The display is set in the session even if
+ *         it can't be reserved.
+ *
+ * The display is released when the session is removed from the list.
+ */
+int
+session_list_set_display(struct session_item *si, int display);
+
+/**
+ * Marks a session as running, and adds it to the session lookup indexes
+ *
+ * @param si Session item
+ *
+ * Call this once the uid, type, bpp, geometry and IP address of the
+ * session are known. Until then, the session won't be found by
+ * session_list_get_bydata() or session_list_get_byuid(). These fields
+ * must not be changed afterwards, as the indexes are keyed on them.
+ */
+void
+session_list_set_running(struct session_item *si);
+
 /**
  *
  * @brief finds a session matching the supplied parameters
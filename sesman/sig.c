@@ -35,6 +35,7 @@
 #include "log.h"
 #include "os_calls.h"
 #include "sesman.h"
+#include "sesexec_control.h"
 #include "session_list.h"
 #include "string_calls.h"
 
@@ -75,6 +76,10 @@ sig_sesman_reload_cfg(void)
     /* replace old config with newly read one */
     g_cfg = cfg;
 
+    /* Idle sesexec processes have the old config. They're replaced
+     * by the main loop */
+    sesexec_pool_clear();
+
     /* Restart logging subsystem */
     error = log_start(g_cfg->sesman_ini, "xrdp-sesman", LOG_START_RESTART);
 
@@ -0,0 +1,101 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2021
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmark for chansrv_xfs directory lookups
+ *
+ * This isn't run by 'make check'. Build and run it with:-
+ *
+ * make -C tests/chansrv bench_xfs && tests/chansrv/bench_xfs [entries]
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <sys/stat.h>
+#include <stdlib.h>
+
+#include "os_calls.h"
+#include "string_calls.h"
+#include "chansrv_xfs.h"
+
+/* Default number of entries to add to the directory */
+#define BENCH_ENTRIES 100000
+
+int main(int argc, char **argv)
+{
+    struct xfs_fs *xfs;
+    fuse_ino_t *inums;
+    char name[64];
+    unsigned int entries = BENCH_ENTRIES;
+    unsigned int i;
+    unsigned int start;
+    unsigned int populate_ms;
+    unsigned int lookup_ms;
+    XFS_INODE *xino;
+    int rv = 1;
+
+    if (argc > 1 && (entries = g_atoi(argv[1])) == 0)
+    {
+        g_printf("Usage: %s [entries]\n", argv[0]);
+        return 1;
+    }
+
+    xfs = xfs_create_xfs_fs(022, g_getuid(), g_getgid());
+    inums = g_new(fuse_ino_t, entries);
+    if (xfs == NULL || inums == NULL)
+    {
+        g_printf("Out of memory\n");
+        goto done;
+    }
+
+    start = g_get_elapsed_ms();
+    for (i = 0 ; i < entries; ++i)
+    {
+        g_snprintf(name, sizeof(name), "file%u", i);
+        if ((xino = xfs_add_entry(xfs, FUSE_ROOT_ID, name,
+                                  S_IFREG | 0644)) == NULL)
+        {
+            g_printf("Can't add %s\n", name);
+            goto done;
+        }
+        inums[i] = xino->inum;
+    }
+    populate_ms = g_get_elapsed_ms() - start;
+
+    start = g_get_elapsed_ms();
+    for (i = 0 ; i < entries; ++i)
+    {
+        g_snprintf(name, sizeof(name), "file%u", i);
+        xino = xfs_lookup_in_dir(xfs, FUSE_ROOT_ID, name);
+        if (xino == NULL || xino->inum != inums[i])
+        {
+            g_printf("Lookup of %s failed\n", name);
+            goto done;
+        }
+    }
+    lookup_ms = g_get_elapsed_ms() - start;
+
+    g_printf("%u entries: populate %u ms, lookup %u ms\n",
+             entries, populate_ms, lookup_ms);
+    rv = 0;
+
+done:
+    g_free(inums);
+    xfs_delete_xfs_fs(xfs);
+    return rv;
+}
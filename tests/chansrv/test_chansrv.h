@@ -0,0 +1,8 @@
+#ifndef TEST_CHANSRV_H
+#define TEST_CHANSRV_H
+
+#include <check.h>
+
+Suite *make_suite_test_xfs(void);
+
+#endif /* TEST_CHANSRV_H */
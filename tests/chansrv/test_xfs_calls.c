@@ -0,0 +1,183 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <sys/stat.h>
+
+#include "os_calls.h"
+#include "string_calls.h"
+#include "log.h"
+#include "chansrv_xfs.h"
+
+#include "test_chansrv.h"
+
+/* Enough entries to make sure the directory index is grown a few times */
+#define MANY_ENTRIES 1000
+
+static struct xfs_fs *g_xfs;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_xfs = xfs_create_xfs_fs(022, g_getuid(), g_getgid());
+    ck_assert_ptr_ne(g_xfs, NULL);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xfs_delete_xfs_fs(g_xfs);
+    g_xfs = NULL;
+}
+
+/******************************************************************************/
+/* Adds 'count' files called file<n> to a directory, and checks they
+ * can all be found again */
+static void
+add_files(fuse_ino_t parent, unsigned int count, fuse_ino_t *inums)
+{
+    char name[64];
+    unsigned int i;
+    XFS_INODE *xino;
+
+    for (i = 0 ; i < count; ++i)
+    {
+        g_snprintf(name, sizeof(name), "file%u", i);
+        xino = xfs_add_entry(g_xfs, parent, name, S_IFREG | 0644);
+        ck_assert_ptr_ne(xino, NULL);
+        inums[i] = xino->inum;
+    }
+
+    for (i = 0 ; i < count; ++i)
+    {
+        g_snprintf(name, sizeof(name), "file%u", i);
+        xino = xfs_lookup_in_dir(g_xfs, parent, name);
+        ck_assert_ptr_ne(xino, NULL);
+        ck_assert_int_eq(xino->inum, inums[i]);
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_xfs__lookup_small_dir)
+{
+    fuse_ino_t inums[4];
+
+    add_files(FUSE_ROOT_ID, 4, inums);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, FUSE_ROOT_ID, "file4"), NULL);
+    ck_assert_ptr_eq(xfs_add_entry(g_xfs, FUSE_ROOT_ID, "file2", 0644), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xfs__lookup_large_dir)
+{
+    fuse_ino_t inums[MANY_ENTRIES];
+
+    add_files(FUSE_ROOT_ID, MANY_ENTRIES, inums);
+
+    /* Names are case-sensitive */
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, FUSE_ROOT_ID, "FILE1"), NULL);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, FUSE_ROOT_ID, "file"), NULL);
+
+    /* Duplicates are still detected */
+    ck_assert_ptr_eq(xfs_add_entry(g_xfs, FUSE_ROOT_ID, "file999", 0644),
+                     NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xfs__remove_large_dir)
+{
+    fuse_ino_t inums[MANY_ENTRIES];
+    char name[64];
+    unsigned int i;
+    XFS_INODE *xino;
+
+    add_files(FUSE_ROOT_ID, MANY_ENTRIES, inums);
+    for (i = 0 ; i < MANY_ENTRIES; i += 2)
+    {
+        xfs_remove_entry(g_xfs, inums[i]);
+    }
+
+    for (i = 0 ; i < MANY_ENTRIES; ++i)
+    {
+        g_snprintf(name, sizeof(name), "file%u", i);
+        xino = xfs_lookup_in_dir(g_xfs, FUSE_ROOT_ID, name);
+        if (i % 2 == 0)
+        {
+            ck_assert_ptr_eq(xino, NULL);
+        }
+        else
+        {
+            ck_assert_ptr_ne(xino, NULL);
+            ck_assert_int_eq(xino->inum, inums[i]);
+        }
+    }
+
+    /* Empty the directory, and check it can be filled again */
+    xfs_remove_directory_contents(g_xfs, FUSE_ROOT_ID);
+    ck_assert_int_eq(xfs_is_dir_empty(g_xfs, FUSE_ROOT_ID), 1);
+    add_files(FUSE_ROOT_ID, MANY_ENTRIES, inums);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xfs__move_large_dir)
+{
+    fuse_ino_t inums[MANY_ENTRIES];
+    fuse_ino_t subdir;
+    XFS_INODE *xino;
+
+    xino = xfs_add_entry(g_xfs, FUSE_ROOT_ID, "subdir", S_IFDIR | 0755);
+    ck_assert_ptr_ne(xino, NULL);
+    subdir = xino->inum;
+    add_files(subdir, MANY_ENTRIES, inums);
+
+    /* Rename within the directory */
+    ck_assert_int_eq(xfs_move_entry(g_xfs, inums[10], subdir, "renamed"), 0);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, subdir, "file10"), NULL);
+    xino = xfs_lookup_in_dir(g_xfs, subdir, "renamed");
+    ck_assert_ptr_ne(xino, NULL);
+    ck_assert_int_eq(xino->inum, inums[10]);
+
+    /* Rename over an existing entry */
+    ck_assert_int_eq(xfs_move_entry(g_xfs, inums[11], subdir, "file12"), 0);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, subdir, "file11"), NULL);
+    xino = xfs_lookup_in_dir(g_xfs, subdir, "file12");
+    ck_assert_ptr_ne(xino, NULL);
+    ck_assert_int_eq(xino->inum, inums[11]);
+
+    /* Move to another directory */
+    ck_assert_int_eq(xfs_move_entry(g_xfs, inums[20], FUSE_ROOT_ID,
+                                    "moved"), 0);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, subdir, "file20"), NULL);
+    xino = xfs_lookup_in_dir(g_xfs, FUSE_ROOT_ID, "moved");
+    ck_assert_ptr_ne(xino, NULL);
+    ck_assert_int_eq(xino->inum, inums[20]);
+    xino = xfs_lookup_in_dir(g_xfs, subdir, "file21");
+    ck_assert_ptr_ne(xino, NULL);
+    ck_assert_int_eq(xino->inum, inums[21]);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xfs(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("xfs");
+
+    tc = tcase_create("xfs");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_xfs__lookup_small_dir);
+    tcase_add_test(tc, test_xfs__lookup_large_dir);
+    tcase_add_test(tc, test_xfs__remove_large_dir);
+    tcase_add_test(tc, test_xfs__move_large_dir);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -92,16 +92,19 @@ START_TEST(test_fifo__simple)
 
     empty = fifo_is_empty(f);
     ck_assert_int_eq(empty, 0);
+    ck_assert_int_eq(fifo_get_count(f), n);
 
     unsigned int i;
     for (i = 0 ; i < n ; ++i)
     {
         const char *p = (const char *)fifo_remove_item(f);
         ck_assert_ptr_eq(p, strings[i]);
+        ck_assert_int_eq(fifo_get_count(f), n - i - 1);
     }
 
     empty = fifo_is_empty(f);
     ck_assert_int_eq(empty, 1);
+    ck_assert_int_eq(fifo_get_count(f), 0);
 
     fifo_delete(f, NULL);
 }
@@ -143,6 +146,7 @@ START_TEST(test_fifo__large_test_1)
         int ok = fifo_add_item(f, (void *)strdup("test item"));
         ck_assert_int_eq(ok, 1);
     }
+    ck_assert_int_eq(fifo_get_count(f), LARGE_TEST_SIZE);
 
     // Clear the fifo, checking free is called the expected number of times
     int c = 0;
@@ -151,6 +155,7 @@ START_TEST(test_fifo__large_test_1)
 
     int empty = fifo_is_empty(f);
     ck_assert_int_eq(empty, 1);
+    ck_assert_int_eq(fifo_get_count(f), 0);
 
     // Finally delete the fifo, checking free is not called this time
     c = 0;
@@ -0,0 +1,243 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "log.h"
+#include "os_calls.h"
+#include "string_calls.h"
+#include "thread_calls.h"
+
+#include "test_common.h"
+
+#define MESSAGES_PER_THREAD 500
+#define THREAD_COUNT 4
+#define FORK_COUNT 20
+
+static char g_log_path[256];
+static tbus g_threads_done;
+
+/******************************************************************************/
+/* Replaces the console logging set up by main() with async file logging */
+static void
+start_async_log(unsigned int queue_length)
+{
+    struct log_config *lc;
+
+    log_end();
+    g_snprintf(g_log_path, sizeof(g_log_path), "/tmp/test_log_async_%d.log",
+               g_getpid());
+    g_file_delete(g_log_path);
+
+    lc = log_config_init_for_console(LOG_LEVEL_INFO, NULL);
+    lc->enable_console = 0;
+    lc->log_file = g_strdup(g_log_path);
+    lc->log_level = LOG_LEVEL_INFO;
+    lc->enable_async = 1;
+    lc->async_queue_length = queue_length;
+    ck_assert_int_eq(log_start_from_param(lc), LOG_STARTUP_OK);
+    log_config_free(lc);
+}
+
+/******************************************************************************/
+static void
+restore_console_log(void)
+{
+    struct log_config *lc;
+
+    g_file_delete(g_log_path);
+    lc = log_config_init_for_console(LOG_LEVEL_INFO, NULL);
+    log_start_from_param(lc);
+    log_config_free(lc);
+}
+
+/******************************************************************************/
+/* Reads the log file into a string. The result must be freed */
+static char *
+read_log(void)
+{
+    char *buff;
+    int size;
+    int fd;
+
+    size = g_file_get_size(g_log_path);
+    ck_assert_int_gt(size, 0);
+    buff = (char *)g_malloc(size + 1, 0);
+    fd = g_file_open_ro(g_log_path);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(g_file_read(fd, buff, size), size);
+    g_file_close(fd);
+    buff[size] = '\0';
+    return buff;
+}
+
+/******************************************************************************/
+/* Counts the lines in the log file containing a string */
+static int
+count_in_log(const char *str)
+{
+    char *buff = read_log();
+    char *p;
+    int count = 0;
+
+    for (p = g_strstr(buff, str); p != NULL; p = g_strstr(p + 1, str))
+    {
+        ++count;
+    }
+    g_free(buff);
+    return count;
+}
+
+/******************************************************************************/
+static THREAD_RV THREAD_CC
+log_thread(void *arg)
+{
+    int index;
+
+    for (index = 0; index < MESSAGES_PER_THREAD; index++)
+    {
+        LOG(LOG_LEVEL_INFO, "async test message %d", index);
+    }
+    tc_sem_inc(g_threads_done);
+    return 0;
+}
+
+/******************************************************************************/
+START_TEST(test_log_async__all_written)
+{
+    int index;
+
+    start_async_log(THREAD_COUNT * MESSAGES_PER_THREAD);
+
+    g_threads_done = tc_sem_create(0);
+    for (index = 0; index < THREAD_COUNT; index++)
+    {
+        ck_assert_int_eq(tc_thread_create(log_thread, NULL), 0);
+    }
+    for (index = 0; index < THREAD_COUNT; index++)
+    {
+        tc_sem_dec(g_threads_done);
+    }
+    tc_sem_delete(g_threads_done);
+
+    /* log_end() writes anything still queued */
+    log_end();
+    ck_assert_int_eq(log_get_dropped_count(), 0);
+    ck_assert_int_eq(count_in_log("async test message"),
+                     THREAD_COUNT * MESSAGES_PER_THREAD);
+
+    restore_console_log();
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_log_async__full_queue)
+{
+    int index;
+    int written;
+    char str[64];
+    char *buff;
+    char *message;
+    char *error;
+
+    /* The smallest queue possible should overflow */
+    start_async_log(1);
+
+    for (index = 0; index < MESSAGES_PER_THREAD; index++)
+    {
+        LOG(LOG_LEVEL_INFO, "async test message %d", index);
+        LOG(LOG_LEVEL_ERROR, "async test error %d", index);
+    }
+    log_end();
+
+    /* Every info message is written or counted, and no errors are lost */
+    written = count_in_log("async test message");
+    ck_assert_int_eq(written + log_get_dropped_count(), MESSAGES_PER_THREAD);
+    ck_assert_int_eq(count_in_log("async test error"), MESSAGES_PER_THREAD);
+    if (log_get_dropped_count() > 0)
+    {
+        ck_assert_int_gt(count_in_log("log messages dropped"), 0);
+    }
+
+    /* Errors written ahead of messages which were queued first are
+     * marked as such */
+    buff = read_log();
+    for (index = 0; index < MESSAGES_PER_THREAD; index++)
+    {
+        g_snprintf(str, sizeof(str), "async test message %d\n", index);
+        message = g_strstr(buff, str);
+        g_snprintf(str, sizeof(str), "async test error %d\n", index);
+        error = g_strstr(buff, str);
+        ck_assert_ptr_ne(error, NULL);
+        if (message != NULL && error < message)
+        {
+            g_snprintf(str, sizeof(str),
+                       "(out of order) async test error %d\n", index);
+            ck_assert_ptr_ne(g_strstr(buff, str), NULL);
+        }
+    }
+    g_free(buff);
+
+    restore_console_log();
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_log_async__fork)
+{
+    int index;
+    int pid;
+    struct proc_exit_status e;
+
+    start_async_log(16);
+
+    /* Fork while other threads keep the writer busy. A child which
+     * inherits a lock held by the writer hangs here */
+    g_threads_done = tc_sem_create(0);
+    for (index = 0; index < THREAD_COUNT; index++)
+    {
+        ck_assert_int_eq(tc_thread_create(log_thread, NULL), 0);
+    }
+    for (index = 0; index < FORK_COUNT; index++)
+    {
+        pid = g_fork();
+        ck_assert_int_ge(pid, 0);
+        if (pid == 0)
+        {
+            LOG(LOG_LEVEL_INFO, "async test child %d", index);
+            LOG(LOG_LEVEL_ERROR, "async test child error %d", index);
+            g_exit(0);
+        }
+        e = g_waitpid_status(pid);
+        ck_assert_int_eq(e.reason, E_PXR_STATUS_CODE);
+        ck_assert_int_eq(e.val, 0);
+    }
+    for (index = 0; index < THREAD_COUNT; index++)
+    {
+        tc_sem_dec(g_threads_done);
+    }
+    tc_sem_delete(g_threads_done);
+    log_end();
+
+    ck_assert_int_eq(count_in_log("async test child error"), FORK_COUNT);
+
+    restore_console_log();
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_log(void)
+{
+    Suite *s;
+    TCase *tc_log;
+
+    s = suite_create("Log");
+
+    tc_log = tcase_create("log_async");
+    suite_add_tcase(s, tc_log);
+    tcase_add_test(tc_log, test_log_async__all_written);
+    tcase_add_test(tc_log, test_log_async__full_queue);
+    tcase_add_test(tc_log, test_log_async__fork);
+
+    return s;
+}
@@ -0,0 +1,172 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2021
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmark for sesman session list lookups
+ *
+ * This isn't run by 'make check'. Build and run it with:-
+ *
+ * make -C tests/sesman bench_session_list &&
+ *     tests/sesman/bench_session_list [sessions [lookups]]
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdlib.h>
+
+#include "os_calls.h"
+#include "string_calls.h"
+#include "log.h"
+#include "trans.h"
+
+#include "sesman.h"
+#include "sesman_config.h"
+#include "session_list.h"
+
+/* Defaults for the number of sessions and lookups */
+#define BENCH_SESSIONS 5000
+#define BENCH_LOOKUPS 100000
+
+/* Normally provided by sesman.c */
+struct config_sesman *g_cfg;
+
+/******************************************************************************/
+/* Adds a running session to the list, as sesman would after the
+ * session announce event from sesexec */
+static int
+add_session(uid_t uid, unsigned short width)
+{
+    struct session_item *si = session_list_new();
+
+    if (si == NULL)
+    {
+        return 1;
+    }
+    si->sesexec_trans = trans_create(TRANS_MODE_UNIX, 128, 128);
+    if (si->sesexec_trans == NULL)
+    {
+        return 1;
+    }
+    si->sesexec_trans->status = TRANS_STATUS_UP;
+    si->uid = uid;
+    si->type = SCP_SESSION_TYPE_XORG;
+    si->start_width = width;
+    si->start_height = 768;
+    si->bpp = 24;
+    g_snprintf(si->start_ip_addr, sizeof(si->start_ip_addr), "10.0.0.1");
+    session_list_set_running(si);
+    return 0;
+}
+
+/******************************************************************************/
+static int
+run_bench(unsigned int sessions, unsigned int lookups)
+{
+    struct scp_session_info *info;
+    unsigned int users = (sessions + 1) / 2;
+    unsigned int cnt;
+    unsigned int i;
+    unsigned int start;
+    unsigned int bydata_ms;
+    unsigned int byuid_ms;
+
+    /* Two sessions per user, with different geometries */
+    for (i = 0 ; i < sessions; ++i)
+    {
+        if (add_session(1000 + i / 2, 1024 + i % 2) != 0)
+        {
+            g_printf("Can't add session %u\n", i);
+            return 1;
+        }
+    }
+
+    start = g_get_elapsed_ms();
+    for (i = 0 ; i < lookups; ++i)
+    {
+        if (session_list_get_bydata(1000 + i % users, SCP_SESSION_TYPE_XORG,
+                                    1024, 768, 24, "10.0.0.1") == NULL)
+        {
+            g_printf("Lookup by data for UID %u failed\n", 1000 + i % users);
+            return 1;
+        }
+    }
+    bydata_ms = g_get_elapsed_ms() - start;
+
+    start = g_get_elapsed_ms();
+    for (i = 0 ; i < lookups; ++i)
+    {
+        info = session_list_get_byuid(1000 + i % users, &cnt, 0);
+        free_session_info_list(info, cnt);
+        if (cnt == 0)
+        {
+            g_printf("Lookup by UID %u failed\n", 1000 + i % users);
+            return 1;
+        }
+    }
+    byuid_ms = g_get_elapsed_ms() - start;
+
+    g_printf("%u sessions, %u lookups: bydata %u ms, byuid %u ms\n",
+             sessions, lookups, bydata_ms, byuid_ms);
+    return 0;
+}
+
+/******************************************************************************/
+int main(int argc, char **argv)
+{
+    struct log_config *logging;
+    unsigned int sessions = BENCH_SESSIONS;
+    unsigned int lookups = BENCH_LOOKUPS;
+    int rv;
+
+    if ((argc > 1 && (sessions = g_atoi(argv[1])) == 0) ||
+            (argc > 2 && (lookups = g_atoi(argv[2])) == 0))
+    {
+        g_printf("Usage: %s [sessions [lookups]]\n", argv[0]);
+        return 1;
+    }
+
+    logging = log_config_init_for_console(LOG_LEVEL_WARNING,
+                                          g_getenv("TEST_LOG_LEVEL"));
+    log_start_from_param(logging);
+    log_config_free(logging);
+
+    if ((g_cfg = g_new0(struct config_sesman, 1)) == NULL)
+    {
+        g_printf("Out of memory\n");
+        rv = 1;
+    }
+    else
+    {
+        g_cfg->sess.max_sessions = sessions;
+        g_cfg->sess.policy = SESMAN_CFG_SESS_POLICY_DEFAULT;
+        if (session_list_init() != 0)
+        {
+            g_printf("Can't create the session list\n");
+            rv = 1;
+        }
+        else
+        {
+            rv = run_bench(sessions, lookups);
+            session_list_cleanup();
+        }
+        g_free(g_cfg);
+    }
+
+    log_end();
+    return rv;
+}
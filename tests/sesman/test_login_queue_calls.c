@@ -0,0 +1,426 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <signal.h>
+
+#include "os_calls.h"
+#include "string_calls.h"
+#include "trans.h"
+
+#include "test_sesman.h"
+
+/* The module is built in here, with its calls to sesexec and to the
+ * EICP and SCP libraries replaced by the stubs below. This also lets
+ * the tests age the requests, rather than waiting for them to time out */
+#define sesexec_start stub_sesexec_start
+#define eicp_send_sys_login_request stub_eicp_send_sys_login_request
+#define scp_send_login_response stub_scp_send_login_response
+#include "login_queue.c"
+
+/* Most pre-session items used by a test */
+#define MAX_TEST_PSI 8
+
+static struct pre_session_item *g_psi[MAX_TEST_PSI];
+static int g_psi_count;
+
+/* Non-zero to make the sesexec_start() stub fail */
+static int g_fail_start;
+/* Number of sesexec processes started by the stub */
+static int g_start_count;
+/* Username and password of the last login request sent to sesexec */
+static char g_last_username[64];
+static char g_last_password[64];
+/* Number of login responses sent to clients by the login queue */
+static int g_response_count;
+
+/******************************************************************************/
+/* Starts a child process which runs until it's killed */
+int
+stub_sesexec_start(struct pre_session_item *psi)
+{
+    int pid;
+
+    if (g_fail_start)
+    {
+        return 1;
+    }
+
+    pid = g_fork();
+    if (pid == 0)
+    {
+        g_sleep(60 * 1000);
+        g_exit(0);
+    }
+    ck_assert_int_gt(pid, 0);
+    psi->sesexec_pid = pid;
+    psi->sesexec_trans = trans_create(TRANS_MODE_UNIX, 128, 128);
+    ck_assert_ptr_ne(psi->sesexec_trans, NULL);
+    psi->sesexec_trans->status = TRANS_STATUS_UP;
+    ++g_start_count;
+    return 0;
+}
+
+/******************************************************************************/
+int
+stub_eicp_send_sys_login_request(struct trans *trans,
+                                 const char *username,
+                                 const char *password,
+                                 const char *ip_addr,
+                                 int scp_fd)
+{
+    g_snprintf(g_last_username, sizeof(g_last_username), "%s", username);
+    g_snprintf(g_last_password, sizeof(g_last_password), "%s", password);
+    return 0;
+}
+
+/******************************************************************************/
+int
+stub_scp_send_login_response(struct trans *trans,
+                             enum scp_login_status login_result,
+                             int server_closed,
+                             int uid)
+{
+    ck_assert_int_eq(login_result, E_SCP_LOGIN_GENERAL_ERROR);
+    ck_assert_int_ne(server_closed, 0);
+    ++g_response_count;
+    return 0;
+}
+
+/******************************************************************************/
+/* Creates a pre-session item for a client asking for a system login */
+static struct pre_session_item *
+new_psi(const char *username)
+{
+    struct pre_session_item *psi;
+
+    ck_assert_int_lt(g_psi_count, MAX_TEST_PSI);
+    psi = g_new0(struct pre_session_item, 1);
+    ck_assert_ptr_ne(psi, NULL);
+    psi->username = g_strdup(username);
+    psi->client_trans = trans_create(TRANS_MODE_UNIX, 128, 128);
+    ck_assert_ptr_ne(psi->client_trans, NULL);
+    psi->client_trans->status = TRANS_STATUS_UP;
+    g_snprintf(psi->start_ip_addr, sizeof(psi->start_ip_addr), "10.0.0.1");
+    g_psi[g_psi_count++] = psi;
+    return psi;
+}
+
+/******************************************************************************/
+/* Makes all the logins look as if they were asked for, and started,
+ * 'ms' milliseconds earlier */
+static void
+age_requests(unsigned int ms)
+{
+    struct login_request *lr;
+    int i;
+
+    for (i = 0 ; i < g_queued->count; ++i)
+    {
+        lr = (struct login_request *)list_get_item(g_queued, i);
+        lr->request_time -= ms;
+    }
+    for (i = 0 ; i < g_active->count; ++i)
+    {
+        lr = (struct login_request *)list_get_item(g_active, i);
+        lr->request_time -= ms;
+        lr->start_time -= ms;
+    }
+}
+
+/******************************************************************************/
+static int
+get_timeout(void)
+{
+    int timeout = -1;
+
+    login_queue_get_timeout(&timeout);
+    return timeout;
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_cfg = g_new0(struct config_sesman, 1);
+    ck_assert_ptr_ne(g_cfg, NULL);
+    g_cfg->sec.max_concurrent_logins = 2;
+    g_cfg->sec.max_queued_logins = 2;
+    g_cfg->sec.login_timeout = 0;
+    g_psi_count = 0;
+    g_fail_start = 0;
+    g_start_count = 0;
+    g_last_username[0] = '\0';
+    g_last_password[0] = '\0';
+    g_response_count = 0;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    struct pre_session_item *psi;
+    int i;
+
+    login_queue_cleanup();
+    for (i = 0 ; i < g_psi_count; ++i)
+    {
+        psi = g_psi[i];
+        if (psi->sesexec_pid > 0 && g_sigkill(psi->sesexec_pid) == 0)
+        {
+            (void)g_waitpid(psi->sesexec_pid);
+        }
+        trans_delete(psi->client_trans);
+        trans_delete(psi->sesexec_trans);
+        g_free(psi->username);
+        g_free(psi);
+    }
+    g_psi_count = 0;
+    g_free(g_cfg);
+    g_cfg = NULL;
+}
+
+/******************************************************************************/
+START_TEST(test_login_queue__start_with_free_worker)
+{
+    struct pre_session_item *psi = new_psi("user1");
+
+    ck_assert_int_eq(login_queue_add(psi, "pass1"), E_SCP_LOGIN_OK);
+    ck_assert_int_eq(psi->auth_state, E_PS_AUTH_ACTIVE);
+    ck_assert_int_eq(psi->dispatcher_action, E_PSD_REMOVE_CLIENT_TRANS);
+    ck_assert_int_eq(g_start_count, 1);
+    ck_assert_str_eq(g_last_username, "user1");
+    ck_assert_str_eq(g_last_password, "pass1");
+    ck_assert_int_eq(login_queue_get_count(), 1);
+
+    /* Nothing to do until the login finishes */
+    ck_assert_int_eq(get_timeout(), -1);
+
+    login_queue_authenticated(psi);
+    ck_assert_int_eq(psi->auth_state, E_PS_AUTH_NONE);
+    ck_assert_int_eq(login_queue_get_count(), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_login_queue__start_failure)
+{
+    struct pre_session_item *psi = new_psi("user1");
+
+    /* The caller sends the error to the client */
+    g_fail_start = 1;
+    ck_assert_int_eq(login_queue_add(psi, "pass1"), E_SCP_LOGIN_GENERAL_ERROR);
+    ck_assert_int_eq(psi->auth_state, E_PS_AUTH_NONE);
+    ck_assert_int_eq(psi->dispatcher_action, E_PSD_NONE);
+    ck_assert_int_eq(login_queue_get_count(), 0);
+    ck_assert_int_eq(g_response_count, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_login_queue__queue_oldest_first)
+{
+    struct pre_session_item *psi[5];
+    int i;
+
+    for (i = 0 ; i < 5; ++i)
+    {
+        psi[i] = new_psi("user");
+    }
+
+    ck_assert_int_eq(login_queue_add(psi[0], "pass0"), E_SCP_LOGIN_OK);
+    ck_assert_int_eq(login_queue_add(psi[1], "pass1"), E_SCP_LOGIN_OK);
+    ck_assert_int_eq(login_queue_add(psi[2], "pass2"), E_SCP_LOGIN_OK);
+    ck_assert_int_eq(login_queue_add(psi[3], "pass3"), E_SCP_LOGIN_OK);
+    ck_assert_int_eq(psi[1]->auth_state, E_PS_AUTH_ACTIVE);
+    ck_assert_int_eq(psi[2]->auth_state, E_PS_AUTH_QUEUED);
+    ck_assert_int_eq(psi[3]->auth_state, E_PS_AUTH_QUEUED);
+    ck_assert_int_eq(psi[2]->dispatcher_action, E_PSD_NONE);
+    ck_assert_int_eq(g_start_count, 2);
+
+    /* The queue is full */
+    ck_assert_int_eq(login_queue_add(psi[4], "pass4"),
+                     E_SCP_LOGIN_GENERAL_ERROR);
+    ck_assert_int_eq(psi[4]->auth_state, E_PS_AUTH_NONE);
+    ck_assert_int_eq(login_queue_get_count(), 4);
+
+    /* No worker is free */
+    ck_assert_int_eq(get_timeout(), -1);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(g_start_count, 2);
+
+    /* A worker becomes free. The oldest queued login is started, and
+     * the client transport is passed on to sesexec */
+    login_queue_authenticated(psi[0]);
+    ck_assert_int_eq(get_timeout(), 0);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(g_start_count, 3);
+    ck_assert_str_eq(g_last_password, "pass2");
+    ck_assert_int_eq(psi[2]->auth_state, E_PS_AUTH_ACTIVE);
+    ck_assert_ptr_eq(psi[2]->client_trans, NULL);
+    ck_assert_int_eq(psi[3]->auth_state, E_PS_AUTH_QUEUED);
+    ck_assert_int_eq(get_timeout(), -1);
+
+    /* sesexec rejects a user */
+    login_queue_remove(psi[1]);
+    ck_assert_int_eq(psi[1]->auth_state, E_PS_AUTH_NONE);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_str_eq(g_last_password, "pass3");
+    ck_assert_int_eq(psi[3]->auth_state, E_PS_AUTH_ACTIVE);
+    ck_assert_int_eq(login_queue_get_count(), 2);
+    ck_assert_int_eq(g_response_count, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_login_queue__client_leaves_queue)
+{
+    struct pre_session_item *psi[4];
+    int i;
+
+    for (i = 0 ; i < 4; ++i)
+    {
+        psi[i] = new_psi("user");
+        ck_assert_int_eq(login_queue_add(psi[i], "pass"), E_SCP_LOGIN_OK);
+    }
+    ck_assert_int_eq(login_queue_get_count(), 4);
+
+    login_queue_remove(psi[2]);
+    ck_assert_int_eq(psi[2]->auth_state, E_PS_AUTH_NONE);
+    ck_assert_int_eq(login_queue_get_count(), 3);
+
+    /* Removing it again does nothing */
+    login_queue_remove(psi[2]);
+    ck_assert_int_eq(login_queue_get_count(), 3);
+
+    /* The next queued login is started in its place */
+    login_queue_authenticated(psi[0]);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(psi[2]->auth_state, E_PS_AUTH_NONE);
+    ck_assert_int_eq(psi[3]->auth_state, E_PS_AUTH_ACTIVE);
+    ck_assert_int_eq(g_start_count, 3);
+    ck_assert_int_eq(login_queue_get_count(), 2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_login_queue__timeouts)
+{
+    struct pre_session_item *psi[3];
+    struct proc_exit_status e;
+    int timeout;
+    int i;
+
+    g_cfg->sec.login_timeout = 10;
+    for (i = 0 ; i < 3; ++i)
+    {
+        psi[i] = new_psi("user");
+        ck_assert_int_eq(login_queue_add(psi[i], "pass"), E_SCP_LOGIN_OK);
+    }
+    ck_assert_int_eq(psi[2]->auth_state, E_PS_AUTH_QUEUED);
+
+    timeout = get_timeout();
+    ck_assert_int_gt(timeout, 9000);
+    ck_assert_int_le(timeout, 10000);
+
+    age_requests(9000);
+    timeout = get_timeout();
+    ck_assert_int_gt(timeout, 0);
+    ck_assert_int_le(timeout, 1000);
+
+    /* The queued login is rejected, and the active ones are stopped */
+    age_requests(1000);
+    ck_assert_int_eq(get_timeout(), 0);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(login_queue_get_count(), 0);
+    ck_assert_int_eq(g_response_count, 1);
+    ck_assert_int_eq(psi[2]->dispatcher_action, E_PSD_TERMINATE_PRE_SESSION);
+    for (i = 0 ; i < 2; ++i)
+    {
+        ck_assert_int_eq(psi[i]->auth_state, E_PS_AUTH_NONE);
+        ck_assert_int_eq(psi[i]->sesexec_trans->status, TRANS_STATUS_DOWN);
+        e = g_waitpid_status(psi[i]->sesexec_pid);
+        ck_assert_int_eq(e.reason, E_PXR_SIGNAL);
+        ck_assert_int_eq(e.val, SIGKILL);
+        psi[i]->sesexec_pid = 0;
+    }
+
+    /* The rejected login needs freeing straight away */
+    ck_assert_int_eq(get_timeout(), 0);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(get_timeout(), -1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_login_queue__queue_time_not_counted)
+{
+    struct pre_session_item *psi[2];
+    int timeout;
+
+    /* Time spent queued doesn't count against the authentication */
+    g_cfg->sec.max_concurrent_logins = 1;
+    g_cfg->sec.login_timeout = 10;
+    psi[0] = new_psi("user0");
+    psi[1] = new_psi("user1");
+    ck_assert_int_eq(login_queue_add(psi[0], "pass"), E_SCP_LOGIN_OK);
+    ck_assert_int_eq(login_queue_add(psi[1], "pass"), E_SCP_LOGIN_OK);
+
+    age_requests(8000);
+    login_queue_authenticated(psi[0]);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(psi[1]->auth_state, E_PS_AUTH_ACTIVE);
+
+    timeout = get_timeout();
+    ck_assert_int_gt(timeout, 9000);
+    ck_assert_int_le(timeout, 10000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_login_queue__queued_start_failure)
+{
+    struct pre_session_item *psi[2];
+
+    g_cfg->sec.max_concurrent_logins = 1;
+    psi[0] = new_psi("user0");
+    psi[1] = new_psi("user1");
+    ck_assert_int_eq(login_queue_add(psi[0], "pass"), E_SCP_LOGIN_OK);
+    ck_assert_int_eq(login_queue_add(psi[1], "pass"), E_SCP_LOGIN_OK);
+
+    /* The client is told, and the pre-session is freed straight away */
+    g_fail_start = 1;
+    login_queue_authenticated(psi[0]);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(psi[1]->auth_state, E_PS_AUTH_NONE);
+    ck_assert_int_eq(psi[1]->dispatcher_action, E_PSD_TERMINATE_PRE_SESSION);
+    ck_assert_int_eq(g_response_count, 1);
+    ck_assert_int_eq(login_queue_get_count(), 0);
+    ck_assert_int_eq(get_timeout(), 0);
+    ck_assert_int_eq(login_queue_check_wait_objs(), 0);
+    ck_assert_int_eq(get_timeout(), -1);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_login_queue(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("login_queue");
+
+    tc = tcase_create("login_queue");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_login_queue__start_with_free_worker);
+    tcase_add_test(tc, test_login_queue__start_failure);
+    tcase_add_test(tc, test_login_queue__queue_oldest_first);
+    tcase_add_test(tc, test_login_queue__client_leaves_queue);
+    tcase_add_test(tc, test_login_queue__timeouts);
+    tcase_add_test(tc, test_login_queue__queue_time_not_counted);
+    tcase_add_test(tc, test_login_queue__queued_start_failure);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
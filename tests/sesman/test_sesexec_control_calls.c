@@ -0,0 +1,234 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdlib.h>
+
+#include "os_calls.h"
+#include "string_calls.h"
+#include "trans.h"
+
+#include "test_sesman.h"
+
+/* The module is built in here, so the pool can be filled with a
+ * stand-in for sesexec from the current directory, and so the tests can
+ * get at the refill timer */
+#define XRDP_LIBEXEC_PATH "."
+#include "sesexec_control.c"
+
+#define FAKE_SESEXEC "./" SESEXEC_SHORTNAME
+
+/* Normally provided by sesman.c */
+int
+sesman_eicp_data_in(struct trans *self)
+{
+    return 0;
+}
+
+int
+sesman_is_term(void)
+{
+    return 0;
+}
+
+/******************************************************************************/
+/* Writes a stand-in for sesexec. It runs until the test process exits,
+ * or exits at once if TEST_SESEXEC_EXIT isn't empty */
+static void
+write_fake_sesexec(void)
+{
+    const char script[] =
+        "#!/bin/sh\n"
+        "[ -n \"$TEST_SESEXEC_EXIT\" ] && exit 1\n"
+        "exec >/dev/null 2>&1\n"
+        "while kill -0 \"$TEST_SESEXEC_PARENT\"; do sleep 1; done\n";
+    int fd;
+
+    g_file_delete(FAKE_SESEXEC);
+    fd = g_file_open_rw(FAKE_SESEXEC);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(g_file_write(fd, script, sizeof(script) - 1),
+                     sizeof(script) - 1);
+    g_file_close(fd);
+    ck_assert_int_eq(g_chmod_hex(FAKE_SESEXEC, 0x755), 0);
+}
+
+/******************************************************************************/
+/* Returns the number of idle processes in the pool */
+static int
+pool_size(void)
+{
+    tbus robjs[64];
+    int robjs_count = 0;
+
+    ck_assert_int_eq(sesexec_pool_get_wait_objs(robjs, &robjs_count), 0);
+    return robjs_count;
+}
+
+/******************************************************************************/
+/* Lets the refill delay run out */
+static void
+expire_refill_delay(void)
+{
+    g_pool_refill_time = g_get_elapsed_ms() - 1;
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    char pid_str[32];
+
+    g_cfg = g_new0(struct config_sesman, 1);
+    ck_assert_ptr_ne(g_cfg, NULL);
+    g_cfg->sesman_ini = g_strdup(DEFAULT_SESMAN_INI);
+    g_snprintf(pid_str, sizeof(pid_str), "%d", g_getpid());
+    g_setenv("TEST_SESEXEC_PARENT", pid_str, 1);
+    g_setenv("TEST_SESEXEC_EXIT", "", 1);
+    write_fake_sesexec();
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    sesexec_pool_clear();
+    g_pool_refill_paused = 0;
+    g_file_delete(FAKE_SESEXEC);
+    g_free(g_cfg->sesman_ini);
+    g_free(g_cfg);
+    g_cfg = NULL;
+}
+
+/******************************************************************************/
+START_TEST(test_sesexec_control__pool_fills)
+{
+    /* The refill time isn't looked at until a sesexec has failed, so
+     * a value which has wrapped doesn't stop the pool filling */
+    g_pool_refill_time = g_get_elapsed_ms() + 0x80000000U;
+
+    g_cfg->sess.sesexec_pool_size = 3;
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 3);
+
+    /* Shrinking the pool */
+    g_cfg->sess.sesexec_pool_size = 1;
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 1);
+
+    /* Limited to MAX_POOL_ITEMS */
+    g_cfg->sess.sesexec_pool_size = MAX_POOL_ITEMS + 1;
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), MAX_POOL_ITEMS);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_sesexec_control__start_uses_pool)
+{
+    struct pre_session_item psi = {0};
+    pid_t pooled_pid;
+
+    g_cfg->sess.sesexec_pool_size = 2;
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 2);
+    pooled_pid = g_pool[1].pid;
+
+    /* The most recently started process is used */
+    ck_assert_int_eq(sesexec_start(&psi), 0);
+    ck_assert_int_eq(psi.sesexec_pid, pooled_pid);
+    ck_assert_ptr_ne(psi.sesexec_trans, NULL);
+    ck_assert_ptr_eq(psi.sesexec_trans->callback_data, &psi);
+    ck_assert_int_eq(pool_size(), 1);
+    trans_delete(psi.sesexec_trans);
+
+    /* ...and the pool is topped up again */
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 2);
+
+    /* With no pool, a process is started for the caller */
+    sesexec_pool_clear();
+    g_cfg->sess.sesexec_pool_size = 0;
+    ck_assert_int_eq(sesexec_start(&psi), 0);
+    ck_assert_int_gt(psi.sesexec_pid, 0);
+    ck_assert_int_ne(psi.sesexec_pid, pooled_pid);
+    trans_delete(psi.sesexec_trans);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_sesexec_control__refill_paused_on_exit)
+{
+    unsigned int start;
+
+    /* Pooled processes which exit stop the pool being refilled */
+    g_setenv("TEST_SESEXEC_EXIT", "1", 1);
+    g_cfg->sess.sesexec_pool_size = 2;
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 2);
+    start = g_get_elapsed_ms();
+    while (!g_pool_refill_paused && g_get_elapsed_ms() - start < 5000)
+    {
+        g_sleep(10);
+        ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    }
+    ck_assert_int_ne(g_pool_refill_paused, 0);
+
+    /* Wait for the second process to go too */
+    while (pool_size() > 0 && g_get_elapsed_ms() - start < 5000)
+    {
+        g_sleep(10);
+        ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    }
+    ck_assert_int_eq(pool_size(), 0);
+
+    /* sesexec is fixed, but we wait for the delay to run out */
+    g_setenv("TEST_SESEXEC_EXIT", "", 1);
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 0);
+
+    expire_refill_delay();
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 2);
+    ck_assert_int_eq(g_pool_refill_paused, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_sesexec_control__refill_paused_on_start_failure)
+{
+    g_file_delete(FAKE_SESEXEC);
+    g_cfg->sess.sesexec_pool_size = 2;
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 0);
+    ck_assert_int_ne(g_pool_refill_paused, 0);
+
+    write_fake_sesexec();
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 0);
+
+    expire_refill_delay();
+    ck_assert_int_eq(sesexec_pool_check_wait_objs(), 0);
+    ck_assert_int_eq(pool_size(), 2);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_sesexec_control(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("sesexec_control");
+
+    tc = tcase_create("sesexec_control");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_sesexec_control__pool_fills);
+    tcase_add_test(tc, test_sesexec_control__start_uses_pool);
+    tcase_add_test(tc, test_sesexec_control__refill_paused_on_exit);
+    tcase_add_test(tc, test_sesexec_control__refill_paused_on_start_failure);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
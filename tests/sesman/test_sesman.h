@@ -0,0 +1,10 @@
+#ifndef TEST_SESMAN_H
+#define TEST_SESMAN_H
+
+#include <check.h>
+
+Suite *make_suite_test_session_list(void);
+Suite *make_suite_test_sesexec_control(void);
+Suite *make_suite_test_login_queue(void);
+
+#endif /* TEST_SESMAN_H */
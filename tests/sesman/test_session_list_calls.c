@@ -0,0 +1,391 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "string_calls.h"
+#include "log.h"
+#include "trans.h"
+
+#include "sesman.h"
+#include "sesman_config.h"
+
+#include "test_sesman.h"
+
+/* The module is built in here, so the tests can get at the foreign
+ * display map timer */
+#include "session_list.c"
+
+/* Enough sessions to make sure the indexes are grown a few times */
+#define MANY_SESSIONS 1000
+
+/* Displays used by the display allocation tests. These cross a word
+ * boundary in the display maps, and shouldn't be used by anything
+ * else on the test machine */
+#define FIRST_TEST_DISPLAY 316
+#define LAST_TEST_DISPLAY 330
+
+/* Normally provided by sesman.c */
+struct config_sesman *g_cfg;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_cfg = g_new0(struct config_sesman, 1);
+    ck_assert_ptr_ne(g_cfg, NULL);
+    g_cfg->sess.max_sessions = MANY_SESSIONS;
+    g_cfg->sess.policy = SESMAN_CFG_SESS_POLICY_DEFAULT;
+    ck_assert_int_eq(session_list_init(), 0);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    session_list_cleanup();
+    g_free(g_cfg);
+    g_cfg = NULL;
+}
+
+/******************************************************************************/
+/* Adds a running session to the list, as sesman would after the
+ * session announce event from sesexec */
+static struct session_item *
+add_session(uid_t uid, unsigned short width, unsigned short height,
+            unsigned char bpp, const char *ip_addr)
+{
+    struct session_item *si = session_list_new();
+
+    ck_assert_ptr_ne(si, NULL);
+    si->sesexec_trans = trans_create(TRANS_MODE_UNIX, 128, 128);
+    ck_assert_ptr_ne(si->sesexec_trans, NULL);
+    si->sesexec_trans->status = TRANS_STATUS_UP;
+    si->uid = uid;
+    si->type = SCP_SESSION_TYPE_XORG;
+    si->start_width = width;
+    si->start_height = height;
+    si->bpp = bpp;
+    g_snprintf(si->start_ip_addr, sizeof(si->start_ip_addr), "%s", ip_addr);
+    session_list_set_running(si);
+    return si;
+}
+
+/******************************************************************************/
+static struct session_item *
+find_session(uid_t uid, unsigned short width, unsigned short height,
+             unsigned char bpp, const char *ip_addr)
+{
+    return session_list_get_bydata(uid, SCP_SESSION_TYPE_XORG,
+                                   width, height, bpp, ip_addr);
+}
+
+/******************************************************************************/
+START_TEST(test_session_list__default_policy)
+{
+    struct session_item *s1 = add_session(1000, 1024, 768, 24, "10.0.0.1");
+    struct session_item *s2 = add_session(1000, 1920, 1080, 24, "10.0.0.2");
+    struct session_item *s3 = add_session(1001, 1024, 768, 32, "10.0.0.1");
+
+    /* The oldest matching session is found first */
+    ck_assert_ptr_eq(find_session(1000, 800, 600, 24, "10.0.0.3"), s1);
+    ck_assert_ptr_eq(find_session(1001, 800, 600, 32, NULL), s3);
+    ck_assert_ptr_eq(find_session(1001, 1024, 768, 24, "10.0.0.1"), NULL);
+    ck_assert_ptr_eq(find_session(1002, 1024, 768, 24, "10.0.0.1"), NULL);
+    ck_assert_ptr_eq(session_list_get_bydata(1000, SCP_SESSION_TYPE_XVNC,
+                     1024, 768, 24, "10.0.0.1"), NULL);
+
+    /* Sessions which are still starting are not found */
+    s1->state = E_SESSION_STARTING;
+    ck_assert_ptr_eq(find_session(1000, 800, 600, 24, "10.0.0.3"), s2);
+    s1->state = E_SESSION_RUNNING;
+
+    /* 'Separate' never matches */
+    g_cfg->sess.policy = SESMAN_CFG_SESS_POLICY_SEPARATE;
+    ck_assert_ptr_eq(find_session(1000, 1024, 768, 24, "10.0.0.1"), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_session_list__other_policies)
+{
+    struct session_item *s1 = add_session(1000, 1024, 768, 24, "10.0.0.1");
+    struct session_item *s2 = add_session(1000, 1920, 1080, 24, "10.0.0.2");
+    struct session_item *s3 = add_session(1000, 1920, 1080, 24, "10.0.0.1");
+
+    g_cfg->sess.policy = SESMAN_CFG_SESS_POLICY_U |
+                         SESMAN_CFG_SESS_POLICY_B |
+                         SESMAN_CFG_SESS_POLICY_D;
+    ck_assert_ptr_eq(find_session(1000, 1920, 1080, 24, NULL), s2);
+    ck_assert_ptr_eq(find_session(1000, 1024, 768, 24, NULL), s1);
+    ck_assert_ptr_eq(find_session(1000, 1024, 768, 16, NULL), NULL);
+    ck_assert_ptr_eq(find_session(1000, 800, 600, 24, NULL), NULL);
+
+    g_cfg->sess.policy |= SESMAN_CFG_SESS_POLICY_I;
+    ck_assert_ptr_eq(find_session(1000, 1920, 1080, 24, "10.0.0.1"), s3);
+    ck_assert_ptr_eq(find_session(1000, 1024, 768, 24, "10.0.0.2"), NULL);
+
+    g_cfg->sess.policy = SESMAN_CFG_SESS_POLICY_U | SESMAN_CFG_SESS_POLICY_I;
+    ck_assert_ptr_eq(find_session(1000, 800, 600, 16, "10.0.0.1"), s1);
+    ck_assert_ptr_eq(find_session(1001, 800, 600, 16, "10.0.0.1"), NULL);
+
+    /* A policy without 'U' can't use the indexes */
+    g_cfg->sess.policy = SESMAN_CFG_SESS_POLICY_D;
+    ck_assert_ptr_eq(find_session(1001, 1920, 1080, 8, NULL), s2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_session_list__many_sessions)
+{
+    struct session_item **items;
+    struct scp_session_info *info;
+    unsigned int cnt;
+    unsigned int i;
+
+    items = g_new(struct session_item *, MANY_SESSIONS);
+    ck_assert_ptr_ne(items, NULL);
+
+    /* 10 sessions for each of 100 users */
+    g_cfg->sess.policy = SESMAN_CFG_SESS_POLICY_U |
+                         SESMAN_CFG_SESS_POLICY_B |
+                         SESMAN_CFG_SESS_POLICY_D;
+    for (i = 0 ; i < MANY_SESSIONS; ++i)
+    {
+        items[i] = add_session(1000 + i % 100, 800 + i / 100, 600, 24, "");
+    }
+
+    for (i = 0 ; i < MANY_SESSIONS; ++i)
+    {
+        ck_assert_ptr_eq(find_session(1000 + i % 100, 800 + i / 100, 600,
+                                      24, NULL), items[i]);
+    }
+
+    info = session_list_get_byuid(1042, &cnt, 0);
+    ck_assert_ptr_ne(info, NULL);
+    ck_assert_int_eq(cnt, 10);
+    for (i = 0 ; i < cnt; ++i)
+    {
+        ck_assert_int_eq(info[i].uid, 1042);
+        ck_assert_int_eq(info[i].width, 800 + i);
+    }
+    free_session_info_list(info, cnt);
+
+    /* Remove the sessions for even uids */
+    for (i = 0 ; i < MANY_SESSIONS; i += 2)
+    {
+        items[i]->sesexec_trans->status = TRANS_STATUS_DOWN;
+    }
+    session_list_check_wait_objs();
+    ck_assert_int_eq(session_list_get_count(), MANY_SESSIONS / 2);
+
+    for (i = 0 ; i < MANY_SESSIONS; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            ck_assert_ptr_eq(find_session(1000 + i % 100, 800 + i / 100,
+                                          600, 24, NULL), NULL);
+        }
+        else
+        {
+            ck_assert_ptr_eq(find_session(1000 + i % 100, 800 + i / 100,
+                                          600, 24, NULL), items[i]);
+        }
+    }
+    ck_assert_ptr_eq(session_list_get_byuid(1042, &cnt, 0), NULL);
+    ck_assert_int_eq(cnt, 0);
+    info = session_list_get_byuid(1043, &cnt, 0);
+    ck_assert_int_eq(cnt, 10);
+    free_session_info_list(info, cnt);
+
+    g_free(items);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_session_list__set_running_twice)
+{
+    struct session_item *s1 = add_session(1000, 1024, 768, 24, "10.0.0.1");
+    struct scp_session_info *info;
+    unsigned int cnt;
+
+    /* A second call leaves the session indexed once */
+    session_list_set_running(s1);
+    info = session_list_get_byuid(1000, &cnt, 0);
+    ck_assert_int_eq(cnt, 1);
+    free_session_info_list(info, cnt);
+
+    s1->sesexec_trans->status = TRANS_STATUS_DOWN;
+    session_list_check_wait_objs();
+    ck_assert_ptr_eq(find_session(1000, 1024, 768, 24, "10.0.0.1"), NULL);
+    ck_assert_ptr_eq(session_list_get_byuid(1000, &cnt, 0), NULL);
+    ck_assert_int_eq(cnt, 0);
+}
+END_TEST
+
+/******************************************************************************/
+/* Adds a starting session on a display */
+static struct session_item *
+add_display_session(int display)
+{
+    struct session_item *si = session_list_new();
+
+    ck_assert_ptr_ne(si, NULL);
+    si->sesexec_trans = trans_create(TRANS_MODE_UNIX, 128, 128);
+    ck_assert_ptr_ne(si->sesexec_trans, NULL);
+    si->sesexec_trans->status = TRANS_STATUS_UP;
+    ck_assert_int_eq(session_list_set_display(si, display), 0);
+    return si;
+}
+
+/******************************************************************************/
+static void
+remove_session(struct session_item *si)
+{
+    si->sesexec_trans->status = TRANS_STATUS_DOWN;
+    session_list_check_wait_objs();
+}
+
+/******************************************************************************/
+/* Makes a display look like it's used by an X server sesman didn't
+ * start, or removes the X server */
+static void
+set_foreign_x_server(int display, int running)
+{
+    char lock_file[64];
+    int fd;
+
+    g_snprintf(lock_file, sizeof(lock_file), "/tmp/.X%d-lock", display);
+    if (running)
+    {
+        fd = g_file_open_rw(lock_file);
+        ck_assert_int_ge(fd, 0);
+        g_file_close(fd);
+    }
+    else
+    {
+        g_file_delete(lock_file);
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_session_list__allocate_displays)
+{
+    struct session_item *items[LAST_TEST_DISPLAY + 1];
+    int display;
+
+    g_cfg->sess.x11_display_offset = FIRST_TEST_DISPLAY;
+    g_cfg->sess.max_display_number = LAST_TEST_DISPLAY;
+
+    /* Displays are allocated in order, across the word boundary */
+    for (display = FIRST_TEST_DISPLAY ; display <= LAST_TEST_DISPLAY;
+            ++display)
+    {
+        ck_assert_int_eq(session_list_get_available_display(), display);
+        items[display] = add_display_session(display);
+    }
+    ck_assert_int_eq(session_list_get_available_display(), -1);
+
+    /* Freed displays are used again, lowest first */
+    remove_session(items[321]);
+    ck_assert_int_eq(session_list_get_available_display(), 321);
+    remove_session(items[318]);
+    ck_assert_int_eq(session_list_get_available_display(), 318);
+    items[318] = add_display_session(318);
+    ck_assert_int_eq(session_list_get_available_display(), 321);
+
+    /* The range can be moved by a config reload */
+    g_cfg->sess.max_display_number = LAST_TEST_DISPLAY + 40;
+    ck_assert_int_eq(session_list_get_available_display(), 321);
+    items[321] = add_display_session(321);
+    ck_assert_int_eq(session_list_get_available_display(),
+                     LAST_TEST_DISPLAY + 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_session_list__set_display)
+{
+    struct session_item *si;
+
+    g_cfg->sess.x11_display_offset = FIRST_TEST_DISPLAY;
+    g_cfg->sess.max_display_number = LAST_TEST_DISPLAY;
+
+    si = add_display_session(FIRST_TEST_DISPLAY);
+    ck_assert_int_eq(session_list_get_available_display(),
+                     FIRST_TEST_DISPLAY + 1);
+
+    /* Moving the session to another display frees the first one */
+    ck_assert_int_eq(session_list_set_display(si, FIRST_TEST_DISPLAY + 1), 0);
+    ck_assert_int_eq(si->display, FIRST_TEST_DISPLAY + 1);
+    ck_assert_int_eq(session_list_get_available_display(),
+                     FIRST_TEST_DISPLAY);
+
+    /* As does clearing the display */
+    ck_assert_int_ne(session_list_set_display(si, -1), 0);
+    ck_assert_int_eq(si->display, -1);
+    ck_assert_int_eq(session_list_get_available_display(),
+                     FIRST_TEST_DISPLAY);
+
+    /* A display outside the configured range grows the maps */
+    ck_assert_int_eq(session_list_set_display(si, 1000), 0);
+    ck_assert_int_ne(g_display_map[1000 / MAP_WORD_BITS], 0);
+    remove_session(si);
+    ck_assert_int_eq(g_display_map[1000 / MAP_WORD_BITS], 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_session_list__foreign_displays)
+{
+    unsigned int now;
+
+    g_cfg->sess.x11_display_offset = FIRST_TEST_DISPLAY;
+    g_cfg->sess.max_display_number = LAST_TEST_DISPLAY;
+
+    /* The expiry time isn't looked at until a display is found in use,
+     * so a value which has wrapped doesn't stop the map expiring */
+    g_foreign_map_expiry = g_get_elapsed_ms() + 0x80000000U;
+
+    set_foreign_x_server(FIRST_TEST_DISPLAY, 1);
+    ck_assert_int_eq(session_list_get_available_display(),
+                     FIRST_TEST_DISPLAY + 1);
+    set_foreign_x_server(FIRST_TEST_DISPLAY, 0);
+    now = g_get_elapsed_ms();
+    ck_assert_int_ne(g_foreign_map_in_use, 0);
+    ck_assert_int_gt((int)(g_foreign_map_expiry - now), 0);
+    ck_assert_int_le((int)(g_foreign_map_expiry - now),
+                     FOREIGN_MAP_LIFETIME_MS);
+
+    /* The display is remembered as in use until the map expires */
+    ck_assert_int_eq(session_list_get_available_display(),
+                     FIRST_TEST_DISPLAY + 1);
+    g_foreign_map_expiry = g_get_elapsed_ms() - 1;
+    ck_assert_int_eq(session_list_get_available_display(),
+                     FIRST_TEST_DISPLAY);
+    ck_assert_int_eq(g_foreign_map_in_use, 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_session_list(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("session_list");
+
+    tc = tcase_create("session_list");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_session_list__default_policy);
+    tcase_add_test(tc, test_session_list__other_policies);
+    tcase_add_test(tc, test_session_list__many_sessions);
+    tcase_add_test(tc, test_session_list__set_running_twice);
+    tcase_add_test(tc, test_session_list__allocate_displays);
+    tcase_add_test(tc, test_session_list__set_display);
+    tcase_add_test(tc, test_session_list__foreign_displays);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -7,6 +7,8 @@ Suite *make_suite_test_bitmap_load(void);
 Suite *make_suite_test_keymap_load(void);
 Suite *make_suite_egfx_base_functions(void);
 Suite *make_suite_region(void);
+Suite *make_suite_latency(void);
+Suite *make_suite_stats(void);
 Suite *make_suite_tconfig_load_gfx(void);
 
 #endif /* TEST_XRDP_H */
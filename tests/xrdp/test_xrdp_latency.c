@@ -0,0 +1,119 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "xrdp_latency.h"
+#include "test_xrdp.h"
+
+/******************************************************************************/
+START_TEST(test_latency_hist__buckets)
+{
+    struct xrdp_latency_hist hist = {0};
+
+    xrdp_latency_hist_add(&hist, 0);
+    xrdp_latency_hist_add(&hist, 1);
+    xrdp_latency_hist_add(&hist, 3);
+    xrdp_latency_hist_add(&hist, 4);
+    xrdp_latency_hist_add(&hist, 0xffffffff);
+
+    ck_assert_int_eq(hist.count, 5);
+    ck_assert_int_eq(hist.buckets[0], 1);
+    ck_assert_int_eq(hist.buckets[1], 1);
+    ck_assert_int_eq(hist.buckets[2], 1);
+    ck_assert_int_eq(hist.buckets[3], 1);
+    ck_assert_int_eq(hist.buckets[XRDP_LATENCY_BUCKETS - 1], 1);
+    ck_assert_uint_eq(hist.max_ms, 0xffffffff);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_latency_hist__percentile)
+{
+    struct xrdp_latency_hist hist = {0};
+    int i;
+
+    ck_assert_int_eq(xrdp_latency_hist_percentile(&hist, 50), 0);
+
+    for (i = 0 ; i < 90; ++i)
+    {
+        xrdp_latency_hist_add(&hist, 10); /* bucket covers 8-15 */
+    }
+    for (i = 0 ; i < 10; ++i)
+    {
+        xrdp_latency_hist_add(&hist, 100); /* bucket covers 64-127 */
+    }
+
+    ck_assert_int_eq(xrdp_latency_hist_percentile(&hist, 50), 15);
+    ck_assert_int_eq(xrdp_latency_hist_percentile(&hist, 90), 15);
+    /* Limited by the largest value seen */
+    ck_assert_int_eq(xrdp_latency_hist_percentile(&hist, 99), 100);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_latency__stages)
+{
+    struct xrdp_latency lat;
+
+    xrdp_latency_init(&lat);
+
+    /* Only the first input of several is timed */
+    xrdp_latency_input(&lat, 1000);
+    xrdp_latency_input(&lat, 1005);
+    xrdp_latency_frame_sent(&lat, 7, 1010, 1030);
+    xrdp_latency_frame_acked(&lat, 7, 1080);
+
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_MODULE].count, 1);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_MODULE].max_ms, 10);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_ENCODE].max_ms, 20);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_NETWORK].max_ms, 50);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_TOTAL].count, 1);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_TOTAL].max_ms, 80);
+
+    /* A repeated ack is ignored */
+    xrdp_latency_frame_acked(&lat, 7, 1090);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_NETWORK].count, 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_latency__input_after_paint)
+{
+    struct xrdp_latency lat;
+
+    xrdp_latency_init(&lat);
+
+    /* Input arriving after the frame was painted isn't attributed to it */
+    xrdp_latency_input(&lat, 2000);
+    xrdp_latency_frame_sent(&lat, 1, 1990, 2010);
+    xrdp_latency_frame_acked(&lat, 1, 2020);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_MODULE].count, 0);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_TOTAL].count, 0);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_ENCODE].count, 1);
+
+    /* ...but to the next one */
+    xrdp_latency_frame_sent(&lat, 2, 2005, 2015);
+    xrdp_latency_frame_acked(&lat, 2, 2025);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_MODULE].max_ms, 5);
+    ck_assert_int_eq(lat.hist[XRDP_LATENCY_TOTAL].max_ms, 25);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_latency(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("Latency");
+
+    tc = tcase_create("xrdp_latency");
+    tcase_add_test(tc, test_latency_hist__buckets);
+    tcase_add_test(tc, test_latency_hist__percentile);
+    tcase_add_test(tc, test_latency__stages);
+    tcase_add_test(tc, test_latency__input_after_paint);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
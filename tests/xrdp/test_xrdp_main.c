@@ -58,6 +58,8 @@ int main (void)
     srunner_add_suite(sr, make_suite_test_keymap_load());
     srunner_add_suite(sr, make_suite_egfx_base_functions());
     srunner_add_suite(sr, make_suite_region());
+    srunner_add_suite(sr, make_suite_latency());
+    srunner_add_suite(sr, make_suite_stats());
     srunner_add_suite(sr, make_suite_tconfig_load_gfx());
 
     srunner_set_tap(sr, "-");
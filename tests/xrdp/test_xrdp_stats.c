@@ -0,0 +1,88 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "xrdp.h"
+#include "xrdp_egfx.h"
+#include "test_xrdp.h"
+
+/******************************************************************************/
+START_TEST(test_stats__codecs)
+{
+    struct xrdp_stats stats;
+
+    xrdp_stats_init(&stats, 0);
+
+    xrdp_stats_codec_update(&stats, XRDP_STATS_CODEC_RFX, 100);
+    xrdp_stats_codec_update(&stats, XRDP_STATS_CODEC_RFX, 50);
+    xrdp_stats_codec_update(&stats, XRDP_STATS_CODEC_NONE, 10);
+    xrdp_stats_codec_update(&stats,
+                            xrdp_stats_codec_from_gfx_id(
+                                XR_RDPGFX_CODECID_AVC444V2), 20);
+
+    ck_assert_int_eq(stats.codec_updates[XRDP_STATS_CODEC_RFX], 2);
+    ck_assert_int_eq(stats.codec_bytes[XRDP_STATS_CODEC_RFX], 150);
+    ck_assert_int_eq(stats.codec_updates[XRDP_STATS_CODEC_NONE], 0);
+    ck_assert_int_eq(stats.codec_updates[XRDP_STATS_CODEC_GFX_AVC444], 1);
+    ck_assert_int_eq(xrdp_stats_codec_from_gfx_id(0x1234),
+                     XRDP_STATS_CODEC_GFX_OTHER);
+
+    /* Out of range channels are ignored */
+    xrdp_stats_channel_sent(&stats, 2, 1000);
+    xrdp_stats_channel_sent(&stats, MAX_STATIC_CHANNELS, 1000);
+    xrdp_stats_channel_sent(&stats, -1, 1000);
+    ck_assert_int_eq(stats.channel_bytes_sent[2], 1000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_stats__report)
+{
+    struct xrdp_process pro = {0};
+    struct stream *s;
+    char *line;
+
+    pro.session_id = 3;
+    pro.server_trans = trans_create(TRANS_MODE_UNIX, 1024, 1024);
+    ck_assert_ptr_ne(pro.server_trans, NULL);
+    pro.server_trans->bytes_sent = 12345;
+
+    make_stream(s);
+    init_stream(s, 4096);
+    xrdp_stats_write_report(&pro, s);
+    ck_assert_ptr_ne(s->end, s->data);
+    ck_assert_int_eq(s->end[-1], '\n');
+    s->end[0] = '\0';
+    line = g_strstr(s->data, "session_id 3\n");
+    ck_assert_ptr_ne(line, NULL);
+    line = g_strstr(s->data, "transport.bytes_sent 12345\n");
+    ck_assert_ptr_ne(line, NULL);
+
+    /* Lines which don't fit are left out, rather than truncated */
+    init_stream(s, 16);
+    s->size = 16;
+    xrdp_stats_write_report(&pro, s);
+    ck_assert_int_le(s->end - s->data, 16);
+    ck_assert_int_eq(s->end[-1], '\n');
+
+    free_stream(s);
+    trans_delete(pro.server_trans);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_stats(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("Stats");
+
+    tc = tcase_create("xrdp_stats");
+    tcase_add_test(tc, test_stats__codecs);
+    tcase_add_test(tc, test_stats__report);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,319 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Reads the performance statistics sockets of running xrdp sessions
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "string_calls.h"
+#include "file.h"
+#include "list.h"
+#include "log.h"
+
+/* Must match xrdp/xrdp_stats.h */
+#define XRDP_STATS_SOCKET_PREFIX "xrdp_stats_"
+
+#define MAX_REPORT_BYTES (64 * 1024)
+#define MAX_TOTALS 256
+
+struct total
+{
+    char name[64];
+    tui64 value;
+};
+
+struct totals
+{
+    unsigned int count;
+    unsigned int sessions;
+    struct total items[MAX_TOTALS];
+};
+
+/*****************************************************************************/
+static void
+usage(const char *name)
+{
+    g_printf("Usage: %s [-c xrdp.ini] [-d directory] [-a]\n\n"
+             "Shows the performance statistics of running xrdp sessions\n\n"
+             "  -c  xrdp.ini file to read stats_socket_dir from\n"
+             "      (default %s/xrdp.ini)\n"
+             "  -d  directory containing the statistics sockets. Overrides\n"
+             "      stats_socket_dir in xrdp.ini\n"
+             "  -a  show totals for all sessions, rather than each session\n",
+             name, XRDP_CFG_PATH);
+}
+
+/*****************************************************************************/
+/* Reads stats_socket_dir from xrdp.ini. Returns 0 if found */
+static int
+read_socket_dir(const char *xrdp_ini, char *dir, unsigned int dir_size)
+{
+    struct list *names;
+    struct list *values;
+    const char *name;
+    int index;
+    int rv = 1;
+
+    names = list_create();
+    names->auto_free = 1;
+    values = list_create();
+    values->auto_free = 1;
+    if (file_by_name_read_section(xrdp_ini, "Globals", names, values) == 0)
+    {
+        for (index = 0; index < names->count; index++)
+        {
+            name = (const char *)list_get_item(names, index);
+            if (g_strcasecmp(name, "stats_socket_dir") == 0)
+            {
+                g_snprintf(dir, dir_size, "%s",
+                           (const char *)list_get_item(values, index));
+                rv = (dir[0] == '\0');
+                break;
+            }
+        }
+    }
+    list_delete(names);
+    list_delete(values);
+    return rv;
+}
+
+/*****************************************************************************/
+/* Reads the whole report from a session socket. Returns bytes read,
+ * or -1 for an error */
+static int
+read_report(const char *path, char *buff, int buff_size)
+{
+    int sck;
+    int bytes;
+    int total = 0;
+
+    sck = g_sck_local_socket();
+    if (sck < 0)
+    {
+        return -1;
+    }
+    if (g_sck_local_connect(sck, path) != 0)
+    {
+        g_sck_close(sck);
+        return -1;
+    }
+    while (total < buff_size - 1)
+    {
+        bytes = g_sck_recv(sck, buff + total, buff_size - 1 - total, 0);
+        if (bytes <= 0)
+        {
+            break;
+        }
+        total += bytes;
+    }
+    g_sck_close(sck);
+    buff[total] = '\0';
+    return total;
+}
+
+/*****************************************************************************/
+/* Values which aren't meaningful summed across sessions. The largest
+ * value is shown instead */
+static int
+is_max_value(const char *name)
+{
+    unsigned int len = g_strlen(name);
+
+    return (len > 3 && (g_strcmp(name + len - 3, "_ms") == 0 ||
+                        g_strcmp(name + len - 3, "_us") == 0 ||
+                        g_strcmp(name + len - 4, "_max") == 0));
+}
+
+/*****************************************************************************/
+static void
+add_to_totals(struct totals *totals, char *report)
+{
+    char *line;
+    char *next;
+    char *value;
+    unsigned int index;
+    tui64 val;
+
+    totals->sessions++;
+    for (line = report; line != NULL && *line != '\0'; line = next)
+    {
+        next = g_strchr(line, '\n');
+        if (next != NULL)
+        {
+            *next++ = '\0';
+        }
+        value = g_strchr(line, ' ');
+        if (value == NULL)
+        {
+            continue;
+        }
+        *value++ = '\0';
+        if (g_strcmp(line, "pid") == 0 || g_strcmp(line, "session_id") == 0 ||
+                g_strcmp(line, "display") == 0)
+        {
+            continue;
+        }
+        val = strtoull(value, NULL, 10);
+
+        for (index = 0; index < totals->count; index++)
+        {
+            if (g_strcmp(totals->items[index].name, line) == 0)
+            {
+                break;
+            }
+        }
+        if (index == totals->count)
+        {
+            if (totals->count == MAX_TOTALS)
+            {
+                continue;
+            }
+            g_snprintf(totals->items[index].name,
+                       sizeof(totals->items[index].name), "%s", line);
+            totals->items[index].value = 0;
+            totals->count++;
+        }
+        if (is_max_value(line))
+        {
+            totals->items[index].value = MAX(totals->items[index].value, val);
+        }
+        else
+        {
+            totals->items[index].value += val;
+        }
+    }
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct log_config *logging;
+    const char *xrdp_ini = XRDP_CFG_PATH "/xrdp.ini";
+    char dir[256] = {0};
+    char path[512];
+    char *report;
+    struct totals *totals = NULL;
+    DIR *dp;
+    struct dirent *entry;
+    unsigned int index;
+    int show_totals = 0;
+    int opt;
+    int rv = 0;
+
+    while ((opt = getopt(argc, argv, "c:d:ah")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                xrdp_ini = optarg;
+                break;
+            case 'd':
+                g_snprintf(dir, sizeof(dir), "%s", optarg);
+                break;
+            case 'a':
+                show_totals = 1;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    logging = log_config_init_for_console(LOG_LEVEL_WARNING, NULL);
+    log_start_from_param(logging);
+    log_config_free(logging);
+
+    if (dir[0] == '\0' && read_socket_dir(xrdp_ini, dir, sizeof(dir)) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "stats_socket_dir is not set in %s", xrdp_ini);
+        log_end();
+        return 1;
+    }
+
+    dp = opendir(dir);
+    if (dp == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't open %s [%s]", dir, g_get_strerror());
+        log_end();
+        return 1;
+    }
+
+    report = (char *)g_malloc(MAX_REPORT_BYTES, 0);
+    if (show_totals)
+    {
+        totals = g_new0(struct totals, 1);
+    }
+    if (report == NULL || (show_totals && totals == NULL))
+    {
+        LOG(LOG_LEVEL_ERROR, "Out of memory");
+        rv = 1;
+    }
+
+    while (rv == 0 && (entry = readdir(dp)) != NULL)
+    {
+        if (g_strncmp(entry->d_name, XRDP_STATS_SOCKET_PREFIX,
+                      sizeof(XRDP_STATS_SOCKET_PREFIX) - 1) != 0)
+        {
+            continue;
+        }
+        g_snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (read_report(path, report, MAX_REPORT_BYTES) <= 0)
+        {
+            /* Probably a socket left over from a crashed session */
+            LOG(LOG_LEVEL_WARNING, "No statistics from %s", path);
+            continue;
+        }
+        if (totals != NULL)
+        {
+            add_to_totals(totals, report);
+        }
+        else
+        {
+            g_printf("[%s]\n%s\n", entry->d_name, report);
+        }
+    }
+    closedir(dp);
+
+    if (totals != NULL)
+    {
+        g_printf("sessions %u\n", totals->sessions);
+        for (index = 0; index < totals->count; index++)
+        {
+            g_printf("%s %llu\n", totals->items[index].name,
+                     (unsigned long long)totals->items[index].value);
+        }
+    }
+
+    g_free(totals);
+    g_free(report);
+    log_end();
+    return rv;
+}
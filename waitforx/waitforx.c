@@ -8,14 +8,25 @@
 #include <limits.h>
 
 #include "config_ac.h"
+
+#if defined(HAVE_SYS_INOTIFY_H)
+#include <sys/inotify.h>
+#endif
+
+#include "defines.h"
 #include "os_calls.h"
 #include "string_calls.h"
 #include "xrdp_sockets.h"
 #include "xwait.h" // For return status codes
 
-#define ATTEMPTS 10
+/* Time allowed for each stage of the wait */
+#define STAGE_WAIT_MS 10000
 #define ALARM_WAIT 30
 
+/* Longest we wait between retries. We're normally woken by an event
+ * well before this */
+#define RETRY_MS 100
+
 /*****************************************************************************/
 static void
 alarm_handler(int signal_num)
@@ -87,6 +98,133 @@ get_display_sock_name(const char *display, char *sock_name,
     return (sock_name[0] != '\0');
 }
 
+/*****************************************************************************/
+/**
+ * Milliseconds left before a deadline, or 0 if it has passed
+ */
+static int
+ms_left(unsigned int deadline)
+{
+    int left = (int)(deadline - g_get_elapsed_ms());
+    return (left > 0) ? left : 0;
+}
+
+/*****************************************************************************/
+/**
+ * Starts watching the X11 socket directory for new sockets
+ *
+ * @return fd to wait on, or -1 if the directory can't be watched
+ */
+static int
+watch_socket_dir(void)
+{
+    int fd = -1;
+#if defined(HAVE_SYS_INOTIFY_H)
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 &&
+            inotify_add_watch(fd, X11_UNIX_SOCKET_DIRECTORY,
+                              IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0)
+    {
+        // Probably the directory doesn't exist yet. We'll poll
+        // until it does.
+        g_file_close(fd);
+        fd = -1;
+    }
+#endif
+    return fd;
+}
+
+/*****************************************************************************/
+/**
+ * Waits for the X11 socket directory to change, or for a timeout
+ *
+ * @param watch_fd fd from watch_socket_dir(), or -1
+ * @param timeout Milliseconds to wait for
+ */
+static void
+wait_for_socket_dir(int watch_fd, int timeout)
+{
+    tintptr robj = watch_fd;
+    char buff[1024];
+
+    if (watch_fd < 0)
+    {
+        g_sleep(timeout);
+    }
+    else if (g_obj_wait(&robj, 1, NULL, 0, timeout) == 0 &&
+             g_file_read(watch_fd, buff, sizeof(buff)) > 0)
+    {
+        // Drain any further events so the next wait blocks
+        while (g_file_read(watch_fd, buff, sizeof(buff)) > 0)
+        {
+        }
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Waits for a connection to be accepted by the local socket for a display
+ *
+ * The socket directory is watched so we can connect as soon as the X
+ * server creates its socket.
+ *
+ * @param sock_name Name of the socket
+ * @param deadline Time (from g_get_elapsed_ms()) to give up at
+ * @return connected fd, or -1
+ */
+static int
+connect_local_socket(const char *sock_name, unsigned int deadline)
+{
+    int watch_fd = -1;
+    int local_fd = -1;
+    int left;
+    int logged = 0;
+
+    printf("<D>Opening socket %s\n", sock_name);
+    while (1)
+    {
+        // Start the watch before trying the socket, so we can't miss
+        // it being created.
+        if (watch_fd < 0)
+        {
+            watch_fd = watch_socket_dir();
+        }
+
+        if ((local_fd = g_sck_local_socket()) >= 0)
+        {
+            if (g_sck_local_connect(local_fd, sock_name) == 0)
+            {
+                printf("<D>Socket '%s' open succeeded.\n", sock_name);
+                break;
+            }
+            if (!logged)
+            {
+                // Only log the first failure, as we retry frequently
+                printf("<D>Socket '%s' open failed [%s]. Waiting for it.\n",
+                       sock_name, g_get_strerror());
+                logged = 1;
+            }
+            g_file_close(local_fd);
+            local_fd = -1;
+        }
+
+        if ((left = ms_left(deadline)) == 0)
+        {
+            printf("<D>Socket '%s' not available\n", sock_name);
+            break;
+        }
+        // The socket can be created a moment before the X server is
+        // listening on it, so retry regularly even with a watch.
+        wait_for_socket_dir(watch_fd, MIN(left, RETRY_MS));
+    }
+
+    if (watch_fd >= 0)
+    {
+        g_file_close(watch_fd);
+    }
+    return local_fd;
+}
+
 /*****************************************************************************/
 static Display *
 open_display(const char *display)
@@ -94,8 +232,7 @@ open_display(const char *display)
     char sock_name[XRDP_SOCKETS_MAXPATH];
     int local_fd = -1;
     Display *dpy = NULL;
-    unsigned int wait = ATTEMPTS;
-    unsigned int n;
+    unsigned int deadline = g_get_elapsed_ms() + STAGE_WAIT_MS;
 
     // If the display is local, we try to connect to the X11 socket for
     // the display first. If we can't do this, we don't attempt to open
@@ -112,41 +249,22 @@ open_display(const char *display)
     // of libxcb. We can't use it here.
     if (get_display_sock_name(display, sock_name, sizeof(sock_name)) != 0)
     {
-        for (n = 1; n <= wait ; ++n)
-        {
-            printf("<D>Opening socket %s. Attempt %u of %u\n",
-                   sock_name, n, wait);
-            if ((local_fd = g_sck_local_socket()) >= 0)
-            {
-                if  (g_sck_local_connect(local_fd, sock_name) == 0)
-                {
-                    printf("<D>Socket '%s' open succeeded.\n", sock_name);
-                    break;
-                }
-                else
-                {
-                    printf("<D>Socket '%s' open failed [%s].\n",
-                           sock_name, g_get_strerror());
-                    g_file_close(local_fd);
-                    local_fd = -1;
-                }
-            }
-            g_sleep(1000);
-        }
-
-        // Subtract the wait time for this stage from the overall wait time
-        wait -= (n - 1);
+        local_fd = connect_local_socket(sock_name, deadline);
     }
 
-    for (n = 1; n <= wait; ++n)
+    printf("<D>Opening display '%s'\n", display);
+    while (1)
     {
-        printf("<D>Opening display '%s'. Attempt %u of %u\n", display, n, wait);
         if ((dpy = XOpenDisplay(display)) != NULL)
         {
             printf("<D>Opened display %s\n", display);
             break;
         }
-        g_sleep(1000);
+        if (ms_left(deadline) == 0)
+        {
+            break;
+        }
+        g_sleep(MIN(ms_left(deadline), RETRY_MS));
     }
 
     // Close the file after we try the display open, to prevent
@@ -159,10 +277,36 @@ open_display(const char *display)
     return dpy;
 }
 
+/*****************************************************************************/
+/**
+ * Gets the number of RandR outputs on the display
+ */
+static unsigned int
+get_output_count(Display *dpy)
+{
+    unsigned int outputs = 0;
+    XRRScreenResources *res;
+
+    res = XRRGetScreenResources(dpy, DefaultRootWindow(dpy));
+    if (res != NULL)
+    {
+        if (res->noutput > 0)
+        {
+            outputs = res->noutput;
+        }
+        XRRFreeScreenResources(res);
+    }
+
+    return outputs;
+}
+
 /*****************************************************************************/
 /**
  * Wait for the RandR extension (if in use) to be available
  *
+ * Rather than polling, we ask for RandR change events, and only look at
+ * the outputs again when something happens.
+ *
  * @param dpy Display
  * @return 0 if/when outputs are available, 1 otherwise
  */
@@ -171,11 +315,11 @@ wait_for_r_and_r(Display *dpy)
 {
     int error_base = 0;
     int event_base = 0;
-    unsigned int outputs = 0;
-    unsigned int wait = ATTEMPTS;
-    unsigned int n;
-
-    XRRScreenResources *res = NULL;
+    unsigned int outputs;
+    unsigned int deadline = g_get_elapsed_ms() + STAGE_WAIT_MS;
+    tintptr robj = ConnectionNumber(dpy);
+    int left;
+    XEvent ev;
 
     if (!XRRQueryExtension(dpy, &event_base, &error_base))
     {
@@ -184,26 +328,40 @@ wait_for_r_and_r(Display *dpy)
         return 0;
     }
 
-    for (n = 1; n <= wait; ++n)
+    // Select the events before looking at the outputs, so a change
+    // between the two can't be missed
+    XRRSelectInput(dpy, DefaultRootWindow(dpy),
+                   RRScreenChangeNotifyMask | RROutputChangeNotifyMask |
+                   RRCrtcChangeNotifyMask);
+
+    printf("<D>Waiting for outputs\n");
+    while (1)
     {
-        printf("<D>Waiting for outputs. Attempt %u of %u\n", n, wait);
-        res = XRRGetScreenResources(dpy, DefaultRootWindow(dpy));
-        if (res != NULL)
+        // Discard queued events. We only need to know there were some
+        while (XPending(dpy) > 0)
         {
-            if (res->noutput > 0)
-            {
-                outputs = res->noutput;
-            }
-            XRRFreeScreenResources(res);
+            XNextEvent(dpy, &ev);
         }
 
+        outputs = get_output_count(dpy);
         if (outputs > 0)
         {
             printf("<D>Display %s ready with %u RandR outputs\n",
                    DisplayString(dpy), outputs);
             return 0;
         }
-        g_sleep(1000);
+
+        if ((left = ms_left(deadline)) == 0)
+        {
+            break;
+        }
+        // Recheck at least once a second in case an event isn't sent.
+        // XRRGetScreenResources() may have queued events, which
+        // g_obj_wait() wouldn't see
+        if (XPending(dpy) == 0)
+        {
+            g_obj_wait(&robj, 1, NULL, 0, MIN(left, 1000));
+        }
     }
 
     printf("<E>Unable to find any RandR outputs\n");
@@ -348,6 +348,13 @@ read_xrdp_ini_startup_params(struct xrdp_startup_params *startup_params)
                            sizeof(startup_params->runtime_group),
                            "%s", val);
             }
+
+            else if (g_strcasecmp(name, "stats_socket_dir") == 0)
+            {
+                g_snprintf(startup_params->stats_socket_dir,
+                           sizeof(startup_params->stats_socket_dir),
+                           "%s", val);
+            }
         }
     }
 
@@ -151,6 +151,18 @@ xrdp_wm_get_vis_region(struct xrdp_wm *self, struct xrdp_bitmap *bitmap,
                        struct xrdp_region *region, int clip_children);
 int
 xrdp_wm_mouse_move(struct xrdp_wm *self, int x, int y);
+/**
+ * Pass on a pointer move held back for coalescing
+ *
+ * Pointer moves with no other flags set are not passed on as they arrive.
+ * Only the most recent is kept, and it is passed on before any other
+ * input is processed, and once per pass of the main loop. A burst of
+ * moves from a high rate pointing device then reaches the module as a
+ * single event, without changing the order of moves relative to button
+ * and key events.
+ */
+int
+xrdp_wm_flush_input(struct xrdp_wm *self);
 int
 xrdp_wm_mouse_touch(struct xrdp_wm *self, int gesture, int param);
 int
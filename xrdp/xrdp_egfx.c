@@ -41,6 +41,7 @@
 #include "libxrdp.h"
 #include "xrdp_channel.h"
 #include "xrdp_mm.h"
+#include "probes.h"
 #include <limits.h>
 
 #define MAX_PART_SIZE 0xFFFF
@@ -54,6 +55,7 @@ xrdp_egfx_send_data(struct xrdp_egfx *egfx, const char *data, int bytes)
     int to_send;
 
     LOG(LOG_LEVEL_TRACE, "xrdp_egfx_send_data:");
+    XRDP_PROBE2(egfx_send, egfx->channel_id, bytes);
 
     if (bytes <= 1500)
     {
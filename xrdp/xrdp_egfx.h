@@ -91,6 +91,10 @@
 /* The bitmap data encapsulated in the bitmapData field is compressed using
    the ClearCodec Codec (sections 2.2.4.1 and 3.3.8.1). */
 #define XR_RDPGFX_CODECID_CLEARCODEC        0x0008
+/* The bitmap data encapsulated in the bitmapData field is compressed using
+   the RemoteFX Progressive Codec (section 2.2.4.2). Only used with
+   RDPGFX_WIRE_TO_SURFACE_PDU_2. */
+#define XR_RDPGFX_CODECID_CAPROGRESSIVE     0x0009
 /* The bitmap data encapsulated in the bitmapData field is compressed using
    the Planar Codec ([MS-RDPEGDI] sections 2.2.2.5.1 and 3.1.9). */
 #define XR_RDPGFX_CODECID_PLANAR            0x000A
@@ -29,6 +29,7 @@
 #include "fifo.h"
 #include "xrdp_egfx.h"
 #include "string_calls.h"
+#include "probes.h"
 
 #ifdef XRDP_RFXCODEC
 #include "rfxcodec_encode.h"
@@ -115,11 +116,6 @@ xrdp_enc_data_destructor(void *item, void *closure)
     {
         g_free(enc->u.gfx.cmd);
     }
-    else
-    {
-        g_free(enc->u.sc.drects);
-        g_free(enc->u.sc.crects);
-    }
     g_free(enc);
 }
 
@@ -174,6 +170,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         client_info->capture_code = CC_SIMPLE;
         client_info->capture_format = XRDP_a8b8g8r8;
         self->process_enc = process_enc_jpg;
+        self->stats_codec = XRDP_STATS_CODEC_JPEG;
     }
 #if defined(XRDP_X264) || defined(XRDP_OPENH264)
     else if (mm->egfx_flags & XRDP_EGFX_H264)
@@ -193,6 +190,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         client_info->capture_code = CC_SUF_A2;
         client_info->capture_format = XRDP_nv12;
         self->process_enc = process_enc_h264;
+        self->stats_codec = XRDP_STATS_CODEC_H264;
     }
 #endif
 #ifdef XRDP_RFXCODEC
@@ -233,6 +231,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         self->in_codec_mode = 1;
         client_info->capture_code = CC_SUF_RFX;
         self->process_enc = process_enc_rfx;
+        self->stats_codec = XRDP_STATS_CODEC_RFX;
         self->codec_handle_rfx = rfxcodec_encode_create(mm->wm->screen->width,
                                  mm->wm->screen->height,
                                  RFX_FORMAT_YUV, 0);
@@ -739,7 +738,8 @@ process_enc_h264(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 static int
 gfx_send_done(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
               int comp_bytes, int pad_bytes, char *comp_pad_data,
-              int got_frame_id, int frame_id, int is_last)
+              int got_frame_id, int frame_id, int is_last,
+              enum xrdp_stats_codec stats_codec)
 
 {
     XRDP_ENC_DATA_DONE *enc_done;
@@ -755,6 +755,7 @@ gfx_send_done(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
     enc_done->pad_bytes = pad_bytes;
     enc_done->comp_bytes = comp_bytes;
     enc_done->comp_pad_data = comp_pad_data;
+    enc_done->stats_codec = stats_codec;
     if (got_frame_id)
     {
         ENC_SET_BIT(enc_done->flags, ENC_DONE_FLAGS_FRAME_ID_BIT);
@@ -954,7 +955,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
                     self->codec_handle_h264_gfx[mon_index], 0,
                     0, 0,
                     width, height, twidth, theight, 0,
-                    enc_gfx_cmd->data,
+                    enc_gfx_cmd->data, enc_gfx_cmd->data_bytes,
                     crects, num_rects_c,
                     s->p, &bitmap_data_length,
                     connection_type, NULL);
@@ -1154,7 +1155,8 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
         }
         /* we have another tile set, send this one to main thread */
         if (gfx_send_done(self, enc, (int)(rv->end - rv->data), 0,
-                          rv->data, 0, 0, 0) != 0)
+                          rv->data, 0, 0, 0,
+                          xrdp_stats_codec_from_gfx_id(codec_id)) != 0)
         {
             free_stream(rv);
             rv = NULL;
@@ -1366,6 +1368,22 @@ gfx_mapsurfacetooutput(struct xrdp_encoder *self,
     return xrdp_egfx_map_surface(bulk, surface_id, x, y);
 }
 
+/*****************************************************************************/
+/* Peeks at the codec of a wire to surface command, for the session stats */
+static enum xrdp_stats_codec
+gfx_wiretosurface_stats_codec(struct stream *in_s)
+{
+    int codec_id;
+
+    if (!s_check_rem(in_s, 4))
+    {
+        return XRDP_STATS_CODEC_NONE;
+    }
+    /* codec_id follows surface_id */
+    codec_id = ((tui8)(in_s->p[2])) | (((tui8)(in_s->p[3])) << 8);
+    return xrdp_stats_codec_from_gfx_id(codec_id);
+}
+
 /*****************************************************************************/
 /* called from encoder thread */
 static int
@@ -1381,6 +1399,7 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int error;
     char *holdp;
     char *holdend;
+    enum xrdp_stats_codec stats_codec;
 
     bulk = self->mm->egfx->bulk;
     g_memset(&in_s, 0, sizeof(in_s));
@@ -1393,6 +1412,7 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
         s = NULL;
         frame_id = 0;
         got_frame_id = 0;
+        stats_codec = XRDP_STATS_CODEC_NONE;
         holdp = in_s.p;
         in_uint16_le(&in_s, cmd_id);
         in_uint8s(&in_s, 2); /* flags */
@@ -1407,9 +1427,11 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
         switch (cmd_id)
         {
             case XR_RDPGFX_CMDID_WIRETOSURFACE_1:       /* 0x0001 */
+                stats_codec = gfx_wiretosurface_stats_codec(&in_s);
                 s = gfx_wiretosurface1(self, bulk, &in_s, enc);
                 break;
             case XR_RDPGFX_CMDID_WIRETOSURFACE_2:       /* 0x0002 */
+                stats_codec = gfx_wiretosurface_stats_codec(&in_s);
                 s = gfx_wiretosurface2(self, bulk, &in_s, enc);
                 break;
             case XR_RDPGFX_CMDID_SOLIDFILL:             /* 0x0004 */
@@ -1448,7 +1470,7 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
             /* send message to main thread */
             error = gfx_send_done(self, enc, (int) (s->end - s->data),
                                   0, s->data, got_frame_id, frame_id,
-                                  !s_check_rem(&in_s, 8));
+                                  !s_check_rem(&in_s, 8), stats_codec);
             if (error != 0)
             {
                 LOG(LOG_LEVEL_ERROR, "process_enc_egfx: gfx_send_done failed "
@@ -1541,8 +1563,11 @@ proc_enc_msg(void *arg)
             tc_mutex_unlock(mutex);
             while (enc != 0)
             {
+                XRDP_PROBE1(enc_dequeue, enc);
                 /* do work */
+                XRDP_PROBE1(process_enc_start, enc);
                 self->process_enc(self, enc);
+                XRDP_PROBE1(process_enc_end, enc);
                 /* get next msg */
                 tc_mutex_lock(mutex);
                 enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
@@ -19,7 +19,7 @@ typedef int (*xrdp_encoder_h264_delete_proc)(void *handle);
 typedef int (*xrdp_encoder_h264_encode_proc)(
     void *handle, int session, int left, int top,
     int width, int height, int twidth, int theight,
-    int format, const char *data,
+    int format, const char *data, int data_bytes,
     short *crects, int num_crects,
     char *cdata, int *cdata_bytes,
     int connection_type, int *flags_ptr);
@@ -56,13 +56,15 @@ struct xrdp_encoder
     int quant_idx_y;
     int quant_idx_u;
     int quant_idx_v;
-    int pad0;
+    int stats_codec; /* XRDP_STATS_CODEC_* for surface commands */
     xrdp_encoder_h264_create_proc xrdp_encoder_h264_create;
     xrdp_encoder_h264_delete_proc xrdp_encoder_h264_delete;
     xrdp_encoder_h264_encode_proc xrdp_encoder_h264_encode;
 };
 
-/* cmd_id = 0 */
+/* cmd_id = 0
+ * drects and crects point into the same allocation as the owning
+ * xrdp_enc_data, and are not freed separately */
 struct xrdp_enc_surface_command
 {
     struct xrdp_mod *mod;
@@ -109,6 +111,8 @@ struct xrdp_enc_data_done
     int cy;
     int flags; /* ENC_DONE_FLAGS_* */
     int frame_id;
+    int stats_codec; /* XRDP_STATS_CODEC_* for EGFX, set by encoder thread */
+    int pad0;
 };
 
 #define ENC_FLAGS_GFX_BIT   0
@@ -121,7 +125,7 @@ struct xrdp_enc_data
     int pad0;
     void *shmem_ptr;
     int shmem_bytes;
-    int pad1;
+    unsigned int paint_time; /* g_get_elapsed_ms() when module sent it */
     union _u
     {
         struct xrdp_enc_surface_command sc;
@@ -44,6 +44,7 @@ struct openh264_encoder
     char *yuvdata;
     int width;
     int height;
+    int y_stale; /* Y plane of yuvdata skipped while using shm directly */
 };
 
 struct openh264_global
@@ -114,7 +115,7 @@ xrdp_encoder_openh264_delete(void *handle)
 int
 xrdp_encoder_openh264_encode(void *handle, int session, int left, int top,
                              int width, int height, int twidth, int theight,
-                             int format, const char *data,
+                             int format, const char *data, int data_bytes,
                              short *crects, int num_crects,
                              char *cdata, int *cdata_bytes,
                              int connection_type, int *flags_ptr)
@@ -146,6 +147,10 @@ xrdp_encoder_openh264_encode(void *handle, int session, int left, int top,
     unsigned char *payload;
     int size;
     int lcdata_bytes;
+    int y_offset;
+    short full_rect[4];
+    short *ycrects;
+    int num_ycrects;
 
     LOG(LOG_LEVEL_TRACE, "xrdp_encoder_openh264_encode:");
     flags = 0;
@@ -217,6 +222,7 @@ xrdp_encoder_openh264_encode(void *handle, int session, int left, int top,
                 oe->openh264_enc_han = NULL;
                 return 2;
             }
+            oe->y_stale = 0;
             flags |= 1;
         }
         oe->width = width;
@@ -236,14 +242,45 @@ xrdp_encoder_openh264_encode(void *handle, int session, int left, int top,
         pic1.pData[1] = pic1.pData[0] + pic1.iPicWidth * pic1.iPicHeight;
         pic1.pData[2] = pic1.pData[1] + (pic1.iPicWidth / 2) *
                         (pic1.iPicHeight / 2);
-        for (index = 0; index < num_crects; index++)
+        /* The source buffer always holds the whole screen. If the padded
+           Y plane lies entirely within it, OpenH264 can read it in place,
+           as it copies the picture during EncodeFrame(). The interleaved
+           UV plane always has to be converted to I420 */
+        y_offset = twidth * top + left;
+        if ((y_offset >= 0) && (pic1.iPicWidth <= twidth) &&
+                (y_offset + twidth * (pic1.iPicHeight - 1) +
+                 pic1.iPicWidth <= data_bytes))
+        {
+            pic1.iStride[0] = twidth;
+            pic1.pData[0] = (unsigned char *) (data + y_offset);
+            oe->y_stale = 1;
+            ycrects = NULL;
+            num_ycrects = 0;
+        }
+        else if (oe->y_stale)
+        {
+            /* yuvdata was bypassed since it was last written */
+            full_rect[0] = left;
+            full_rect[1] = top;
+            full_rect[2] = width;
+            full_rect[3] = height;
+            ycrects = full_rect;
+            num_ycrects = 1;
+            oe->y_stale = 0;
+        }
+        else
+        {
+            ycrects = crects;
+            num_ycrects = num_crects;
+        }
+        for (index = 0; index < num_ycrects; index++)
         {
             src8 = data;
             dst8 = (char *) (pic1.pData[0]);
-            x = crects[index * 4 + 0];
-            y = crects[index * 4 + 1];
-            cx = crects[index * 4 + 2];
-            cy = crects[index * 4 + 3];
+            x = ycrects[index * 4 + 0];
+            y = ycrects[index * 4 + 1];
+            cx = ycrects[index * 4 + 2];
+            cy = ycrects[index * 4 + 3];
             LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_encoder_openh264_encode: "
                       "x %d y %d cx %d cy %d", x, y, cx, cy);
             src8 += twidth * y + x;
@@ -31,7 +31,7 @@ xrdp_encoder_openh264_delete(void *handle);
 int
 xrdp_encoder_openh264_encode(void *handle, int session, int left, int top,
                              int width, int height, int twidth, int theight,
-                             int format, const char *data,
+                             int format, const char *data, int data_bytes,
                              short *crects, int num_crects,
                              char *cdata, int *cdata_bytes,
                              int connection_type, int *flags_ptr);
@@ -43,6 +43,8 @@ struct x264_encoder
     x264_param_t x264_params;
     int width;
     int height;
+    int y_stale; /* Y plane of yuvdata skipped while using shm directly */
+    int uv_stale; /* UV plane of yuvdata skipped while using shm directly */
 };
 
 struct x264_global
@@ -95,30 +97,75 @@ xrdp_encoder_x264_delete(void *handle)
     return 0;
 }
 
+/*****************************************************************************/
+/* Returns non-zero if the encoder can read a plane directly from the
+   source buffer, i.e. all rows of the padded plane lie within it */
+static int
+plane_in_buffer(int offset, int stride, int row_bytes, int rows,
+                int data_bytes)
+{
+    return (offset >= 0) && (row_bytes <= stride) && (rows > 0) &&
+           (offset + stride * (rows - 1) + row_bytes <= data_bytes);
+}
+
+/*****************************************************************************/
+/* Copy rects from the source buffer into a plane of yuvdata. For the
+   UV plane, each source row covers two rows of the rects */
+static void
+copy_rects(char *dst, int dst_stride, const char *src, int src_stride,
+           int left, int top, const short *crects, int num_crects, int uv)
+{
+    const char *src8;
+    char *dst8;
+    int index;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int cy_step;
+
+    cy_step = uv ? 2 : 1;
+    for (index = 0; index < num_crects; index++)
+    {
+        x = crects[index * 4 + 0];
+        y = crects[index * 4 + 1];
+        cx = crects[index * 4 + 2];
+        cy = crects[index * 4 + 3];
+        LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_encoder_x264_encode: x %d y %d "
+                  "cx %d cy %d", x, y, cx, cy);
+        src8 = src + src_stride * (y / cy_step) + x;
+        dst8 = dst + dst_stride * ((y - top) / cy_step) + (x - left);
+        for (; cy > 0; cy -= cy_step)
+        {
+            g_memcpy(dst8, src8, cx);
+            src8 += src_stride;
+            dst8 += dst_stride;
+        }
+    }
+}
+
 /*****************************************************************************/
 int
 xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                          int width, int height, int twidth, int theight,
-                         int format, const char *data,
+                         int format, const char *data, int data_bytes,
                          short *crects, int num_crects,
                          char *cdata, int *cdata_bytes, int connection_type,
                          int *flags_ptr)
 {
     struct x264_global *xg;
     struct x264_encoder *xe;
-    const char *src8;
-    char *dst8;
-    int index;
     x264_nal_t *nals;
     int num_nals;
     int frame_size;
     int x264_width_height;
+    int i_width;
+    int i_height;
+    int y_offset;
+    int uv_offset;
     int flags;
-    int x;
-    int y;
-    int cx;
-    int cy;
     int ct; /* connection_type */
+    short full_rect[4];
 
     x264_picture_t pic_in;
     x264_picture_t pic_out;
@@ -178,6 +225,8 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                 xe->x264_enc_han = NULL;
                 return 2;
             }
+            xe->y_stale = 0;
+            xe->uv_stale = 0;
             flags |= 1;
         }
         xe->width = width;
@@ -186,53 +235,72 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
 
     if ((data != NULL) && (xe->x264_enc_han != NULL))
     {
-        x264_width_height = xe->x264_params.i_width * xe->x264_params.i_height;
-        for (index = 0; index < num_crects; index++)
+        i_width = xe->x264_params.i_width;
+        i_height = xe->x264_params.i_height;
+        x264_width_height = i_width * i_height;
+        y_offset = twidth * top + left;
+        uv_offset = twidth * theight + twidth * (top / 2) + left;
+        full_rect[0] = left;
+        full_rect[1] = top;
+        full_rect[2] = width;
+        full_rect[3] = height;
+        g_memset(&pic_in, 0, sizeof(pic_in));
+        pic_in.img.i_csp = X264_CSP_NV12;
+        pic_in.img.i_plane = 2;
+        /* The source buffer always holds the whole screen, so where a
+           padded plane lies entirely within it, x264 can read that plane
+           in place. x264 copies the picture before x264_encoder_encode()
+           returns. Otherwise the changed rects are copied into yuvdata,
+           or everything if yuvdata has been bypassed since it was last
+           written */
+        if (plane_in_buffer(y_offset, twidth, i_width, i_height, data_bytes))
+        {
+            pic_in.img.plane[0] = (unsigned char *) (data + y_offset);
+            pic_in.img.i_stride[0] = twidth;
+            xe->y_stale = 1;
+        }
+        else
         {
-            src8 = data;
-            dst8 = xe->yuvdata;
-            x = crects[index * 4 + 0];
-            y = crects[index * 4 + 1];
-            cx = crects[index * 4 + 2];
-            cy = crects[index * 4 + 3];
-            LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_encoder_x264_encode: x %d y %d "
-                      "cx %d cy %d", x, y, cx, cy);
-            src8 += twidth * y + x;
-            dst8 += xe->x264_params.i_width * (y - top) + (x - left);
-            for (; cy > 0; cy -= 1)
+            if (xe->y_stale)
+            {
+                copy_rects(xe->yuvdata, i_width, data, twidth,
+                           left, top, full_rect, 1, 0);
+                xe->y_stale = 0;
+            }
+            else
             {
-                g_memcpy(dst8, src8, cx);
-                src8 += twidth;
-                dst8 += xe->x264_params.i_width;
+                copy_rects(xe->yuvdata, i_width, data, twidth,
+                           left, top, crects, num_crects, 0);
             }
+            pic_in.img.plane[0] = (unsigned char *) (xe->yuvdata);
+            pic_in.img.i_stride[0] = i_width;
+        }
+        if (plane_in_buffer(uv_offset, twidth, i_width, i_height / 2,
+                            data_bytes))
+        {
+            pic_in.img.plane[1] = (unsigned char *) (data + uv_offset);
+            pic_in.img.i_stride[1] = twidth;
+            xe->uv_stale = 1;
         }
-        for (index = 0; index < num_crects; index++)
+        else
         {
-            src8 = data;
-            src8 += twidth * theight;
-            dst8 = xe->yuvdata;
-            dst8 += x264_width_height;
-            x = crects[index * 4 + 0];
-            y = crects[index * 4 + 1];
-            cx = crects[index * 4 + 2];
-            cy = crects[index * 4 + 3];
-            src8 += twidth * (y / 2) + x;
-            dst8 += xe->x264_params.i_width * ((y - top) / 2) + (x - left);
-            for (; cy > 0; cy -= 2)
+            if (xe->uv_stale)
             {
-                g_memcpy(dst8, src8, cx);
-                src8 += twidth;
-                dst8 += xe->x264_params.i_width;
+                copy_rects(xe->yuvdata + x264_width_height, i_width,
+                           data + twidth * theight, twidth,
+                           left, top, full_rect, 1, 1);
+                xe->uv_stale = 0;
             }
+            else
+            {
+                copy_rects(xe->yuvdata + x264_width_height, i_width,
+                           data + twidth * theight, twidth,
+                           left, top, crects, num_crects, 1);
+            }
+            pic_in.img.plane[1] = (unsigned char *)
+                                  (xe->yuvdata + x264_width_height);
+            pic_in.img.i_stride[1] = i_width;
         }
-        g_memset(&pic_in, 0, sizeof(pic_in));
-        pic_in.img.i_csp = X264_CSP_NV12;
-        pic_in.img.i_plane = 2;
-        pic_in.img.plane[0] = (unsigned char *) (xe->yuvdata);
-        pic_in.img.plane[1] = (unsigned char *)
-                              (xe->yuvdata + x264_width_height);
-        pic_in.img.i_stride[0] = xe->x264_params.i_width;
-        pic_in.img.i_stride[1] = xe->x264_params.i_width;
         num_nals = 0;
         frame_size = x264_encoder_encode(xe->x264_enc_han, &nals, &num_nals,
                                          &pic_in, &pic_out);
@@ -0,0 +1,207 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Input to display latency measurement
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "os_calls.h"
+#include "log.h"
+#include "xrdp_latency.h"
+
+/*****************************************************************************/
+void
+xrdp_latency_init(struct xrdp_latency *self)
+{
+    int index;
+
+    g_memset(self, 0, sizeof(struct xrdp_latency));
+    for (index = 0; index < XRDP_LATENCY_MAX_FRAMES; index++)
+    {
+        self->frames[index].frame_id = -1;
+    }
+}
+
+/*****************************************************************************/
+void
+xrdp_latency_input(struct xrdp_latency *self, unsigned int now)
+{
+    if (!self->have_input)
+    {
+        self->have_input = 1;
+        self->input_time = now;
+    }
+}
+
+/*****************************************************************************/
+void
+xrdp_latency_frame_sent(struct xrdp_latency *self, int frame_id,
+                        unsigned int paint_time, unsigned int now)
+{
+    struct xrdp_latency_frame *frame;
+
+    if (frame_id < 0)
+    {
+        return;
+    }
+    frame = &self->frames[frame_id % XRDP_LATENCY_MAX_FRAMES];
+    frame->frame_id = frame_id;
+    frame->sent_time = now;
+    frame->have_input = 0;
+    /* Input which arrived after the module produced this frame can't
+     * have caused it. Unsigned arithmetic copes with wrap-around */
+    if (self->have_input && (int)(paint_time - self->input_time) >= 0)
+    {
+        frame->have_input = 1;
+        frame->input_time = self->input_time;
+        self->have_input = 0;
+        xrdp_latency_hist_add(&self->hist[XRDP_LATENCY_MODULE],
+                              paint_time - self->input_time);
+    }
+    xrdp_latency_hist_add(&self->hist[XRDP_LATENCY_ENCODE], now - paint_time);
+}
+
+/*****************************************************************************/
+void
+xrdp_latency_frame_acked(struct xrdp_latency *self, int frame_id,
+                         unsigned int now)
+{
+    struct xrdp_latency_frame *frame;
+
+    if (frame_id < 0)
+    {
+        return;
+    }
+    frame = &self->frames[frame_id % XRDP_LATENCY_MAX_FRAMES];
+    if (frame->frame_id != frame_id)
+    {
+        /* Not sent, or forgotten as too many frames were in flight */
+        return;
+    }
+    xrdp_latency_hist_add(&self->hist[XRDP_LATENCY_NETWORK],
+                          now - frame->sent_time);
+    if (frame->have_input)
+    {
+        xrdp_latency_hist_add(&self->hist[XRDP_LATENCY_TOTAL],
+                              now - frame->input_time);
+    }
+    frame->frame_id = -1;
+}
+
+/*****************************************************************************/
+void
+xrdp_latency_hist_add(struct xrdp_latency_hist *hist, unsigned int ms)
+{
+    int bucket;
+    unsigned int val;
+
+    bucket = 0;
+    for (val = ms; val != 0 && bucket < XRDP_LATENCY_BUCKETS - 1; val >>= 1)
+    {
+        bucket++;
+    }
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->total_ms += ms;
+    if (ms > hist->max_ms)
+    {
+        hist->max_ms = ms;
+    }
+}
+
+/*****************************************************************************/
+unsigned int
+xrdp_latency_hist_percentile(const struct xrdp_latency_hist *hist,
+                             unsigned int percent)
+{
+    unsigned long long wanted;
+    unsigned long long seen;
+    unsigned int rv;
+    int bucket;
+
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+    wanted = ((unsigned long long)hist->count * percent + 99) / 100;
+    seen = 0;
+    for (bucket = 0; bucket < XRDP_LATENCY_BUCKETS - 1; bucket++)
+    {
+        seen += hist->buckets[bucket];
+        if (seen >= wanted)
+        {
+            /* Upper bound of the bucket, but no more than we've seen */
+            rv = (bucket == 0) ? 0 : (1u << bucket) - 1;
+            return MIN(rv, hist->max_ms);
+        }
+    }
+    return hist->max_ms;
+}
+
+/*****************************************************************************/
+const char *
+xrdp_latency_stage_to_str(enum xrdp_latency_stage stage)
+{
+    const char *rv = "unknown";
+
+    switch (stage)
+    {
+        case XRDP_LATENCY_MODULE:
+            rv = "module";
+            break;
+        case XRDP_LATENCY_ENCODE:
+            rv = "encode";
+            break;
+        case XRDP_LATENCY_NETWORK:
+            rv = "network";
+            break;
+        case XRDP_LATENCY_TOTAL:
+            rv = "total";
+            break;
+        case XRDP_LATENCY_STAGE_COUNT:
+            break;
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+void
+xrdp_latency_log_summary(const struct xrdp_latency *self)
+{
+    int stage;
+    const struct xrdp_latency_hist *hist;
+
+    for (stage = 0; stage < XRDP_LATENCY_STAGE_COUNT; stage++)
+    {
+        hist = &self->hist[stage];
+        if (hist->count == 0)
+        {
+            continue;
+        }
+        LOG(LOG_LEVEL_INFO, "Latency %s: samples %u avg %u ms "
+            "p50 <=%u ms p90 <=%u ms p99 <=%u ms max %u ms",
+            xrdp_latency_stage_to_str((enum xrdp_latency_stage)stage),
+            hist->count, (unsigned int)(hist->total_ms / hist->count),
+            xrdp_latency_hist_percentile(hist, 50),
+            xrdp_latency_hist_percentile(hist, 90),
+            xrdp_latency_hist_percentile(hist, 99),
+            hist->max_ms);
+    }
+}
@@ -0,0 +1,127 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Input to display latency measurement
+ */
+
+#ifndef _XRDP_LATENCY_H
+#define _XRDP_LATENCY_H
+
+#include "arch.h"
+
+/*
+ * Latency is split into stages, so a slow session can be attributed to
+ * the X server, the encoder or the network/client:-
+ *
+ *   input received          frame from module      frame sent    frame acked
+ *        |---- MODULE ---------->|---- ENCODE ------->|-- NETWORK -->|
+ *        |------------------------------ TOTAL ---------------------->|
+ *
+ * Only the first input after the last measured frame is timed, and is
+ * attributed to the next frame the module produces after it arrived.
+ */
+enum xrdp_latency_stage
+{
+    XRDP_LATENCY_MODULE = 0,
+    XRDP_LATENCY_ENCODE,
+    XRDP_LATENCY_NETWORK,
+    XRDP_LATENCY_TOTAL,
+
+    XRDP_LATENCY_STAGE_COUNT
+};
+
+/* Bucket n counts samples in [2^(n-1), 2^n) ms, bucket 0 counts 0 ms.
+ * The last bucket also counts everything larger */
+#define XRDP_LATENCY_BUCKETS 16
+
+/* Frames we remember while waiting for an ack */
+#define XRDP_LATENCY_MAX_FRAMES 32
+
+struct xrdp_latency_hist
+{
+    unsigned int buckets[XRDP_LATENCY_BUCKETS];
+    unsigned int count;
+    unsigned int max_ms;
+    unsigned long long total_ms;
+};
+
+struct xrdp_latency_frame
+{
+    int frame_id; /* -1 if slot is free */
+    int have_input;
+    unsigned int input_time;
+    unsigned int sent_time;
+};
+
+struct xrdp_latency
+{
+    int have_input;
+    unsigned int input_time; /* oldest input not yet seen in a frame */
+    struct xrdp_latency_frame frames[XRDP_LATENCY_MAX_FRAMES];
+    struct xrdp_latency_hist hist[XRDP_LATENCY_STAGE_COUNT];
+};
+
+void
+xrdp_latency_init(struct xrdp_latency *self);
+
+/**
+ * Record the arrival of an input event from the client
+ */
+void
+xrdp_latency_input(struct xrdp_latency *self, unsigned int now);
+
+/**
+ * Record that a frame has been encoded and sent to the client
+ *
+ * @param frame_id Frame ID, as the client will acknowledge it
+ * @param paint_time When the frame was received from the module
+ * @param now Current time
+ */
+void
+xrdp_latency_frame_sent(struct xrdp_latency *self, int frame_id,
+                        unsigned int paint_time, unsigned int now);
+
+/**
+ * Record a frame acknowledgement from the client
+ */
+void
+xrdp_latency_frame_acked(struct xrdp_latency *self, int frame_id,
+                         unsigned int now);
+
+void
+xrdp_latency_hist_add(struct xrdp_latency_hist *hist, unsigned int ms);
+
+/**
+ * Estimate a percentile from a histogram
+ *
+ * @param percent Percentile required (0-100)
+ * @return Upper bound of the bucket containing the percentile, in ms
+ */
+unsigned int
+xrdp_latency_hist_percentile(const struct xrdp_latency_hist *hist,
+                             unsigned int percent);
+
+const char *
+xrdp_latency_stage_to_str(enum xrdp_latency_stage stage);
+
+/**
+ * Log a summary of the latency of each stage
+ */
+void
+xrdp_latency_log_summary(const struct xrdp_latency *self);
+
+#endif
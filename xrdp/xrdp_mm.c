@@ -35,6 +35,7 @@
 #include "xrdp_egfx.h"
 #include "libxrdp.h"
 #include "xrdp_channel.h"
+#include "probes.h"
 #include <limits.h>
 
 /* Forward declarations */
@@ -60,6 +61,8 @@ xrdp_mm_create(struct xrdp_wm *owner)
     self->login_values->auto_free = 1;
 
     self->uid = -1; /* Never good to default UIDs to 0 */
+    xrdp_latency_init(&self->latency);
+    xrdp_stats_init(&self->stats, g_get_elapsed_ms());
 
     LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_mm_create: bpp %d mcs_connection_type %d "
               "jpeg_codec_id %d v3_codec_id %d rfx_codec_id %d "
@@ -163,6 +166,8 @@ xrdp_mm_delete(struct xrdp_mm *self)
     /* shutdown thread */
     xrdp_encoder_delete(self->encoder);
 
+    xrdp_latency_log_summary(&self->latency);
+
     trans_delete(self->sesman_trans);
     self->sesman_trans = 0;
     list_delete(self->login_names);
@@ -675,6 +680,10 @@ xrdp_mm_trans_process_channel_data(struct xrdp_mm *self, struct stream *s)
         {
             rv = libxrdp_send_to_channel(self->wm->session, chan_id,
                                          s->p, size, total_size, chan_flags);
+            if (rv == 0)
+            {
+                xrdp_stats_channel_sent(&self->stats, chan_id, size);
+            }
         }
     }
 
@@ -1580,6 +1589,7 @@ xrdp_mm_egfx_frame_ack(void *user, uint32_t queue_depth, int frame_id,
     LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_mm_egfx_frame_ack: "
               "incoming %d, client %d, server %d",
               frame_id, encoder->frame_id_client, encoder->frame_id_server);
+    xrdp_latency_frame_acked(&self->latency, frame_id, g_get_elapsed_ms());
     if (frame_id < 0 || frame_id > encoder->frame_id_server)
     {
         /* if frame_id is negative or bigger then what server last sent
@@ -3669,6 +3679,11 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         {
             if (is_gfx)
             {
+                xrdp_stats_codec_update(&self->stats,
+                                        (enum xrdp_stats_codec)
+                                        enc_done->stats_codec,
+                                        enc_done->comp_bytes);
+                self->stats.egfx_bytes_sent += enc_done->comp_bytes;
                 xrdp_egfx_send_data(self->egfx,
                                     enc_done->comp_pad_data +
                                     enc_done->pad_bytes,
@@ -3680,6 +3695,10 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
                 y = enc_done->y;
                 cx = enc_done->cx;
                 cy = enc_done->cy;
+                xrdp_stats_codec_update(&self->stats,
+                                        (enum xrdp_stats_codec)
+                                        self->encoder->stats_codec,
+                                        enc_done->comp_bytes);
                 if (client_ack && !enc_done->continuation)
                 {
                     libxrdp_fastpath_send_frame_marker(self->wm->session, 0,
@@ -3706,10 +3725,18 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
             LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: last set");
             if (got_frame_id)
             {
+                xrdp_latency_frame_sent(&self->latency, enc_done->frame_id,
+                                        enc->paint_time, g_get_elapsed_ms());
                 if (client_ack)
                 {
                     self->encoder->frame_id_server = enc_done->frame_id;
                     xrdp_mm_update_module_frame_ack(self);
+                    if (self->encoder->frame_id_server_sent !=
+                            enc_done->frame_id)
+                    {
+                        /* Client is too far behind - ack deferred */
+                        self->stats.frames_held++;
+                    }
                 }
                 else
                 {
@@ -3721,11 +3748,6 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
             {
                 g_free(enc->u.gfx.cmd);
             }
-            else
-            {
-                g_free(enc->u.sc.drects);
-                g_free(enc->u.sc.crects);
-            }
             if (enc->shmem_ptr != NULL)
             {
                 g_munmap(enc->shmem_ptr, enc->shmem_bytes);
@@ -3964,6 +3986,7 @@ xrdp_mm_frame_ack(struct xrdp_mm *self, int frame_id)
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_frame_ack: "
               "incoming %d, client %d, server %d", frame_id,
               encoder->frame_id_client, encoder->frame_id_server);
+    xrdp_latency_frame_acked(&self->latency, frame_id, g_get_elapsed_ms());
     if ((frame_id < 0) || (frame_id > encoder->frame_id_server))
     {
         /* if frame_id is negative or bigger then what server last sent
@@ -4232,6 +4255,7 @@ server_paint_rects_ex(struct xrdp_mod *mod,
     short *s;
     int index;
     XRDP_ENC_DATA *enc_data;
+    unsigned int queued;
 
     wm = (struct xrdp_wm *)(mod->wm);
     mm = wm->mm;
@@ -4240,8 +4264,11 @@ server_paint_rects_ex(struct xrdp_mod *mod,
 
     if (mm->encoder != 0)
     {
-        /* copy formal params to XRDP_ENC_DATA */
-        enc_data = (XRDP_ENC_DATA *) g_malloc(sizeof(XRDP_ENC_DATA), 1);
+        /* copy formal params to XRDP_ENC_DATA. The rectangle lists
+           are stored after it in the same allocation */
+        enc_data = (XRDP_ENC_DATA *)
+                   g_malloc(sizeof(XRDP_ENC_DATA) +
+                            sizeof(short) * 4 * (num_drects + num_crects), 0);
         if (enc_data == 0)
         {
             if (shmem_ptr != NULL)
@@ -4250,32 +4277,10 @@ server_paint_rects_ex(struct xrdp_mod *mod,
             }
             return 1;
         }
+        g_memset(enc_data, 0, sizeof(XRDP_ENC_DATA));
 
-        enc_data->u.sc.drects = (short *)
-                                g_malloc(sizeof(short) * num_drects * 4, 0);
-        if (enc_data->u.sc.drects == 0)
-        {
-            if (shmem_ptr != NULL)
-            {
-                g_munmap(shmem_ptr, shmem_bytes);
-            }
-            g_free(enc_data);
-            return 1;
-        }
-
-        enc_data->u.sc.crects = (short *)
-                                g_malloc(sizeof(short) * num_crects * 4, 0);
-        if (enc_data->u.sc.crects == 0)
-        {
-            if (shmem_ptr != NULL)
-            {
-                g_munmap(shmem_ptr, shmem_bytes);
-            }
-            g_free(enc_data->u.sc.drects);
-            g_free(enc_data);
-            return 1;
-        }
-
+        enc_data->u.sc.drects = (short *) (enc_data + 1);
+        enc_data->u.sc.crects = enc_data->u.sc.drects + num_drects * 4;
         g_memcpy(enc_data->u.sc.drects, drects, sizeof(short) * num_drects * 4);
         g_memcpy(enc_data->u.sc.crects, crects, sizeof(short) * num_crects * 4);
 
@@ -4291,6 +4296,7 @@ server_paint_rects_ex(struct xrdp_mod *mod,
         enc_data->u.sc.frame_id = frame_id;
         enc_data->shmem_ptr = shmem_ptr;
         enc_data->shmem_bytes = shmem_bytes;
+        enc_data->paint_time = g_get_elapsed_ms();
         if (width == 0 || height == 0)
         {
             LOG_DEVEL(LOG_LEVEL_WARNING, "server_paint_rects: error");
@@ -4299,7 +4305,10 @@ server_paint_rects_ex(struct xrdp_mod *mod,
         /* insert into fifo for encoder thread to process */
         tc_mutex_lock(mm->encoder->mutex);
         fifo_add_item(mm->encoder->fifo_to_proc, (void *) enc_data);
+        queued = fifo_get_count(mm->encoder->fifo_to_proc);
         tc_mutex_unlock(mm->encoder->mutex);
+        XRDP_PROBE2(enc_enqueue, enc_data, queued);
+        mm->stats.enc_queue_max = MAX(mm->stats.enc_queue_max, queued);
 
         /* signal xrdp_encoder thread */
         g_set_wait_obj(mm->encoder->xrdp_encoder_event_to_proc);
@@ -4357,6 +4366,7 @@ server_egfx_cmd(struct xrdp_mod *mod,
     XRDP_ENC_DATA *enc;
     struct xrdp_wm *wm;
     struct xrdp_mm *mm;
+    unsigned int queued;
 
     wm = (struct xrdp_wm *)(mod->wm);
     mm = wm->mm;
@@ -4396,10 +4406,14 @@ server_egfx_cmd(struct xrdp_mod *mod,
     enc->u.gfx.data_bytes = data_bytes;
     enc->shmem_ptr = data;
     enc->shmem_bytes = data_bytes;
+    enc->paint_time = g_get_elapsed_ms();
     /* insert into fifo for encoder thread to process */
     tc_mutex_lock(mm->encoder->mutex);
     fifo_add_item(mm->encoder->fifo_to_proc, enc);
+    queued = fifo_get_count(mm->encoder->fifo_to_proc);
     tc_mutex_unlock(mm->encoder->mutex);
+    XRDP_PROBE2(enc_enqueue, enc, queued);
+    mm->stats.enc_queue_max = MAX(mm->stats.enc_queue_max, queued);
     /* signal xrdp_encoder thread */
     g_set_wait_obj(mm->encoder->xrdp_encoder_event_to_proc);
     return 0;
@@ -4846,8 +4860,13 @@ server_send_to_channel(struct xrdp_mod *mod, int channel_id,
         return 1;
     }
 
-    return libxrdp_send_to_channel(wm->session, channel_id, data, data_len,
-                                   total_data_len, flags);
+    if (libxrdp_send_to_channel(wm->session, channel_id, data, data_len,
+                                total_data_len, flags) != 0)
+    {
+        return 1;
+    }
+    xrdp_stats_channel_sent(&wm->mm->stats, channel_id, data_len);
+    return 0;
 }
 
 /*****************************************************************************/
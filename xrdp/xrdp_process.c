@@ -57,6 +57,7 @@ xrdp_process_delete(struct xrdp_process *self)
     }
 
     g_delete_wait_obj(self->self_term_event);
+    xrdp_stats_end(self);
     libxrdp_exit(self->session);
     xrdp_wm_delete(self->wm);
     trans_delete(self->server_trans);
@@ -248,6 +249,7 @@ xrdp_process_main_loop(struct xrdp_process *self)
     if (libxrdp_process_incoming(self->session) == 0)
     {
         init_stream(self->server_trans->in_s, 32 * 1024);
+        xrdp_stats_listen(self);
 
         term_obj = g_get_term();
         cont = 1;
@@ -264,6 +266,10 @@ xrdp_process_main_loop(struct xrdp_process *self)
                                   wobjs, &wobjs_count, &timeout);
             trans_get_wait_objs_rw(self->server_trans, robjs, &robjs_count,
                                    wobjs, &wobjs_count, &timeout);
+            if (self->stats_trans != NULL)
+            {
+                trans_get_wait_objs(self->stats_trans, robjs, &robjs_count);
+            }
             /* wait */
             if (g_obj_wait(robjs, robjs_count, wobjs, wobjs_count, timeout) != 0)
             {
@@ -293,6 +299,17 @@ xrdp_process_main_loop(struct xrdp_process *self)
             {
                 break;
             }
+
+            /* pass on coalesced pointer motion from this wakeup */
+            xrdp_wm_flush_input(self->wm);
+
+            if (self->stats_trans != NULL &&
+                    trans_check_wait_objs(self->stats_trans) != 0)
+            {
+                /* Not fatal for the session */
+                LOG(LOG_LEVEL_WARNING, "Stats socket failed - closing it");
+                xrdp_stats_end(self);
+            }
         }
         /* send disconnect message if possible */
         libxrdp_disconnect(self->session);
@@ -304,6 +321,7 @@ xrdp_process_main_loop(struct xrdp_process *self)
            maybe should check that connection got far enough */
         libxrdp_disconnect(self->session);
     }
+    xrdp_stats_end(self);
     /* Run end in module */
     xrdp_process_mod_end(self);
     xrdp_wm_delete(self->wm);
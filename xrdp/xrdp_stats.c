@@ -0,0 +1,339 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Per-session performance counters
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "xrdp.h"
+#include "xrdp_egfx.h"
+#include "xrdp_encoder.h"
+#include "xrdp_stats.h"
+#include "fifo.h"
+
+/* Size of the largest report we'll send */
+#define XRDP_STATS_REPORT_BYTES (16 * 1024)
+
+/*****************************************************************************/
+void
+xrdp_stats_init(struct xrdp_stats *self, unsigned int now)
+{
+    g_memset(self, 0, sizeof(struct xrdp_stats));
+    self->start_time = now;
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_codec_update(struct xrdp_stats *self,
+                        enum xrdp_stats_codec codec, int bytes)
+{
+    if (codec > XRDP_STATS_CODEC_NONE && codec < XRDP_STATS_CODEC_COUNT)
+    {
+        self->codec_updates[codec]++;
+        self->codec_bytes[codec] += bytes;
+    }
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_channel_sent(struct xrdp_stats *self, int chan_id, int bytes)
+{
+    if (chan_id >= 0 && chan_id < MAX_STATIC_CHANNELS && bytes > 0)
+    {
+        self->channel_bytes_sent[chan_id] += bytes;
+    }
+}
+
+/*****************************************************************************/
+enum xrdp_stats_codec
+xrdp_stats_codec_from_gfx_id(int codec_id)
+{
+    switch (codec_id)
+    {
+        case XR_RDPGFX_CODECID_PLANAR:
+            return XRDP_STATS_CODEC_GFX_PLANAR;
+        case XR_RDPGFX_CODECID_AVC420:
+            return XRDP_STATS_CODEC_GFX_AVC420;
+        case XR_RDPGFX_CODECID_AVC444:
+        case XR_RDPGFX_CODECID_AVC444V2:
+            return XRDP_STATS_CODEC_GFX_AVC444;
+        case XR_RDPGFX_CODECID_CAPROGRESSIVE:
+            return XRDP_STATS_CODEC_GFX_PROGRESSIVE;
+        default:
+            break;
+    }
+    return XRDP_STATS_CODEC_GFX_OTHER;
+}
+
+/*****************************************************************************/
+const char *
+xrdp_stats_codec_to_str(enum xrdp_stats_codec codec)
+{
+    const char *rv = "unknown";
+
+    switch (codec)
+    {
+        case XRDP_STATS_CODEC_NONE:
+            rv = "none";
+            break;
+        case XRDP_STATS_CODEC_RFX:
+            rv = "rfx";
+            break;
+        case XRDP_STATS_CODEC_JPEG:
+            rv = "jpeg";
+            break;
+        case XRDP_STATS_CODEC_H264:
+            rv = "h264";
+            break;
+        case XRDP_STATS_CODEC_GFX_PLANAR:
+            rv = "gfx_planar";
+            break;
+        case XRDP_STATS_CODEC_GFX_AVC420:
+            rv = "gfx_avc420";
+            break;
+        case XRDP_STATS_CODEC_GFX_AVC444:
+            rv = "gfx_avc444";
+            break;
+        case XRDP_STATS_CODEC_GFX_PROGRESSIVE:
+            rv = "gfx_progressive";
+            break;
+        case XRDP_STATS_CODEC_GFX_OTHER:
+            rv = "gfx_other";
+            break;
+        case XRDP_STATS_CODEC_COUNT:
+            break;
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+/* Adds a 'name value' line to a report. Lines which don't fit are dropped */
+static void
+out_stat(struct stream *s, const char *name, tui64 value)
+{
+    int avail;
+    int len;
+
+    avail = s->size - (int)(s->p - s->data);
+    if (avail > 0)
+    {
+        len = g_snprintf(s->p, avail, "%s %llu\n",
+                         name, (unsigned long long)value);
+        if (len > 0 && len < avail)
+        {
+            s->p += len;
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+write_encoder_report(struct xrdp_mm *mm, struct stream *s)
+{
+    struct xrdp_encoder *encoder = mm->encoder;
+    unsigned int queue_depth;
+    int in_flight;
+
+    if (encoder == NULL)
+    {
+        return;
+    }
+    tc_mutex_lock(encoder->mutex);
+    queue_depth = fifo_get_count(encoder->fifo_to_proc);
+    tc_mutex_unlock(encoder->mutex);
+    in_flight = encoder->frame_id_server - encoder->frame_id_client;
+
+    out_stat(s, "encoder.queue_depth", queue_depth);
+    out_stat(s, "encoder.queue_max", mm->stats.enc_queue_max);
+    out_stat(s, "encoder.frames_in_flight", MAX(in_flight, 0));
+    out_stat(s, "encoder.frames_in_flight_max", encoder->frames_in_flight);
+    out_stat(s, "encoder.frames_held", mm->stats.frames_held);
+}
+
+/*****************************************************************************/
+static void
+write_latency_report(const struct xrdp_latency *latency, struct stream *s)
+{
+    const struct xrdp_latency_hist *hist;
+    const char *stage_name;
+    char name[64];
+    int stage;
+
+    for (stage = 0; stage < XRDP_LATENCY_STAGE_COUNT; stage++)
+    {
+        hist = &latency->hist[stage];
+        stage_name =
+            xrdp_latency_stage_to_str((enum xrdp_latency_stage)stage);
+        g_snprintf(name, sizeof(name), "latency.%s.samples", stage_name);
+        out_stat(s, name, hist->count);
+        if (hist->count == 0)
+        {
+            continue;
+        }
+        g_snprintf(name, sizeof(name), "latency.%s.p50_ms", stage_name);
+        out_stat(s, name, xrdp_latency_hist_percentile(hist, 50));
+        g_snprintf(name, sizeof(name), "latency.%s.p90_ms", stage_name);
+        out_stat(s, name, xrdp_latency_hist_percentile(hist, 90));
+        g_snprintf(name, sizeof(name), "latency.%s.p99_ms", stage_name);
+        out_stat(s, name, xrdp_latency_hist_percentile(hist, 99));
+        g_snprintf(name, sizeof(name), "latency.%s.max_ms", stage_name);
+        out_stat(s, name, hist->max_ms);
+    }
+}
+
+/*****************************************************************************/
+static void
+write_mm_report(struct xrdp_wm *wm, struct stream *s)
+{
+    struct xrdp_mm *mm = wm->mm;
+    const struct xrdp_stats *stats = &mm->stats;
+    char name[64];
+    char chan_name[16];
+    int chan_flags;
+    int chan_count;
+    int index;
+
+    out_stat(s, "uptime_ms", g_get_elapsed_ms() - stats->start_time);
+    out_stat(s, "display", mm->display);
+    for (index = XRDP_STATS_CODEC_NONE + 1;
+            index < XRDP_STATS_CODEC_COUNT; index++)
+    {
+        if (stats->codec_updates[index] == 0)
+        {
+            continue;
+        }
+        g_snprintf(name, sizeof(name), "codec.%s.updates",
+                   xrdp_stats_codec_to_str((enum xrdp_stats_codec)index));
+        out_stat(s, name, stats->codec_updates[index]);
+        g_snprintf(name, sizeof(name), "codec.%s.bytes",
+                   xrdp_stats_codec_to_str((enum xrdp_stats_codec)index));
+        out_stat(s, name, stats->codec_bytes[index]);
+    }
+
+    chan_count = MIN(libxrdp_get_channel_count(wm->session),
+                     MAX_STATIC_CHANNELS);
+    for (index = 0; index < chan_count; index++)
+    {
+        if (stats->channel_bytes_sent[index] == 0 ||
+                libxrdp_query_channel(wm->session, index,
+                                      chan_name, &chan_flags) != 0)
+        {
+            continue;
+        }
+        g_snprintf(name, sizeof(name), "channel.%s.bytes_sent", chan_name);
+        out_stat(s, name, stats->channel_bytes_sent[index]);
+    }
+    out_stat(s, "channel.egfx.bytes_sent", stats->egfx_bytes_sent);
+
+    write_encoder_report(mm, s);
+    write_latency_report(&mm->latency, s);
+    out_stat(s, "input.mouse_moves_coalesced", stats->mouse_moves_coalesced);
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_write_report(struct xrdp_process *pro, struct stream *s)
+{
+    struct trans *trans = pro->server_trans;
+    unsigned int rtt_us;
+    unsigned int rttvar_us;
+
+    out_stat(s, "pid", g_getpid());
+    out_stat(s, "session_id", pro->session_id);
+    out_stat(s, "log.messages_dropped", log_get_dropped_count());
+
+    out_stat(s, "transport.tls", trans->tls != NULL);
+    out_stat(s, "transport.bytes_sent", trans->bytes_sent);
+    out_stat(s, "transport.bytes_recv", trans->bytes_recv);
+    if (trans->mode == TRANS_MODE_TCP &&
+            g_tcp_get_rtt(trans->sck, &rtt_us, &rttvar_us) == 0)
+    {
+        out_stat(s, "transport.rtt_us", rtt_us);
+        out_stat(s, "transport.rttvar_us", rttvar_us);
+    }
+
+    if (pro->wm != NULL && pro->wm->mm != NULL)
+    {
+        write_mm_report(pro->wm, s);
+    }
+    s_mark_end(s);
+}
+
+/*****************************************************************************/
+/* Sends the report to a new connection. Always returns non-zero
+ * so the caller closes the connection */
+static int
+xrdp_stats_conn_in(struct trans *self, struct trans *new_self)
+{
+    struct xrdp_process *pro = (struct xrdp_process *)(self->callback_data);
+    struct stream *s;
+
+    s = trans_get_out_s(new_self, XRDP_STATS_REPORT_BYTES);
+    if (s != NULL)
+    {
+        xrdp_stats_write_report(pro, s);
+        if (trans_force_write(new_self) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_stats_conn_in: can't send report");
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+int
+xrdp_stats_listen(struct xrdp_process *pro)
+{
+    const char *dir = pro->lis_layer->startup_params->stats_socket_dir;
+    char path[256];
+    struct trans *lis;
+
+    if (dir[0] == '\0')
+    {
+        return 0;
+    }
+    g_snprintf(path, sizeof(path), "%s/" XRDP_STATS_SOCKET_BASE_STR,
+               dir, g_getpid(), pro->session_id);
+    lis = trans_create(TRANS_MODE_UNIX, 256, XRDP_STATS_REPORT_BYTES);
+    if (lis == NULL)
+    {
+        return 1;
+    }
+    lis->trans_conn_in = xrdp_stats_conn_in;
+    lis->callback_data = pro;
+    if (trans_listen(lis, path) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "Can't listen on stats socket %s", path);
+        trans_delete(lis);
+        return 1;
+    }
+    LOG(LOG_LEVEL_DEBUG, "Session statistics available on %s", path);
+    pro->stats_trans = lis;
+    return 0;
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_end(struct xrdp_process *pro)
+{
+    /* The listener removes its socket file */
+    trans_delete(pro->stats_trans);
+    pro->stats_trans = NULL;
+}
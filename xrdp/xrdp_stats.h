@@ -0,0 +1,126 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2024, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Per-session performance counters
+ */
+
+#ifndef _XRDP_STATS_H
+#define _XRDP_STATS_H
+
+#include "arch.h"
+#include "ms-rdpbcgr.h"
+
+/*
+ * Counters are only updated from the session's main thread, so no
+ * locking is needed.
+ *
+ * If stats_socket_dir is set in xrdp.ini, each session listens on a
+ * UNIX domain socket in that directory called XRDP_STATS_SOCKET_BASE_STR.
+ * Connecting to the socket returns a text report of 'key value' lines,
+ * and the connection is then closed. tools/stats/xrdp-stats reads these.
+ */
+#define XRDP_STATS_SOCKET_PREFIX "xrdp_stats_"
+#define XRDP_STATS_SOCKET_BASE_STR XRDP_STATS_SOCKET_PREFIX "%d_%d"
+
+enum xrdp_stats_codec
+{
+    XRDP_STATS_CODEC_NONE = 0,
+    /* Surface commands */
+    XRDP_STATS_CODEC_RFX,
+    XRDP_STATS_CODEC_JPEG,
+    XRDP_STATS_CODEC_H264,
+    /* Graphics pipeline (EGFX) */
+    XRDP_STATS_CODEC_GFX_PLANAR,
+    XRDP_STATS_CODEC_GFX_AVC420,
+    XRDP_STATS_CODEC_GFX_AVC444,
+    XRDP_STATS_CODEC_GFX_PROGRESSIVE,
+    XRDP_STATS_CODEC_GFX_OTHER,
+
+    XRDP_STATS_CODEC_COUNT
+};
+
+struct xrdp_stats
+{
+    unsigned int start_time;
+    /* Encoded updates, and their compressed size, for each codec */
+    tui64 codec_updates[XRDP_STATS_CODEC_COUNT];
+    tui64 codec_bytes[XRDP_STATS_CODEC_COUNT];
+    /* Bytes sent on each static virtual channel, and on the EGFX channel */
+    tui64 channel_bytes_sent[MAX_STATIC_CHANNELS];
+    tui64 egfx_bytes_sent;
+    /* Most updates waiting for the encoder thread at once */
+    unsigned int enc_queue_max;
+    /* Frames from the module we couldn't ack straight away, as too
+     * many frames were in flight to the client */
+    tui64 frames_held;
+    /* Mouse move events merged with a later one */
+    tui64 mouse_moves_coalesced;
+};
+
+struct xrdp_process;
+struct stream;
+
+void
+xrdp_stats_init(struct xrdp_stats *self, unsigned int now);
+
+/**
+ * Count an encoded update
+ *
+ * @param codec Codec used. Updates for XRDP_STATS_CODEC_NONE are ignored
+ * @param bytes Size of the encoded update
+ */
+void
+xrdp_stats_codec_update(struct xrdp_stats *self,
+                        enum xrdp_stats_codec codec, int bytes);
+
+void
+xrdp_stats_channel_sent(struct xrdp_stats *self, int chan_id, int bytes);
+
+/**
+ * Maps an XR_RDPGFX_CODECID_* value to a stats codec
+ */
+enum xrdp_stats_codec
+xrdp_stats_codec_from_gfx_id(int codec_id);
+
+const char *
+xrdp_stats_codec_to_str(enum xrdp_stats_codec codec);
+
+/**
+ * Writes the text report for a session to a stream
+ *
+ * The report is truncated if the stream is too small.
+ */
+void
+xrdp_stats_write_report(struct xrdp_process *pro, struct stream *s);
+
+/**
+ * Starts listening on the stats socket for a session
+ *
+ * Does nothing if stats_socket_dir is not set
+ *
+ * @return 0 for success
+ */
+int
+xrdp_stats_listen(struct xrdp_process *pro);
+
+/**
+ * Stops listening on the stats socket for a session, and removes it
+ */
+void
+xrdp_stats_end(struct xrdp_process *pro);
+
+#endif
@@ -31,6 +31,8 @@
 #include "scancode.h"
 #include "xrdp_client_info.h"
 #include "xrdp_tconfig.h"
+#include "xrdp_latency.h"
+#include "xrdp_stats.h"
 
 #define MAX_NR_CHANNELS 16
 #define MAX_CHANNEL_NAME 16
@@ -452,6 +454,10 @@ struct xrdp_mm
     int last_sync_saved;
     int last_sync_key_flags;
     int last_sync_device_flags;
+    /* Input to display latency for this session */
+    struct xrdp_latency latency;
+    /* Performance counters for this session */
+    struct xrdp_stats stats;
 };
 
 struct xrdp_key_info
@@ -557,6 +563,10 @@ struct xrdp_wm
     int current_pointer;
     int mouse_x;
     int mouse_y;
+    /* pointer move held back for coalescing, see xrdp_wm_flush_input() */
+    int pending_mouse_move;
+    int pending_mouse_x;
+    int pending_mouse_y;
     /* keyboard info (indexed by a return from scancode_to_index()) */
     int keys[SCANCODE_MAX_INDEX + 1]; /* key states 0 up 1 down*/
     int caps_lock;
@@ -605,6 +615,7 @@ struct xrdp_process
     //int app_sck;
     tbus done_event;
     int session_id;
+    struct trans *stats_trans; /* stats socket listener, or NULL */
 };
 
 /* rdp listener */
@@ -760,6 +771,8 @@ struct xrdp_startup_params
     // a lot of storage for them.
     char runtime_user[64];
     char runtime_group[64];
+    /* Directory for session statistics sockets, or empty */
+    char stats_socket_dir[256];
 };
 
 /*
@@ -1264,6 +1264,19 @@ xrdp_wm_mouse_move(struct xrdp_wm *self, int x, int y)
     return 0;
 }
 
+/*****************************************************************************/
+int
+xrdp_wm_flush_input(struct xrdp_wm *self)
+{
+    if (self == 0 || !self->pending_mouse_move)
+    {
+        return 0;
+    }
+    self->pending_mouse_move = 0;
+    return xrdp_wm_mouse_move(self, self->pending_mouse_x,
+                              self->pending_mouse_y);
+}
+
 /*****************************************************************************/
 static int
 xrdp_wm_clear_popup(struct xrdp_wm *self)
@@ -2133,6 +2146,34 @@ callback(intptr_t id, int msg, intptr_t param1, intptr_t param2,
         return 0;
     }
 
+    switch (msg)
+    {
+        case RDP_INPUT_SYNCHRONIZE:
+        case RDP_INPUT_SCANCODE:
+        case RDP_INPUT_UNICODE:
+        case RDP_INPUT_MOUSE:
+        case RDP_INPUT_MOUSEX:
+            if (wm->mm != NULL)
+            {
+                xrdp_latency_input(&wm->mm->latency, g_get_elapsed_ms());
+            }
+            break;
+    }
+
+    if (msg == RDP_INPUT_MOUSE && param3 == PTRFLAGS_MOVE)
+    {
+        /* only the last of a run of moves needs to reach the module */
+        if (wm->pending_mouse_move && wm->mm != NULL)
+        {
+            wm->mm->stats.mouse_moves_coalesced++;
+        }
+        wm->pending_mouse_move = 1;
+        wm->pending_mouse_x = param1;
+        wm->pending_mouse_y = param2;
+        return 0;
+    }
+    xrdp_wm_flush_input(wm);
+
     rv = 0;
 
     switch (msg)
@@ -2487,6 +2528,9 @@ xrdp_wm_check_wait_objs(struct xrdp_wm *self)
 
     rv = 0;
 
+    /* get client input to the module before processing its output */
+    xrdp_wm_flush_input(self);
+
     if (g_is_wait_obj_set(self->login_state_event))
     {
         g_reset_wait_obj(self->login_state_event);
@@ -28,6 +28,10 @@
 #include "string_calls.h"
 #include "scancode.h"
 
+/* Max number of fds which can follow a single message. All of these
+ * must fit on the transport fd queue */
+#define XUP_MAX_MSG_FDS TRANS_MAX_RECV_FDS
+
 static int
 send_server_monitor_update(struct mod *v, struct stream *s,
                            int width, int height,
@@ -90,6 +94,86 @@ lib_mod_log_peer(struct mod *mod)
     return 0;
 }
 
+/******************************************************************************/
+/*
+ * Count the file descriptors the Xorg module sends after a message
+ *
+ * Every *_shmfd order in the message is followed on the socket (after the
+ * message itself) by a 4 byte marker which carries the fd. Only type 3
+ * order lists can be scanned here, as type 1 orders carry no length.
+ * These are not used for shmfd orders by xorgxrdp.
+ *
+ * Returns the number of fds, or -1 if the message can't be scanned
+ */
+static int
+lib_mod_count_message_fds(struct stream *s)
+{
+    int type;
+    int num_orders;
+    int len;
+    int index;
+    int cmd_bytes;
+    int shmem_bytes;
+    int rv;
+    char *phold;
+
+    rv = 0;
+    s->p = s->data;
+    if (!s_check_rem(s, 8))
+    {
+        return -1;
+    }
+    in_uint16_le(s, type);
+    in_uint16_le(s, num_orders);
+    in_uint8s(s, 4);
+    if (type != 3)
+    {
+        s->p = s->data;
+        return -1;
+    }
+    for (index = 0; index < num_orders; index++)
+    {
+        phold = s->p;
+        if (!s_check_rem(s, 4))
+        {
+            break;
+        }
+        in_uint16_le(s, type);
+        in_uint16_le(s, len);
+        switch (type)
+        {
+            case 62: /* server_egfx_shmfd */
+                if (!s_check_rem(s, 4))
+                {
+                    break;
+                }
+                in_uint32_le(s, cmd_bytes);
+                if (cmd_bytes < 0 || !s_check_rem(s, cmd_bytes + 4))
+                {
+                    break;
+                }
+                in_uint8s(s, cmd_bytes);
+                in_uint32_le(s, shmem_bytes);
+                if (shmem_bytes != 0)
+                {
+                    rv++;
+                }
+                break;
+            case 63: /* server_set_pointer_shmfd */
+            case 64: /* server_paint_rect_shmfd */
+                rv++;
+                break;
+        }
+        if (len < 4)
+        {
+            break;
+        }
+        s->p = phold + len;
+    }
+    s->p = s->data;
+    return rv;
+}
+
 /******************************************************************************/
 static int
 lib_data_in(struct trans *trans)
@@ -97,6 +181,9 @@ lib_data_in(struct trans *trans)
     struct mod *self;
     struct stream *s;
     int len;
+    int num_fds;
+    int fd;
+    int rv;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "lib_data_in:");
     if (trans == 0)
@@ -131,8 +218,44 @@ lib_data_in(struct trans *trans)
             }
         /* fall through */
         case 2:
+            /* Each fd used by the message follows it in the stream as a
+             * 4 byte marker. Read these with the message, so that
+             * processing it never has to wait on the socket */
+            num_fds = -1;
+            if (trans->mode == TRANS_MODE_UNIX)
+            {
+                num_fds = lib_mod_count_message_fds(s);
+            }
+            self->msg_fds_read = (num_fds >= 0);
+            if (num_fds > XUP_MAX_MSG_FDS)
+            {
+                LOG(LOG_LEVEL_ERROR, "lib_data_in: message uses %d fds "
+                    "(max %d)", num_fds, XUP_MAX_MSG_FDS);
+                return 1;
+            }
+            if (num_fds > 0)
+            {
+                trans->header_size += 4 * num_fds;
+                if (trans->header_size > (unsigned int)s->size)
+                {
+                    LOG(LOG_LEVEL_ERROR, "lib_data_in: message too big");
+                    return 1;
+                }
+                trans->extra_flags = 3;
+                break;
+            }
+        /* fall through */
+        case 3:
             s->p = s->data;
-            if (lib_mod_process_message(self, s) != 0)
+            rv = lib_mod_process_message(self, s);
+            self->msg_fds_read = 0;
+            /* Don't let unclaimed fds leak into the next message */
+            while ((fd = trans_get_recv_fd(trans)) >= 0)
+            {
+                LOG(LOG_LEVEL_WARNING, "lib_data_in: unused fd %d", fd);
+                g_file_close(fd);
+            }
+            if (rv != 0)
             {
                 LOG(LOG_LEVEL_ERROR, "lib_data_in: lib_mod_process_message failed");
                 return 1;
@@ -293,7 +416,9 @@ lib_mod_connect(struct mod *mod)
         }
     }
 
-    mod->trans = trans_create(socket_mode, 8 * 8192, 8192);
+    /* Allow room for the fd markers which follow a maximum size message */
+    mod->trans = trans_create(socket_mode, 8 * 8192 + 4 * XUP_MAX_MSG_FDS,
+                              8192);
     if (mod->trans == 0)
     {
         free_stream(s);
@@ -320,6 +445,7 @@ lib_mod_connect(struct mod *mod)
         if (socket_mode == TRANS_MODE_UNIX)
         {
             lib_mod_log_peer(mod);
+            trans_enable_fd_passing(mod->trans);
         }
     }
     else
@@ -1227,6 +1353,83 @@ send_suppress_output(struct mod *mod, int suppress,
     return 0;
 }
 
+/******************************************************************************/
+/*
+ * Read the dirty and copied rectangle lists from a paint order
+ *
+ * The lists are stored one after the other in storage which is owned by the
+ * module and reused for every order, so no allocation is needed per frame.
+ * The pointers returned are valid until the next call.
+ *
+ * Returns non-zero if the order is malformed
+ */
+static int
+lib_mod_in_paint_rects(struct mod *amod, struct stream *s,
+                       int *num_drects, short **drects,
+                       int *num_crects, short **crects)
+{
+    int num_rects;
+    const unsigned char *p;
+#if !defined(L_ENDIAN)
+    int index;
+    short *rects;
+#endif
+
+    if (!s_check_rem_and_log(s, 2, "lib_mod_in_paint_rects:"))
+    {
+        return 1;
+    }
+    in_uint16_le(s, *num_drects);
+    if (!s_check_rem_and_log(s, *num_drects * 8 + 2,
+                             "lib_mod_in_paint_rects:"))
+    {
+        return 1;
+    }
+    /* peek at the copied rectangle count, so storage is only sized once */
+    p = (const unsigned char *) (s->p + *num_drects * 8);
+    *num_crects = p[0] | (p[1] << 8);
+    if (!s_check_rem_and_log(s, *num_drects * 8 + 2 + *num_crects * 8,
+                             "lib_mod_in_paint_rects:"))
+    {
+        return 1;
+    }
+
+    num_rects = *num_drects + *num_crects;
+    if (num_rects > amod->paint_rects_alloc)
+    {
+        g_free(amod->paint_rects);
+        amod->paint_rects = g_new(short, 4 * num_rects);
+        if (amod->paint_rects == NULL)
+        {
+            amod->paint_rects_alloc = 0;
+            return 1;
+        }
+        amod->paint_rects_alloc = num_rects;
+    }
+    *drects = amod->paint_rects;
+    *crects = amod->paint_rects + 4 * *num_drects;
+
+#if defined(L_ENDIAN)
+    /* wire format matches ours - copy the lists directly */
+    in_uint8a(s, *drects, *num_drects * 8);
+    in_uint8s(s, 2);
+    in_uint8a(s, *crects, *num_crects * 8);
+#else
+    rects = *drects;
+    for (index = 0; index < *num_drects * 4; index++)
+    {
+        in_sint16_le(s, rects[index]);
+    }
+    in_uint8s(s, 2);
+    rects = *crects;
+    for (index = 0; index < *num_crects * 4; index++)
+    {
+        in_sint16_le(s, rects[index]);
+    }
+#endif
+    return 0;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1242,38 +1445,15 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
     int shmem_offset;
     int width;
     int height;
-    int index;
     int rv;
-    tsi16 *ldrects;
-    tsi16 *ldrects1;
-    tsi16 *lcrects;
-    tsi16 *lcrects1;
+    short *ldrects;
+    short *lcrects;
     char *bmpdata;
 
-    /* dirty pixels */
-    in_uint16_le(s, num_drects);
-    ldrects = (tsi16 *) g_malloc(2 * 4 * num_drects, 0);
-    ldrects1 = ldrects;
-    for (index = 0; index < num_drects; index++)
-    {
-        in_sint16_le(s, ldrects1[0]);
-        in_sint16_le(s, ldrects1[1]);
-        in_sint16_le(s, ldrects1[2]);
-        in_sint16_le(s, ldrects1[3]);
-        ldrects1 += 4;
-    }
-
-    /* copied pixels */
-    in_uint16_le(s, num_crects);
-    lcrects = (tsi16 *) g_malloc(2 * 4 * num_crects, 0);
-    lcrects1 = lcrects;
-    for (index = 0; index < num_crects; index++)
+    if (lib_mod_in_paint_rects(amod, s, &num_drects, &ldrects,
+                               &num_crects, &lcrects) != 0)
     {
-        in_sint16_le(s, lcrects1[0]);
-        in_sint16_le(s, lcrects1[1]);
-        in_sint16_le(s, lcrects1[2]);
-        in_sint16_le(s, lcrects1[3]);
-        lcrects1 += 4;
+        return 1;
     }
 
     in_uint32_le(s, flags);
@@ -1338,12 +1518,59 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
         rv = 1;
     }
 
-    g_free(lcrects);
-    g_free(ldrects);
-
     return rv;
 }
 
+/******************************************************************************/
+/*
+ * Get the fd sent with a *_shmfd order
+ *
+ * Normally lib_data_in() has already read the marker carrying the fd
+ * along with the message, and the fd is queued on the transport. If the
+ * message could not be scanned for fds, read the marker here.
+ *
+ * Returns the fd, or -1 on error
+ */
+static int
+lib_mod_get_order_fd(struct mod *amod)
+{
+    int fd;
+    int recv_bytes;
+    unsigned int num_fds;
+    char msg[4];
+
+    fd = trans_get_recv_fd(amod->trans);
+    if (fd >= 0)
+    {
+        return fd;
+    }
+    if (amod->msg_fds_read)
+    {
+        /* The socket is already positioned at the next message */
+        LOG(LOG_LEVEL_ERROR, "lib_mod_get_order_fd: no fd was sent "
+            "with the message");
+        return -1;
+    }
+    fd = -1;
+    num_fds = 0;
+    if (g_tcp_can_recv(amod->trans->sck, 5000) == 0)
+    {
+        return -1;
+    }
+    recv_bytes = g_sck_recv_fd_set(amod->trans->sck, msg, 4, &fd, 1, &num_fds);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "lib_mod_get_order_fd: "
+              "g_sck_recv_fd_set rv %d fd %d", recv_bytes, fd);
+    if (recv_bytes != 4 || num_fds != 1)
+    {
+        if (num_fds == 1)
+        {
+            g_file_close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1355,10 +1582,7 @@ process_server_egfx_shmfd(struct mod *amod, struct stream *s)
     int cmd_bytes;
     int shmem_bytes;
     int fd;
-    int recv_bytes;
-    unsigned int num_fds;
     void *shmem_ptr;
-    char msg[4];
 
     rv = 0;
     in_uint32_le(s, cmd_bytes);
@@ -1368,31 +1592,21 @@ process_server_egfx_shmfd(struct mod *amod, struct stream *s)
     {
         return amod->server_egfx_cmd(amod, cmd, cmd_bytes, NULL, 0);
     }
-    fd = -1;
-    num_fds = -1;
-    if (g_tcp_can_recv(amod->trans->sck, 5000) == 0)
+    fd = lib_mod_get_order_fd(amod);
+    if (fd < 0)
     {
         return 1;
     }
-    recv_bytes = g_sck_recv_fd_set(amod->trans->sck, msg, 4, &fd, 1, &num_fds);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_server_egfx_shmfd: "
-              "g_sck_recv_fd_set rv %d fd %d", recv_bytes, fd);
-    if (recv_bytes == 4)
+    if (g_file_map(fd, 1, 0, shmem_bytes, &shmem_ptr) == 0)
     {
-        if (num_fds == 1)
-        {
-            if (g_file_map(fd, 1, 0, shmem_bytes, &shmem_ptr) == 0)
-            {
-                /* we give up ownership of shmem_ptr
-                   will get cleaned up in server_egfx_cmd or
-                   xrdp_mm_process_enc_done(gfx) */
-                data = (char *) shmem_ptr;
-                rv = amod->server_egfx_cmd(amod, cmd, cmd_bytes,
-                                           data, shmem_bytes);
-            }
-            g_file_close(fd);
-        }
+        /* we give up ownership of shmem_ptr
+           will get cleaned up in server_egfx_cmd or
+           xrdp_mm_process_enc_done(gfx) */
+        data = (char *) shmem_ptr;
+        rv = amod->server_egfx_cmd(amod, cmd, cmd_bytes,
+                                   data, shmem_bytes);
     }
+    g_file_close(fd);
     return rv;
 }
 
@@ -1409,13 +1623,10 @@ process_server_set_pointer_shmfd(struct mod *amod, struct stream *s)
     int width;
     int height;
     int fd;
-    int recv_bytes;
     int shmembytes;
-    unsigned int num_fds;
     void *shmemptr;
     char *cur_data;
     char *cur_mask;
-    char msg[4];
 
     rv = 0;
     in_sint16_le(s, x);
@@ -1423,33 +1634,23 @@ process_server_set_pointer_shmfd(struct mod *amod, struct stream *s)
     in_uint16_le(s, bpp);
     in_uint16_le(s, width);
     in_uint16_le(s, height);
-    fd = -1;
-    num_fds = -1;
-    if (g_tcp_can_recv(amod->trans->sck, 5000) == 0)
+    fd = lib_mod_get_order_fd(amod);
+    if (fd < 0)
     {
         return 1;
     }
-    recv_bytes = g_sck_recv_fd_set(amod->trans->sck, msg, 4, &fd, 1, &num_fds);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_server_set_pointer_shmfd: "
-              "g_sck_recv_fd_set rv %d fd %d", recv_bytes, fd);
-    if (recv_bytes == 4)
+    Bpp = (bpp == 0) ? 3 : (bpp + 7) / 8;
+    shmembytes = width * height * Bpp + width * height / 8;
+    if (g_file_map(fd, 1, 0, shmembytes, &shmemptr) == 0)
     {
-        if (num_fds == 1)
-        {
-            Bpp = (bpp == 0) ? 3 : (bpp + 7) / 8;
-            shmembytes = width * height * Bpp + width * height / 8;
-            if (g_file_map(fd, 1, 0, shmembytes, &shmemptr) == 0)
-            {
-                cur_data = (char *)shmemptr;
-                cur_mask = cur_data + width * height * Bpp;
-                rv = amod->server_set_pointer_large(amod, x, y,
-                                                    cur_data, cur_mask,
-                                                    bpp, width, height);
-                g_munmap(shmemptr, shmembytes);
-            }
-            g_file_close(fd);
-        }
+        cur_data = (char *)shmemptr;
+        cur_mask = cur_data + width * height * Bpp;
+        rv = amod->server_set_pointer_large(amod, x, y,
+                                            cur_data, cur_mask,
+                                            bpp, width, height);
+        g_munmap(shmemptr, shmembytes);
     }
+    g_file_close(fd);
     return rv;
 }
 
@@ -1468,43 +1669,17 @@ process_server_paint_rect_shmfd(struct mod *amod, struct stream *s)
     int top;
     int width;
     int height;
-    int index;
     int rv;
-    int16_t *ldrects;
-    int16_t *ldrects1;
-    int16_t *lcrects;
-    int16_t *lcrects1;
+    short *ldrects;
+    short *lcrects;
     char *bmpdata;
     int fd;
-    int recv_bytes;
-    unsigned int num_fds;
     void *shmem_ptr;
-    char msg[4];
 
-    /* dirty pixels */
-    in_uint16_le(s, num_drects);
-    ldrects = g_new(int16_t, 2 * 4 * num_drects);
-    ldrects1 = ldrects;
-    for (index = 0; index < num_drects; index++)
+    if (lib_mod_in_paint_rects(amod, s, &num_drects, &ldrects,
+                               &num_crects, &lcrects) != 0)
     {
-        in_sint16_le(s, ldrects1[0]);
-        in_sint16_le(s, ldrects1[1]);
-        in_sint16_le(s, ldrects1[2]);
-        in_sint16_le(s, ldrects1[3]);
-        ldrects1 += 4;
-    }
-
-    /* copied pixels */
-    in_uint16_le(s, num_crects);
-    lcrects = g_new(int16_t, 2 * 4 * num_crects);
-    lcrects1 = lcrects;
-    for (index = 0; index < num_crects; index++)
-    {
-        in_sint16_le(s, lcrects1[0]);
-        in_sint16_le(s, lcrects1[1]);
-        in_sint16_le(s, lcrects1[2]);
-        in_sint16_le(s, lcrects1[3]);
-        lcrects1 += 4;
+        return 1;
     }
 
     in_uint32_le(s, flags);
@@ -1517,38 +1692,26 @@ process_server_paint_rect_shmfd(struct mod *amod, struct stream *s)
     in_uint16_le(s, width);
     in_uint16_le(s, height);
 
-    if (g_tcp_can_recv(amod->trans->sck, 5000) == 0)
+    fd = lib_mod_get_order_fd(amod);
+    if (fd < 0)
     {
-        g_free(ldrects);
-        g_free(lcrects);
         return 1;
     }
     rv = 1;
-    recv_bytes = g_sck_recv_fd_set(amod->trans->sck, msg, 4, &fd, 1, &num_fds);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_server_paint_rect_shmfd: "
-              "g_sck_recv_fd_set rv %d fd %d", recv_bytes, fd);
-    if (recv_bytes == 4)
-    {
-        if (num_fds == 1)
-        {
-            if (g_file_map(fd, 1, 0, shmem_bytes, &shmem_ptr) == 0)
-            {
-                bmpdata = (char *)shmem_ptr;
-                bmpdata += shmem_offset;
-                /* we give up ownership of shmem_ptr
-                   will get cleaned up in server_paint_rects_ex or
-                   xrdp_mm_process_enc_done(rfx, gfx) */
-                rv = amod->server_paint_rects_ex(amod, num_drects, ldrects,
-                                                 num_crects, lcrects, bmpdata,
-                                                 left, top, width, height,
-                                                 flags, frame_id,
-                                                 shmem_ptr, shmem_bytes);
-            }
-            g_file_close(fd);
-        }
-    }
-    g_free(ldrects);
-    g_free(lcrects);
+    if (g_file_map(fd, 1, 0, shmem_bytes, &shmem_ptr) == 0)
+    {
+        bmpdata = (char *)shmem_ptr;
+        bmpdata += shmem_offset;
+        /* we give up ownership of shmem_ptr
+           will get cleaned up in server_paint_rects_ex or
+           xrdp_mm_process_enc_done(rfx, gfx) */
+        rv = amod->server_paint_rects_ex(amod, num_drects, ldrects,
+                                         num_crects, lcrects, bmpdata,
+                                         left, top, width, height,
+                                         flags, frame_id,
+                                         shmem_ptr, shmem_bytes);
+    }
+    g_file_close(fd);
     return rv;
 }
 
@@ -1938,6 +2101,9 @@ lib_mod_end(struct mod *mod)
         g_shmdt(mod->screen_shmem_pixels);
         mod->screen_shmem_pixels = 0;
     }
+    g_free(mod->paint_rects);
+    mod->paint_rects = NULL;
+    mod->paint_rects_alloc = 0;
     return 0;
 }
 
@@ -2088,6 +2254,7 @@ mod_exit(tintptr handle)
         return 0;
     }
     trans_delete(mod->trans);
+    g_free(mod->paint_rects);
     g_free(mod);
     return 0;
 }
@@ -214,6 +214,9 @@ struct mod
     struct trans *trans;
     char keycode_set[32];
     enum caps_processing_status caps_processing_status;
+    short *paint_rects; /* reused for paint order rectangle lists */
+    int paint_rects_alloc; /* in rectangles */
+    int msg_fds_read; /* fds for the current message were read with it */
 };
 
 #endif // XUP_H